@@ -20,6 +20,9 @@
 #include "shell.h"
 #include "services.h"
 #include "service_queues.h"
+#include "rtos_utils.h"
+#include "mem_pool.h"
+#include "heap_trace.h"
 #include "FreeRTOS.h"
 #include "FreeRTOSConfig.h"
 #include "task.h"
@@ -45,19 +48,20 @@ static void ps_exec_callback(struct ush_object *self, struct ush_file_descriptor
                                 USH_SHELL_FONT_STYLE_RESET;
     int header_len = strlen(tasks_header);
     int tasks_maxlen = 40 * uxTaskGetNumberOfTasks();
-    char *ps_msg = pvPortMalloc(header_len + tasks_maxlen);
+    char *ps_msg = mem_pool_alloc(header_len + tasks_maxlen);
     strcpy(ps_msg, tasks_header);
 
     // call FreeRTOS vTaskList API and print to CLI
     vTaskListTasks(ps_msg + header_len, tasks_maxlen); // note this is a blocking, processor intensive function
     shell_print(ps_msg);
-    vPortFree(ps_msg);
+    mem_pool_free(ps_msg);
 }
 
 /**
 * @brief '/bin/top' executable callback function.
 *
-* Prints out FreeRTOS task runtime stats information in a similar style to *nix 'top'.
+* Prints out FreeRTOS task runtime stats information in a similar style to *nix 'top',
+* followed by the utilization of each core since boot and since 'top' was last run.
 *
 * @param ush_file_execute_callback Params given by typedef ush_file_execute_callback. see ush_types.h
 *
@@ -71,21 +75,49 @@ static void top_exec_callback(struct ush_object *self, struct ush_file_descripto
                                 "Task            Runtime(us)     Percentage\r\n"
                                 "------------------------------------------\r\n"
                                 USH_SHELL_FONT_STYLE_RESET;
+    const char *cores_header =  USH_SHELL_FONT_STYLE_BOLD
+                                USH_SHELL_FONT_COLOR_BLUE
+                                "\r\nCore            Since boot      Since last\r\n"
+                                "------------------------------------------\r\n"
+                                USH_SHELL_FONT_STYLE_RESET;
     int header_len = strlen(tasks_header);
     int tasks_maxlen = 40 * uxTaskGetNumberOfTasks();
-    char *top_msg = pvPortMalloc(header_len + tasks_maxlen);
+    int cores_maxlen = strlen(cores_header) + (40 * configNUMBER_OF_CORES);
+    char *top_msg = mem_pool_alloc(header_len + tasks_maxlen + cores_maxlen);
     strcpy(top_msg, tasks_header);
 
-    // call FreeRTOS vTaskGetRunTimeStats API and print to CLI
+    // call FreeRTOS vTaskGetRunTimeStats API
     vTaskGetRunTimeStatistics(top_msg + header_len, tasks_maxlen);
+
+    // core utilization is the time each core has spent outside of its idle task.
+    // keep the previous readings so that the load since the last 'top' can be shown
+    static configRUN_TIME_COUNTER_TYPE last_total_time;
+    static configRUN_TIME_COUNTER_TYPE last_idle_time[configNUMBER_OF_CORES];
+    configRUN_TIME_COUNTER_TYPE total_time = portGET_RUN_TIME_COUNTER_VALUE();
+    strcat(top_msg, cores_header);
+    for (BaseType_t core = 0; core < configNUMBER_OF_CORES; core++) {
+        configRUN_TIME_COUNTER_TYPE idle_time = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(core));
+        configRUN_TIME_COUNTER_TYPE busy_time = (total_time > idle_time) ? total_time - idle_time : 0;
+        configRUN_TIME_COUNTER_TYPE period_time = total_time - last_total_time;
+        configRUN_TIME_COUNTER_TYPE period_idle = idle_time - last_idle_time[core];
+        configRUN_TIME_COUNTER_TYPE period_busy = (period_time > period_idle) ? period_time - period_idle : 0;
+        sprintf(top_msg + strlen(top_msg), "%-16ld%lu%%\t\t%lu%%\r\n",
+                (long)core,
+                (uint32_t)(total_time ? ((uint64_t)busy_time * 100) / total_time : 0),
+                (uint32_t)(period_time ? ((uint64_t)period_busy * 100) / period_time : 0));
+        last_idle_time[core] = idle_time;
+    }
+    last_total_time = total_time;
+
     shell_print(top_msg);
-    vPortFree(top_msg);
+    mem_pool_free(top_msg);
 }
 
 /**
 * @brief '/bin/free' executable callback function.
 *
-* Prints out the FreeRTOS heap memory manager usage statistics in a similar style to *nix 'free'.
+* Prints out the FreeRTOS heap memory manager usage statistics in a similar style to *nix 'free',
+* followed by the usage of each scratch buffer pool size class (see mem_pool.h).
 *
 * @param ush_file_execute_callback Params given by typedef ush_file_execute_callback. see ush_types.h
 *
@@ -93,10 +125,10 @@ static void top_exec_callback(struct ush_object *self, struct ush_file_descripto
 */
 static void free_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
 {
-    HeapStats_t *heap_stats = pvPortMalloc(sizeof(HeapStats_t)); // structure to hold heap stats results
+    HeapStats_t *heap_stats = mem_pool_alloc(sizeof(HeapStats_t)); // structure to hold heap stats results
     vPortGetHeapStats(heap_stats);  // get the heap stats
-    const int heap_stats_maxlen = 300; // just a rough estimate for dynamic mem needed
-    char *heap_stats_msg = pvPortMalloc(heap_stats_maxlen);
+    const int heap_stats_maxlen = 400; // just a rough estimate for dynamic mem needed
+    char *heap_stats_msg = mem_pool_alloc(heap_stats_maxlen);
     unsigned int total_heap_size = configTOTAL_HEAP_SIZE;
     
     // format the heap stats
@@ -127,8 +159,133 @@ static void free_exec_callback(struct ush_object *self, struct ush_file_descript
     );
     
     shell_print(heap_stats_msg);
-    vPortFree(heap_stats);
-    vPortFree(heap_stats_msg);
+
+    // format the pool stats, reusing the message buffer
+    int msg_pos = snprintf(heap_stats_msg, heap_stats_maxlen,
+            USH_SHELL_FONT_STYLE_BOLD
+            USH_SHELL_FONT_COLOR_BLUE
+            "\r\nPool    Blocks  In use  Max     Allocs  Empty\r\n"
+            "----------------------------------------------\r\n"
+            USH_SHELL_FONT_STYLE_RESET);
+    for (int class = 0; class < MEM_POOL_NUM_CLASSES && msg_pos < heap_stats_maxlen; class++) {
+        mem_pool_stats_t pool = mem_pool_stats[class];
+        msg_pos += snprintf(heap_stats_msg + msg_pos, heap_stats_maxlen - msg_pos,
+                            "%-8u%-8u%-8u%-8u%-8lu%lu\r\n",
+                            pool.block_size, pool.blocks, pool.in_use, pool.high_water,
+                            pool.allocs, pool.exhausted);
+    }
+    if (msg_pos < heap_stats_maxlen) {
+        snprintf(heap_stats_msg + msg_pos, heap_stats_maxlen - msg_pos,
+                 "Heap fallbacks:\t\t%lu\r\n", mem_pool_heap_fallbacks);
+    }
+
+    shell_print(heap_stats_msg);
+    mem_pool_free(heap_stats);
+    mem_pool_free(heap_stats_msg);
+}
+
+/**
+* @brief '/bin/heap' executable callback function.
+*
+* Prints out the heap usage of each task - live and peak bytes, allocation and
+* free counts, failed allocations, and allocations per second since 'heap' was
+* last run. 'heap live' lists the live allocations grouped by owning task and
+* call site (resolve the call site addresses with addr2line against the elf).
+* Requires the ENABLE_HEAP_TRACE build option.
+*
+* @param ush_file_execute_callback Params given by typedef ush_file_execute_callback. see ush_types.h
+*
+* @return nothing
+*/
+static void heap_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
+{
+#ifdef ENABLE_HEAP_TRACE
+    if (argc == 1) {
+        const char *heap_header =   USH_SHELL_FONT_STYLE_BOLD
+                                    USH_SHELL_FONT_COLOR_BLUE
+                                    "Task            Live    Peak    Allocs  Frees   Fails   Allocs/s\r\n"
+                                    "----------------------------------------------------------------\r\n"
+                                    USH_SHELL_FONT_STYLE_RESET;
+        const int heap_msg_maxlen = strlen(heap_header) + (HEAP_TRACE_TASKS_MAX * 72) + 100;
+        char *heap_msg = mem_pool_alloc(heap_msg_maxlen);
+        // allocation rates are since the last time 'heap' was run
+        static uint32_t last_allocs[HEAP_TRACE_TASKS_MAX];
+        static uint64_t last_us;
+        uint64_t now_us = get_time_us();
+        uint32_t elapsed_ms = (uint32_t)((now_us - last_us) / 1000);
+        int msg_pos;
+
+        msg_pos = snprintf(heap_msg, heap_msg_maxlen, "%s", heap_header);
+        for (int i = 0; i < HEAP_TRACE_TASKS_MAX && msg_pos < heap_msg_maxlen; i++) {
+            heap_trace_task_t task_stats;
+            vTaskSuspendAll(); // snapshot, the heap hooks may be updating it
+            task_stats = heap_trace_tasks[i];
+            xTaskResumeAll();
+            if (i > 0 && task_stats.task == NULL) break; // end of the used entries
+            msg_pos += snprintf(heap_msg + msg_pos, heap_msg_maxlen - msg_pos,
+                                "%-16s%-8lu%-8lu%-8lu%-8lu%-8lu%lu\r\n",
+                                task_stats.name,
+                                task_stats.live_bytes, task_stats.peak_bytes,
+                                task_stats.allocs, task_stats.frees, task_stats.failures,
+                                elapsed_ms ? ((task_stats.allocs - last_allocs[i]) * 1000) / elapsed_ms : 0);
+            last_allocs[i] = task_stats.allocs;
+        }
+        last_us = now_us;
+        if (msg_pos < heap_msg_maxlen) {
+            snprintf(heap_msg + msg_pos, heap_msg_maxlen - msg_pos,
+                     "Untracked allocs/frees: %lu/%lu, unattributed allocs: %lu\r\n",
+                     heap_trace_stats.untracked_allocs, heap_trace_stats.untracked_frees,
+                     heap_trace_stats.dropped_tasks);
+        }
+
+        shell_print(heap_msg);
+        mem_pool_free(heap_msg);
+    }
+    else if (argc == 2 && strcmp(argv[1], "live") == 0) {
+        const char *live_header =   USH_SHELL_FONT_STYLE_BOLD
+                                    USH_SHELL_FONT_COLOR_BLUE
+                                    "Task            Call site   Count   Bytes\r\n"
+                                    "-----------------------------------------\r\n"
+                                    USH_SHELL_FONT_STYLE_RESET;
+        const int live_msg_maxlen = strlen(live_header) + (HEAP_TRACE_ALLOCS_MAX * 48);
+        heap_trace_alloc_t *allocs = mem_pool_alloc(sizeof(heap_trace_allocs));
+        char *live_msg = mem_pool_alloc(live_msg_maxlen);
+        int msg_pos;
+
+        // take a snapshot of the table, then group it by owner and call site
+        vTaskSuspendAll();
+        memcpy(allocs, heap_trace_allocs, sizeof(heap_trace_allocs));
+        xTaskResumeAll();
+
+        msg_pos = snprintf(live_msg, live_msg_maxlen, "%s", live_header);
+        for (int i = 0; i < HEAP_TRACE_ALLOCS_MAX && msg_pos < live_msg_maxlen; i++) {
+            uint32_t count = 1;
+            uint32_t bytes = allocs[i].size;
+            if (allocs[i].addr == NULL) continue;
+            for (int j = i + 1; j < HEAP_TRACE_ALLOCS_MAX; j++) {
+                if (allocs[j].addr != NULL &&
+                    allocs[j].owner == allocs[i].owner &&
+                    allocs[j].call_site == allocs[i].call_site) {
+                    count++;
+                    bytes += allocs[j].size;
+                    allocs[j].addr = NULL; // counted
+                }
+            }
+            msg_pos += snprintf(live_msg + msg_pos, live_msg_maxlen - msg_pos,
+                                "%-16s0x%08lx  %-8lu%lu\r\n",
+                                heap_trace_tasks[allocs[i].owner].name, allocs[i].call_site, count, bytes);
+        }
+
+        shell_print(live_msg);
+        mem_pool_free(live_msg);
+        mem_pool_free(allocs);
+    }
+    else {
+        shell_print("command syntax error, see 'help <heap>'");
+    }
+#else
+    shell_print("heap tracking is not enabled, see ENABLE_HEAP_TRACE in project.cmake");
+#endif
 }
 
 /**
@@ -144,7 +301,7 @@ static void df_exec_callback(struct ush_object *self, struct ush_file_descriptor
 {
     flash_usage_t flash_usage;
     const int flash_usage_msg_maxlen = 300;
-    char *flash_usage_msg = pvPortMalloc(flash_usage_msg_maxlen);
+    char *flash_usage_msg = mem_pool_alloc(flash_usage_msg_maxlen);
 
     // get the flash usage data struct
     flash_usage = onboard_flash_usage();
@@ -167,7 +324,7 @@ static void df_exec_callback(struct ush_object *self, struct ush_file_descriptor
     );
 
     shell_print(flash_usage_msg);
-    vPortFree(flash_usage_msg);
+    mem_pool_free(flash_usage_msg);
 }
 
 /**
@@ -205,8 +362,9 @@ static void kill_exec_callback(struct ush_object *self, struct ush_file_descript
 /**
 * @brief '/bin/service' executable callback function.
 *
-* Interact with system services (list/start/suspend/resume). Services are defined in services.h
-* Note that stopping services is performed with '/bin/kill'.
+* Interact with system services (list/start/suspend/resume/pin). Services are defined in services.h
+* Note that stopping services is performed with '/bin/kill'. 'pin' sets the cores a
+* running service may run on, on SMP builds.
 *
 * @param ush_file_execute_callback Params given by typedef ush_file_execute_callback. see ush_types.h
 *
@@ -214,8 +372,8 @@ static void kill_exec_callback(struct ush_object *self, struct ush_file_descript
 */
 static void service_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
 {
-    char *err_msg = pvPortMalloc(100);    // buffer for holding the error output message
-    char *service_msg = pvPortMalloc(32); // buffer for holding the service success message
+    char *err_msg = mem_pool_alloc(100);    // buffer for holding the error output message
+    char *service_msg = mem_pool_alloc(64); // buffer for holding the service success message
 
     if (argc == 3) {
         struct taskman_item_t tmi;
@@ -230,7 +388,7 @@ static void service_exec_callback(struct ush_object *self, struct ush_file_descr
                 int i;
                 for(i = 0; i < service_descriptors_length; i++) {
                     if (strcmp(argv[2], service_descriptors[i].name) == 0) {
-                        service_descriptors[i].service_func(); // call the function pointer for the matching service
+                        service_start(&service_descriptors[i]); // call the function pointer for the matching service
                         break;
                     }
                     if (i == (service_descriptors_length - 1)) {
@@ -269,28 +427,72 @@ static void service_exec_callback(struct ush_object *self, struct ush_file_descr
             shell_print("command syntax error, see 'help <service>'");
         }
     }
+    else if (argc == 4 && strcmp(argv[1], "pin") == 0) { // PIN a running service (task) to a core
+        struct taskman_item_t tmi;
+        tmi.task = xTaskGetHandle(argv[2]);
+        tmi.action = PIN;
+        tmi.core_mask = AFFINITY_ANY;
+        bool core_valid = (strcmp(argv[3], "any") == 0);
+        if (!core_valid && argv[3][0] >= '0' && argv[3][0] < ('0' + configNUMBER_OF_CORES) && argv[3][1] == '\0') {
+            tmi.core_mask = 1 << (argv[3][0] - '0');
+            core_valid = true;
+        }
+
+        if (configNUMBER_OF_CORES < 2) {
+            shell_print("pinning services requires an SMP build, see RTOS_NUM_CORES in rtos_config.h");
+        }
+        else if (tmi.task == NULL) {
+            sprintf(err_msg, "%s is not a running service, try '/bin/ps'", argv[2]);
+            shell_print(err_msg);
+        }
+        else if (!core_valid) {
+            sprintf(err_msg, "core must be 0-%d or 'any'", configNUMBER_OF_CORES - 1);
+            shell_print(err_msg);
+        }
+        else {
+            taskman_request(&tmi);
+            sprintf(service_msg, "%s service pinned to core %s", argv[2], argv[3]);
+            shell_print(service_msg);
+        }
+    }
     else if (argc == 2 && strcmp(argv[1], "list") == 0) { // LIST available services and their current state
         int i;
         const char *service_list_header =   USH_SHELL_FONT_STYLE_BOLD
                                             USH_SHELL_FONT_COLOR_BLUE
-                                            "Available Services\tStatus\r\n"
-                                            "------------------------------------\r\n"
+                                            "Available Services\tStatus\t\tCore\r\n"
+                                            "--------------------------------------------\r\n"
                                             USH_SHELL_FONT_STYLE_RESET;
-        char *service_list_msg = pvPortMalloc(strlen(service_list_header) +
+        char *service_list_msg = mem_pool_alloc(strlen(service_list_header) +
                                  (service_descriptors_length *
-                                 (configMAX_TASK_NAME_LEN + 16))); // add 16 bytes per line for service state and whitespace
+                                 (configMAX_TASK_NAME_LEN + 24))); // add 24 bytes per line for service state, core and whitespace
         TaskHandle_t service_taskhandle;
         char service_state[12];
+        char service_core[8];
 
         strcpy(service_list_msg, service_list_header);
 
         // interate through available services, get their states from RTOS
         for (i = 0; i < service_descriptors_length; i++) {
             service_taskhandle = xTaskGetHandle(service_descriptors[i].name);
+            strcpy(service_core, "-");
             if (service_taskhandle == NULL) {
                 strcpy(service_state, "not started");
             }
             else {
+                // list the cores the service may run on
+                UBaseType_t core_mask = task_get_core_affinity(service_taskhandle);
+                if (core_mask == 0) {
+                    strcpy(service_core, "any");
+                }
+                else {
+                    service_core[0] = '\0';
+                    for (int core = 0; core < configNUMBER_OF_CORES; core++) {
+                        if (core_mask & (1 << core)) {
+                            sprintf(service_core + strlen(service_core), "%s%d", strlen(service_core) ? "," : "", core);
+                        }
+                    }
+                }
+
                 switch (eTaskGetState(service_taskhandle)) {
                     case (eRunning):
                     case (eBlocked):
@@ -314,19 +516,19 @@ static void service_exec_callback(struct ush_object *self, struct ush_file_descr
                 strcpy(service_list_msg + strlen(service_list_msg), "\t");
             }
             // copy current service state into table
-            sprintf(service_list_msg + strlen(service_list_msg), "\t\t%s\r\n", service_state);
+            sprintf(service_list_msg + strlen(service_list_msg), "\t\t%-12s\t%s\r\n", service_state, service_core);
         }
 
         shell_print(service_list_msg);
-        vPortFree(service_list_msg);
+        mem_pool_free(service_list_msg);
     }
     else {
         shell_print("command syntax error, see 'help <service>'");
     }
 
     // free heap used for the string buffers
-    vPortFree(err_msg);
-    vPortFree(service_msg);
+    mem_pool_free(err_msg);
+    mem_pool_free(service_msg);
 }
 
 /**
@@ -391,6 +593,15 @@ static const struct ush_file_descriptor bin_files[] = {
         .get_data = NULL,
         .set_data = NULL 
     },
+    {
+        .name = "heap",
+        .description = "print heap usage per task",
+        .help = "usage: heap      - live/peak bytes and allocation counts per task\r\n"
+                "       heap live - live allocations by task and call site\r\n",
+        .exec = heap_exec_callback,
+        .get_data = NULL,
+        .set_data = NULL 
+    },
     {
         .name = "df",
         .description = "print flash memory usage stats",
@@ -410,7 +621,8 @@ static const struct ush_file_descriptor bin_files[] = {
     {
         .name = "service",
         .description = "interact with available services",
-        .help = "usage: service <list|start|suspend|resume> <\e[3mservicename\e[0m>\r\n",
+        .help = "usage: service <list|start|suspend|resume> <\e[3mservicename\e[0m>\r\n"
+                "       service pin <\e[3mservicename\e[0m> <\e[3mcore\e[0m|any>\r\n",
         .exec = service_exec_callback,
         .get_data = NULL,
         .set_data = NULL 
@@ -23,6 +23,7 @@
 #include "cli_utils.h"
 #include "services.h"
 #include "service_queues.h"
+#include "mem_pool.h"
 #include "lfs.h"
 #include "FreeRTOS.h"
 #include "task.h"
@@ -111,7 +112,7 @@ size_t time_get_data_callback(struct ush_object *self, struct ush_file_descripto
 static void gpio_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
 {
     bool syntax_err = false;
-    char *gpio_msg = pvPortMalloc(20);
+    char *gpio_msg = mem_pool_alloc(20);
 
     if (strcmp(argv[1], "read") == 0 && argc == 3) {
         int gpio_index = atoi(argv[2]);
@@ -153,7 +154,7 @@ static void gpio_exec_callback(struct ush_object *self, struct ush_file_descript
     if (!syntax_err) {
         shell_print(gpio_msg);
     }
-    vPortFree(gpio_msg);
+    mem_pool_free(gpio_msg);
 }
 
 /**
@@ -168,7 +169,7 @@ static void gpio_exec_callback(struct ush_object *self, struct ush_file_descript
 size_t gpio_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
 {
     uint32_t gpio_values;
-    char *gpio_states_msg = pvPortMalloc(80 + 20 * GPIO_COUNT);
+    char *gpio_states_msg = mem_pool_alloc(80 + 20 * GPIO_COUNT);
     char direction[4];
     
     strcpy(gpio_states_msg,
@@ -196,88 +197,106 @@ size_t gpio_get_data_callback(struct ush_object *self, struct ush_file_descripto
     // print directly from this function rather than returning pointer to uShell.
     // this allows us to malloc/free rather than using static memory
     shell_print(gpio_states_msg);
-    vPortFree(gpio_states_msg);
+    mem_pool_free(gpio_states_msg);
     // return null since we already printed output
     return 0;
 }
 
 /**
-* @brief '/dev/i2c0' executable callback function.
+* @brief '/dev/i2c0' and '/dev/i2c1' executable callback function.
 *
-* Interact with I2C bus 0 by reading/writing raw bytes targetted to a specific
-* client device address.
+* Interact with an I2C bus by reading/writing raw bytes targetted to a specific
+* client device address. 'writeread' writes bytes (e.g. a register address) and
+* reads back after a repeated start, in one transaction.
 *
 * @param ush_file_execute_callback Params given by typedef ush_file_execute_callback. see ush_types.h
 *
 * @return nothing
 */
-static void i2c0_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
+static void i2c_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
 {
     bool syntax_err = false;
+    uint8_t bus = file->name[3] - '0'; // "i2c0" or "i2c1"
 
-    if (argc == 4 &&
-        (strcmp(argv[1], "read") == 0 || strcmp(argv[1], "write") == 0) &&
+    if ((argc == 4 || argc == 5) &&
+        (strcmp(argv[1], "read") == 0 || strcmp(argv[1], "write") == 0 || strcmp(argv[1], "writeread") == 0) &&
         (argv[2][0] == '0' && argv[2][1] == 'x')) {
 
         // get i2c target address
-        uint8_t addr = strtol(&argv[2][2], NULL, 16);
+        i2c_xfer_t xfer = {.addr = strtol(&argv[2][2], NULL, 16)};
+        size_t tx_guess = 0;
 
-        // i2c read
-        if (strcmp(argv[1], "read") == 0) {
-            size_t nbytes = strtol(argv[3], NULL, 10);
-            uint8_t rxdata[nbytes];
-
-            // read data from i2c bus
-            if (i2c0_read(addr, rxdata, nbytes) > 0) {
-                char *rx_msg_prefix = "Received: 0x";
-                // allocate heap memory for printable rx data
-                char *rx_msg = pvPortMalloc(nbytes * 3 + strlen(rx_msg_prefix));
-                sprintf(rx_msg, rx_msg_prefix);
+        // guess the length of the data to write before actually checking
+        if (strcmp(argv[1], "read") != 0 && strlen(argv[3]) > 2) {
+            tx_guess = (strlen(argv[3]) - 2) / 2;
+        }
+        uint8_t txdata[tx_guess + 1];
 
-                for (int rx_byte = 0; rx_byte < nbytes; rx_byte++) {
-                    sprintf(rx_msg + strlen(rx_msg_prefix) + (rx_byte * 3), "%02x ", rxdata[rx_byte]);
-                }
+        if (strcmp(argv[1], "read") == 0 && argc == 4) {
+            xfer.rx_len = strtol(argv[3], NULL, 10);
+        }
+        else if (strcmp(argv[1], "write") == 0 && argc == 4) {
+            // convert string to data and get real number of bytes
+            xfer.tx_len = hex_string_to_byte_array(argv[3], txdata);
+            if (xfer.tx_len == 0) syntax_err = true;
+        }
+        else if (strcmp(argv[1], "writeread") == 0 && argc == 5) {
+            xfer.tx_len = hex_string_to_byte_array(argv[3], txdata);
+            xfer.rx_len = strtol(argv[4], NULL, 10);
+            if (xfer.tx_len == 0 || xfer.rx_len == 0) syntax_err = true;
+        }
+        else {syntax_err = true;}
 
-                shell_print(rx_msg);
-                vPortFree(rx_msg);
+        if (!syntax_err) {
+            xfer.tx_buf = txdata;
+            xfer.rx_buf = (xfer.rx_len > 0) ? mem_pool_alloc(xfer.rx_len) : NULL;
+            if (xfer.rx_len > 0 && xfer.rx_buf == NULL) {
+                shell_print("out of memory");
             }
             else {
-                shell_print("No response");
-            }
-        }
+                int result = i2c_transfer(bus, &xfer);
 
-        // i2c write
-        if (strcmp(argv[1], "write") == 0) {
-            // guess the length of the data to write before actually checking
-            size_t nbytes = (strlen(argv[3]) - 2) / 2;
-            uint8_t txdata[nbytes];
-            // convert string to data and get real number of bytes
-            nbytes = hex_string_to_byte_array(argv[3], txdata);
-            // write data on i2c bus if formatted correctly
-            if (nbytes > 0) {
-                int bytes_written = i2c0_write(addr, txdata, nbytes);
-                if(bytes_written > 0) {
-                    char *tx_msg = pvPortMalloc(16);
-                    sprintf(tx_msg, "Wrote %d bytes", bytes_written);
+                // i2c read
+                if (xfer.rx_len > 0 && result > 0) {
+                    char *rx_msg_prefix = "Received: 0x";
+                    // allocate heap memory for printable rx data
+                    char *rx_msg = mem_pool_alloc(result * 3 + strlen(rx_msg_prefix) + 1);
+                    sprintf(rx_msg, rx_msg_prefix);
+
+                    for (int rx_byte = 0; rx_byte < result; rx_byte++) {
+                        sprintf(rx_msg + strlen(rx_msg_prefix) + (rx_byte * 3), "%02x ", xfer.rx_buf[rx_byte]);
+                    }
+
+                    shell_print(rx_msg);
+                    mem_pool_free(rx_msg);
+                }
+                // i2c write
+                else if (result > 0) {
+                    char *tx_msg = mem_pool_alloc(16);
+                    sprintf(tx_msg, "Wrote %d bytes", result);
                     shell_print(tx_msg);
-                    vPortFree(tx_msg);
+                    mem_pool_free(tx_msg);
+                }
+                else if (result < 0) {
+                    shell_print("No response");
                 }
                 else {
-                    shell_print("Error writing to bus");
+                    shell_print("Timed out");
                 }
+
+                if (xfer.rx_buf != NULL) mem_pool_free(xfer.rx_buf);
             }
-            else {syntax_err = true;}
         }
     }
     else {syntax_err = true;}
 
     if (syntax_err) {
-        shell_print("command syntax error, see 'help <i2c0>'");
+        shell_print("command syntax error, see 'help <i2c>'");
     }
 }
 
 /**
-* @brief '/dev/i2c0' get data callback function.
+* @brief '/dev/i2c0' and '/dev/i2c1' get data callback function.
 *
 * Sweep through all 7-bit I2C addresses, to see if any client devices are present
 * on the I2C bus. Print out a table that looks like this:
@@ -297,25 +316,30 @@ static void i2c0_exec_callback(struct ush_object *self, struct ush_file_descript
 * Functional idea borrowed from:
 * https://github.com/raspberrypi/pico-examples/blob/master/i2c/bus_scan/bus_scan.c
 *
+* Followed by the bus statistics and the registered devices on the bus.
+*
 * @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
 *
 * @return nothing, print the data directly so we can malloc/free
 */
-size_t i2c0_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
+size_t i2c_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
 {
     // use malloc rather than passing a pointer to a static char back to uShell,
     // since it is a rather large array
-    char *i2c0_scan_msg = pvPortMalloc(400);
+    const size_t i2c_len = 400 + 200 + (I2C_NUM_DEVICES * 40);
+    char *i2c_scan_msg = mem_pool_alloc(i2c_len);
+    uint8_t bus = file->name[3] - '0'; // "i2c0" or "i2c1"
+    size_t msg_pos;
 
-    sprintf(i2c0_scan_msg,  USH_SHELL_FONT_STYLE_BOLD
-                            USH_SHELL_FONT_COLOR_BLUE
-                            "I2C0 Bus Scan\r\n"
-                            USH_SHELL_FONT_STYLE_RESET
-                            "   0 1 2 3 4 5 6 7 8 9 A B C D E F\r\n");
+    msg_pos = snprintf(i2c_scan_msg, i2c_len, USH_SHELL_FONT_STYLE_BOLD
+                                              USH_SHELL_FONT_COLOR_BLUE
+                                              "I2C%d Bus Scan\r\n"
+                                              USH_SHELL_FONT_STYLE_RESET
+                                              "   0 1 2 3 4 5 6 7 8 9 A B C D E F\r\n", bus);
 
     for (int addr = 0; addr < (1 << 7); ++addr) {
         if (addr % 16 == 0) {
-            sprintf(i2c0_scan_msg + strlen(i2c0_scan_msg), "%02x ", addr);
+            msg_pos += snprintf(i2c_scan_msg + msg_pos, i2c_len - msg_pos, "%02x ", addr);
         }
 
         // Perform a 1-byte dummy read from the probe address. If a peripheral device
@@ -326,51 +350,86 @@ size_t i2c0_get_data_callback(struct ush_object *self, struct ush_file_descripto
         uint8_t rxdata;
         if ((addr & 0x78) == 0 || (addr & 0x78) == 0x78) // skip over i2c "reserved" 0000xxx or 1111xxx addresses
             ret = -1;
-        else
-            ret = i2c0_read(addr, &rxdata, 1);
+        else {
+            i2c_xfer_t xfer = {.addr = addr, .rx_buf = &rxdata, .rx_len = 1};
+            ret = i2c_transfer(bus, &xfer);
+        }
+
+        msg_pos += snprintf(i2c_scan_msg + msg_pos, i2c_len - msg_pos, "%s%s",
+                            ret <= 0 ? "." : "@", addr % 16 == 15 ? "\r\n" : " ");
+    }
 
-        sprintf(i2c0_scan_msg + strlen(i2c0_scan_msg), ret < 0 ? "." : "@");
-        sprintf(i2c0_scan_msg + strlen(i2c0_scan_msg), addr % 16 == 15 ? "\r\n" : " ");
+    // bus statistics, then the devices registered on the bus with their clocks
+    i2c_bus_stats_t stats = i2c_bus_stats[bus]; // snapshot, transactions may be updating it
+    msg_pos += snprintf(i2c_scan_msg + msg_pos, i2c_len - msg_pos,
+                        "\r\nXFERS\tBYTES\tNAKS\tABORTS\tTIMEOUTS\tCLOCK CHANGES\tkHz\r\n"
+                        "%lu\t%lu\t%lu\t%lu\t%lu\t\t%lu\t\t%lu\r\n",
+                        stats.xfers, stats.bytes, stats.naks, stats.aborts,
+                        stats.timeouts, stats.clock_changes, stats.clock_khz);
+    for (int dev = 0; dev < I2C_NUM_DEVICES && msg_pos < i2c_len; dev++) {
+        if (i2c_devices[dev].bus != bus) continue;
+        msg_pos += snprintf(i2c_scan_msg + msg_pos, i2c_len - msg_pos, "%s\t0x%02x\t%lu kHz\r\n",
+                            i2c_devices[dev].name, i2c_devices[dev].addr, i2c_devices[dev].max_khz);
     }
 
     // print directly from this function rather than returning pointer to uShell.
     // this allows us to malloc/free rather than using static memory
-    shell_print(i2c0_scan_msg);
-    vPortFree(i2c0_scan_msg);
+    shell_print(i2c_scan_msg);
+    mem_pool_free(i2c_scan_msg);
     // return null since we already printed output
     return 0;
 }
 
 /**
-* @brief '/dev/spi0' executable callback function.
+* @brief '/dev/spi0' and '/dev/spi1' executable callback function.
 *
-* Interact with SPI bus 0 by reading/writing to a specific register address.
+* Interact with a device on a SPI bus by reading/writing to a specific register
+* address, or benchmark the throughput of repeated register reads from it. The
+* device is named from the SPI_DEVICES registry in hardware_config.h, and may be
+* left out for the first device on the bus.
 *
 * @param ush_file_execute_callback Params given by typedef ush_file_execute_callback. see ush_types.h
 *
 * @return nothing
 */
-static void spi0_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
+static void spi_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
 {
     bool syntax_err = false;
+    uint8_t bus = file->name[3] - '0'; // "spi0" or "spi1"
+    spi_dev_t dev = SPI_NUM_DEVICES;
+    int arg = 2;
+
+    // optional device name, otherwise the first device on the bus
+    if (argc > arg && !(argv[arg][0] == '0' && argv[arg][1] == 'x')) {
+        dev = spi_dev_find(argv[arg++]);
+        if (dev < SPI_NUM_DEVICES && spi_devices[dev].bus != bus) dev = SPI_NUM_DEVICES;
+    }
+    else {
+        for (int d = 0; d < SPI_NUM_DEVICES && dev == SPI_NUM_DEVICES; d++) {
+            if (spi_devices[d].bus == bus) dev = d;
+        }
+    }
 
-    if (argc == 4 &&
-        (strcmp(argv[1], "read") == 0 || strcmp(argv[1], "write") == 0) &&
-        (argv[2][0] == '0' && argv[2][1] == 'x')) {
+    if (dev == SPI_NUM_DEVICES) {
+        shell_print("no such device on this bus, see 'cat <spi>'");
+    }
+    else if (argc >= arg + 2 &&
+        (strcmp(argv[1], "read") == 0 || strcmp(argv[1], "write") == 0 || strcmp(argv[1], "bench") == 0) &&
+        (argv[arg][0] == '0' && argv[arg][1] == 'x')) {
 
         // get spi target register address
-        uint8_t addr = strtol(&argv[2][2], NULL, 16);
+        uint8_t addr = strtol(&argv[arg][2], NULL, 16);
 
         // spi read
-        if (strcmp(argv[1], "read") == 0) {
-            size_t nbytes = strtol(argv[3], NULL, 10);
+        if (strcmp(argv[1], "read") == 0 && argc == arg + 2) {
+            size_t nbytes = strtol(argv[arg + 1], NULL, 10);
             uint8_t rxdata[nbytes];
 
             // read data from spi bus
-            if (spi0_read_registers(SPI0_TARGET_DEV_0_CS, addr, rxdata, nbytes) > 0) {
+            if (spi_dev_read(dev, addr, rxdata, nbytes) > 0) {
                 char *rx_msg_prefix = "Received: 0x";
                 // allocate heap memory for printable rx data
-                char *rx_msg = pvPortMalloc(nbytes * 3 + strlen(rx_msg_prefix));
+                char *rx_msg = mem_pool_alloc(nbytes * 3 + strlen(rx_msg_prefix));
                 sprintf(rx_msg, rx_msg_prefix);
 
                 for (int rx_byte = 0; rx_byte < nbytes; rx_byte++) {
@@ -378,28 +437,28 @@ static void spi0_exec_callback(struct ush_object *self, struct ush_file_descript
                 }
 
                 shell_print(rx_msg);
-                vPortFree(rx_msg);
+                mem_pool_free(rx_msg);
             }
             else {
                 shell_print("No response");
             }
         }
 
-        // spi write
-        if (strcmp(argv[1], "write") == 0) {
+        // spi write, as many bytes as given - split into bursts if the device needs it
+        else if (strcmp(argv[1], "write") == 0 && argc == arg + 2) {
             // guess the length of the data to write before actually checking
-            size_t nbytes = (strlen(argv[3]) - 2) / 2;
+            size_t nbytes = (strlen(argv[arg + 1]) - 2) / 2;
             uint8_t txdata[nbytes];
             // convert string to data and get real number of bytes
-            nbytes = hex_string_to_byte_array(argv[3], txdata);
-            // write data on i2c bus if formatted correctly
-            if (nbytes == 1) { // for now we are only expecting to write a single byte to a single register addr
-                int bytes_written = spi0_write_register(SPI0_TARGET_DEV_0_CS, addr, txdata[0]);
+            nbytes = hex_string_to_byte_array(argv[arg + 1], txdata);
+            // write data on spi bus if formatted correctly
+            if (nbytes > 0) {
+                int bytes_written = spi_dev_write(dev, addr, txdata, nbytes);
                 if(bytes_written > 0) {
-                    char *tx_msg = pvPortMalloc(16);
+                    char *tx_msg = mem_pool_alloc(16);
                     sprintf(tx_msg, "Wrote %d bytes", bytes_written);
                     shell_print(tx_msg);
-                    vPortFree(tx_msg);
+                    mem_pool_free(tx_msg);
                 }
                 else {
                     shell_print("Error writing to bus");
@@ -407,68 +466,175 @@ static void spi0_exec_callback(struct ush_object *self, struct ush_file_descript
             }
             else {syntax_err = true;}
         }
+
+        // spi throughput benchmark - repeated register reads of up to one burst each
+        else if (strcmp(argv[1], "bench") == 0 && argc <= arg + 2) {
+            uint32_t total_bytes = (argc == arg + 2) ? strtol(argv[arg + 1], NULL, 10) : 16384;
+            uint16_t chunk = (spi_devices[dev].burst > 0 && spi_devices[dev].burst < 256) ? spi_devices[dev].burst : 256;
+            uint8_t *bench_buf = mem_pool_alloc(chunk);
+            uint32_t bytes_done = 0;
+            uint32_t xfers = 0;
+            uint64_t start_us = get_time_us();
+            uint64_t elapsed_us;
+
+            while (bytes_done < total_bytes) {
+                uint16_t len = (total_bytes - bytes_done < chunk) ? total_bytes - bytes_done : chunk;
+                if (spi_dev_read(dev, addr, bench_buf, len) != len) break;
+                bytes_done += len;
+                xfers++;
+            }
+            elapsed_us = get_time_us() - start_us;
+            mem_pool_free(bench_buf);
+
+            char *bench_msg = mem_pool_alloc(160);
+            snprintf(bench_msg, 160,
+                     "%s: %lu bytes in %lu transactions, %lu us\r\n"
+                     "%lu KB/s at %lu kHz, %lu us per transaction\r\n",
+                     spi_devices[dev].name, bytes_done, xfers, (uint32_t)elapsed_us,
+                     (uint32_t)(elapsed_us ? ((uint64_t)bytes_done * 1000000 / 1024) / elapsed_us : 0),
+                     spi_dev_stats[dev].clock_khz,
+                     xfers ? (uint32_t)(elapsed_us / xfers) : 0);
+            shell_print(bench_msg);
+            mem_pool_free(bench_msg);
+        }
+        else {syntax_err = true;}
     }
     else {syntax_err = true;}
 
     if (syntax_err) {
-        shell_print("command syntax error, see 'help <i2c0>'");
+        shell_print("command syntax error, see 'help <spi>'");
     }
 }
 
 /**
-* @brief '/dev/spi0' get data callback function.
+* @brief '/dev/spi0' and '/dev/spi1' get data callback function.
 *
-* Interrogates any devices on SPI bus 0 for its ID number.
+* Lists the devices registered on the SPI bus with their clock, mode and
+* transaction stats, and interrogates the target device on SPI bus 0 for its
+* ID number.
 *
 * @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
 *
 * @return nothing, print the data directly so we can malloc/free
 */
-size_t spi0_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
+size_t spi_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
 {
-    // read out the device ID of expected target on the bus
+    const char *spi_header = "DEVICE\t\tCS\tkHz\t\tMODE\tXFERS\tBYTES\tTIMEOUTS\tRECONFIGS\tBUS ms\r\n"
+                             "\t\t\tmax/actual\r\n";
+    const size_t spi_line_len = 100;
+    size_t spi_len = strlen(spi_header) + (SPI_NUM_DEVICES * spi_line_len) + 30;
+    char *spi_msg = mem_pool_alloc(spi_len);
+    uint8_t bus = file->name[3] - '0'; // "spi0" or "spi1"
+    size_t msg_pos = 0;
+
+    // read out the device ID of expected target on bus 0
     // device ID specified in hardware_config.h
-    // if more than one device is attached to the bus, this can be made into a loop through chip selects
-    uint8_t device_id;
-    int bytes_read = spi0_read_registers(SPI0_TARGET_DEV_0_CS, SPI0_TARGET_DEV_0_ID_REG, &device_id, 1);
-    char *device_id_msg = pvPortMalloc(30);
-    if (bytes_read == 1 && device_id != 0) { // assuming device ID is never 0, that would be weird
-        sprintf(device_id_msg, "found device id: 0x%x\r\n", device_id);
+    if (bus == 0) {
+        uint8_t device_id;
+        int bytes_read = spi_dev_read(SPI0_TARGET_DEV_0, SPI0_TARGET_DEV_0_ID_REG, &device_id, 1);
+        if (bytes_read == 1 && device_id != 0) { // assuming device ID is never 0, that would be weird
+            msg_pos = snprintf(spi_msg, spi_len, "found device id: 0x%x\r\n", device_id);
+        }
+        else {
+            msg_pos = snprintf(spi_msg, spi_len, "no response on SPI\r\n");
+        }
     }
-    else {
-        sprintf(device_id_msg, "no response on SPI\r\n");
+
+    // list the devices on this bus
+    msg_pos += snprintf(spi_msg + msg_pos, spi_len - msg_pos, "%s", spi_header);
+    for (int dev = 0; dev < SPI_NUM_DEVICES && msg_pos < spi_len; dev++) {
+        spi_dev_stats_t stats = spi_dev_stats[dev]; // snapshot, transactions may be updating it
+        if (spi_devices[dev].bus != bus) continue;
+        msg_pos += snprintf(spi_msg + msg_pos, spi_len - msg_pos,
+                            "%-15s\t%u\t%lu/%lu\t%u\t%lu\t%lu\t%lu\t\t%lu\t\t%lu\r\n",
+                            spi_devices[dev].name,
+                            spi_devices[dev].cs_pin,
+                            spi_devices[dev].max_khz, stats.clock_khz,
+                            (spi_devices[dev].cpol << 1) | spi_devices[dev].cpha,
+                            stats.xfers, stats.bytes, stats.timeouts, stats.reconfigs,
+                            (uint32_t)(stats.bus_us / 1000));
     }
     
     // print directly from this function rather than returning pointer to uShell.
     // this allows us to malloc/free rather than using static memory
-    shell_print(device_id_msg);
-    vPortFree(device_id_msg);
+    shell_print(spi_msg);
+    mem_pool_free(spi_msg);
 
     // return null since we already printed output
     return 0;
 }
 
 /**
-* @brief '/dev/adc' get data callback function.
+* @brief '/dev/adc0' executable callback function.
+*
+* Change the sample rate of the ADC stream, or stop it so that reads of the ADC
+* are single conversions again.
+*
+* @param ush_file_execute_callback Params given by typedef ush_file_execute_callback. see ush_types.h
+*
+* @return nothing
+*/
+static void adc0_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "rate") == 0) {
+        if (!adc_stream_set_rate(strtol(argv[2], NULL, 10))) {
+            shell_print("sample rate out of range");
+        }
+    }
+    else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        adc_stream_stop();
+    }
+    else {
+        shell_print("command syntax error, see 'help <adc0>'");
+    }
+}
+
+/**
+* @brief '/dev/adc0' get data callback function.
 *
 * Reads the value of the ADC peripheral and prints the value converted to a
 * voltage. See the settings in hardware_config.h for which channel/pin this
-* corresponds to.
+* corresponds to. While the ADC is streaming, also prints the configured and
+* measured sample rates, overruns, and the min/max/mean of each channel over
+* the last block.
 *
 * @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
 *
-* @return length of pointer to the ADC value
+* @return nothing, print the data directly so we can malloc/free
 */
 size_t adc0_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
 {
-    static char adc_val[9] = {'\0'};
-
-    sprintf(adc_val, "%.3fV\r\n", read_adc(0));
+    const size_t adc_len = 200 + (ADC_STREAM_CHANNELS_MAX * 60);
+    char *adc_msg = mem_pool_alloc(adc_len);
+    adc_stream_stats_t stats = adc_stream_stats; // snapshot, the stream may be updating it
+    size_t msg_pos;
+
+    msg_pos = snprintf(adc_msg, adc_len, "%.3fV\r\n", read_adc(0));
+
+    if (stats.running) {
+        msg_pos += snprintf(adc_msg + msg_pos, adc_len - msg_pos,
+                            "streaming at %lu Hz per channel (measured %lu Hz), decimation %d\r\n"
+                            "blocks: %lu, overruns: %lu, FIFO overflows: %lu\r\n"
+                            "CHANNEL\tMIN\tMAX\tMEAN\r\n",
+                            stats.rate_hz, stats.measured_rate_hz, ADC_STREAM_DECIMATION,
+                            stats.blocks, stats.overruns, stats.fifo_overflows);
+        for (int c = 0; c < stats.num_channels && msg_pos < adc_len; c++) {
+            adc_stream_chan_stats_t *chan = &stats.chan[stats.channels[c]];
+            msg_pos += snprintf(adc_msg + msg_pos, adc_len - msg_pos, "adc%d\t%.3fV\t%.3fV\t%.3fV\r\n",
+                                stats.channels[c], chan->min * ADC_CONV_FACT,
+                                chan->max * ADC_CONV_FACT, chan->mean * ADC_CONV_FACT);
+        }
+    }
+    else {
+        msg_pos += snprintf(adc_msg + msg_pos, adc_len - msg_pos, "not streaming\r\n");
+    }
 
-    // set pointer to data
-    *data = (uint8_t*)adc_val;
-    // return data size
-    return strlen(adc_val);
+    // print directly from this function rather than returning pointer to uShell.
+    // this allows us to malloc/free rather than using static memory
+    shell_print(adc_msg);
+    mem_pool_free(adc_msg);
+    // return null since we already printed output
+    return 0;
 }
 
 /**
@@ -484,7 +650,7 @@ size_t adc0_get_data_callback(struct ush_object *self, struct ush_file_descripto
 */
 size_t usb0_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
 {
-    uint8_t *usb_rx_data = pvPortMalloc(CFG_TUD_CDC_RX_BUFSIZE);
+    uint8_t *usb_rx_data = mem_pool_alloc(CFG_TUD_CDC_RX_BUFSIZE);
     usb_rx_data[0] = '\0'; // make sure initial strlen is zero
     
     while (usb_data_get(usb_rx_data + strlen(usb_rx_data))) {
@@ -494,7 +660,7 @@ size_t usb0_get_data_callback(struct ush_object *self, struct ush_file_descripto
     // print directly from this function rather than returning pointer to uShell.
     // this allows us to malloc/free rather than using static memory
     shell_print(usb_rx_data);
-    vPortFree(usb_rx_data);
+    mem_pool_free(usb_rx_data);
     // return null since we already printed output
     return 0;
 }
@@ -513,11 +679,62 @@ void usb0_set_data_callback(struct ush_object *self, struct ush_file_descriptor
     usb_data_put(data);
 }
 
+/**
+* @brief '/dev/uart1' executable callback function.
+*
+* Print the auxilliary UART statistics: byte and overrun counters, and the
+* RX/TX throughput since the last time the stats were printed.
+*
+* @param ush_file_execute_callback Params given by typedef ush_file_execute_callback. see ush_types.h
+*
+* @return nothing
+*/
+static void uart1_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
+{
+    static aux_uart_stats_t last_stats;  // counters at the last stats print, for throughput
+    static uint64_t last_time_us;
+
+    if (argc == 2 && strcmp(argv[1], "stats") == 0) {
+        aux_uart_stats_t stats = aux_uart_stats; // snapshot, the UART ISR may be updating it
+        uint64_t now_us = get_time_us();
+        uint64_t elapsed_us = now_us - last_time_us;
+        char *uart_msg = mem_pool_alloc(340);
+
+        snprintf(uart_msg, 340,
+                 "RX bytes:\t\t%lu\r\n"
+                 "RX buffer overruns:\t%lu\r\n"
+                 "RX hw overruns:\t\t%lu\r\n"
+                 "TX bytes:\t\t%lu\r\n"
+                 "TX writes:\t\t%lu\r\n"
+                 "TX queue full:\t\t%lu\r\n"
+                 "TX timeouts:\t\t%lu\r\n"
+                 "RX rate:\t\t%lu bytes/s\r\n"
+                 "TX rate:\t\t%lu bytes/s",
+                 stats.rx_bytes,
+                 stats.rx_overruns,
+                 stats.rx_hw_overruns,
+                 stats.tx_bytes,
+                 stats.tx_writes,
+                 stats.tx_queue_full,
+                 stats.tx_timeouts,
+                 (uint32_t)(((uint64_t)(stats.rx_bytes - last_stats.rx_bytes) * 1000000) / (elapsed_us ? elapsed_us : 1)),
+                 (uint32_t)(((uint64_t)(stats.tx_bytes - last_stats.tx_bytes) * 1000000) / (elapsed_us ? elapsed_us : 1)));
+        shell_print(uart_msg);
+        mem_pool_free(uart_msg);
+
+        last_stats = stats;
+        last_time_us = now_us;
+    }
+    else {
+        shell_print("command syntax error, see 'help <uart1>'");
+    }
+}
+
 /**
 * @brief '/dev/uart1' get data callback function.
 *
-* Reads any bytes that are available in the auxilliary UART RX FIFO, and attempts
-* to print them as a string.
+* Reads any bytes that have been received by the auxilliary UART into its RX
+* buffer, and attempts to print them as a string.
 *
 * @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
 *
@@ -525,19 +742,18 @@ void usb0_set_data_callback(struct ush_object *self, struct ush_file_descriptor
 */
 size_t uart1_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
 {
-    static uint8_t uart_rx_data[UART_RX_FIFO_SIZE_AUX];
-    uart_rx_data[0] = '\0'; // make sure initial strlen is zero
+    static uint8_t uart_rx_data[UART_RX_FIFO_SIZE_AUX + 1];
+    int rx_len;
 
     // set pointer to data
     *data = (uint8_t*)uart_rx_data;
 
-    if (aux_uart_read(uart_rx_data, UART_RX_FIFO_SIZE_AUX) > 0) {
-        // return data size
-        return strlen(uart_rx_data);
-    }
-    else {
-        return 0;
-    }
+    // read up to one FIFO's worth at a time, leaving room for a null terminator
+    rx_len = aux_uart_read(uart_rx_data, UART_RX_FIFO_SIZE_AUX);
+    uart_rx_data[rx_len] = '\0';
+
+    // return data size
+    return strlen((char *)uart_rx_data);
 }
 
 /**
@@ -591,34 +807,67 @@ static const struct ush_file_descriptor dev_files[] = {
     {
         .name = "i2c0",
         .description = "I2C bus 0",
-        .help = "usage: i2c0 <read>  <\e[3maddress(0x...)\e[0m> <\e[3mnbytes\e[0m>\r\n"
-                "            <write> <\e[3maddress(0x...)\e[0m> <\e[3mdata(0x...)\e[0m>\r\n"
+        .help = "usage: i2c0 <read>      <\e[3maddress(0x...)\e[0m> <\e[3mnbytes\e[0m>\r\n"
+                "            <write>     <\e[3maddress(0x...)\e[0m> <\e[3mdata(0x...)\e[0m>\r\n"
+                "            <writeread> <\e[3maddress(0x...)\e[0m> <\e[3mdata(0x...)\e[0m> <\e[3mnbytes\e[0m>\r\n"
                 "\r\n"
-                "       cat i2c0 - scan i2c0 bus and print a table of responding addresses\r\n",
-        .exec = i2c0_exec_callback,
-        .get_data = i2c0_get_data_callback,
+                "       cat i2c0 - scan i2c0 bus and print a table of responding addresses, bus stats and devices\r\n",
+        .exec = i2c_exec_callback,
+        .get_data = i2c_get_data_callback,
         .set_data = NULL
     },
 #endif /* HW_USE_I2C0 */
+#if HW_USE_I2C1
+    {
+        .name = "i2c1",
+        .description = "I2C bus 1",
+        .help = "usage: i2c1 <read>      <\e[3maddress(0x...)\e[0m> <\e[3mnbytes\e[0m>\r\n"
+                "            <write>     <\e[3maddress(0x...)\e[0m> <\e[3mdata(0x...)\e[0m>\r\n"
+                "            <writeread> <\e[3maddress(0x...)\e[0m> <\e[3mdata(0x...)\e[0m> <\e[3mnbytes\e[0m>\r\n"
+                "\r\n"
+                "       cat i2c1 - scan i2c1 bus and print a table of responding addresses, bus stats and devices\r\n",
+        .exec = i2c_exec_callback,
+        .get_data = i2c_get_data_callback,
+        .set_data = NULL
+    },
+#endif /* HW_USE_I2C1 */
 #if HW_USE_SPI0
     {
         .name = "spi0",
         .description = "SPI bus 0",
-        .help = "usage: spi0 <read>  <\e[3mreg addr(0x...)\e[0m> <\e[3mnbytes\e[0m>\r\n"
-                "            <write> <\e[3mreg addr(0x...)\e[0m> <\e[3mdata byte(0x...)\e[0m>\r\n"
+        .help = "usage: spi0 <read>  [\e[3mdevice\e[0m] <\e[3mreg addr(0x...)\e[0m> <\e[3mnbytes\e[0m>\r\n"
+                "            <write> [\e[3mdevice\e[0m] <\e[3mreg addr(0x...)\e[0m> <\e[3mdata(0x...)\e[0m>\r\n"
+                "            <bench> [\e[3mdevice\e[0m] <\e[3mreg addr(0x...)\e[0m> [\e[3mnbytes\e[0m]\r\n"
                 "\r\n"
-                "       cat spi0 - read device IDs of all devices in chip select table\r\n",
-        .exec = spi0_exec_callback,
-        .get_data = spi0_get_data_callback,
+                "       cat spi0 - read the target device ID, list devices on the bus and their stats\r\n",
+        .exec = spi_exec_callback,
+        .get_data = spi_get_data_callback,
         .set_data = NULL
     },
 #endif /* HW_USE_SPI0 */
+#if HW_USE_SPI1
+    {
+        .name = "spi1",
+        .description = "SPI bus 1",
+        .help = "usage: spi1 <read>  [\e[3mdevice\e[0m] <\e[3mreg addr(0x...)\e[0m> <\e[3mnbytes\e[0m>\r\n"
+                "            <write> [\e[3mdevice\e[0m] <\e[3mreg addr(0x...)\e[0m> <\e[3mdata(0x...)\e[0m>\r\n"
+                "            <bench> [\e[3mdevice\e[0m] <\e[3mreg addr(0x...)\e[0m> [\e[3mnbytes\e[0m]\r\n"
+                "\r\n"
+                "       cat spi1 - list devices on the bus and their stats\r\n",
+        .exec = spi_exec_callback,
+        .get_data = spi_get_data_callback,
+        .set_data = NULL
+    },
+#endif /* HW_USE_SPI1 */
 #if HW_USE_ADC && ADC0_INIT
     {
         .name = "adc0",
         .description = "Analog-to-Digital Converter",
-        .help = NULL,
-        .exec = NULL,
+        .help = "usage: adc0 <rate> <\e[3msamples per second\e[0m> - (re)start streaming at this rate\r\n"
+                "            <stop> - stop streaming, reads are single conversions\r\n"
+                "\r\n"
+                "       cat adc0 - print the ADC0 voltage, and stream rate, overruns and min/max/mean\r\n",
+        .exec = adc0_exec_callback,
         .get_data = adc0_get_data_callback,
         .set_data = NULL
     },
@@ -637,8 +886,11 @@ static const struct ush_file_descriptor dev_files[] = {
     {
         .name = "uart1",
         .description = "auxilliary UART",
-        .help = NULL,
-        .exec = NULL,
+        .help = "usage: uart1 <stats>\r\n"
+                "\r\n"
+                "       cat uart1 - print received data\r\n"
+                "       echo <\e[3mdata\e[0m> > uart1 - send data\r\n",
+        .exec = uart1_exec_callback,
         .get_data = uart1_get_data_callback,
         .set_data = uart1_set_data_callback
     }
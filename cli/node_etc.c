@@ -17,6 +17,7 @@
 #include <microshell.h>
 #include "shell.h"
 #include "motd.h"
+#include "mem_pool.h"
 #include "FreeRTOS.h"
 
 
@@ -33,11 +34,11 @@
 size_t motd_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
 {
     // copy motd string into ram
-    char *motd_msg = pvPortMalloc(strlen(motd_ascii));
+    char *motd_msg = mem_pool_alloc(strlen(motd_ascii) + 1);
     strcpy(motd_msg, motd_ascii);
     // print to cli
     shell_print(motd_msg);
-    vPortFree(motd_msg);
+    mem_pool_free(motd_msg);
 
     // return null since we already printed output
     return 0;
@@ -14,23 +14,229 @@
  ******************************************************************************/
 
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <microshell.h>
 #include "shell.h"
 #include "services.h"
 #include "service_queues.h"
+#include "mem_pool.h"
+#include "hardware/flash.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
 
 
+/**
+* @brief Get a new storagemanager request item for the flash0 filesystem.
+*
+* Takes an item from the storagemanager item pool and fills in the action and
+* file/directory name. Prints an error to the shell if no item is available.
+*
+* @param action storagemanager action to perform
+* @param name file or directory name, may be NULL
+* @param data_len size of data buffer needed for the request, 0 if none
+*
+* @return pointer to the request item, or NULL if none available
+*/
+static storman_item_t *flash0_item_new(storman_action_t action, const char *name, size_t data_len)
+{
+    storman_item_t *smi = storman_item_alloc(data_len);
+
+    if (smi == NULL) {
+        shell_print("error, " xstr(SERVICE_NAME_STORMAN) " is busy, try again");
+        return NULL;
+    }
+    smi->action = action;
+    if (name != NULL) {
+        strncpy(smi->sm_item_name, name, PATHNAME_MAX_LEN - 1);
+    }
+
+    return smi;
+}
+
+/**
+* @brief Dump the entire contents of a file on flash0.
+*
+* Opens the file through a storagemanager file handle and streams it to the
+* shell in FILE_SIZE_MAX chunks, so files larger than a single transfer
+* buffer can be dumped.
+*
+* @param name name of the file to dump
+*
+* @return nothing
+*/
+static void flash0_dumpfile(const char *name)
+{
+    storman_item_t *smi = flash0_item_new(FOPEN, name, FILE_SIZE_MAX);
+    int handle;
+
+    if (smi == NULL) return;
+
+    // open the file read-only
+    smi->sm_item_flags = LFS_O_RDONLY;
+    if (!storman_request_wait(smi, STORMAN_REQUEST_TIMEOUT) || smi->sm_item_result < 0) {
+        storman_item_release(smi);
+        return;
+    }
+    handle = smi->sm_item_result;
+
+    // read and print chunks until the end of the file, reusing the same item
+    do {
+        smi->action = FREAD;
+        smi->sm_item_handle = handle;
+        smi->sm_item_size = smi->sm_item_data_len - 1;
+        if (!storman_request_wait(smi, STORMAN_REQUEST_TIMEOUT) || smi->sm_item_result <= 0) {
+            break;
+        }
+        shell_print_no_newline(smi->sm_item_data); // chunks run together as the file does
+    } while (smi->sm_item_result == smi->sm_item_size);
+    shell_print(""); // one line break after the whole file
+
+    smi->action = FCLOSE;
+    smi->sm_item_handle = handle;
+    storman_request_wait(smi, STORMAN_REQUEST_TIMEOUT);
+    storman_item_release(smi);
+}
+
+/**
+* @brief Print the storagemanager request latency statistics.
+*
+* Prints the count, average and worst case latency of each storagemanager
+* action which has been serviced, followed by its non-empty histogram buckets
+* (shown as the upper bound of the bucket in microseconds), and the bytes
+* copied through the request queue per request against the old by-value path.
+*
+* @param none
+*
+* @return nothing
+*/
+static void flash0_print_latency(void)
+{
+    const int lat_msg_maxlen = 1024;
+    char *lat_msg = mem_pool_alloc(lat_msg_maxlen);
+    int lat_msg_len;
+
+    if (lat_msg == NULL) return;
+    lat_msg_len = snprintf(lat_msg, lat_msg_maxlen,
+                           USH_SHELL_FONT_STYLE_BOLD
+                           USH_SHELL_FONT_COLOR_BLUE
+                           "Action      Count   Avg(us)   Max(us)   MaxWait(us)\r\n"
+                           "---------------------------------------------------\r\n"
+                           USH_SHELL_FONT_STYLE_RESET);
+
+    for (int action = 0; action < STORMAN_NUM_ACTIONS && lat_msg_len < lat_msg_maxlen; action++) {
+        storman_latency_t lat = storman_latency[action]; // snapshot, storagemanager may be updating it
+        if (lat.count == 0) continue;
+        lat_msg_len += snprintf(lat_msg + lat_msg_len, lat_msg_maxlen - lat_msg_len,
+                                "%-11s %-7lu %-9lu %-9lu %lu\r\n ",
+                                storman_action_names[action],
+                                lat.count,
+                                (uint32_t)(lat.total_us / lat.count),
+                                lat.max_us,
+                                lat.wait_max_us);
+        for (int bucket = 0; bucket < STORMAN_LAT_BUCKETS && lat_msg_len < lat_msg_maxlen; bucket++) {
+            if (lat.hist[bucket] == 0) continue;
+            lat_msg_len += snprintf(lat_msg + lat_msg_len, lat_msg_maxlen - lat_msg_len,
+                                    (bucket == STORMAN_LAT_BUCKETS - 1) ? " >=%lu:%lu" : " <%lu:%lu",
+                                    (bucket == STORMAN_LAT_BUCKETS - 1) ? (1UL << (bucket - 1)) : (1UL << bucket),
+                                    lat.hist[bucket]);
+        }
+        if (lat_msg_len < lat_msg_maxlen) {
+            lat_msg_len += snprintf(lat_msg + lat_msg_len, lat_msg_maxlen - lat_msg_len, "\r\n");
+        }
+    }
+
+    storman_queue_stats_t qstats = storman_queue_stats; // snapshot, requesters may be updating it
+    if (qstats.requests > 0 && lat_msg_len < lat_msg_maxlen) {
+        snprintf(lat_msg + lat_msg_len, lat_msg_maxlen - lat_msg_len,
+                 "queue: %lu requests, %lu bytes/request (by value: %u), data %lu bytes/request",
+                 qstats.requests,
+                 qstats.queue_bytes / qstats.requests,
+                 (unsigned int)STORMAN_BYVALUE_REQUEST_BYTES,
+                 qstats.data_bytes / qstats.requests);
+    }
+
+    shell_print(lat_msg);
+    mem_pool_free(lat_msg);
+}
+
+/**
+* @brief Print the storagemanager log writer statistics.
+*
+* Shows how many records have been appended to buffered logs versus how many
+* flash program/commit cycles were actually needed to write them.
+*
+* @param none
+*
+* @return nothing
+*/
+static void flash0_print_logstat(void)
+{
+    storman_log_stats_t stats = storman_log_stats; // snapshot, storagemanager may be updating it
+    char logstat_msg[384];
+
+    snprintf(logstat_msg, sizeof(logstat_msg),
+             USH_SHELL_FONT_STYLE_BOLD
+             USH_SHELL_FONT_COLOR_BLUE
+             "Log Writer Statistics\r\n"
+             "---------------------\r\n"
+             USH_SHELL_FONT_STYLE_RESET
+             "Records appended:\t%lu\r\n"
+             "Bytes appended:\t\t%lu\r\n"
+             "Flushes (size):\t\t%lu\r\n"
+             "Flushes (time):\t\t%lu\r\n"
+             "Flushes (sync):\t\t%lu\r\n"
+             "Bytes dropped:\t\t%lu\r\n"
+             "Commits saved:\t\t%lu",
+             stats.records,
+             stats.bytes,
+             stats.size_flushes,
+             stats.time_flushes,
+             stats.sync_flushes,
+             stats.dropped,
+             (stats.records > stats.flushes) ? (stats.records - stats.flushes) : 0);
+    shell_print(logstat_msg);
+}
+
+/**
+* @brief Print the onboard flash I/O counters and littlefs geometry.
+*
+* @param none
+*
+* @return nothing
+*/
+static void flash0_print_iostat(void)
+{
+    flash_io_stats_t io = onboard_flash_io_stats; // snapshot, storagemanager may be updating it
+    char iostat_msg[320];
+
+    snprintf(iostat_msg, sizeof(iostat_msg),
+             USH_SHELL_FONT_STYLE_BOLD
+             USH_SHELL_FONT_COLOR_BLUE
+             "Flash I/O Statistics\r\n"
+             "--------------------\r\n"
+             USH_SHELL_FONT_STYLE_RESET
+             "Geometry (rd/cache/la):\t%u/%u/%u\r\n"
+             "Reads:\t\t\t%lu (%lu bytes)\r\n"
+             "Programs:\t\t%lu (%lu bytes)\r\n"
+             "Erases:\t\t\t%lu (%lu bytes)",
+             FLASH0_READ_SIZE, FLASH0_CACHE_SIZE, FLASH0_LOOKAHEAD_SIZE,
+             io.reads, io.read_bytes,
+             io.progs, io.prog_bytes,
+             io.erases, io.erases * FLASH0_BLOCK_SIZE);
+    shell_print(iostat_msg);
+}
+
 /**
 * @brief '/mnt/flash0' executable callback function.
 *
 * Interact with the onboard flash0 filesystem (list directories, read/write
-* files, etc.), by putting the action request into the storagemanager's queue
-* for servicing, and then reading out any resulting data from the global
-* storagemanager data structure.
+* files, etc.), by taking a request item from the storagemanager's pool and
+* passing it to the storagemanager's queue for servicing, and then waiting for
+* that request to complete and reading out any resulting data from the item's
+* data buffer.
 *
 * @param ush_file_execute_callback Params given by typedef ush_file_execute_callback. see ush_types.h
 *
@@ -39,103 +245,153 @@
 static void flash0_exec_callback(struct ush_object *self, struct ush_file_descriptor const *file, int argc, char *argv[])
 {
     bool syntax_err = false;
-    struct storman_item_t smi;
+    bool wait_data = false; // true if the storagemanager will return data to print
+    const char *result_fmt = NULL; // if set, wait for the request and print its result with this format
+    storman_item_t *smi = NULL;
+
+    // statistics are kept by storagemanager but can be read without it
+    if (argc == 2 && strcmp(argv[1], "latency") == 0) {
+        flash0_print_latency();
+        return;
+    }
+    if (argc == 2 && strcmp(argv[1], "logstat") == 0) {
+        flash0_print_logstat();
+        return;
+    }
+    if (argc == 2 && strcmp(argv[1], "iostat") == 0) {
+        flash0_print_iostat();
+        return;
+    }
 
     // make sure storagemanager is actually running
     if (xTaskGetHandle(xstr(SERVICE_NAME_STORMAN)) == NULL) {
         shell_print("error, " xstr(SERVICE_NAME_STORMAN) " service is not running");
+        return;
     }
     else if (argc > 1) {
         if (strcmp(argv[1], "lsdir") == 0 && argc == 3) {
-            smi.action = LSDIR;
-            strcpy(smi.sm_item_name, argv[2]);
-            storman_request(&smi);
-            // wait for storagemanager to provide semaphore indicating data is ready
-            if (xSemaphoreTake(smi_glob_sem, DELAY_STORMAN * 2) == pdTRUE) {
-                shell_print(smi_glob.sm_item_data);
-            }
+            smi = flash0_item_new(LSDIR, argv[2], FILE_SIZE_MAX);
+            wait_data = true;
         }
         else if (strcmp(argv[1], "mkdir") == 0 && argc == 3) {
-            smi.action = MKDIR;
-            strcpy(smi.sm_item_name, argv[2]);
-            storman_request(&smi);
+            smi = flash0_item_new(MKDIR, argv[2], 0);
         }
         else if (strcmp(argv[1], "rmdir") == 0 && argc == 3) {
-            smi.action = RMDIR;
-            strcpy(smi.sm_item_name, argv[2]);
-            storman_request(&smi);
+            smi = flash0_item_new(RMDIR, argv[2], 0);
         }
         else if (strcmp(argv[1], "mkfile") == 0 && argc == 3) {
-            smi.action = MKFILE;
-            strcpy(smi.sm_item_name, argv[2]);
-            storman_request(&smi);
+            smi = flash0_item_new(MKFILE, argv[2], 0);
         }
         else if (strcmp(argv[1], "rmfile") == 0 && argc == 3) {
-            smi.action = RMFILE;
-            strcpy(smi.sm_item_name, argv[2]);
-            storman_request(&smi);
+            smi = flash0_item_new(RMFILE, argv[2], 0);
         }
         else if (strcmp(argv[1], "dumpfile") == 0 && argc == 3) {
-            smi.action = DUMPFILE;
-            strcpy(smi.sm_item_name, argv[2]);
-            storman_request(&smi);
-            // wait for storagemanager to provide semaphore indicating data is ready
-            if (xSemaphoreTake(smi_glob_sem, DELAY_STORMAN * 2) == pdTRUE) {
-                shell_print(smi_glob.sm_item_data);
-            }
+            flash0_dumpfile(argv[2]);
+            return;
         }
         else if (strcmp(argv[1], "readfile") == 0 && argc == 5) {
-            smi.action = READFILE;
-            strcpy(smi.sm_item_name, argv[2]);
-            smi.sm_item_offset = (lfs_soff_t)strtol(argv[3], NULL, 10);
-            smi.sm_item_size = strtol(argv[4], NULL, 10);
-            storman_request(&smi);
-            // wait for storagemanager to provide semaphore indicating data is ready
-            if (xSemaphoreTake(smi_glob_sem, DELAY_STORMAN * 2) == pdTRUE) {
-                shell_print(smi_glob.sm_item_data);
+            smi = flash0_item_new(READFILE, argv[2], FILE_SIZE_MAX);
+            if (smi != NULL) {
+                smi->sm_item_offset = (lfs_soff_t)strtol(argv[3], NULL, 10);
+                smi->sm_item_size = strtol(argv[4], NULL, 10);
             }
+            wait_data = true;
         }
         else if (strcmp(argv[1], "writefile") == 0 && argc == 4) {
-            smi.action = WRITEFILE;
-            strcpy(smi.sm_item_name, argv[2]);
-            strcpy(smi.sm_item_data, argv[3]);
-            storman_request(&smi);
+            // data buffer only needs to be as large as the data being written
+            smi = flash0_item_new(WRITEFILE, argv[2], strlen(argv[3]) + 1);
+            if (smi != NULL) {
+                strcpy(smi->sm_item_data, argv[3]);
+            }
         }
         else if (strcmp(argv[1], "appendfile") == 0 && argc == 4) {
-            smi.action = APPENDFILE;
-            strcpy(smi.sm_item_name, argv[2]);
-            strcpy(smi.sm_item_data, argv[3]);
-            storman_request(&smi);
+            smi = flash0_item_new(APPENDFILE, argv[2], strlen(argv[3]) + 1);
+            if (smi != NULL) {
+                strcpy(smi->sm_item_data, argv[3]);
+            }
         }
         else if (strcmp(argv[1], "filestat") == 0 && argc == 3) {
-            smi.action = FILESTAT;
-            strcpy(smi.sm_item_name, argv[2]);
-            storman_request(&smi);
-            // wait for storagemanager to provide semaphore indicating data is ready
-            if (xSemaphoreTake(smi_glob_sem, DELAY_STORMAN * 2) == pdTRUE) {
-                shell_print(smi_glob.sm_item_data);
-            }
+            smi = flash0_item_new(FILESTAT, argv[2], PATHNAME_MAX_LEN + 32);
+            wait_data = true;
         }
         else if (strcmp(argv[1], "fsstat") == 0 && argc == 2) {
-            smi.action = FSSTAT;
-            storman_request(&smi);
-            // wait for storagemanager to provide semaphore indicating data is ready
-            if (xSemaphoreTake(smi_glob_sem, DELAY_STORMAN * 2) == pdTRUE) {
-                shell_print(smi_glob.sm_item_data);
-            }
+            smi = flash0_item_new(FSSTAT, NULL, 80);
+            wait_data = true;
         }
         else if (strcmp(argv[1], "format") == 0 && argc == 2) {
-            smi.action = FORMAT;
-            storman_request(&smi);
-            // wait for storagemanager to provide semaphore indicating data is ready
-            if (xSemaphoreTake(smi_glob_sem, DELAY_STORMAN * 2) == pdTRUE) {
-                shell_print(smi_glob.sm_item_data);
+            smi = flash0_item_new(FORMAT, NULL, 32);
+            wait_data = true;
+        }
+        else if (strcmp(argv[1], "open") == 0 && argc == 4) {
+            int flags = 0;
+            if      (strcmp(argv[3], "r") == 0)  flags = LFS_O_RDONLY;
+            else if (strcmp(argv[3], "w") == 0)  flags = LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC;
+            else if (strcmp(argv[3], "a") == 0)  flags = LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND;
+            else if (strcmp(argv[3], "rw") == 0) flags = LFS_O_RDWR | LFS_O_CREAT;
+            else {syntax_err = true;}
+            if (!syntax_err) {
+                smi = flash0_item_new(FOPEN, argv[2], 0);
+                if (smi != NULL) {
+                    smi->sm_item_flags = flags;
+                }
+                result_fmt = "opened as handle %d";
+            }
+        }
+        else if (strcmp(argv[1], "read") == 0 && argc == 4) {
+            smi = flash0_item_new(FREAD, NULL, FILE_SIZE_MAX);
+            if (smi != NULL) {
+                smi->sm_item_handle = strtol(argv[2], NULL, 10);
+                smi->sm_item_size = strtol(argv[3], NULL, 10);
+                if (smi->sm_item_size > FILE_SIZE_MAX - 1) {
+                    smi->sm_item_size = FILE_SIZE_MAX - 1; // limit to a single transfer
+                }
+            }
+            wait_data = true;
+        }
+        else if (strcmp(argv[1], "write") == 0 && argc == 4) {
+            smi = flash0_item_new(FWRITE, NULL, strlen(argv[3]) + 1);
+            if (smi != NULL) {
+                smi->sm_item_handle = strtol(argv[2], NULL, 10);
+                smi->sm_item_size = strlen(argv[3]);
+                strcpy(smi->sm_item_data, argv[3]);
+            }
+            result_fmt = "%d bytes written";
+        }
+        else if (strcmp(argv[1], "seek") == 0 && argc == 4) {
+            smi = flash0_item_new(FSEEK, NULL, 0);
+            if (smi != NULL) {
+                smi->sm_item_handle = strtol(argv[2], NULL, 10);
+                smi->sm_item_offset = (lfs_soff_t)strtol(argv[3], NULL, 10);
+                smi->sm_item_flags = LFS_SEEK_SET;
+            }
+            result_fmt = "file position %d";
+        }
+        else if (strcmp(argv[1], "close") == 0 && argc == 3) {
+            smi = flash0_item_new(FCLOSE, NULL, 0);
+            if (smi != NULL) {
+                smi->sm_item_handle = strtol(argv[2], NULL, 10);
             }
         }
+        else if (strcmp(argv[1], "bench") == 0 && argc == 2) {
+            smi = flash0_item_new(FSBENCH, NULL, FILE_SIZE_MAX);
+            wait_data = true;
+        }
+        else if (strcmp(argv[1], "log") == 0 && argc == 4) {
+            if (!storman_log(argv[2], argv[3])) {
+                shell_print("error, could not queue log record");
+            }
+            return;
+        }
+        else if (strcmp(argv[1], "logsync") == 0 && (argc == 2 || argc == 3)) {
+            smi = flash0_item_new(LOGSYNC, (argc == 3) ? argv[2] : NULL, 0);
+        }
         else if (strcmp(argv[1], "unmount") == 0 && argc == 2) {
-            smi.action = UNMOUNT;
-            storman_request(&smi);
-            shell_print("/mnt folder unmounted, restart storagemanager service to re-mount");
+            smi = flash0_item_new(UNMOUNT, NULL, 0);
+            if (smi != NULL && storman_request(smi)) {
+                shell_print("/mnt folder unmounted, restart storagemanager service to re-mount");
+            }
+            storman_item_release(smi);
+            return;
         }
         else {syntax_err = true;}
     }
@@ -144,6 +400,27 @@ static void flash0_exec_callback(struct ush_object *self, struct ush_file_descri
     if (syntax_err) {
         shell_print("command syntax error, see 'help <flash0>'");
     }
+    else if (smi != NULL) {
+        if (wait_data) {
+            // wait for storagemanager to complete this request, then print its output
+            if (storman_request_wait(smi, STORMAN_REQUEST_TIMEOUT) && smi->sm_item_result >= 0) {
+                shell_print(smi->sm_item_data);
+            }
+        }
+        else if (result_fmt != NULL) {
+            // wait for storagemanager to complete this request, then print its result
+            if (storman_request_wait(smi, STORMAN_REQUEST_TIMEOUT) && smi->sm_item_result >= 0) {
+                char result_msg[32];
+                snprintf(result_msg, sizeof(result_msg), result_fmt, smi->sm_item_result);
+                shell_print(result_msg);
+            }
+        }
+        else {
+            storman_request(smi);
+        }
+        // drop our reference, the item returns to the pool once storagemanager is done with it
+        storman_item_release(smi);
+    }
 }
 
 // mnt directory files descriptor
@@ -155,8 +432,18 @@ static const struct ush_file_descriptor mnt_files[] = {
                 "              <readfile> <\e[3mname\e[0m> <\e[3moffset\e[0m> <\e[3mlength\e[0m>,\r\n"
                 "              <writefile|appendfile> <\e[3mname\e[0m> <\e[3mdata\e[0m>,\r\n"
                 "              <filestat> <\e[3mname\e[0m>,\r\n"
+                "              <open> <\e[3mname\e[0m> <r|w|a|rw>,\r\n"
+                "              <read> <\e[3mhandle\e[0m> <\e[3mlength\e[0m>,\r\n"
+                "              <write> <\e[3mhandle\e[0m> <\e[3mdata\e[0m>,\r\n"
+                "              <seek> <\e[3mhandle\e[0m> <\e[3moffset\e[0m>,\r\n"
+                "              <close> <\e[3mhandle\e[0m>,\r\n"
+                "              <log> <\e[3mname\e[0m> <\e[3mrecord\e[0m>,\r\n"
+                "              <logsync> [\e[3mname\e[0m],\r\n"
+                "              <logstat|iostat>\r\n"
+                "              <bench>\r\n"
                 "              <fsstat>\r\n"
                 "              <format>\r\n"
+                "              <latency>\r\n"
                 "              <unmount>\r\n",
         .exec = flash0_exec_callback,
         .get_data = NULL,
@@ -37,12 +37,19 @@ static void wifi_exec_callback(struct ush_object *self, struct ush_file_descript
     if (argc == 4) {
         if (strcmp(argv[1], "setauth") == 0) { // set the wifi network authentication parameters
             // create wifi_auth file with new credentials (or overwrite existing)
-            struct storman_item_t smi;
-            smi.action = WRITEFILE;
-            strcpy(smi.sm_item_name, "wifi_auth");
-            sprintf(smi.sm_item_data, "%s,%s", argv[2], argv[3]);
-            storman_request(&smi);
-            shell_print("wifi network credentials set");
+            size_t auth_len = strlen(argv[2]) + strlen(argv[3]) + 2; // ssid + ',' + pass + null
+            storman_item_t *smi = storman_item_alloc(auth_len);
+            if (smi != NULL) {
+                smi->action = WRITEFILE;
+                strcpy(smi->sm_item_name, "wifi_auth");
+                snprintf(smi->sm_item_data, auth_len, "%s,%s", argv[2], argv[3]);
+                storman_request(smi);
+                storman_item_release(smi);
+                shell_print("wifi network credentials set");
+            }
+            else {
+                shell_print("error, could not set wifi network credentials");
+            }
         }
         else {
             shell_print("command syntax error, see 'help <wifi>'");
@@ -20,6 +20,12 @@
 #include <git.h>
 #include "hardware_config.h"
 #include "shell.h"
+#include "service_queues.h"
+#include "service_log.h"
+#include "rtos_utils.h"
+#include "service_events.h"
+#include "mem_pool.h"
+#include "stack_monitor.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "version.h"
@@ -38,7 +44,7 @@ size_t mcuinfo_get_data_callback(struct ush_object *self, struct ush_file_descri
 {
     // use malloc rather than passing a pointer to a static char back to uShell,
     // since it is a rather large array
-    char *mcuinfo_msg = pvPortMalloc(250);
+    char *mcuinfo_msg = mem_pool_alloc(250);
     const char* scheduler_state[] = {"suspended", "not started", "running"};
     
     sprintf(mcuinfo_msg, "MCU: " xstr(MCU_NAME) ", running at %ld Hz\r\n", get_sys_clk_hz());
@@ -53,7 +59,7 @@ size_t mcuinfo_get_data_callback(struct ush_object *self, struct ush_file_descri
     // print directly from this function rather than returning pointer to uShell.
     // this allows us to malloc/free rather than using static memory
     shell_print(mcuinfo_msg);
-    vPortFree(mcuinfo_msg);
+    mem_pool_free(mcuinfo_msg);
     // return null since we already printed output
     return 0;
 }
@@ -71,7 +77,7 @@ size_t version_get_data_callback(struct ush_object *self, struct ush_file_descri
 {
     // use malloc rather than passing a pointer to a static char array back to uShell,
     // since it is a rather large array
-    char *version_msg = pvPortMalloc(400);
+    char *version_msg = mem_pool_alloc(400);
 
     sprintf(version_msg, "" USH_SHELL_FONT_STYLE_BOLD USH_SHELL_FONT_COLOR_BLUE);
     sprintf(version_msg + strlen(version_msg), xstr(PROJECT_NAME) " version:\t" xstr(PROJECT_VERSION) "\r\n"); // Top level project version
@@ -91,7 +97,7 @@ size_t version_get_data_callback(struct ush_object *self, struct ush_file_descri
     // print directly from this function rather than returning pointer to uShell.
     // this allows us to malloc/free rather than using static memory
     shell_print(version_msg);
-    vPortFree(version_msg);
+    mem_pool_free(version_msg);
     // return null since we already printed output
     return 0;
 }
@@ -136,17 +142,303 @@ size_t uptime_get_data_callback(struct ush_object *self, struct ush_file_descrip
     uint16_t num_days    = (uint16_t) ((((((current_time_us / 1E6) - num_seconds) / 60) - num_minutes) / 60) - num_hours) / 24;
 
     // build formatted string
-    char *uptime_msg = pvPortMalloc(55);
+    char *uptime_msg = mem_pool_alloc(55);
     snprintf(uptime_msg, 55, "System up %d days, %d hours, %d minutes, %d seconds\r\n", num_days, num_hours, num_minutes, num_seconds);
 
     // print the uptime msg
     shell_print(uptime_msg);
-    vPortFree(uptime_msg);
+    mem_pool_free(uptime_msg);
 
     // return null since we printed directly to the shell
     return 0;
 }
 
+/**
+* @brief '/proc/clistat' get data callback function.
+*
+* Print the CLI UART receive statistics (characters received, buffered, and
+* dropped due to RX ring buffer or hardware FIFO overruns), and the CLI output
+* statistics and throughput for each backend, and the CPU time shell_print()
+* uses per KB of output, plus print queue usage overall and for each task that
+* has printed through it.
+*
+* @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
+*
+* @return nothing, print the data directly so we can malloc/free
+*/
+size_t clistat_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
+{
+    cli_uart_stats_t stats = cli_uart_stats; // snapshot, the UART ISR may be updating it
+    cli_tx_stats_t tx_stats = cli_tx_stats;
+    const size_t clistat_len = 560 + (PRINT_PRODUCERS_MAX * (configMAX_TASK_NAME_LEN + 40));
+    char *clistat_msg = mem_pool_alloc(clistat_len);
+    size_t msg_pos;
+
+    msg_pos = snprintf(clistat_msg, clistat_len,
+             "CLI UART RX chars: %lu\r\n"
+             "CLI UART RX pending: %lu\r\n"
+             "CLI UART RX buffer overruns: %lu\r\n"
+             "CLI UART RX hardware overruns: %lu\r\n"
+             "CLI UART TX chars: %lu in %lu bursts, %lu chars/sec\r\n"
+             "CLI USB TX chars: %lu in %lu bursts, %lu chars/sec\r\n"
+             "CLI print CPU: %lu us/KB over %lu chars\r\n"
+             "CLI print queue: %lu msgs, %lu dropped, %lu/%u bytes peak use\r\n",
+             stats.rx_chars,
+             cli_uart_rx_pending(),
+             stats.rx_overruns,
+             stats.rx_hw_overruns,
+             tx_stats.uart_chars, tx_stats.uart_bursts,
+             (uint32_t)(tx_stats.uart_us ? (tx_stats.uart_chars * 1000000ULL) / tx_stats.uart_us : 0),
+             tx_stats.usb_chars, tx_stats.usb_bursts,
+             (uint32_t)(tx_stats.usb_us ? (tx_stats.usb_chars * 1000000ULL) / tx_stats.usb_us : 0),
+             (uint32_t)(tx_stats.print_chars ? (tx_stats.print_cpu_us * 1024) / tx_stats.print_chars : 0),
+             tx_stats.print_chars,
+             print_ring_stats.records, print_ring_stats.drops,
+             print_ring_stats.high_water, PRINT_RING_SIZE);
+
+    // add the queued/dropped message counts for each task that has printed
+    for (int entry = 0; entry < PRINT_PRODUCERS_MAX && msg_pos < clistat_len; entry++) {
+        if (print_producer_stats[entry].task != NULL) {
+            msg_pos += snprintf(clistat_msg + msg_pos, clistat_len - msg_pos,
+                                "  %-*s %lu msgs, %lu dropped\r\n",
+                                configMAX_TASK_NAME_LEN, print_producer_stats[entry].name,
+                                print_producer_stats[entry].records, print_producer_stats[entry].drops);
+        }
+    }
+
+    // print the stats msg
+    shell_print(clistat_msg);
+    mem_pool_free(clistat_msg);
+    // return null since we already printed output
+    return 0;
+}
+
+/**
+* @brief '/proc/logstat' get data callback function.
+*
+* Print the binary log statistics (records logged, dropped, waiting, and the
+* ring high water mark).
+*
+* @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
+*
+* @return nothing, print the data directly so we can malloc/free
+*/
+size_t logstat_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
+{
+    log_stats_t stats = log_stats; // snapshot, ISRs may be logging
+    char *logstat_msg = mem_pool_alloc(160);
+
+    snprintf(logstat_msg, 160,
+             "Log records: %lu\r\n"
+             "Log records dropped: %lu\r\n"
+             "Log records waiting: %s\r\n"
+             "Log ring peak use: %lu/%u records\r\n",
+             stats.records,
+             stats.drops,
+             log_pending() ? "yes" : "no",
+             stats.high_water, LOG_RING_DEPTH);
+
+    // print the stats msg
+    shell_print(logstat_msg);
+    mem_pool_free(logstat_msg);
+    // return null since we already printed output
+    return 0;
+}
+
+/**
+* @brief '/proc/sched' get data callback function.
+*
+* Print the schedule statistics of each periodic service - period, CPU budget,
+* average/max execution time and start jitter, and period/budget overruns.
+*
+* @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
+*
+* @return nothing, print the data directly so we can malloc/free
+*/
+size_t sched_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
+{
+    const char *sched_header = "SERVICE\t\tPERIOD\tBUDGET\tCYCLES\tEXEC us\t\tJITTER us\tOVERRUNS\r\n"
+                               "\t\tms\tus\t\tavg/max\t\tavg/max\t\tperiod/budget\r\n";
+    const size_t sched_line_len = 100;
+    size_t sched_len = strlen(sched_header) + (TASK_PERIODS_MAX * sched_line_len);
+    char *sched_msg = mem_pool_alloc(sched_len);
+    size_t msg_pos;
+
+    msg_pos = snprintf(sched_msg, sched_len, "%s", sched_header);
+    for (int i = 0; i < TASK_PERIODS_MAX && task_periods[i] != NULL; i++) {
+        task_period_t tp = *task_periods[i]; // snapshot, the service may be updating it
+        uint32_t jitter_cycles = tp.cycles - tp.overruns;
+        msg_pos += snprintf(sched_msg + msg_pos, sched_len - msg_pos,
+                            "%-15s\t%lu\t%lu\t%lu\t%lu/%lu\t\t%lu/%lu\t\t%lu/%lu\r\n",
+                            tp.name,
+                            (uint32_t)((tp.period * 1000) / configTICK_RATE_HZ),
+                            tp.budget_us,
+                            tp.cycles,
+                            (uint32_t)(tp.cycles ? tp.exec_total_us / tp.cycles : 0), tp.exec_max_us,
+                            (uint32_t)(jitter_cycles ? tp.jitter_total_us / jitter_cycles : 0), tp.jitter_max_us,
+                            tp.overruns, tp.budget_overruns);
+        if (msg_pos >= sched_len) break;
+    }
+
+    // print the schedule stats
+    shell_print(sched_msg);
+    mem_pool_free(sched_msg);
+    // return null since we already printed output
+    return 0;
+}
+
+/**
+* @brief '/proc/events' get data callback function.
+*
+* Print the event statistics of each event-driven service - wakeups per second
+* with and without events to handle, events handled, and average/max latency
+* from an event being signalled to the service waking up to handle it.
+*
+* @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
+*
+* @return nothing, print the data directly so we can malloc/free
+*/
+size_t events_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
+{
+    const char *events_header = "SERVICE\t\tWAKEUPS/s\tIDLE/s\tEVENTS\tLATENCY us\r\n"
+                                "\t\t(x1000)\t\t(x1000)\t\tavg/max\r\n";
+    const size_t events_line_len = 80;
+    size_t events_len = strlen(events_header) + (SERVICE_EVENTS_MAX * events_line_len);
+    char *events_msg = mem_pool_alloc(events_len);
+    size_t msg_pos;
+
+    msg_pos = snprintf(events_msg, events_len, "%s", events_header);
+    for (int i = 0; i < SERVICE_EVENTS_MAX && service_events[i] != NULL; i++) {
+        service_events_t se = *service_events[i]; // snapshot, the service may be updating it
+        uint64_t elapsed_us = get_time_us() - se.start_us;
+        // rates are in thousandths of a wakeup per second, since idle services wake up rarely
+        msg_pos += snprintf(events_msg + msg_pos, events_len - msg_pos,
+                            "%-15s\t%lu\t\t%lu\t%lu\t%lu/%lu\r\n",
+                            se.name,
+                            (uint32_t)(elapsed_us ? (se.wakeups * 1000000000ULL) / elapsed_us : 0),
+                            (uint32_t)(elapsed_us ? (se.idle_wakeups * 1000000000ULL) / elapsed_us : 0),
+                            se.events,
+                            (uint32_t)(se.wakeups ? se.latency_total_us / se.wakeups : 0), se.latency_max_us);
+        if (msg_pos >= events_len) break;
+    }
+
+    // print the event stats
+    shell_print(events_msg);
+    mem_pool_free(events_msg);
+    // return null since we already printed output
+    return 0;
+}
+
+/**
+* @brief '/proc/power' get data callback function.
+*
+* Print how the CPU time since boot splits between running services, idling
+* awake, and sleeping in tickless idle, along with the number and length of
+* the sleeps. Sleep stats stay at 0 unless built with ENABLE_TICKLESS_IDLE.
+*
+* @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
+*
+* @return nothing, print the data directly so we can malloc/free
+*/
+size_t power_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
+{
+    const size_t power_len = 300;
+    char *power_msg = mem_pool_alloc(power_len);
+    rtos_power_stats_t ps = rtos_power_stats; // snapshot, the idle task may be updating it
+    uint64_t uptime_us = get_time_us();
+    // the idle task is charged for the time it spends asleep, run time stats are in OS ticks
+    uint64_t idle_us = (uint64_t)(ulTaskGetIdleRunTimeCounter() * RUN_TIME_STATS_time_us_64_divider);
+    uint64_t awake_idle_us = (idle_us > ps.sleep_us) ? idle_us - ps.sleep_us : 0;
+    uint64_t active_us = (uptime_us > idle_us) ? uptime_us - idle_us : 0;
+
+    // percentages are in tenths of a percent
+    snprintf(power_msg, power_len,
+             "tickless idle:\t%s\r\n"
+             "uptime:\t\t%llu ms\r\n"
+             "active:\t\t%llu ms (%lu.%lu%%)\r\n"
+             "idle awake:\t%llu ms (%lu.%lu%%)\r\n"
+             "asleep:\t\t%llu ms (%lu.%lu%%)\r\n"
+             "sleeps:\t\t%lu, avg/max %lu/%lu us\r\n"
+             "expected ticks:\t%llu\r\n",
+             configUSE_TICKLESS_IDLE ? "enabled" : "disabled",
+             uptime_us / 1000,
+             active_us / 1000, (uint32_t)((active_us * 1000) / uptime_us) / 10, (uint32_t)((active_us * 1000) / uptime_us) % 10,
+             awake_idle_us / 1000, (uint32_t)((awake_idle_us * 1000) / uptime_us) / 10, (uint32_t)((awake_idle_us * 1000) / uptime_us) % 10,
+             ps.sleep_us / 1000, (uint32_t)((ps.sleep_us * 1000) / uptime_us) / 10, (uint32_t)((ps.sleep_us * 1000) / uptime_us) % 10,
+             ps.sleeps, (uint32_t)(ps.sleeps ? ps.sleep_us / ps.sleeps : 0), ps.sleep_max_us,
+             ps.expected_ticks);
+
+    // print the power stats
+    shell_print(power_msg);
+    mem_pool_free(power_msg);
+    // return null since we already printed output
+    return 0;
+}
+
+/**
+* @brief '/proc/stack' get data callback function.
+*
+* Print the stack use of each task sampled by the stackmonitor service - stack
+* size, peak use, least free, growth over the last trend window and the
+* recommended size, all in words like the STACK_ defines in services.h - along
+* with the stack overflow that caused the last reboot, if there was one.
+*
+* @param ush_file_data_getter Params given by typedef ush_file_data_getter. see ush_types.h
+*
+* @return nothing, print the data directly so we can malloc/free
+*/
+size_t stack_get_data_callback(struct ush_object *self, struct ush_file_descriptor const *file, uint8_t **data)
+{
+    const char *stack_header = "TASK\t\tSIZE\tPEAK\tFREE\tGROWTH\tRECOMMENDED\r\n"
+                               "\t\twords\tused\tmin\t/window\r\n";
+    const size_t stack_line_len = 64;
+    size_t stack_len = strlen(stack_header) + (STACK_MON_TASKS_MAX * stack_line_len) + 160;
+    char *stack_msg = mem_pool_alloc(stack_len);
+    uint32_t reclaimable_words = 0;
+    size_t msg_pos;
+
+    msg_pos = snprintf(stack_msg, stack_len, "%s", stack_header);
+    for (int i = 0; i < STACK_MON_TASKS_MAX && msg_pos < stack_len; i++) {
+        stack_mon_task_t stats = stack_mon_tasks[i]; // snapshot, the service may be updating it
+        uint32_t recommended;
+        if (stats.task == NULL) continue;
+        recommended = stack_mon_recommended(&stats);
+        if (recommended < stats.stack_words) reclaimable_words += stats.stack_words - recommended;
+        msg_pos += snprintf(stack_msg + msg_pos, stack_len - msg_pos,
+                            "%-15s\t%lu\t%lu\t%lu\t%lu\t%lu%s\r\n",
+                            stats.name,
+                            stats.stack_words,
+                            stats.stack_words - stats.min_free_words,
+                            stats.min_free_words,
+                            stats.trend_words,
+                            recommended,
+                            stats.warned_free_words ? " (low)" : "");
+    }
+
+    if (msg_pos < stack_len) {
+        msg_pos += snprintf(stack_msg + msg_pos, stack_len - msg_pos,
+                            "Reclaimable at recommended sizes: %lu words (%lu bytes)\r\n",
+                            reclaimable_words, (uint32_t)(reclaimable_words * sizeof(StackType_t)));
+    }
+    if (msg_pos < stack_len) {
+        if (stack_mon_last_crash.magic == STACK_MON_CRASH_MAGIC) {
+            snprintf(stack_msg + msg_pos, stack_len - msg_pos,
+                     "Last reboot: stack overflow in %s (%lu words) at %llu ms\r\n",
+                     stack_mon_last_crash.name, stack_mon_last_crash.stack_words,
+                     stack_mon_last_crash.uptime_us / 1000);
+        }
+        else {
+            snprintf(stack_msg + msg_pos, stack_len - msg_pos, "Last reboot: no stack overflow\r\n");
+        }
+    }
+
+    // print the stack stats
+    shell_print(stack_msg);
+    mem_pool_free(stack_msg);
+    // return null since we already printed output
+    return 0;
+}
+
 // proc directory files descriptor
 static const struct ush_file_descriptor proc_files[] = {
     {
@@ -180,6 +472,54 @@ static const struct ush_file_descriptor proc_files[] = {
         .exec = NULL,
         .get_data = uptime_get_data_callback,
         .set_data = NULL
+    },
+    {
+        .name = "clistat",
+        .description = "get CLI serial I/O statistics",
+        .help = NULL,
+        .exec = NULL,
+        .get_data = clistat_get_data_callback,
+        .set_data = NULL
+    },
+    {
+        .name = "logstat",
+        .description = "get binary log statistics",
+        .help = NULL,
+        .exec = NULL,
+        .get_data = logstat_get_data_callback,
+        .set_data = NULL
+    },
+    {
+        .name = "sched",
+        .description = "get service schedule jitter and overrun stats",
+        .help = NULL,
+        .exec = NULL,
+        .get_data = sched_get_data_callback,
+        .set_data = NULL
+    },
+    {
+        .name = "events",
+        .description = "get event-driven service wakeup and latency stats",
+        .help = NULL,
+        .exec = NULL,
+        .get_data = events_get_data_callback,
+        .set_data = NULL
+    },
+    {
+        .name = "power",
+        .description = "get sleep vs active time stats for tickless idle",
+        .help = NULL,
+        .exec = NULL,
+        .get_data = power_get_data_callback,
+        .set_data = NULL
+    },
+    {
+        .name = "stack",
+        .description = "get task stack use, growth and recommended sizes",
+        .help = NULL,
+        .exec = NULL,
+        .get_data = stack_get_data_callback,
+        .set_data = NULL
     }
 };
 
@@ -43,15 +43,90 @@ static int ush_read(struct ush_object *self, char *ch)
     return 0;
 }
 
-// microshell character write interface
-static int ush_write(struct ush_object *self, char ch)
+// CLI output burst buffer - microshell writes one char at a time, which are
+// collected here and written to the backend in blocks
+static char cli_tx_buf[CLI_TX_BURST_SIZE];
+static size_t cli_tx_len;
+
+// global CLI output statistics (extern declared in shell.h)
+cli_tx_stats_t cli_tx_stats;
+
+// write out any buffered CLI output as one block, returns false if the
+// backend could not take all of it
+static bool shell_flush(void)
 {
+    uint64_t start_us;
+    int written;
+
+    if (cli_tx_len == 0) return true;
+
+    start_us = get_time_us();
     if (CLI_USE_USB) {
-        return cli_usb_putc(ch);  // CLI over USB put single char
+        written = cli_usb_write(cli_tx_buf, cli_tx_len);  // CLI over USB block write
+        cli_tx_stats.usb_us += get_time_us() - start_us;
+        cli_tx_stats.usb_chars += written;
+        cli_tx_stats.usb_bursts++;
     }
     else {
-        return cli_uart_putc(ch); // CLI over UART put single char
+        written = cli_uart_write(cli_tx_buf, cli_tx_len); // CLI over UART block write
+        cli_tx_stats.uart_us += get_time_us() - start_us;
+        cli_tx_stats.uart_chars += written;
+        cli_tx_stats.uart_bursts++;
     }
+
+    // output that could not be written (i.e. USB host not connected) is dropped
+    bool complete = ((size_t)written == cli_tx_len);
+    cli_tx_len = 0;
+    return complete;
+}
+
+// total time the CLI output backend has spent blocked waiting on the hardware
+static uint64_t shell_tx_wait_us(void)
+{
+    if (CLI_USE_USB) {
+        return cli_usb_stats.tx_wait_us;
+    }
+    else {
+        return cli_uart_stats.tx_wait_us;
+    }
+}
+
+// microshell character write interface
+static int ush_write(struct ush_object *self, char ch)
+{
+    // buffer the char, writing out a burst whenever the buffer fills up
+    cli_tx_buf[cli_tx_len++] = ch;
+    if (cli_tx_len == CLI_TX_BURST_SIZE) {
+        shell_flush();
+    }
+    return 1;
+}
+
+// write chars straight to the CLI output, bypassing microshell
+static void shell_write(const char *buf, size_t len)
+{
+    for (size_t pos = 0; pos < len; pos++) {
+        ush_write(&ush, buf[pos]);
+    }
+}
+
+// write a string straight to the CLI output a burst at a time. each burst blocks
+// in the backend write until the hardware has taken it, and if the backend can't
+// take a burst (i.e. USB host not connected) the rest of the string is dropped
+static void shell_write_string(const char *buf)
+{
+    size_t len = strlen(buf);
+    size_t pos = 0;
+
+    while (pos < len) {
+        size_t count = CLI_TX_BURST_SIZE - cli_tx_len;
+        if (count > len - pos) count = len - pos;
+        memcpy(&cli_tx_buf[cli_tx_len], buf + pos, count);
+        cli_tx_len += count;
+        pos += count;
+        if (cli_tx_len == CLI_TX_BURST_SIZE && !shell_flush()) break;
+    }
+    shell_flush();
 }
 
 // I/O interface descriptor
@@ -128,14 +203,59 @@ void shell_init(void)
 void shell_service(void)
 {
     ush_service(&ush);
+    shell_flush(); // write out any output (i.e. echoed input) from this pass
+}
+
+// print a string and leave microshell in the state its own print would have,
+// so it follows up with the line break (if newline) and prompt as usual
+static void shell_print_string(char *buf, bool newline)
+{
+    uint64_t start_us = get_time_us();
+    uint64_t start_wait_us = shell_tx_wait_us();
+    size_t print_len = strlen(buf);
+
+    // the string is written out here rather than a char at a time by microshell,
+    // so the only waiting is the backend blocking until the hardware is ready
+    shell_write_string(buf);
+    if (newline) {
+        ush_print(&ush, "");
+    }
+    else {
+        ush_print_no_newline(&ush, "");
+    }
+    ush_service(&ush); // move past the (empty) write to the state that follows a print
+
+    // CPU time is the elapsed time less the time spent blocked on the hardware
+    // (preemption by higher priority tasks is counted too, so this is an upper bound)
+    cli_tx_stats.print_cpu_us += (get_time_us() - start_us) - (shell_tx_wait_us() - start_wait_us);
+    cli_tx_stats.print_chars += print_len;
 }
 
 void shell_print(char *buf)
 {
-    // print buffer using microshell interface
-    ush_print(&ush, buf);
-    // wait until printing is finished to exit function (blocking)
-    while(shell_is_printing()) {}
+    shell_print_string(buf, true);
+}
+
+void shell_print_no_newline(char *buf)
+{
+    shell_print_string(buf, false);
+}
+
+void shell_print_above_input(const char *buf)
+{
+    // erase the partial input line and print the message in its place
+    shell_write(SHELL_ERASE_LINE, strlen(SHELL_ERASE_LINE));
+    shell_write(buf, strlen(buf));
+    if (buf[0] != '\0' && buf[strlen(buf) - 1] != '\n') {
+        shell_write("\r\n", 2);
+    }
+
+    // redraw the prompt the same way microshell does, then the input so far
+    shell_write(SHELL_PROMPT_PREFIX HOST_NAME SHELL_PROMPT_SPACE, strlen(SHELL_PROMPT_PREFIX HOST_NAME SHELL_PROMPT_SPACE));
+    shell_write(ush.current_node->path, strlen(ush.current_node->path));
+    shell_write(SHELL_PROMPT_SUFFIX, strlen(SHELL_PROMPT_SUFFIX));
+    shell_write(ush.desc->input_buffer, ush.in_pos);
+    shell_flush();
 }
 
 void shell_print_slow(const char *buf) {
@@ -159,8 +279,7 @@ void shell_print_slow(const char *buf) {
             task_delay_ms(SLOW_PRINT_CHAR_DELAY_MS);
         }
         if (!end_of_string) {
-            ush_print(&ush, char_buf);
-            while(shell_is_printing()) {}
+            shell_print_no_newline(char_buf);
         }
     }
 }
@@ -172,6 +291,7 @@ bool shell_is_printing(void)
         ush_service(&ush); // keep servicing the shell if it is still writing chars
         return true;
     } else {
+        shell_flush(); // done, write out the tail of the output
         return false;
     }
 }
@@ -18,6 +18,7 @@
 #define SHELL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <microshell.h>
 
 
@@ -64,10 +65,27 @@
 #define TIMESTAMP_LEN 20 // length of timestamp() string to use when sizing print buffers
 #define SLOW_PRINT_CHAR_DELAY_MS 1   // shell_print_slow() OS tick delay between chars
 #define SLOW_PRINT_LINE_DELAY_MS 5  // shell_print_slow() OS tick delay between lines
+#define CLI_TX_BURST_SIZE 64 // CLI output is collected and written in bursts of this size (one USB packet)
+#define SHELL_ERASE_LINE "\r\033[2K" // VT100 return to start of line and erase it
+
+// CLI output statistics, per backend
+typedef struct cli_tx_stats_t {
+    uint32_t uart_chars;    // characters written to the CLI UART
+    uint32_t uart_bursts;   // block writes to the CLI UART
+    uint64_t uart_us;       // time spent in CLI UART block writes
+    uint32_t usb_chars;     // characters written to CLI over USB
+    uint32_t usb_bursts;    // block writes to CLI over USB
+    uint64_t usb_us;        // time spent in USB block writes
+    uint32_t print_chars;   // characters printed with shell_print()
+    uint64_t print_cpu_us;  // time shell_print() spent running, i.e. not blocked waiting on the backend
+} cli_tx_stats_t;
 
 // global microshell instance handler
 extern struct ush_object ush;
 
+// global CLI output statistics
+extern cli_tx_stats_t cli_tx_stats;
+
 /**
 * @brief Initialize the CLI shell.
 *
@@ -95,7 +113,11 @@ void shell_service(void);
 *
 * Wrapper which allows other functions within the CLI to print output to the shell.
 * Anything outside the CLI task should use the print queue (cli_print_raw() or cli_print_timestamped()).
-* Note that this function blocks until printing is complete.
+* Note that this function blocks until printing is complete - the calling task
+* sleeps while the UART/USB hardware drains each burst of output, so other tasks
+* get to run during large prints. If the backend can't take the output (i.e. USB
+* host not connected) the rest of it is dropped rather than retried. CPU time
+* used is tracked in cli_tx_stats.
 *
 * @param buf pointer to the string to print
 *
@@ -103,6 +125,33 @@ void shell_service(void);
 */
 void shell_print(char *buf);
 
+/**
+* @brief Print string output in the shell without a line break.
+*
+* Same as shell_print(), but no line break is added after the string, so that
+* output produced in pieces (i.e. a file read in chunks) can be printed as one.
+*
+* @param buf pointer to the string to print
+*
+* @return nothing
+*/
+void shell_print_no_newline(char *buf);
+
+/**
+* @brief Print string output above the current shell input line.
+*
+* Used to print asynchronous output (i.e. from the print queue) while the user
+* is part way through typing a command. The partial input line is erased, the
+* string is printed on its own line, and then the prompt and partial input are
+* redrawn so the user can carry on typing. Only valid while microshell is
+* waiting for input (ush.state is USH_STATE_READ_CHAR).
+*
+* @param buf pointer to the string to print
+*
+* @return nothing
+*/
+void shell_print_above_input(const char *buf);
+
 /**
 * @brief Print string output in the shell, slowly.
 *
@@ -120,8 +169,9 @@ void shell_print_slow(const char *buf);
 /**
 * @brief Check if the shell is currently printing.
 *
-* Wrap this function in while() to wait until the shell is done printing all
-* characters of a string before moving on. This is implemented inside shell_print().
+* Wrap this function in while() to wait until microshell is done printing all
+* characters of a string it is writing itself. shell_print() does not need this,
+* it writes its string out directly.
 *
 * @param none
 *
@@ -85,7 +85,7 @@ int bme280_read_compensation_parameters(bme280_compensation_params_t *compensati
     int bytes_read;
 
     // read out factory compensation parameter data bytes 0-25 (comp data is split between 2 memory blocks)
-    bytes_read = spi0_read_registers(SPI0_TARGET_DEV_0_CS, 0x88, comp_params_buffer, 26);
+    bytes_read = spi_dev_read(SPI_DEV_BME280, 0x88, comp_params_buffer, 26);
 
     if (bytes_read == 26) {
         // break out data into individual compensation factors - following
@@ -110,7 +110,7 @@ int bme280_read_compensation_parameters(bme280_compensation_params_t *compensati
         // humidity compensation
         compensation_params->hum_comp.H1 = comp_params_buffer[25];
         // read out factory compensation parameter data bytes 26-32, re-using the same buffer
-        spi0_read_registers(SPI0_TARGET_DEV_0_CS, 0xE1, comp_params_buffer, 7);
+        spi_dev_read(SPI_DEV_BME280, 0xE1, comp_params_buffer, 7);
         compensation_params->hum_comp.H2 = comp_params_buffer[0] | (comp_params_buffer[1] << 8);
         compensation_params->hum_comp.H3 = comp_params_buffer[2];
         compensation_params->hum_comp.H4 = (comp_params_buffer[3] << 4) | (comp_params_buffer[4] & 0x0F);
@@ -124,13 +124,15 @@ int bme280_read_compensation_parameters(bme280_compensation_params_t *compensati
 
 int bme280_init(void) {
     int registers_written = 0;
+    uint8_t ctrl_hum = 0x01;  // humidity oversampling register = x1
+    uint8_t ctrl_meas = 0x27; // other oversampling modes, run mode normal
 
     // read out compensation parameters from device ROM and store in global structure
     if (bme280_read_compensation_parameters(&bme280_compensation_params_glob)) {
         // humidity oversampling register = x1
-        registers_written += spi0_write_register(SPI0_TARGET_DEV_0_CS, 0xF2, 0x01);
+        registers_written += spi_dev_write(SPI_DEV_BME280, 0xF2, &ctrl_hum, 1);
         // set other oversampling modes, run mode normal
-        registers_written += spi0_write_register(SPI0_TARGET_DEV_0_CS, 0xF4, 0x27);
+        registers_written += spi_dev_write(SPI_DEV_BME280, 0xF4, &ctrl_meas, 1);
     }
 
     // make sure BME280 configuration has taken place
@@ -145,7 +147,7 @@ int bme280_read_sensors(bme280_compensation_params_t *compensation_params, bme28
     uint32_t press_raw, hum_raw;
     
     // read raw data (uncalibrated) from sensors
-    if (spi0_read_registers(SPI0_TARGET_DEV_0_CS, 0xF7, raw_data_buffer, 8) == 8) {
+    if (spi_dev_read(SPI_DEV_BME280, 0xF7, raw_data_buffer, 8) == 8) {
         // shift data into the appropriate bin (temp, press, hum)
         temp_raw  = ((uint32_t) raw_data_buffer[3] << 12) | ((uint32_t) raw_data_buffer[4] << 4) | (raw_data_buffer[5] >> 4);
         press_raw = ((uint32_t) raw_data_buffer[0] << 12) | ((uint32_t) raw_data_buffer[1] << 4) | (raw_data_buffer[2] >> 4);
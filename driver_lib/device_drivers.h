@@ -123,8 +123,7 @@ int bme280_read_sensors(bme280_compensation_params_t *compensation_params, bme28
 // MCP4725 specific settings
 // VDD rail voltage - defines scaling for the 12-bit DAC value
 #define MCP4725_VDD 3.3
-// I2C address (hex)
-#define MCP4725_I2C_ADDR 0x60
+// I2C bus, address and clock are set by its I2C_DEVICES entry in hardware_config.h
 
 /**
 * @brief Initialize the MCP4725 device.
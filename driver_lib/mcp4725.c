@@ -23,13 +23,14 @@ int mcp4725_init(void) {
     uint8_t rx_byte;
 
     // read a single byte to check for MCP4725 device code
-    if (i2c0_read(MCP4725_I2C_ADDR, &rx_byte, 1) == 1) {
+    if (i2c_dev_transfer(I2C_DEV_MCP4725, NULL, 0, &rx_byte, 1) == 1) {
         rx_byte = rx_byte >> 4;
         if (rx_byte == 0xC) { // check for 4-bit device code 1100
             return 1;
         }
         else return 0;
     }
+    else return 0;
 }
 
 int mcp4725_set_voltage(float voltage, bool save_in_eeprom) {
@@ -41,7 +42,7 @@ int mcp4725_set_voltage(float voltage, bool save_in_eeprom) {
         dac_write_data[1] = (uint8_t) (dac_setting >> 4); // upper 8 bits of DAC value goes in 2nd byte
         dac_write_data[2] = (uint8_t) (dac_setting << 4); // lower 4 bits goes in top nibble of 3rd byte
 
-        if (i2c0_write(MCP4725_I2C_ADDR, dac_write_data, 3) == 3) {
+        if (i2c_dev_transfer(I2C_DEV_MCP4725, dac_write_data, 3, NULL, 0) == 3) {
             return 1;
         }
         else return 0;
@@ -50,7 +51,7 @@ int mcp4725_set_voltage(float voltage, bool save_in_eeprom) {
         dac_write_data[0] = (uint8_t) (dac_setting >> 8); // upper 4 bits of DAC value goes in 1st byte
         dac_write_data[1] = (uint8_t) dac_setting;        // lower 8 bits of DAC value goes into 2nd byte
 
-        if (i2c0_write(MCP4725_I2C_ADDR, dac_write_data, 2) == 2) {
+        if (i2c_dev_transfer(I2C_DEV_MCP4725, dac_write_data, 2, NULL, 0) == 2) {
             return 1;
         }
         else return 0;
@@ -61,7 +62,7 @@ float mcp4725_get_voltage(void) {
     uint16_t dac_setting;
     uint8_t dac_read_data[3];
 
-    if (i2c0_read(MCP4725_I2C_ADDR, dac_read_data, 3) == 3) {
+    if (i2c_dev_transfer(I2C_DEV_MCP4725, NULL, 0, dac_read_data, 3) == 3) {
         dac_setting = (uint16_t) (dac_read_data[1] << 4);               // 2nd byte read is 8 MSBs of the current DAC setting
         dac_setting = dac_setting | (uint16_t) (dac_read_data[2] >> 4); // top nibble of 3rd byte read has 4 LSBs of DAC setting
 
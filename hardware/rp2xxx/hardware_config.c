@@ -42,8 +42,6 @@ void hardware_init(void) {
     SemaphoreHandle_t gpio_mutex = NULL;
     SemaphoreHandle_t cli_uart_mutex = NULL;
     SemaphoreHandle_t aux_uart_mutex = NULL;
-    SemaphoreHandle_t i2c0_mutex = NULL;
-    SemaphoreHandle_t spi0_mutex = NULL;
     SemaphoreHandle_t onboard_flash_mutex = NULL;
     SemaphoreHandle_t adc_mutex = NULL;
     SemaphoreHandle_t usb_mutex = NULL;
@@ -87,12 +85,20 @@ void hardware_init(void) {
         i2c0_init();
         uart_puts(UART_ID_CLI, "i2c0 ");
     }
+    if (HW_USE_I2C1) {
+        i2c1_init();
+        uart_puts(UART_ID_CLI, "i2c1 ");
+    }
 
     // initialize spi peripheral(s)
     if (HW_USE_SPI0) {
         spi0_init();
         uart_puts(UART_ID_CLI, "spi0 ");
     }
+    if (HW_USE_SPI1) {
+        spi1_init();
+        uart_puts(UART_ID_CLI, "spi1 ");
+    }
 
     // initialize the onboard LED gpio (if not a Pico W board)
     if (HW_USE_ONBOARD_LED) {
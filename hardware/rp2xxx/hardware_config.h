@@ -49,8 +49,8 @@ search file for these keywords including the leading '*' to find section
  * GPIO
  * CLI UART
  * Auxilliary UART
- * I2C0 Master
- * SPI0 Master
+ * I2C Master
+ * SPI Master
  * On-board LED
  * Watchdog Timer
  * Chip Reset
@@ -279,10 +279,24 @@ void gpio_write_all(uint32_t gpio_states);
 #define UART_PARITY_CLI     UART_PARITY_NONE
 #define UART_TX_PIN_CLI     0
 #define UART_RX_PIN_CLI     1
+#define UART_RX_BUF_SIZE_CLI 256 // size of the CLI RX ring buffer, must be a power of 2
+
+// CLI UART statistics
+typedef struct cli_uart_stats_t {
+    uint32_t rx_chars;      // characters received into the RX ring buffer
+    uint32_t rx_overruns;   // characters dropped because the RX ring buffer was full
+    uint32_t rx_hw_overruns; // hardware FIFO overruns (characters lost before the ISR ran)
+    uint32_t tx_waits;      // writes that blocked waiting for the TX interrupt to drain them
+    uint32_t tx_timeouts;   // writes that gave up before all characters were sent
+    uint64_t tx_wait_us;    // time writers spent blocked waiting on the TX interrupt
+} cli_uart_stats_t;
 
 // global CLI UART mutex
 extern SemaphoreHandle_t cli_uart_mutex;
 
+// global CLI UART statistics
+extern cli_uart_stats_t cli_uart_stats;
+
 /**
 * @brief Initialize the CLI UART.
 *
@@ -307,18 +321,45 @@ void cli_uart_init(void);
 */
 int cli_uart_putc(char tx_char);
 
+/**
+* @brief Write a block of characters to CLI UART.
+*
+* Write a burst of characters to the UART used for the Command Line Interface,
+* taking the CLI UART mutex once for the whole block. Whatever does not fit in
+* the TX FIFO is fed by the UART TX interrupt while the calling task blocks, so
+* the CPU is free for other tasks while the characters go out on the wire.
+* Returns once all of the characters have been written to the TX FIFO.
+*
+* @param tx_data pointer to the characters to write
+* @param tx_len  number of characters to write
+*
+* @return number of characters written, 0 upon failure
+*/
+int cli_uart_write(const char *tx_data, size_t tx_len);
+
 /**
 * @brief Read character from CLI UART.
 *
 * Read a single character from the UART used for the Command Line Interface in
 * a non-blocking fashion. This function is used by Microshell for all CLI input.
+* Characters are taken from the RX ring buffer filled by the UART interrupt, so
+* no mutex is needed (the CLI task is the only consumer).
 *
 * @param none
 *
-* @return Character read from UART
+* @return Character read from UART, or NOCHAR if nothing has been received
 */
 char cli_uart_getc(void);
 
+/**
+* @brief Get the number of characters waiting in the CLI UART RX buffer.
+*
+* @param none
+*
+* @return number of received characters not yet read with cli_uart_getc()
+*/
+uint32_t cli_uart_rx_pending(void);
+
 /**
 * @brief Print a string to the CLI UART.
 *
@@ -349,10 +390,31 @@ void cli_uart_puts(const char *print_string);
 #define UART_TX_PIN_AUX         8
 #define UART_RX_PIN_AUX         9
 #define UART_RX_FIFO_SIZE_AUX   32 // from RP2040 datasheet (hardware limited)
+#define UART_RX_BUF_SIZE_AUX    1024 // size of the RX stream buffer filled by the aux UART interrupt
+#define UART_TX_QUEUE_DEPTH_AUX 8    // number of asynchronous TX writes that can be queued
+
+// Aux UART asynchronous write completion callback. Called from the UART
+// interrupt once the last byte of a write has been handed to the hardware, so
+// the callback must be short and may only use FreeRTOS "FromISR" APIs.
+typedef void (*aux_uart_tx_callback_t)(const uint8_t *tx_data, size_t tx_len, void *cb_arg);
+
+// Aux UART statistics
+typedef struct aux_uart_stats_t {
+    uint32_t rx_bytes;        // bytes received into the RX stream buffer
+    uint32_t rx_overruns;     // bytes dropped because the RX stream buffer was full
+    uint32_t rx_hw_overruns;  // hardware FIFO overruns (bytes lost before the ISR ran)
+    uint32_t tx_bytes;        // bytes written to the hardware
+    uint32_t tx_writes;       // writes completed
+    uint32_t tx_queue_full;   // writes rejected because the TX queue was full
+    uint32_t tx_timeouts;     // blocking writes that gave up before all bytes were sent
+} aux_uart_stats_t;
 
 // global Aux UART mutex
 extern SemaphoreHandle_t aux_uart_mutex;
 
+// global Aux UART statistics
+extern aux_uart_stats_t aux_uart_stats;
+
 /**
 * @brief Initialize the AUX UART.
 *
@@ -369,6 +431,9 @@ void aux_uart_init(void);
 * @brief Write bytes to AUX UART.
 *
 * Write one or more bytes to the UART used for the auxilliary serial interface.
+* The write is queued behind any asynchronous writes in progress, and the
+* calling task blocks (without spinning) until it has been sent. If it times
+* out, whatever is left of the write is cancelled before returning.
 *
 * @param tx_data pointer to the data to write
 * @param tx_len  length in bytes of data to write
@@ -377,11 +442,29 @@ void aux_uart_init(void);
 */
 int aux_uart_write(uint8_t *tx_data, size_t tx_len);
 
+/**
+* @brief Write bytes to AUX UART without blocking.
+*
+* Queues a write for the aux UART TX interrupt and returns immediately. The
+* data is not copied, so the buffer must stay valid until the completion
+* callback has been called.
+*
+* @param tx_data pointer to the data to write
+* @param tx_len  length in bytes of data to write
+* @param callback function called (from the ISR) when the write is done, may be NULL
+* @param cb_arg   argument passed through to the callback
+*
+* @return 1 if the write was queued, 0 if the TX queue is full
+*/
+int aux_uart_write_async(const uint8_t *tx_data, size_t tx_len, aux_uart_tx_callback_t callback, void *cb_arg);
+
 /**
 * @brief Read bytes from AUX UART.
 *
 * Read any bytes available on the auxilliary UART in a non-blocking fashion,
 * until no more bytes are immediately available or rx_len has been reached.
+* Bytes are received by the UART interrupt into a stream buffer, so nothing
+* is lost as long as the buffer is read before UART_RX_BUF_SIZE_AUX fills up.
 *
 * @param rx_data pointer to the data buffer to hold the bytes received
 * @param rx_len  maximum number of bytes to read (buffer size)
@@ -392,20 +475,90 @@ int aux_uart_read(uint8_t *rx_data, size_t rx_len);
 
 
 /************************
- * I2C0 Master
+ * I2C Master
 *************************/
 
-// Enable I2C0 peripheral - setting to false will disable (not initialized at boot)
+// Enable I2C peripherals - setting to false will disable (not initialized at boot)
 #define HW_USE_I2C0 true
+#define HW_USE_I2C1 false
 
 // I2C0 Settings
 #define I2C0_ID            i2c0
-#define I2C0_FREQ_KHZ      100
+#define I2C0_FREQ_KHZ      100 // clock for addresses not in I2C_DEVICES
 #define I2C0_SDA_PIN       20
 #define I2C0_SCL_PIN       21
 
-// global I2C0 mutex
-extern SemaphoreHandle_t i2c0_mutex;
+// I2C1 Settings
+#define I2C1_ID            i2c1
+#define I2C1_FREQ_KHZ      100
+#define I2C1_SDA_PIN       6
+#define I2C1_SCL_PIN       7
+
+// I2C transaction engine settings (both buses)
+#define I2C_XFER_TIMEOUT_MS 100 // max time to wait for a queued transaction
+
+// I2C device registry - devices that can run faster than the bus default clock.
+// The clock is switched for each transaction, so a 400 kHz (Fast-mode) or 1 MHz
+// (Fast-mode Plus) device can share a bus with 100 kHz ones. Fast-mode Plus
+// needs stronger external pull-ups than the internal ones enabled at init.
+// Each entry gives an I2C_DEV_<name> handle for i2c_dev_transfer().
+//   name    device name
+//   bus     I2C bus the device is attached to, 0 or 1
+//   addr    7-bit device address
+//   max_khz max I2C clock the device supports (100, 400 or 1000)
+#define I2C_DEVICES(X) \
+    /* name     bus  addr  max_khz */ \
+    X(MCP4725,  0,   0x60, 400)
+
+#define I2C_DEV_ENUM(name, bus, addr, max_khz) I2C_DEV_##name,
+typedef enum i2c_dev_t {
+    I2C_DEVICES(I2C_DEV_ENUM)
+    I2C_NUM_DEVICES
+} i2c_dev_t;
+
+// I2C device descriptor, one for each I2C_DEVICES entry
+typedef struct i2c_dev_desc_t {
+    const char *name;
+    uint8_t bus;
+    uint8_t addr;
+    uint32_t max_khz;
+} i2c_dev_desc_t;
+
+// I2C device registry, indexed by i2c_dev_t
+extern const i2c_dev_desc_t i2c_devices[I2C_NUM_DEVICES];
+
+// I2C bus statistics
+typedef struct i2c_bus_stats_t {
+    uint32_t xfers;         // transactions completed
+    uint32_t bytes;         // bytes transferred (written and read)
+    uint32_t naks;          // transactions where the address or a data byte was not acknowledged
+    uint32_t aborts;        // transactions aborted for any other reason (e.g. arbitration lost)
+    uint32_t timeouts;      // transactions that timed out
+    uint32_t clock_changes; // times the bus clock was switched between devices
+    uint32_t clock_khz;     // actual bus clock, 0 until the first transaction
+} i2c_bus_stats_t;
+
+// global I2C bus statistics, indexed by bus number
+extern i2c_bus_stats_t i2c_bus_stats[2];
+
+// I2C transaction descriptor. Transactions are queued by i2c_transfer() and run
+// back to back from the I2C interrupt, which keeps the FIFOs filled and drained.
+// A transaction writes tx_len bytes, then reads rx_len bytes after a repeated
+// start (e.g. a register address, then the register contents), so that no other
+// transaction can get onto the bus in between.
+typedef struct i2c_xfer_t {
+    uint8_t addr;               // 7-bit target device address
+    const uint8_t *tx_buf;      // bytes to write, may be NULL if tx_len is 0
+    uint16_t tx_len;            // number of bytes to write, 0 for a read only
+    uint8_t *rx_buf;            // buffer for the bytes read, may be NULL if rx_len is 0
+    uint16_t rx_len;            // number of bytes to read after the write, 0 for a write only
+    // transaction engine state, set by i2c_transfer()
+    uint32_t freq_khz;          // bus clock for the transaction
+    struct i2c_xfer_t *next;    // next transaction in the queue
+    TaskHandle_t task;          // task waiting for the transaction
+    volatile bool done;         // set once the transaction has completed
+    volatile int result;        // see i2c_transfer()
+} i2c_xfer_t;
 
 /**
 * @brief Initialize I2C bus 0.
@@ -420,66 +573,165 @@ extern SemaphoreHandle_t i2c0_mutex;
 void i2c0_init(void);
 
 /**
-* @brief Write bytes onto I2C0 bus.
+* @brief Initialize I2C bus 1.
 *
-* Put byte(s) onto I2C bus 0 given a specific device address. It is assumed this
-* is a blocking function.
+* Initialization routine for the I2C1 peripheral using the settings defined
+* above.
 *
-* @param addr 7-bit address (0-127) of target device on I2C bus
-* @param write_data pointer to the byte array to write onto the bus
-* @param length number of bytes to write onto the bus
+* @param none
 *
-* @return number of bytes written, or -1 if no response
+* @return nothing
 */
-int i2c0_write(uint8_t addr, const uint8_t *write_data, size_t length);
+void i2c1_init(void);
 
 /**
-* @brief Read bytes off of I2C0 bus.
+* @brief Run an I2C transaction.
+*
+* Queues the transaction behind any others on the bus and blocks the calling
+* task until it has completed - the bus is set to the clock of the target
+* device (from I2C_DEVICES, or the bus default), and the bytes are moved by the
+* I2C interrupt, so the caller sleeps instead of spinning. A write followed by
+* a read is joined by a repeated start. If the scheduler is not running yet
+* (drivers initialized at boot), the transaction is run with blocking transfers
+* instead.
+*
+* @param bus  I2C bus number, 0 or 1
+* @param xfer pointer to the transaction descriptor, must stay valid until the call returns
+*
+* @return number of bytes read (or written, for a write only), -1 if the device
+*         did not acknowledge or the transaction was aborted, 0 if it timed out or
+*         the bus is not enabled
+*/
+int i2c_transfer(uint8_t bus, i2c_xfer_t *xfer);
+
+/**
+* @brief Run an I2C transaction with a registered device.
 *
-* Read byte(s) from a given device adress on I2C bus 0. It is assumed this is a
-* blocking function.
+* Writes and/or reads a device from I2C_DEVICES, see i2c_transfer(). Give both
+* a write and a read for a combined register read.
 *
-* @param addr 7-bit address (0-127) of target device on I2C bus
-* @param read_data pointer to the byte array to store the data read from the bus
-* @param length number of bytes to read from the bus
+* @param dev     target device, I2C_DEV_<name> from I2C_DEVICES
+* @param tx_buf  pointer to the bytes to write
+* @param tx_len  number of bytes to write, 0 for a read only
+* @param rx_buf  pointer to the byte array to store the data read from the device
+* @param rx_len  number of bytes to read after the write, 0 for a write only
 *
-* @return number of bytes read, or -1 if no response
+* @return number of bytes read (or written, for a write only), -1 if no response
 */
-int i2c0_read(uint8_t addr, uint8_t *read_data, size_t length);
+int i2c_dev_transfer(i2c_dev_t dev, const uint8_t *tx_buf, uint16_t tx_len, uint8_t *rx_buf, uint16_t rx_len);
 
 
 /************************
- * SPI0 Master
+ * SPI Master
 *************************/
 
-// Enable SPI0 peripheral - setting to false will disable (not initialized at boot)
+// Enable SPI peripherals - setting to false will disable (not initialized at boot)
 #define HW_USE_SPI0 true
+#define HW_USE_SPI1 false
 
 // SPI0 Settings
 #define SPI0_ID             spi0
-#define SPI0_FREQ_KHZ       500
+#define SPI0_FREQ_KHZ       500 // clock until the first transaction, then each device runs at its own clock
 #define SPI0_MISO_PIN       4
 #define SPI0_MOSI_PIN       3
 #define SPI0_CLK_PIN        2
 #define SPI0_CS_PIN_DEFAULT 5
 
+// SPI1 Settings
+#define SPI1_ID             spi1
+#define SPI1_FREQ_KHZ       500
+#define SPI1_MISO_PIN       12
+#define SPI1_MOSI_PIN       11
+#define SPI1_CLK_PIN        10
+#define SPI1_CS_PIN_DEFAULT 13
+
+// SPI transaction engine settings (both buses)
+#define SPI_DMA_IRQ         DMA_IRQ_1 // DMA interrupt used by the SPI transaction engine
+#define SPI_XFER_TIMEOUT_MS 100       // max time to wait for a queued transaction, on top of its own delays
+
+// SPI device registry - every device attached to a SPI bus, with the clock,
+// mode and timing it needs. The bus is reconfigured for each transaction, so
+// fast devices (flash, displays) can run at tens of MHz on the same bus as
+// slow sensors. Each entry gives a SPI_DEV_<name> handle for spi_dev_read() etc.
+//   name          device name, also used to select the device from the CLI
+//   bus           SPI bus the device is attached to, 0 or 1
+//   cs            master pin number for the chip select line connected to the device
+//   max_khz       max SPI clock the device supports, the bus runs at the nearest clock at or below it
+//   cpol, cpha    SPI mode - clock polarity and phase
+//   burst         max bytes per transaction, longer writes are split into bursts (0 for no limit)
+//   cs_gap_us     min time chip select stays de-asserted between transactions
+//   read_delay_us delay between the register address and the data of a read
+#define SPI_DEVICES(X) \
+    /* name    bus  cs                   max_khz  cpol  cpha  burst  cs_gap_us  read_delay_us */ \
+    X(BME280,  0,   SPI0_CS_PIN_DEFAULT, 10000,   0,    0,    0,     0,         0)
+
+#define SPI_DEV_ENUM(name, bus, cs, max_khz, cpol, cpha, burst, cs_gap_us, read_delay_us) SPI_DEV_##name,
+typedef enum spi_dev_t {
+    SPI_DEVICES(SPI_DEV_ENUM)
+    SPI_NUM_DEVICES
+} spi_dev_t;
+
+// SPI device descriptor, one for each SPI_DEVICES entry
+typedef struct spi_dev_desc_t {
+    const char *name;
+    uint8_t bus;
+    uint8_t cs_pin;
+    uint32_t max_khz;
+    uint8_t cpol;
+    uint8_t cpha;
+    uint16_t burst;
+    uint32_t cs_gap_us;
+    uint32_t read_delay_us;
+} spi_dev_desc_t;
+
+// SPI device registry, indexed by spi_dev_t
+extern const spi_dev_desc_t spi_devices[SPI_NUM_DEVICES];
+
+// SPI device statistics
+typedef struct spi_dev_stats_t {
+    uint32_t xfers;         // transactions completed
+    uint32_t bytes;         // bytes transferred (both directions at once)
+    uint32_t timeouts;      // transactions that timed out
+    uint32_t reconfigs;     // times the bus clock/mode had to be changed for this device
+    uint32_t clock_khz;     // actual bus clock the device runs at, 0 until its first transaction
+    uint64_t bus_us;        // time the device has had chip select asserted
+} spi_dev_stats_t;
+
+// global SPI device statistics, indexed by spi_dev_t
+extern spi_dev_stats_t spi_dev_stats[SPI_NUM_DEVICES];
+
 // Target/peripheral device settings -
-// used to define a target device by the chip select it is attached to, and the
-// register address that can be interrogated for the expected device ID to
-// validate communication
-#define SPI0_TARGET_DEV_0_CS     SPI0_CS_PIN_DEFAULT
+// used to define a target device on SPI0, and the register address that can be
+// interrogated for the expected device ID to validate communication
+#define SPI0_TARGET_DEV_0        SPI_DEV_BME280
 #define SPI0_TARGET_DEV_0_ID     0x60
 #define SPI0_TARGET_DEV_0_ID_REG 0xD0
-// more TARGET_DEV entries and associated chip selects can be added to expand this list
-
-// global SPI0 mutex
-extern SemaphoreHandle_t spi0_mutex;
+// more TARGET_DEV entries can be added to expand this list
+
+// SPI transaction descriptor. Transactions are queued by spi_dev_transfer() and
+// run back to back by DMA, each with its own device's chip select, clock and
+// timing, so that devices share a bus without the callers holding it. A
+// transaction can be split in two phases (e.g. a register address, then the
+// data) with chip select held asserted for a delay in between.
+typedef struct spi_xfer_t {
+    const uint8_t *tx_buf;      // bytes to send, NULL to send zeros (read only)
+    uint8_t *rx_buf;            // buffer for the bytes received, NULL to discard them (write only)
+    uint16_t len;               // total number of bytes to transfer
+    uint16_t split;             // bytes in the first phase, 0 to transfer everything in one go
+    uint32_t split_delay_us;    // delay between the two phases
+    // transaction engine state, set by spi_dev_transfer()
+    spi_dev_t dev;              // target device
+    struct spi_xfer_t *next;    // next transaction in the queue
+    TaskHandle_t task;          // task waiting for the transaction
+    volatile bool done;         // set once the transaction has completed
+    volatile int result;        // bytes transferred
+} spi_xfer_t;
 
 /**
 * @brief Initialize SPI bus 0.
 *
 * Initialization routine for the SPI0 peripheral using the settings defined
-* above.
+* above, including the chip selects of the SPI_DEVICES on bus 0.
 *
 * @param none
 *
@@ -488,34 +740,75 @@ extern SemaphoreHandle_t spi0_mutex;
 void spi0_init(void);
 
 /**
-* @brief Write a byte into a SPI0 register address.
+* @brief Initialize SPI bus 1.
+*
+* Initialization routine for the SPI1 peripheral using the settings defined
+* above, including the chip selects of the SPI_DEVICES on bus 1.
+*
+* @param none
+*
+* @return nothing
+*/
+void spi1_init(void);
+
+/**
+* @brief Run a SPI transaction with a device.
+*
+* Queues the transaction behind any others on the device's bus and blocks the
+* calling task until it has completed - the bus is set to the device's clock
+* and mode, the bytes are moved by DMA and the delays are timed by alarms, so
+* the caller sleeps instead of spinning. If the scheduler is not running yet
+* (drivers initialized at boot), the transaction is run with blocking
+* transfers instead.
+*
+* @param dev  target device, SPI_DEV_<name> from SPI_DEVICES
+* @param xfer pointer to the transaction descriptor, must stay valid until the call returns
+*
+* @return number of bytes transferred, 0 if the transaction timed out or the bus is not enabled
+*/
+int spi_dev_transfer(spi_dev_t dev, spi_xfer_t *xfer);
+
+/**
+* @brief Write bytes into successive SPI device registers.
 *
-* Writes a single byte to a target device identified by the chip select pin, into
-* the register at the given address.
+* Writes the data to a device starting at the given register address (with the
+* MSB clear, which signifies a write). Writes longer than the device's burst
+* limit are split into several transactions, each starting at the register
+* address following the bytes already written.
 *
-* @param cs_pin    master pin number for the chip select line connected to target device
-* @param reg_addr  8-bit register address to write to
-* @param data_byte single-byte of data to write into target register    
+* @param dev      target device, SPI_DEV_<name> from SPI_DEVICES
+* @param reg_addr 8-bit register address to write to
+* @param data     pointer to the bytes to write
+* @param len      number of bytes to write
 *
-* @return 1 if success, 0 if failure
+* @return number of bytes written
 */
-int spi0_write_register(uint8_t cs_pin, uint8_t reg_addr, uint8_t data_byte);
+int spi_dev_write(spi_dev_t dev, uint8_t reg_addr, const uint8_t *data, uint16_t len);
 
 /**
-* @brief Read byte(s) from a SPI0 register address.
+* @brief Read bytes from successive SPI device registers.
 *
-* Reads one or more bytes from a target device identified by the chip select pin,
-* from the given register address. Multiple successive registers can be read in
-* series by specifying the read length. This is a blocking read.
+* Reads one or more bytes from a device, starting at the given register address
+* (sent with the MSB set, which signifies a read). The calling task blocks until
+* the read has completed, see spi_dev_transfer().
 *
-* @param cs_pin   master pin number for the chip select line connected to target device
+* @param dev      target device, SPI_DEV_<name> from SPI_DEVICES
 * @param reg_addr 8-bit register address to read from
 * @param read_buf pointer to the byte array to store the data read from target
 * @param len      number of successive register locations to read from
 *
 * @return number of bytes read
 */
-int spi0_read_registers(uint8_t cs_pin, uint8_t reg_addr, uint8_t *read_buf, uint16_t len);
+int spi_dev_read(spi_dev_t dev, uint8_t reg_addr, uint8_t *read_buf, uint16_t len);
+
+/**
+* @brief Look up a SPI device by name.
+*
+* @param name device name from SPI_DEVICES, not case sensitive
+*
+* @return device handle, SPI_NUM_DEVICES if there is no such device
+*/
+spi_dev_t spi_dev_find(const char *name);
 
 
 /************************
@@ -644,6 +937,12 @@ typedef enum {POWERON,   // normal power-on reset
 // Global reset reason type - set at boot
 extern reset_reason_t last_reset_reason;
 
+// Persistent RAM - variables declared with PERSISTENT_RAM(name) are left out of
+// the RAM cleared at boot, so they keep their contents through a watchdog or
+// program-requested reset (but not a power cycle). Check a magic number before
+// trusting them.
+#define PERSISTENT_RAM(name) __uninitialized_ram(name)
+
 /**
 * @brief Get the reset reason.
 *
@@ -795,12 +1094,24 @@ uint32_t read_chip_register(uint32_t reg_addr);
 // Onboard Flash Settings
 #define FLASH0_FS_SIZE       (256 * 1024)       // size of the 'flash0' filesystem (intended for littlefs to manage)
 #define PATHNAME_MAX_LEN      32                // maximum string length of path+filename on the filesystem
-#define FILE_SIZE_MAX         BUF_OUT_SIZE      // maximum size of a single file in bytes - set to shell output buffer size so entire files can be dumped
+#define FILE_SIZE_MAX         BUF_OUT_SIZE      // maximum size of a single-shot file transfer (dumpfile/readfile/etc) - set to shell output buffer size
+#define FLASH0_FILE_MAX       (FLASH0_FS_SIZE / 2) // maximum size of a single file in bytes - larger files can be streamed through open file handles
+#define FLASH0_OPEN_FILES_MAX 4                 // maximum number of files that can be held open by storagemanager at once
 #define FLASH0_BLOCK_SIZE     FLASH_SECTOR_SIZE // "block" size in littlefs terms is "sector" size in RP2040 terms
 #define FLASH0_PAGE_SIZE      FLASH_PAGE_SIZE   // littlefs page size is equal to flash page size
-#define FLASH0_CACHE_SIZE     FLASH_PAGE_SIZE   // read/write cache sizes are equal to a page
-#define FLASH0_LOOKAHEAD_SIZE 32                // lookahead buffer size for tracking block allocation
 #define FLASH0_BLOCK_CYCLES   500               // max number of erase cycles for a block (for wear leveling)
+// littlefs cache/lookahead geometry - these can be overridden at build time, i.e.
+// add_definitions(-DFLASH0_CACHE_SIZE=1024) in the top-level CMakeLists.txt.
+// Use 'flash0 bench' to compare geometries and 'flash0 iostat' to see flash traffic.
+#ifndef FLASH0_READ_SIZE
+#define FLASH0_READ_SIZE      1                 // min read size, cache_size must be a multiple of it
+#endif
+#ifndef FLASH0_CACHE_SIZE
+#define FLASH0_CACHE_SIZE     FLASH_PAGE_SIZE   // read/write cache size, a multiple of the page size and a factor of the block size
+#endif
+#ifndef FLASH0_LOOKAHEAD_SIZE
+#define FLASH0_LOOKAHEAD_SIZE 32                // lookahead buffer size for tracking block allocation (multiple of 8 bytes)
+#endif
 
 // Onboard flash usage detail structure
 typedef struct flash_usage_t {
@@ -810,9 +1121,21 @@ typedef struct flash_usage_t {
     int flash_free_size;
 } flash_usage_t;
 
+// Onboard flash I/O counters - accumulated by the littlefs block device functions
+typedef struct flash_io_stats_t {
+    uint32_t reads;
+    uint32_t read_bytes;
+    uint32_t progs;
+    uint32_t prog_bytes;
+    uint32_t erases;
+} flash_io_stats_t;
+
 // global onboard flash mutex
 extern SemaphoreHandle_t onboard_flash_mutex;
 
+// global onboard flash I/O counters
+extern flash_io_stats_t onboard_flash_io_stats;
+
 /**
 * @brief Initialize onboard flash memory.
 *
@@ -922,6 +1245,45 @@ flash_usage_t onboard_flash_usage(void);
 // ACD conversion
 #define ADC_CONV_FACT (3.3f / (1 << 12)) // 3.3V reference, 12-bit resolution
 
+// ADC streaming settings - the initialized channels are sampled round-robin by
+// the free-running ADC, and DMA moves the samples into a double buffer (see
+// adc_stream_start())
+#define ADC_STREAM_RATE_HZ       10000     // default samples per second, per channel
+#define ADC_STREAM_BLOCK_FRAMES  256       // samples per channel in each half of the double buffer
+#define ADC_STREAM_DECIMATION    8         // raw samples averaged into each sample of the stream ring
+#define ADC_STREAM_RING_SAMPLES  256       // decimated samples kept per channel for consumers
+#define ADC_STREAM_CONSUMERS_MAX 4         // tasks that can subscribe to the stream
+#define ADC_STREAM_CHANNELS_MAX  3         // ADC input channels that can be streamed (ADC0-ADC2)
+#define ADC_DMA_IRQ              DMA_IRQ_1 // DMA interrupt used by the ADC stream, shared with the SPI engine
+
+#if (ADC_STREAM_BLOCK_FRAMES % ADC_STREAM_DECIMATION) != 0
+#error "ADC_STREAM_BLOCK_FRAMES must be a multiple of ADC_STREAM_DECIMATION"
+#endif
+
+// ADC stream statistics for a channel, in raw counts (see ADC_CONV_FACT), over the last block
+typedef struct adc_stream_chan_stats_t {
+    uint16_t min;
+    uint16_t max;
+    uint16_t mean;
+    uint16_t last;              // most recent sample
+} adc_stream_chan_stats_t;
+
+// ADC stream statistics
+typedef struct adc_stream_stats_t {
+    bool running;               // true while the ADC is streaming
+    uint32_t rate_hz;           // sample rate per channel set by the ADC clock divider
+    uint32_t measured_rate_hz;  // sample rate per channel measured over the last block
+    uint32_t blocks;            // blocks processed
+    uint32_t overruns;          // blocks dropped or overwritten before they were processed
+    uint32_t fifo_overflows;    // times the ADC FIFO overflowed (DMA fell behind)
+    uint8_t num_channels;       // channels being sampled
+    uint8_t channels[ADC_STREAM_CHANNELS_MAX];                // ADC channel numbers, in sampling order
+    adc_stream_chan_stats_t chan[ADC_STREAM_CHANNELS_MAX];    // indexed by ADC channel number
+} adc_stream_stats_t;
+
+// global ADC stream statistics
+extern adc_stream_stats_t adc_stream_stats;
+
 // global ADC mutex
 extern SemaphoreHandle_t adc_mutex;
 
@@ -947,12 +1309,106 @@ void adcs_init(void);
 * may share the same ADC block internal to the MCU. Here, "channel" refers to
 * a specific GPIO/pin given in the settings above.
 *
+* While the ADC is streaming, the latest streamed sample of the channel is
+* returned instead of starting a conversion.
+*
 * @param adc_channel channel number of the ADC to read
 *
 * @return value of the analog-to-digital conversion (voltage reading)
 */
 float read_adc(int adc_channel);
 
+/**
+* @brief Start streaming the ADC.
+*
+* Samples every initialized channel (ADCn_INIT) in turn with the ADC free
+* running at the given rate, and has DMA fill the two halves of a double buffer
+* one after the other. Each time a half (block) is full, block_ready is called
+* from the DMA interrupt, and adc_stream_process() should then be called from a
+* task to hand the block on. Restarts the stream if it is already running.
+*
+* @param rate_hz     samples per second, per channel
+* @param block_ready callback from the DMA interrupt when a block is ready, may be NULL
+*
+* @return true if the stream was started, false if the rate is out of range or no channels are initialized
+*/
+bool adc_stream_start(uint32_t rate_hz, void (*block_ready)(BaseType_t *higher_priority_woken));
+
+/**
+* @brief Change the sample rate of the ADC stream.
+*
+* Restarts the stream at the new rate with the same block_ready callback, or
+* starts it again if it was stopped. The stream stats are reset.
+*
+* @param rate_hz samples per second, per channel
+*
+* @return true if the stream was restarted, false if the rate is out of range
+*/
+bool adc_stream_set_rate(uint32_t rate_hz);
+
+/**
+* @brief Stop streaming the ADC.
+*
+* Stops the ADC and its DMA, after which read_adc() does single conversions
+* again.
+*
+* @param none
+*
+* @return nothing
+*/
+void adc_stream_stop(void);
+
+/**
+* @brief Process the next block of streamed samples.
+*
+* Averages every ADC_STREAM_DECIMATION samples of each channel into the stream
+* ring, updates adc_stream_stats, and notifies the subscribed tasks (on
+* NOTIFY_INDEX_ADC). Blocks that are not processed before DMA comes back round
+* to their half of the buffer are counted as overruns.
+*
+* @param none
+*
+* @return true if a block was processed, false if none was ready
+*/
+bool adc_stream_process(void);
+
+/**
+* @brief Subscribe a task to the ADC stream.
+*
+* The task is notified on NOTIFY_INDEX_ADC each time new decimated samples are
+* added to the stream ring, see adc_stream_read().
+*
+* @param task task to notify
+*
+* @return true if subscribed, false if there are already ADC_STREAM_CONSUMERS_MAX subscribers
+*/
+bool adc_stream_subscribe(TaskHandle_t task);
+
+/**
+* @brief Unsubscribe a task from the ADC stream.
+*
+* @param task task to stop notifying
+*
+* @return nothing
+*/
+void adc_stream_unsubscribe(TaskHandle_t task);
+
+/**
+* @brief Read decimated samples of a channel from the stream ring.
+*
+* Each consumer keeps its own read position, starting at 0. A consumer that
+* falls more than ADC_STREAM_RING_SAMPLES behind skips ahead to the oldest
+* sample still in the ring.
+*
+* @param adc_channel ADC channel number to read
+* @param buf         buffer for the samples, in raw counts (see ADC_CONV_FACT)
+* @param max_samples max number of samples to read
+* @param read_pos    pointer to the consumer's read position, advanced past the samples read
+*
+* @return number of samples read
+*/
+size_t adc_stream_read(uint8_t adc_channel, uint16_t *buf, size_t max_samples, uint32_t *read_pos);
+
 
 /************************
  * USB (TinyUSB) CDC
@@ -990,6 +1446,16 @@ typedef struct usb_iface_t {
 // global USB mutex
 extern SemaphoreHandle_t usb_mutex;
 
+// CLI over USB transmit statistics
+typedef struct cli_usb_stats_t {
+    uint32_t tx_waits;      // times a writer blocked waiting for the host to take data
+    uint32_t tx_timeouts;   // writes that gave up before all characters were sent
+    uint64_t tx_wait_us;    // time writers spent blocked waiting on the host
+} cli_usb_stats_t;
+
+// global CLI over USB transmit statistics
+extern cli_usb_stats_t cli_usb_stats;
+
 /**
 * @brief Initialize the serial number used for USB device ID.
 *
@@ -1054,6 +1520,21 @@ void usb_write_bytes(struct usb_iface_t *usb_iface);
 */
 int cli_usb_putc(char tx_char);
 
+/**
+* @brief Write a block of characters to CLI over USB.
+*
+* Write a burst of characters to the USB CDC ID used for the Command Line
+* Interface, taking the USB mutex once per packet-sized chunk and flushing
+* once per chunk rather than once per character. When the CDC TX FIFO is full
+* the calling task blocks until TinyUSB reports a completed transfer to the host.
+*
+* @param tx_data pointer to the characters to write
+* @param tx_len  number of characters to write
+*
+* @return number of characters written (less than tx_len if not connected or the host stops reading)
+*/
+int cli_usb_write(const char *tx_data, size_t tx_len);
+
 /**
 * @brief Read character from CLI over USB.
 *
@@ -1067,6 +1548,15 @@ int cli_usb_putc(char tx_char);
 */
 char cli_usb_getc(void);
 
+/**
+* @brief Get the number of characters waiting to be read from the CLI over USB.
+*
+* @param none
+*
+* @return number of received characters not yet read with cli_usb_getc()
+*/
+uint32_t cli_usb_rx_pending(void);
+
 
 /**************************
  * Wireless (CYW43 WiFi/BT)
@@ -8,26 +8,65 @@
  * @author Cavin McKinley (MCKNLY LLC)
  *
  * @date 02-14-2024
- * 
+ *
  * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
  *            Released under the MIT License
- * 
+ *
  * SPDX-License-Identifier: MIT
  ******************************************************************************/
 
+#include <string.h>
 #include "hardware_config.h"
+#include "rtos_utils.h"
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "semphr.h"
+#include "task.h"
+
+#define ADC_CLOCK_CYCLES_MIN  96 // ADC clock cycles per conversion, sets the max sample rate
+#define ADC_STREAM_RING_BLOCK (ADC_STREAM_BLOCK_FRAMES / ADC_STREAM_DECIMATION) // decimated samples per channel in each block
 
 // global ADC mutex
 SemaphoreHandle_t adc_mutex;
 
+// global ADC stream statistics
+adc_stream_stats_t adc_stream_stats;
+
+// ADC stream state. The data DMA channel fills one half of the double buffer,
+// then chains to a control channel that writes the address of the other half
+// back into it and restarts it - so DMA alternates between the halves with no
+// CPU involved, however late the interrupts are. The completion interrupt marks
+// the full half as ready, and adc_stream_process() takes it, decimates it into
+// the stream ring and releases it. Protected by a hardware spin lock, since it
+// is touched by tasks on either core and by the DMA interrupt.
+static uint16_t adc_stream_buf[2][ADC_STREAM_BLOCK_FRAMES * ADC_STREAM_CHANNELS_MAX];
+static uint16_t *adc_stream_buf_addr[2] __attribute__((aligned(8))) = {adc_stream_buf[0], adc_stream_buf[1]}; // read by the control channel in a ring
+static uint16_t adc_stream_ring[ADC_STREAM_CHANNELS_MAX][ADC_STREAM_RING_SAMPLES];
+static volatile uint32_t adc_stream_ring_pos;       // decimated samples written to the ring, per channel
+static int adc_stream_dma_data = -1;                // DMA channel moving samples from the ADC FIFO
+static int adc_stream_dma_ctrl = -1;                // DMA channel pointing the data channel at the next half
+static uint32_t adc_stream_block_len;               // samples in each half (frames x channels)
+static uint32_t adc_stream_block_us;                // time DMA takes to fill a half
+static uint8_t adc_stream_ready;                    // bit for each half that is full and waiting to be processed
+static uint32_t adc_stream_seq;                     // blocks DMA has completed, including ones missed by the interrupt
+static uint32_t adc_stream_ready_seq[2];            // adc_stream_seq when each half was completed
+static int adc_stream_in_use = -1;                  // half being processed, -1 if none
+static uint64_t adc_stream_last_us;                 // time of the last completion interrupt, or of the start
+static void (*adc_stream_block_ready)(BaseType_t *higher_priority_woken);
+static TaskHandle_t adc_stream_consumers[ADC_STREAM_CONSUMERS_MAX];
+static spin_lock_t *adc_lock;
+
+static void on_adc_dma_irq(void);
+
 
 void adcs_init(void) {
     // create ADC mutex
-    adc_mutex = xSemaphoreCreateMutex();
+    adc_mutex = MUTEX_CREATE(adc_mutex);
 
     adc_init();
     if (ADC0_INIT)
@@ -36,17 +75,350 @@ void adcs_init(void) {
         adc_gpio_init(ADC1_GPIO);
     if (ADC2_INIT)
         adc_gpio_init(ADC2_GPIO);
+
+    // set up streaming - DMA channels and their completion interrupt, claimed
+    // here at boot so the interrupt is handled on the same core as the SPI engine's
+    adc_lock = spin_lock_init(spin_lock_claim_unused(true));
+    adc_stream_dma_data = dma_claim_unused_channel(true);
+    adc_stream_dma_ctrl = dma_claim_unused_channel(true);
+    irq_add_shared_handler(ADC_DMA_IRQ, on_adc_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(ADC_DMA_IRQ, true);
 }
 
 float read_adc(int adc_channel) {
     uint16_t result = 0;
+
     if(xSemaphoreTake(adc_mutex, 10) == pdTRUE) {
-        // select ADC input pin/channel (0-2)
-        adc_select_input(adc_channel);
-        // read raw value
-        result = adc_read();
+        if (adc_stream_stats.running) {
+            // the ADC is free running, don't interrupt it
+            if (adc_channel >= 0 && adc_channel < ADC_STREAM_CHANNELS_MAX) {
+                result = adc_stream_stats.chan[adc_channel].last;
+            }
+        }
+        else {
+            // select ADC input pin/channel (0-2)
+            adc_select_input(adc_channel);
+            // read raw value
+            result = adc_read();
+        }
         xSemaphoreGive(adc_mutex);
     }
     // return floating-point voltage
     return result * ADC_CONV_FACT;
-}
\ No newline at end of file
+}
+
+// half of the buffer the data channel is filling. Just after a half is full the
+// channel briefly points at its end, until the control channel has moved it on
+static int adc_stream_writing_half(void) {
+    uintptr_t addr = dma_hw->ch[adc_stream_dma_data].write_addr;
+    uintptr_t half0_end = (uintptr_t)&adc_stream_buf[0][adc_stream_block_len];
+    uintptr_t half1 = (uintptr_t)adc_stream_buf[1];
+    uintptr_t half1_end = (uintptr_t)&adc_stream_buf[1][adc_stream_block_len];
+
+    return ((addr >= half1 && addr < half1_end) || addr == half0_end) ? 1 : 0;
+}
+
+// DMA interrupt handler, shared with any other users of ADC_DMA_IRQ
+static void on_adc_dma_irq(void) {
+    BaseType_t higher_priority_woken = pdFALSE;
+    bool block_done = false;
+    uint32_t lock_state;
+
+    if (adc_stream_dma_data < 0 || !dma_irqn_get_channel_status(ADC_DMA_IRQ - DMA_IRQ_0, adc_stream_dma_data)) return;
+    dma_irqn_acknowledge_channel(ADC_DMA_IRQ - DMA_IRQ_0, adc_stream_dma_data);
+
+    lock_state = spin_lock_blocking(adc_lock);
+    if (adc_stream_stats.running) {
+        uint64_t now_us = time_us_64();
+        uint32_t elapsed_us = (uint32_t)(now_us - adc_stream_last_us);
+        // the interrupt can be held off (e.g. by flash writes) while DMA carries
+        // on, so work out from the time how many blocks have completed
+        uint32_t completed = (elapsed_us + (adc_stream_block_us / 2)) / adc_stream_block_us;
+        int writing = adc_stream_writing_half();
+        int half = writing ^ 1;
+
+        if (completed == 0) completed = 1;
+        if (completed > 1) adc_stream_stats.overruns += completed - 1; // never seen by the CPU
+        adc_stream_seq += completed;
+
+        // DMA is filling the other half again - lost if it was never taken
+        if (adc_stream_ready & (1u << writing)) {
+            adc_stream_stats.overruns++;
+            adc_stream_ready &= ~(1u << writing);
+        }
+        adc_stream_ready |= (1u << half);
+        adc_stream_ready_seq[half] = adc_stream_seq;
+
+        if (adc_hw->fcs & ADC_FCS_OVER_BITS) {
+            adc_stream_stats.fifo_overflows++;
+            hw_set_bits(&adc_hw->fcs, ADC_FCS_OVER_BITS); // write 1 to clear
+        }
+        if (elapsed_us > 0) {
+            adc_stream_stats.measured_rate_hz = (uint32_t)((completed * ADC_STREAM_BLOCK_FRAMES * 1000000ULL) / elapsed_us);
+        }
+        adc_stream_last_us = now_us;
+        block_done = true;
+    }
+    spin_unlock(adc_lock, lock_state);
+
+    if (block_done && adc_stream_block_ready != NULL) {
+        adc_stream_block_ready(&higher_priority_woken);
+        portYIELD_FROM_ISR(higher_priority_woken);
+    }
+}
+
+// configure the data channel to fill the first half, then chain to the control
+// channel, which restarts it on the next half from the address ring
+static void adc_stream_dma_config(void) {
+    dma_channel_config data_config = dma_channel_get_default_config(adc_stream_dma_data);
+    channel_config_set_transfer_data_size(&data_config, DMA_SIZE_16);
+    channel_config_set_read_increment(&data_config, false);
+    channel_config_set_write_increment(&data_config, true);
+    channel_config_set_dreq(&data_config, DREQ_ADC);
+    channel_config_set_chain_to(&data_config, adc_stream_dma_ctrl);
+    dma_channel_configure(adc_stream_dma_data, &data_config, adc_stream_buf[0], &adc_hw->fifo, adc_stream_block_len, false);
+
+    // one address per restart, writing the trigger alias reloads the transfer count too
+    dma_channel_config ctrl_config = dma_channel_get_default_config(adc_stream_dma_ctrl);
+    channel_config_set_transfer_data_size(&ctrl_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl_config, true);
+    channel_config_set_write_increment(&ctrl_config, false);
+    channel_config_set_ring(&ctrl_config, false, 3); // wrap the reads around the 8-byte address array
+    dma_channel_configure(adc_stream_dma_ctrl, &ctrl_config, &dma_hw->ch[adc_stream_dma_data].al2_write_addr_trig,
+                          &adc_stream_buf_addr[1], 1, false);
+}
+
+bool adc_stream_start(uint32_t rate_hz, void (*block_ready)(BaseType_t *higher_priority_woken)) {
+    uint32_t adc_clock_hz = clock_get_hz(clk_adc);
+    uint32_t lock_state;
+    uint32_t total_rate_hz;
+    uint32_t clock_cycles;
+    uint8_t channel_mask = 0;
+    uint8_t num_channels = 0;
+    uint8_t channels[ADC_STREAM_CHANNELS_MAX];
+
+    // the initialized channels, in the order the round robin samples them
+    const bool channel_init[ADC_STREAM_CHANNELS_MAX] = {ADC0_INIT, ADC1_INIT, ADC2_INIT};
+    for (uint8_t ch = 0; ch < ADC_STREAM_CHANNELS_MAX; ch++) {
+        if (!channel_init[ch]) continue;
+        channels[num_channels++] = ch;
+        channel_mask |= (1u << ch);
+    }
+    if (adc_lock == NULL || num_channels == 0 || rate_hz == 0) return false;
+
+    // the ADC clock divider sets the time between conversions, across all channels
+    total_rate_hz = rate_hz * num_channels;
+    clock_cycles = adc_clock_hz / total_rate_hz;
+    if (clock_cycles < ADC_CLOCK_CYCLES_MIN || clock_cycles > 0xFFFF) return false;
+
+    adc_stream_stop();
+
+    // single conversions are done with the mutex held, wait for any to finish
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        xSemaphoreTake(adc_mutex, portMAX_DELAY);
+    }
+
+    lock_state = spin_lock_blocking(adc_lock);
+    memset(&adc_stream_stats, 0, sizeof(adc_stream_stats));
+    adc_stream_stats.rate_hz = adc_clock_hz / clock_cycles / num_channels;
+    adc_stream_stats.num_channels = num_channels;
+    memcpy(adc_stream_stats.channels, channels, num_channels);
+    adc_stream_block_len = ADC_STREAM_BLOCK_FRAMES * num_channels;
+    adc_stream_block_us = (uint32_t)((ADC_STREAM_BLOCK_FRAMES * 1000000ULL) / adc_stream_stats.rate_hz);
+    adc_stream_ready = 0;
+    adc_stream_seq = 0;
+    adc_stream_in_use = -1;
+    adc_stream_last_us = time_us_64();
+    adc_stream_ring_pos = 0;
+    adc_stream_block_ready = block_ready;
+    adc_stream_stats.running = true;
+    spin_unlock(adc_lock, lock_state);
+
+    // samples go into the FIFO as 12-bit values, and DMA takes each one as soon as it arrives
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_fifo_drain();
+    adc_set_clkdiv((float)(clock_cycles - 1));
+    adc_select_input(channels[0]);
+    adc_set_round_robin(channel_mask);
+
+    adc_stream_dma_config();
+    dma_irqn_set_channel_enabled(ADC_DMA_IRQ - DMA_IRQ_0, adc_stream_dma_data, true);
+    dma_channel_start(adc_stream_dma_data);
+    adc_run(true);
+
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        xSemaphoreGive(adc_mutex);
+    }
+
+    return true;
+}
+
+bool adc_stream_set_rate(uint32_t rate_hz) {
+    return adc_stream_start(rate_hz, adc_stream_block_ready);
+}
+
+void adc_stream_stop(void) {
+    uint32_t lock_state;
+
+    if (adc_lock == NULL || !adc_stream_stats.running) return;
+
+    // wait for any single conversion to finish
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        xSemaphoreTake(adc_mutex, portMAX_DELAY);
+    }
+
+    lock_state = spin_lock_blocking(adc_lock);
+    adc_stream_stats.running = false;
+    spin_unlock(adc_lock, lock_state);
+
+    adc_run(false);
+    adc_set_round_robin(0);
+
+    // clear the enables before aborting, so that neither channel can trigger the
+    // other on the way out
+    dma_irqn_set_channel_enabled(ADC_DMA_IRQ - DMA_IRQ_0, adc_stream_dma_data, false);
+    hw_clear_bits(&dma_hw->ch[adc_stream_dma_ctrl].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);
+    hw_clear_bits(&dma_hw->ch[adc_stream_dma_data].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);
+    dma_channel_abort(adc_stream_dma_ctrl);
+    dma_channel_abort(adc_stream_dma_data);
+    dma_irqn_acknowledge_channel(ADC_DMA_IRQ - DMA_IRQ_0, adc_stream_dma_data);
+
+    adc_fifo_setup(false, false, 0, false, false);
+    adc_fifo_drain();
+    adc_set_clkdiv(0);
+
+    // single conversions can use the ADC again
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        xSemaphoreGive(adc_mutex);
+    }
+}
+
+bool adc_stream_process(void) {
+    uint32_t lock_state;
+    const uint16_t *block;
+    uint8_t num_channels;
+    uint32_t sums[ADC_STREAM_CHANNELS_MAX] = {0};
+    uint32_t decim_sums[ADC_STREAM_CHANNELS_MAX] = {0};
+    adc_stream_chan_stats_t chan[ADC_STREAM_CHANNELS_MAX];
+    uint32_t ring_pos;
+    uint32_t seq = 0;
+    bool overwritten;
+    int half = -1;
+
+    if (adc_lock == NULL) return false;
+
+    // take the full half - there is only ever one, as an older one is dropped as an overrun
+    lock_state = spin_lock_blocking(adc_lock);
+    if (adc_stream_stats.running && adc_stream_in_use < 0) {
+        for (int h = 0; h < 2; h++) {
+            if (adc_stream_ready & (1u << h)) half = h;
+        }
+        if (half >= 0) {
+            adc_stream_ready &= ~(1u << half);
+            adc_stream_in_use = half;
+            seq = adc_stream_ready_seq[half];
+        }
+    }
+    spin_unlock(adc_lock, lock_state);
+    if (half < 0) return false;
+
+    block = adc_stream_buf[half];
+    num_channels = adc_stream_stats.num_channels;
+    ring_pos = adc_stream_ring_pos;
+    for (int c = 0; c < num_channels; c++) {
+        chan[c].min = 0xFFFF;
+        chan[c].max = 0;
+    }
+
+    // samples are interleaved one per channel in sampling order. average every
+    // ADC_STREAM_DECIMATION of each channel into the ring
+    for (uint32_t frame = 0; frame < ADC_STREAM_BLOCK_FRAMES; frame++) {
+        for (int c = 0; c < num_channels; c++) {
+            uint16_t sample = block[(frame * num_channels) + c] & 0x0FFF;
+            uint8_t ch = adc_stream_stats.channels[c];
+            if (sample < chan[c].min) chan[c].min = sample;
+            if (sample > chan[c].max) chan[c].max = sample;
+            sums[c] += sample;
+            decim_sums[c] += sample;
+            chan[c].last = sample;
+            if ((frame + 1) % ADC_STREAM_DECIMATION == 0) {
+                adc_stream_ring[ch][(ring_pos + (frame / ADC_STREAM_DECIMATION)) % ADC_STREAM_RING_SAMPLES] =
+                    decim_sums[c] / ADC_STREAM_DECIMATION;
+                decim_sums[c] = 0;
+            }
+        }
+    }
+
+    // DMA only comes back round to this half once the other one is full - if it
+    // has, the samples may have been overwritten while they were processed, so
+    // drop them rather than hand them on
+    lock_state = spin_lock_blocking(adc_lock);
+    adc_stream_in_use = -1;
+    overwritten = (adc_stream_writing_half() == half) || (adc_stream_seq - seq >= 2);
+    if (overwritten) {
+        adc_stream_stats.overruns++;
+    }
+    else {
+        adc_stream_ring_pos = ring_pos + ADC_STREAM_RING_BLOCK;
+        for (int c = 0; c < num_channels; c++) {
+            chan[c].mean = sums[c] / ADC_STREAM_BLOCK_FRAMES;
+            adc_stream_stats.chan[adc_stream_stats.channels[c]] = chan[c];
+        }
+        adc_stream_stats.blocks++;
+    }
+    spin_unlock(adc_lock, lock_state);
+    if (overwritten) return true;
+
+    // hand the new samples on to the consumers
+    for (int i = 0; i < ADC_STREAM_CONSUMERS_MAX; i++) {
+        TaskHandle_t task = adc_stream_consumers[i];
+        if (task != NULL) xTaskNotifyGiveIndexed(task, NOTIFY_INDEX_ADC);
+    }
+
+    return true;
+}
+
+bool adc_stream_subscribe(TaskHandle_t task) {
+    bool subscribed = false;
+
+    taskENTER_CRITICAL();
+    for (int i = 0; i < ADC_STREAM_CONSUMERS_MAX && !subscribed; i++) {
+        if (adc_stream_consumers[i] == task) subscribed = true;
+    }
+    for (int i = 0; i < ADC_STREAM_CONSUMERS_MAX && !subscribed; i++) {
+        if (adc_stream_consumers[i] == NULL) {
+            adc_stream_consumers[i] = task;
+            subscribed = true;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return subscribed;
+}
+
+void adc_stream_unsubscribe(TaskHandle_t task) {
+    taskENTER_CRITICAL();
+    for (int i = 0; i < ADC_STREAM_CONSUMERS_MAX; i++) {
+        if (adc_stream_consumers[i] == task) adc_stream_consumers[i] = NULL;
+    }
+    taskEXIT_CRITICAL();
+}
+
+size_t adc_stream_read(uint8_t adc_channel, uint16_t *buf, size_t max_samples, uint32_t *read_pos) {
+    uint32_t write_pos = adc_stream_ring_pos;
+    size_t num_samples = 0;
+
+    if (adc_channel >= ADC_STREAM_CHANNELS_MAX) return 0;
+
+    // skip ahead past samples that have been overwritten, or are about to be by
+    // the next block
+    if (write_pos - *read_pos > ADC_STREAM_RING_SAMPLES - ADC_STREAM_RING_BLOCK) {
+        *read_pos = write_pos - (ADC_STREAM_RING_SAMPLES - ADC_STREAM_RING_BLOCK);
+    }
+    while (*read_pos != write_pos && num_samples < max_samples) {
+        buf[num_samples++] = adc_stream_ring[adc_channel][*read_pos % ADC_STREAM_RING_SAMPLES];
+        (*read_pos)++;
+    }
+
+    return num_samples;
+}
@@ -16,6 +16,9 @@
  ******************************************************************************/
 
 #include "hardware_config.h"
+#include "services.h"
+#include "service_log.h"
+#include "rtos_utils.h"
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "FreeRTOS.h"
@@ -43,11 +46,13 @@ void gpio_process(uint gpio, uint32_t event_mask) {
     gpio_event.gpio = gpio;
     gpio_event.event_mask = event_mask;
     gpio_event.timestamp = get_time_us();
+
+    LOG_DEBUG(GPIO, LOG_GPIO_IRQ, gpio, event_mask);
 }
 
 void gpio_init_all(void) {
     // create GPIO mutex
-    gpio_mutex = xSemaphoreCreateMutex();
+    gpio_mutex = MUTEX_CREATE(gpio_mutex);
     
     for (int gpio_num = 0; gpio_num < GPIO_COUNT; gpio_num++) {
         // enable the GPIO pin
@@ -8,66 +8,396 @@
  * @author Cavin McKinley (MCKNLY LLC)
  *
  * @date 02-14-2024
- * 
+ *
  * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
  *            Released under the MIT License
- * 
+ *
  * SPDX-License-Identifier: MIT
  ******************************************************************************/
 
 #include "hardware_config.h"
+#include "rtos_utils.h"
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/i2c.h"
-#include "semphr.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "FreeRTOS.h"
+#include "task.h"
 
-// global I2C0 mutex
-SemaphoreHandle_t i2c0_mutex;
+#define I2C_FIFO_DEPTH      16  // depth of the I2C TX (command) and RX FIFOs
 
 
-void i2c0_init(void) {
-    // create I2C0 mutex
-    i2c0_mutex = xSemaphoreCreateMutex();
-
-    i2c_init(I2C0_ID, I2C0_FREQ_KHZ * 1000);
-    gpio_set_function(I2C0_SDA_PIN, GPIO_FUNC_I2C);
-    gpio_set_function(I2C0_SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(I2C0_SDA_PIN);
-    gpio_pull_up(I2C0_SCL_PIN);
+// I2C device registry (extern declared in hardware_config.h)
+#define I2C_DEV_DESC(name_, bus_, addr_, max_khz_) \
+    {.name = #name_, .bus = (bus_), .addr = (addr_), .max_khz = (max_khz_)},
+const i2c_dev_desc_t i2c_devices[I2C_NUM_DEVICES] = {
+    I2C_DEVICES(I2C_DEV_DESC)
+};
+
+// global I2C bus statistics
+i2c_bus_stats_t i2c_bus_stats[2];
+
+// I2C transaction engine state, one per bus. Transactions wait in a singly
+// linked queue and are run one at a time: the I2C interrupt tops up the TX FIFO
+// with write and read commands, drains the RX FIFO, and completes the
+// transaction on the STOP condition. All of it is protected by a hardware spin
+// lock, since it is touched by tasks on either core and by the I2C interrupts.
+typedef struct i2c_bus_t {
+    i2c_inst_t *inst;           // SDK I2C instance, NULL if the bus is not initialized
+    uint32_t default_khz;       // clock for addresses not in I2C_DEVICES
+    uint32_t freq_khz;          // clock the bus is currently set to
+    i2c_xfer_t *queue_head;     // transactions waiting for the bus
+    i2c_xfer_t *queue_tail;
+    i2c_xfer_t *active;         // transaction on the bus, NULL if idle
+    uint16_t cmd_pos;           // commands (bytes to write, then reads) issued to the TX FIFO
+    uint16_t rx_pos;            // bytes read out of the RX FIFO
+    int abort_result;           // result of an aborted transaction, waiting for its STOP condition (0 if not aborted)
+    bool aborting;              // a timed out transaction is being aborted, the bus is not free until it is done
+} i2c_bus_t;
+
+static i2c_bus_t i2c_buses[2];
+static spin_lock_t *i2c_lock;
+
+static void i2c_engine_next(i2c_bus_t *bus);
+
+
+// set the bus clock for a transaction, if it isn't already. only called between
+// transactions, while the bus is idle
+static void i2c_bus_set_clock(i2c_bus_t *bus, uint32_t freq_khz) {
+    i2c_bus_stats_t *stats = &i2c_bus_stats[bus - i2c_buses];
+
+    if (bus->freq_khz == freq_khz) return;
+    stats->clock_khz = i2c_set_baudrate(bus->inst, freq_khz * 1000) / 1000;
+    bus->freq_khz = freq_khz;
+    stats->clock_changes++;
+}
+
+// issue as many commands as the FIFOs have room for. Reads are only issued while
+// the RX FIFO has room for their bytes, and the TX FIFO interrupt is only left
+// enabled while there are commands it can take. called with i2c_lock held
+static void i2c_engine_fill(i2c_bus_t *bus) {
+    i2c_hw_t *hw = i2c_get_hw(bus->inst);
+    i2c_xfer_t *xfer = bus->active;
+    uint16_t total = xfer->tx_len + xfer->rx_len;
+    bool rx_full = false;
+
+    while (bus->cmd_pos < total && hw->txflr < I2C_FIFO_DEPTH) {
+        uint32_t cmd;
+        if (bus->cmd_pos < xfer->tx_len) {
+            cmd = xfer->tx_buf[bus->cmd_pos];
+        }
+        else {
+            if ((bus->cmd_pos - xfer->tx_len) - bus->rx_pos >= I2C_FIFO_DEPTH) {
+                rx_full = true; // picked up again once the RX FIFO has been drained
+                break;
+            }
+            cmd = I2C_IC_DATA_CMD_CMD_BITS;
+            if (bus->cmd_pos == xfer->tx_len && xfer->tx_len > 0) {
+                cmd |= I2C_IC_DATA_CMD_RESTART_BITS; // repeated start between the write and the read
+            }
+        }
+        if (bus->cmd_pos == total - 1) cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+        hw->data_cmd = cmd;
+        bus->cmd_pos++;
+    }
+
+    if (bus->cmd_pos < total && !rx_full) {
+        hw_set_bits(&hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+    }
+    else {
+        hw_clear_bits(&hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+    }
+}
+
+// move the bytes received so far out of the RX FIFO. called with i2c_lock held
+static void i2c_engine_drain(i2c_bus_t *bus) {
+    i2c_hw_t *hw = i2c_get_hw(bus->inst);
+    i2c_xfer_t *xfer = bus->active;
+
+    while (hw->rxflr > 0) {
+        uint8_t rx_byte = (uint8_t)hw->data_cmd;
+        if (bus->rx_pos < xfer->rx_len) xfer->rx_buf[bus->rx_pos++] = rx_byte;
+    }
+}
+
+// end the active transaction, returns the task to notify (outside of the lock).
+// called with i2c_lock held
+static TaskHandle_t i2c_engine_finish(i2c_bus_t *bus, int result) {
+    i2c_xfer_t *xfer = bus->active;
+    i2c_bus_stats_t *stats = &i2c_bus_stats[bus - i2c_buses];
+    TaskHandle_t task = xfer->task;
+
+    i2c_get_hw(bus->inst)->intr_mask = 0;
+    if (result > 0) {
+        stats->xfers++;
+        stats->bytes += xfer->tx_len + bus->rx_pos;
+    }
+    xfer->result = result;
+    xfer->done = true; // the descriptor belongs to the caller again after this
+    bus->active = NULL;
+
+    i2c_engine_next(bus);
+    return task;
+}
+
+// put the next queued transaction on the bus, if the bus is free.
+// called with i2c_lock held
+static void i2c_engine_next(i2c_bus_t *bus) {
+    i2c_xfer_t *xfer = bus->queue_head;
+    i2c_hw_t *hw;
+
+    if (bus->active != NULL || xfer == NULL) return;
+    if (bus->aborting) {
+        // the interrupt starts the next transaction once the controller has stopped
+        if (i2c_get_hw(bus->inst)->enable & I2C_IC_ENABLE_ABORT_BITS) return;
+        bus->aborting = false;
+    }
+
+    bus->queue_head = xfer->next;
+    if (bus->queue_head == NULL) bus->queue_tail = NULL;
+    bus->active = xfer;
+    bus->cmd_pos = 0;
+    bus->rx_pos = 0;
+    bus->abort_result = 0;
+
+    // the target address can only be changed with the controller disabled
+    i2c_bus_set_clock(bus, xfer->freq_khz);
+    hw = i2c_get_hw(bus->inst);
+    hw->enable = 0;
+    hw->tar = xfer->addr;
+    hw->enable = 1;
+    (void)hw->clr_intr; // clear anything left over from the last transaction
+
+    hw->intr_mask = I2C_IC_INTR_MASK_M_RX_FULL_BITS | I2C_IC_INTR_MASK_M_STOP_DET_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+    i2c_engine_fill(bus);
+}
+
+// I2C interrupt handler, common to both buses
+static void i2c_engine_irq(i2c_bus_t *bus) {
+    i2c_hw_t *hw = i2c_get_hw(bus->inst);
+    TaskHandle_t task = NULL;
+    uint32_t lock_state;
+    uint32_t status;
+
+    lock_state = spin_lock_blocking(i2c_lock);
+    status = hw->intr_stat;
+    if (bus->active == NULL) {
+        // the transaction timed out and was cancelled. once the controller has
+        // finished aborting it the bus is free for the next one
+        (void)hw->clr_intr;
+        if (!(hw->enable & I2C_IC_ENABLE_ABORT_BITS)) {
+            hw->intr_mask = 0;
+            if (bus->aborting) {
+                bus->aborting = false;
+                i2c_engine_next(bus);
+            }
+        }
+    }
+    else {
+        if (status & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+            // the controller flushes the TX FIFO and sends a STOP, the transaction ends on that
+            uint32_t abort_source = hw->tx_abrt_source;
+            if (abort_source & (I2C_IC_TX_ABRT_SOURCE_ABRT_7B_ADDR_NOACK_BITS | I2C_IC_TX_ABRT_SOURCE_ABRT_TXDATA_NOACK_BITS)) {
+                i2c_bus_stats[bus - i2c_buses].naks++;
+            }
+            else {
+                i2c_bus_stats[bus - i2c_buses].aborts++;
+            }
+            (void)hw->clr_tx_abrt;
+            bus->abort_result = -1;
+            hw_clear_bits(&hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+        }
+
+        i2c_engine_drain(bus);
+        if (bus->abort_result == 0) i2c_engine_fill(bus);
+
+        if (status & I2C_IC_INTR_STAT_R_STOP_DET_BITS) {
+            (void)hw->clr_stop_det;
+            i2c_engine_drain(bus);
+            if (bus->abort_result != 0) {
+                task = i2c_engine_finish(bus, bus->abort_result);
+            }
+            else {
+                task = i2c_engine_finish(bus, bus->active->rx_len > 0 ? bus->rx_pos : bus->active->tx_len);
+            }
+        }
+    }
+    spin_unlock(i2c_lock, lock_state);
+
+    if (task != NULL) {
+        BaseType_t higher_priority_woken = pdFALSE;
+        vTaskNotifyGiveIndexedFromISR(task, NOTIFY_INDEX_I2C, &higher_priority_woken);
+        portYIELD_FROM_ISR(higher_priority_woken);
+    }
+}
+
+static void on_i2c0_irq(void) {
+    i2c_engine_irq(&i2c_buses[0]);
 }
 
-int i2c0_write(uint8_t addr, const uint8_t *write_data, size_t length) {
-    i2c_inst_t *i2c = I2C0_ID;
-    int bytes_written = 0;
+static void on_i2c1_irq(void) {
+    i2c_engine_irq(&i2c_buses[1]);
+}
+
+// run a transaction with blocking SDK calls, for use before the scheduler is running
+static int i2c_transfer_blocking(i2c_bus_t *bus, i2c_xfer_t *xfer) {
+    i2c_bus_stats_t *stats = &i2c_bus_stats[bus - i2c_buses];
+    uint32_t timeout_us = I2C_XFER_TIMEOUT_MS * 1000;
+    int result = 0;
 
-    // write bytes if mutex is obtained
-    if(xSemaphoreTake(i2c0_mutex, 10) == pdTRUE) {
-        bytes_written = i2c_write_blocking(i2c, addr, write_data, length, false);
-        xSemaphoreGive(i2c0_mutex);
+    i2c_bus_set_clock(bus, xfer->freq_khz);
+    if (xfer->tx_len > 0) {
+        // no STOP if a read follows, so that the read starts with a repeated start
+        result = i2c_write_timeout_us(bus->inst, xfer->addr, xfer->tx_buf, xfer->tx_len, xfer->rx_len > 0, timeout_us);
+    }
+    if (xfer->rx_len > 0 && (xfer->tx_len == 0 || result == xfer->tx_len)) {
+        result = i2c_read_timeout_us(bus->inst, xfer->addr, xfer->rx_buf, xfer->rx_len, false, timeout_us);
     }
 
-    // check for Pico SDK-specific error and replace with -1
-    if(bytes_written == PICO_ERROR_GENERIC) {
-        bytes_written = -1;
+    // replace Pico SDK-specific errors
+    if (result == PICO_ERROR_GENERIC) {
+        stats->naks++;
+        return -1;
+    }
+    if (result == PICO_ERROR_TIMEOUT) {
+        stats->timeouts++;
+        return 0;
     }
 
-    return bytes_written;
+    stats->xfers++;
+    stats->bytes += xfer->tx_len + xfer->rx_len;
+    return result;
 }
 
-int i2c0_read(uint8_t addr, uint8_t *read_data, size_t length) {
-    i2c_inst_t *i2c = I2C0_ID;
-    int bytes_read = 0;
+// common bus initialization - pins and the transaction engine
+static void i2c_bus_init(uint8_t bus_num, i2c_inst_t *inst, uint32_t freq_khz, uint8_t sda_pin, uint8_t scl_pin) {
+    i2c_bus_t *bus = &i2c_buses[bus_num];
+    i2c_hw_t *hw = i2c_get_hw(inst);
+
+    // initialize the I2C peripheral and set pins
+    i2c_bus_stats[bus_num].clock_khz = i2c_init(inst, freq_khz * 1000) / 1000;
+    gpio_set_function(sda_pin, GPIO_FUNC_I2C);
+    gpio_set_function(scl_pin, GPIO_FUNC_I2C);
+    gpio_pull_up(sda_pin);
+    gpio_pull_up(scl_pin);
 
-    // read bytes if mutex is obtained
-    if(xSemaphoreTake(i2c0_mutex, 10) == pdTRUE) {
-        bytes_read = i2c_read_blocking(i2c, addr, read_data, length, false);
-        xSemaphoreGive(i2c0_mutex);
+    // set up the transaction engine - interrupt on every byte received, and
+    // when the TX FIFO is half empty so it is topped up before the bus stalls
+    if (i2c_lock == NULL) {
+        i2c_lock = spin_lock_init(spin_lock_claim_unused(true));
     }
+    hw->enable = 0;
+    hw->rx_tl = 0;
+    hw->tx_tl = I2C_FIFO_DEPTH / 2;
+    hw->intr_mask = 0;
+    hw->enable = 1;
+    bus->default_khz = freq_khz;
+    bus->freq_khz = freq_khz;
+    bus->inst = inst;
+    irq_set_exclusive_handler(bus_num == 0 ? I2C0_IRQ : I2C1_IRQ, bus_num == 0 ? on_i2c0_irq : on_i2c1_irq);
+    irq_set_enabled(bus_num == 0 ? I2C0_IRQ : I2C1_IRQ, true);
+}
+
+void i2c0_init(void) {
+    i2c_bus_init(0, I2C0_ID, I2C0_FREQ_KHZ, I2C0_SDA_PIN, I2C0_SCL_PIN);
+}
 
-    // check for Pico SDK-specific error and replace with -1
-    if(bytes_read == PICO_ERROR_GENERIC) {
-        bytes_read = -1;
+void i2c1_init(void) {
+    i2c_bus_init(1, I2C1_ID, I2C1_FREQ_KHZ, I2C1_SDA_PIN, I2C1_SCL_PIN);
+}
+
+int i2c_transfer(uint8_t bus_num, i2c_xfer_t *xfer) {
+    i2c_bus_t *bus;
+    TickType_t timeout;
+    uint32_t lock_state;
+
+    if (bus_num > 1 || (xfer->tx_len + xfer->rx_len) == 0) return 0;
+    bus = &i2c_buses[bus_num];
+    if (bus->inst == NULL) return 0; // bus not enabled in hardware_config.h
+
+    // run at the clock of the target device if it is registered
+    xfer->freq_khz = bus->default_khz;
+    for (int dev = 0; dev < I2C_NUM_DEVICES; dev++) {
+        if (i2c_devices[dev].bus == bus_num && i2c_devices[dev].addr == xfer->addr) {
+            xfer->freq_khz = i2c_devices[dev].max_khz;
+            break;
+        }
     }
 
-    return bytes_read;
-}
\ No newline at end of file
+    // drivers are initialized before the scheduler starts, when there is nothing to wait on
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) {
+        return i2c_transfer_blocking(bus, xfer);
+    }
+
+    xfer->next = NULL;
+    xfer->task = xTaskGetCurrentTaskHandle();
+    xfer->done = false;
+    xfer->result = 0;
+    ulTaskNotifyTakeIndexed(NOTIFY_INDEX_I2C, pdTRUE, 0); // clear a completion that arrived after a timeout
+
+    // queue the transaction, and start it if the bus is free
+    lock_state = spin_lock_blocking(i2c_lock);
+    if (bus->queue_tail != NULL) {
+        bus->queue_tail->next = xfer;
+    }
+    else {
+        bus->queue_head = xfer;
+    }
+    bus->queue_tail = xfer;
+    i2c_engine_next(bus);
+    spin_unlock(i2c_lock, lock_state);
+
+    // sleep until the engine has run it
+    timeout = pdMS_TO_TICKS(I2C_XFER_TIMEOUT_MS) + 1;
+    ulTaskNotifyTakeIndexed(NOTIFY_INDEX_I2C, pdTRUE, timeout);
+
+    lock_state = spin_lock_blocking(i2c_lock);
+    if (!xfer->done) {
+        // timed out (e.g. a device holding the clock low) - take the transaction
+        // off the bus or out of the queue, the buffers belong to the caller again
+        // once this returns
+        i2c_bus_stats[bus_num].timeouts++;
+        if (bus->active == xfer) {
+            i2c_hw_t *hw = i2c_get_hw(bus->inst);
+            // have the controller flush its FIFOs and send a STOP. the bus stays
+            // busy until the abort is done, when the TX_ABRT (or STOP_DET)
+            // interrupt starts the next transaction
+            bus->aborting = true;
+            i2c_engine_finish(bus, 0);
+            hw->intr_mask = I2C_IC_INTR_MASK_M_TX_ABRT_BITS | I2C_IC_INTR_MASK_M_STOP_DET_BITS;
+            hw_set_bits(&hw->enable, I2C_IC_ENABLE_ABORT_BITS);
+        }
+        else {
+            i2c_xfer_t **link = &bus->queue_head;
+            i2c_xfer_t *prev = NULL;
+            while (*link != NULL && *link != xfer) {
+                prev = *link;
+                link = &(*link)->next;
+            }
+            if (*link == xfer) {
+                *link = xfer->next;
+                if (bus->queue_tail == xfer) bus->queue_tail = prev;
+            }
+        }
+        // an abort of an idle controller finishes without an interrupt, so the
+        // queue may need starting from here
+        i2c_engine_next(bus);
+    }
+    spin_unlock(i2c_lock, lock_state);
+
+    return xfer->result;
+}
+
+int i2c_dev_transfer(i2c_dev_t dev, const uint8_t *tx_buf, uint16_t tx_len, uint8_t *rx_buf, uint16_t rx_len) {
+    if (dev >= I2C_NUM_DEVICES) return 0;
+
+    i2c_xfer_t xfer = {
+        .addr = i2c_devices[dev].addr,
+        .tx_buf = tx_buf,
+        .tx_len = tx_len,
+        .rx_buf = rx_buf,
+        .rx_len = rx_len
+    };
+    return i2c_transfer(i2c_devices[dev].bus, &xfer);
+}
@@ -20,6 +20,7 @@
 #include "hw_net.h"
 #include "hardware_config.h"
 #include "version.h"
+#include "mem_pool.h"
 #include "FreeRTOS.h"
 #include "pico/cyw43_arch.h"
 #include "lwip/apps/mdns.h"
@@ -119,12 +120,12 @@ u16_t httpd_ssi_handler(int iIndex, char *pcInsert, int iInsertLen, uint16_t cur
             break;
         }
         case 4: { /* freeram */
-            HeapStats_t *heap_stats = pvPortMalloc(sizeof(HeapStats_t)); // structure to hold heap stats results
+            HeapStats_t *heap_stats = mem_pool_alloc(sizeof(HeapStats_t)); // structure to hold heap stats results
             vPortGetHeapStats(heap_stats);  // get the heap stats
             tag_print = snprintf(pcInsert, iInsertLen, "%.1f KB / %.1f KB",
                                                         ( (float)heap_stats->xAvailableHeapSpaceInBytes / 1024 ),
                                                         ( (float)(configTOTAL_HEAP_SIZE) / 1024 ));
-            vPortFree(heap_stats);
+            mem_pool_free(heap_stats);
             break;
         }
         case 5: { /* freeflsh <-- notice no 'a' to fit into 8 characters */
@@ -15,14 +15,58 @@
  * SPDX-License-Identifier: MIT
  ******************************************************************************/
 
+#include <string.h>
+#include <strings.h>
 #include "hardware_config.h"
+#include "rtos_utils.h"
+#include "mem_pool.h"
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/spi.h"
-#include "semphr.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "FreeRTOS.h"
+#include "task.h"
 
-// global SPI0 mutex
-SemaphoreHandle_t spi0_mutex;
+
+// SPI device registry (extern declared in hardware_config.h)
+#define SPI_DEV_DESC(name_, bus_, cs_, max_khz_, cpol_, cpha_, burst_, cs_gap_us_, read_delay_us_) \
+    {.name = #name_, .bus = (bus_), .cs_pin = (cs_), .max_khz = (max_khz_), .cpol = (cpol_), .cpha = (cpha_), \
+     .burst = (burst_), .cs_gap_us = (cs_gap_us_), .read_delay_us = (read_delay_us_)},
+const spi_dev_desc_t spi_devices[SPI_NUM_DEVICES] = {
+    SPI_DEVICES(SPI_DEV_DESC)
+};
+
+// global SPI device statistics
+spi_dev_stats_t spi_dev_stats[SPI_NUM_DEVICES];
+
+// SPI transaction engine state, one per bus. Transactions wait in a singly
+// linked queue and are run one at a time: the DMA completion interrupt moves
+// the active transaction on to its second phase or completes it, and alarms
+// time the delays between phases and transactions. All of it is protected by
+// a hardware spin lock, since it is touched by tasks on either core and by the
+// DMA and alarm interrupts.
+typedef struct spi_bus_t {
+    spi_inst_t *inst;           // SDK SPI instance, NULL if the bus is not initialized
+    int dma_tx;                 // DMA channel feeding the TX FIFO
+    int dma_rx;                 // DMA channel draining the RX FIFO
+    spi_xfer_t *queue_head;     // transactions waiting for the bus
+    spi_xfer_t *queue_tail;
+    spi_xfer_t *active;         // transaction on the bus, NULL if idle
+    bool second_phase;          // the active transaction is in its second phase
+    alarm_id_t alarm;           // pending delay alarm, 0 if none
+    uint64_t bus_free_us;       // earliest time the next transaction may assert its chip select
+    uint64_t cs_assert_us;      // time the active transaction asserted its chip select
+    int configured_dev;         // device the clock and mode are set for, -1 if none
+} spi_bus_t;
+
+static spi_bus_t spi_buses[2];
+static spin_lock_t *spi_lock;
+static uint8_t spi_zero;        // source of the zeros sent by read-only transactions
+static uint8_t spi_discard;     // sink for the bytes received by write-only transactions
+
+static void spi_engine_next(spi_bus_t *bus);
 
 
 // chip select assertion routine to use in spi reads/writes
@@ -39,52 +83,360 @@ static inline void cs_deassert(uint8_t cs_pin) {
     asm volatile("nop \n nop \n nop");
 }
 
+// set the bus clock and mode for a device, if it isn't already. only called
+// between transactions, while the bus is idle
+static void spi_bus_configure(spi_bus_t *bus, spi_dev_t dev) {
+    const spi_dev_desc_t *desc = &spi_devices[dev];
+
+    if (bus->configured_dev == (int)dev) return;
+    spi_dev_stats[dev].clock_khz = spi_set_baudrate(bus->inst, desc->max_khz * 1000) / 1000;
+    spi_set_format(bus->inst, 8, desc->cpol ? SPI_CPOL_1 : SPI_CPOL_0, desc->cpha ? SPI_CPHA_1 : SPI_CPHA_0, SPI_MSB_FIRST);
+    bus->configured_dev = dev;
+    spi_dev_stats[dev].reconfigs++;
+}
+
+// start DMA for len bytes of a transaction from offset. the RX channel finishes
+// last, so its completion interrupt marks the end of the phase
+static void spi_dma_start(spi_bus_t *bus, spi_xfer_t *xfer, uint16_t offset, uint16_t len) {
+    dma_channel_config tx_config = dma_channel_get_default_config(bus->dma_tx);
+    channel_config_set_transfer_data_size(&tx_config, DMA_SIZE_8);
+    channel_config_set_dreq(&tx_config, spi_get_dreq(bus->inst, true));
+    channel_config_set_read_increment(&tx_config, xfer->tx_buf != NULL);
+    channel_config_set_write_increment(&tx_config, false);
+    dma_channel_configure(bus->dma_tx, &tx_config,
+                          &spi_get_hw(bus->inst)->dr,
+                          xfer->tx_buf ? xfer->tx_buf + offset : &spi_zero,
+                          len, false);
+
+    dma_channel_config rx_config = dma_channel_get_default_config(bus->dma_rx);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_8);
+    channel_config_set_dreq(&rx_config, spi_get_dreq(bus->inst, false));
+    channel_config_set_read_increment(&rx_config, false);
+    channel_config_set_write_increment(&rx_config, xfer->rx_buf != NULL);
+    dma_channel_configure(bus->dma_rx, &rx_config,
+                          xfer->rx_buf ? xfer->rx_buf + offset : &spi_discard,
+                          &spi_get_hw(bus->inst)->dr,
+                          len, false);
+
+    // start both together so the RX channel is ready for the first byte
+    dma_start_channel_mask((1u << bus->dma_tx) | (1u << bus->dma_rx));
+}
+
+// end the active transaction, returns the task to notify (outside of the lock).
+// called with spi_lock held
+static TaskHandle_t spi_engine_finish(spi_bus_t *bus, int result) {
+    spi_xfer_t *xfer = bus->active;
+    const spi_dev_desc_t *desc = &spi_devices[xfer->dev];
+    TaskHandle_t task = xfer->task;
+    uint64_t now_us = time_us_64();
+
+    cs_deassert(desc->cs_pin);
+    bus->bus_free_us = now_us + desc->cs_gap_us;
+    spi_dev_stats[xfer->dev].bus_us += now_us - bus->cs_assert_us;
+    if (result > 0) {
+        spi_dev_stats[xfer->dev].xfers++;
+        spi_dev_stats[xfer->dev].bytes += result;
+    }
+    xfer->result = result;
+    xfer->done = true; // the descriptor belongs to the caller again after this
+    bus->active = NULL;
+
+    spi_engine_next(bus);
+    return task;
+}
+
+// alarm callback - a delay between phases, or the gap before the next transaction, is over
+static int64_t spi_alarm_callback(alarm_id_t id, void *user_data) {
+    spi_bus_t *bus = (spi_bus_t *)user_data;
+    uint32_t lock_state = spin_lock_blocking(spi_lock);
+    if (id == bus->alarm) { // otherwise the alarm was cancelled after it fired
+        bus->alarm = 0;
+        if (bus->active != NULL && bus->second_phase) {
+            spi_dma_start(bus, bus->active, bus->active->split, bus->active->len - bus->active->split);
+        }
+        else {
+            spi_engine_next(bus);
+        }
+    }
+    spin_unlock(spi_lock, lock_state);
+    return 0; // don't reschedule
+}
+
+// wait for a delay without holding the bus, returns false if it has already passed.
+// called with spi_lock held
+static bool spi_engine_delay(spi_bus_t *bus, uint64_t delay_us) {
+    if (delay_us == 0) return false;
+    // fire_if_past is false so that the callback never runs here with the lock held
+    bus->alarm = add_alarm_in_us(delay_us, spi_alarm_callback, bus, false);
+    if (bus->alarm > 0) return true;
+    bus->alarm = 0; // already passed, or no alarm slot free - carry on without the delay
+    return false;
+}
+
+// put the next queued transaction on the bus, if the bus is free.
+// called with spi_lock held
+static void spi_engine_next(spi_bus_t *bus) {
+    spi_xfer_t *xfer = bus->queue_head;
+    uint64_t now_us;
+
+    if (bus->active != NULL || bus->alarm != 0 || xfer == NULL) return;
+
+    // honour the chip select gap of the last transaction
+    now_us = time_us_64();
+    if (now_us < bus->bus_free_us && spi_engine_delay(bus, bus->bus_free_us - now_us)) return;
+
+    bus->queue_head = xfer->next;
+    if (bus->queue_head == NULL) bus->queue_tail = NULL;
+    bus->active = xfer;
+    bus->second_phase = false;
+
+    spi_bus_configure(bus, xfer->dev);
+    cs_assert(spi_devices[xfer->dev].cs_pin);
+    bus->cs_assert_us = time_us_64();
+    spi_dma_start(bus, xfer, 0, (xfer->split > 0 && xfer->split < xfer->len) ? xfer->split : xfer->len);
+}
+
+// DMA interrupt handler, shared by both buses and any other users of SPI_DMA_IRQ
+static void on_spi_dma_irq(void) {
+    for (int b = 0; b < 2; b++) {
+        spi_bus_t *bus = &spi_buses[b];
+        TaskHandle_t task = NULL;
+        uint32_t lock_state;
+
+        if (bus->inst == NULL || !dma_irqn_get_channel_status(SPI_DMA_IRQ - DMA_IRQ_0, bus->dma_rx)) continue;
+        dma_irqn_acknowledge_channel(SPI_DMA_IRQ - DMA_IRQ_0, bus->dma_rx);
+
+        lock_state = spin_lock_blocking(spi_lock);
+        // no active transaction means it timed out and was cancelled, and a busy RX
+        // channel means this completion was for one cancelled just before it started
+        if (bus->active != NULL && !dma_channel_is_busy(bus->dma_rx)) {
+            if (!bus->second_phase && bus->active->split > 0 && bus->active->split < bus->active->len) {
+                // first phase done, chip select stays asserted through the delay
+                bus->second_phase = true;
+                if (!spi_engine_delay(bus, bus->active->split_delay_us)) {
+                    spi_dma_start(bus, bus->active, bus->active->split, bus->active->len - bus->active->split);
+                }
+            }
+            else {
+                task = spi_engine_finish(bus, bus->active->len);
+            }
+        }
+        spin_unlock(spi_lock, lock_state);
+
+        if (task != NULL) {
+            BaseType_t higher_priority_woken = pdFALSE;
+            vTaskNotifyGiveIndexedFromISR(task, NOTIFY_INDEX_SPI, &higher_priority_woken);
+            portYIELD_FROM_ISR(higher_priority_woken);
+        }
+    }
+}
+
+// run a transaction with blocking SDK calls, for use before the scheduler is running
+static int spi_transfer_blocking(spi_bus_t *bus, spi_xfer_t *xfer) {
+    const spi_dev_desc_t *desc = &spi_devices[xfer->dev];
+    uint16_t first = (xfer->split > 0 && xfer->split < xfer->len) ? xfer->split : xfer->len;
+    uint16_t phase_len[2] = {first, xfer->len - first};
+    uint16_t offset = 0;
+
+    spi_bus_configure(bus, xfer->dev);
+    cs_assert(desc->cs_pin);
+    for (int phase = 0; phase < 2 && phase_len[phase] > 0; phase++) {
+        if (phase == 1) busy_wait_us(xfer->split_delay_us);
+        if (xfer->tx_buf != NULL && xfer->rx_buf != NULL) {
+            spi_write_read_blocking(bus->inst, xfer->tx_buf + offset, xfer->rx_buf + offset, phase_len[phase]);
+        }
+        else if (xfer->tx_buf != NULL) {
+            spi_write_blocking(bus->inst, xfer->tx_buf + offset, phase_len[phase]);
+        }
+        else if (xfer->rx_buf != NULL) {
+            spi_read_blocking(bus->inst, 0, xfer->rx_buf + offset, phase_len[phase]);
+        }
+        offset += phase_len[phase];
+    }
+    cs_deassert(desc->cs_pin);
+    busy_wait_us(desc->cs_gap_us);
+
+    spi_dev_stats[xfer->dev].xfers++;
+    spi_dev_stats[xfer->dev].bytes += xfer->len;
+    return xfer->len;
+}
+
+// common bus initialization - pins, chip selects of the bus's devices, DMA channels
+static void spi_bus_init(uint8_t bus_num, spi_inst_t *inst, uint32_t freq_khz, uint8_t miso_pin, uint8_t mosi_pin, uint8_t clk_pin) {
+    spi_bus_t *bus = &spi_buses[bus_num];
+
+    // initialize the SPI peripheral and set pins
+    spi_init(inst, freq_khz * 1000);
+    gpio_set_function(miso_pin, GPIO_FUNC_SPI);
+    gpio_set_function(mosi_pin, GPIO_FUNC_SPI);
+    gpio_set_function(clk_pin, GPIO_FUNC_SPI);
+
+    // initialize the chip selects of the devices on this bus and drive them high (active low)
+    for (int dev = 0; dev < SPI_NUM_DEVICES; dev++) {
+        if (spi_devices[dev].bus != bus_num) continue;
+        gpio_init(spi_devices[dev].cs_pin);
+        gpio_set_dir(spi_devices[dev].cs_pin, GPIO_OUT);
+        gpio_put(spi_devices[dev].cs_pin, 1);
+    }
+
+    // set up the transaction engine - DMA channels and their completion interrupt,
+    // which is shared by both buses
+    if (spi_lock == NULL) {
+        spi_lock = spin_lock_init(spin_lock_claim_unused(true));
+        irq_add_shared_handler(SPI_DMA_IRQ, on_spi_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(SPI_DMA_IRQ, true);
+    }
+    bus->dma_tx = dma_claim_unused_channel(true);
+    bus->dma_rx = dma_claim_unused_channel(true);
+    bus->configured_dev = -1;
+    bus->inst = inst;
+    dma_irqn_set_channel_enabled(SPI_DMA_IRQ - DMA_IRQ_0, bus->dma_rx, true);
+}
+
 void spi0_init(void) {
-    // create SPI0 mutex
-    spi0_mutex = xSemaphoreCreateMutex();
-
-    // initialize SPI0 and set pins
-    spi_init(SPI0_ID, SPI0_FREQ_KHZ * 1000);
-    gpio_set_function(SPI0_MISO_PIN, GPIO_FUNC_SPI);
-    gpio_set_function(SPI0_MOSI_PIN, GPIO_FUNC_SPI);
-    gpio_set_function(SPI0_CLK_PIN, GPIO_FUNC_SPI);
-
-    // initialize chip select and drive high (it is active low)
-    // for multiple devices on the bus, more chip selects would need to be added
-    gpio_init(SPI0_CS_PIN_DEFAULT);
-    gpio_set_dir(SPI0_CS_PIN_DEFAULT, GPIO_OUT);
-    gpio_put(SPI0_CS_PIN_DEFAULT, 1);
-}
-
-int spi0_write_register(uint8_t cs_pin, uint8_t reg_addr, uint8_t data_byte) {
-    int bytes_written;
-    uint8_t write_buf[2];
-    write_buf[0] = reg_addr & 0x7F; // write bit mask (MSB signifies read)
-    write_buf[1] = data_byte;
-    // obtain mutex on hw and then write to spi
-    if(xSemaphoreTake(spi0_mutex, 10) == pdTRUE) {
-        cs_assert(cs_pin);
-        bytes_written = spi_write_blocking(SPI0_ID, write_buf, 2);
-        cs_deassert(cs_pin);
-        xSemaphoreGive(spi0_mutex);
+    spi_bus_init(0, SPI0_ID, SPI0_FREQ_KHZ, SPI0_MISO_PIN, SPI0_MOSI_PIN, SPI0_CLK_PIN);
+}
+
+void spi1_init(void) {
+    spi_bus_init(1, SPI1_ID, SPI1_FREQ_KHZ, SPI1_MISO_PIN, SPI1_MOSI_PIN, SPI1_CLK_PIN);
+}
+
+int spi_dev_transfer(spi_dev_t dev, spi_xfer_t *xfer) {
+    spi_bus_t *bus;
+    TickType_t timeout;
+    uint32_t lock_state;
+
+    if (dev >= SPI_NUM_DEVICES || xfer->len == 0) return 0;
+    bus = &spi_buses[spi_devices[dev].bus];
+    if (bus->inst == NULL) return 0; // bus not enabled in hardware_config.h
+    xfer->dev = dev;
+
+    // drivers are initialized before the scheduler starts, when there is nothing to wait on
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) {
+        return spi_transfer_blocking(bus, xfer);
+    }
+
+    xfer->next = NULL;
+    xfer->task = xTaskGetCurrentTaskHandle();
+    xfer->done = false;
+    xfer->result = 0;
+    ulTaskNotifyTakeIndexed(NOTIFY_INDEX_SPI, pdTRUE, 0); // clear a completion that arrived after a timeout
+
+    // queue the transaction, and start it if the bus is free
+    lock_state = spin_lock_blocking(spi_lock);
+    if (bus->queue_tail != NULL) {
+        bus->queue_tail->next = xfer;
+    }
+    else {
+        bus->queue_head = xfer;
+    }
+    bus->queue_tail = xfer;
+    spi_engine_next(bus);
+    spin_unlock(spi_lock, lock_state);
+
+    // sleep until the engine has run it
+    timeout = pdMS_TO_TICKS(SPI_XFER_TIMEOUT_MS + ((xfer->split_delay_us + spi_devices[dev].cs_gap_us) / 1000)) + 1;
+    ulTaskNotifyTakeIndexed(NOTIFY_INDEX_SPI, pdTRUE, timeout);
+
+    lock_state = spin_lock_blocking(spi_lock);
+    if (!xfer->done) {
+        // timed out - take the transaction off the bus or out of the queue, the
+        // buffers belong to the caller again once this returns
+        spi_dev_stats[dev].timeouts++;
+        if (bus->active == xfer) {
+            // an abort can raise a completion interrupt (RP2040-E13), which would
+            // finish the next transaction as soon as it starts. mask the RX
+            // channel's interrupt through the abort and clear anything it raised
+            dma_irqn_set_channel_enabled(SPI_DMA_IRQ - DMA_IRQ_0, bus->dma_rx, false);
+            dma_channel_abort(bus->dma_tx);
+            dma_channel_abort(bus->dma_rx);
+            dma_irqn_acknowledge_channel(SPI_DMA_IRQ - DMA_IRQ_0, bus->dma_rx);
+            dma_irqn_set_channel_enabled(SPI_DMA_IRQ - DMA_IRQ_0, bus->dma_rx, true);
+            if (bus->alarm != 0) {
+                cancel_alarm(bus->alarm);
+                bus->alarm = 0;
+            }
+            spi_engine_finish(bus, 0);
+        }
+        else {
+            spi_xfer_t **link = &bus->queue_head;
+            spi_xfer_t *prev = NULL;
+            while (*link != NULL && *link != xfer) {
+                prev = *link;
+                link = &(*link)->next;
+            }
+            if (*link == xfer) {
+                *link = xfer->next;
+                if (bus->queue_tail == xfer) bus->queue_tail = prev;
+            }
+        }
     }
-    if (bytes_written == 2) {
-        return 1;
+    spin_unlock(spi_lock, lock_state);
+
+    return xfer->result;
+}
+
+int spi_dev_write(spi_dev_t dev, uint8_t reg_addr, const uint8_t *data, uint16_t len) {
+    uint16_t burst;
+    uint16_t written = 0;
+    uint8_t *tx_buf;
+
+    if (dev >= SPI_NUM_DEVICES || len == 0) return 0;
+    burst = (spi_devices[dev].burst > 0 && spi_devices[dev].burst < len) ? spi_devices[dev].burst : len;
+    tx_buf = mem_pool_alloc(burst + 1);
+    if (tx_buf == NULL) return 0;
+
+    // one transaction per burst - the register address, then the data
+    while (written < len) {
+        uint16_t chunk = (len - written < burst) ? len - written : burst;
+        tx_buf[0] = (reg_addr + written) & 0x7F; // write bit mask (MSB signifies read)
+        memcpy(tx_buf + 1, data + written, chunk);
+        spi_xfer_t xfer = {
+            .tx_buf = tx_buf,
+            .rx_buf = NULL,
+            .len = chunk + 1
+        };
+        if (spi_dev_transfer(dev, &xfer) != chunk + 1) break;
+        written += chunk;
     }
-    else return 0;
+
+    mem_pool_free(tx_buf);
+    return written;
 }
 
-int spi0_read_registers(uint8_t cs_pin, uint8_t reg_addr, uint8_t *read_buf, uint16_t len) {
+int spi_dev_read(spi_dev_t dev, uint8_t reg_addr, uint8_t *read_buf, uint16_t len) {
+    // one buffer for each direction - the byte clocked in while the address goes out is discarded
+    uint8_t *tx_buf;
+    uint8_t *rx_buf;
     int bytes_read;
-    reg_addr |= 0x80; // make sure read bit is set (MSB)
-    // obtain mutex on hw and then read from spi
-    if(xSemaphoreTake(spi0_mutex, 10) == pdTRUE) {
-        cs_assert(cs_pin);
-        spi_write_blocking(SPI0_ID, &reg_addr, 1); // write the address to read
-        wait_here_us(10 * 1000);                   // wait 10ms before read
-        bytes_read = spi_read_blocking(SPI0_ID, 0, read_buf, len); // read the result
-        cs_deassert(cs_pin);
-        xSemaphoreGive(spi0_mutex);
+
+    if (dev >= SPI_NUM_DEVICES || len == 0) return 0;
+    tx_buf = mem_pool_alloc(2 * (len + 1));
+    if (tx_buf == NULL) return 0;
+    rx_buf = tx_buf + len + 1;
+    memset(tx_buf, 0, len + 1);
+    tx_buf[0] = reg_addr | 0x80; // make sure read bit is set (MSB)
+    spi_xfer_t xfer = {
+        .tx_buf = tx_buf,
+        .rx_buf = rx_buf,
+        .len = len + 1,
+        .split = spi_devices[dev].read_delay_us ? 1 : 0, // address phase, then the data after the delay
+        .split_delay_us = spi_devices[dev].read_delay_us
+    };
+
+    bytes_read = spi_dev_transfer(dev, &xfer) - 1;
+    if (bytes_read > 0) {
+        memcpy(read_buf, rx_buf + 1, bytes_read);
     }
+    else bytes_read = 0;
+
+    mem_pool_free(tx_buf);
     return bytes_read;
-}
\ No newline at end of file
+}
+
+spi_dev_t spi_dev_find(const char *name) {
+    for (int dev = 0; dev < SPI_NUM_DEVICES; dev++) {
+        if (strcasecmp(spi_devices[dev].name, name) == 0) return (spi_dev_t)dev;
+    }
+    return SPI_NUM_DEVICES;
+}
@@ -18,10 +18,16 @@
 
 #include "hardware_config.h"
 #include "shell.h"
+#include "services.h"
+#include "service_log.h"
+#include "rtos_utils.h"
 #include "pico/stdlib.h"
 #include "hardware/uart.h"
 #include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "semphr.h"
+#include "queue.h"
+#include "stream_buffer.h"
 
 #define NOCHAR 255 // return value of uart read if there is nothing to read
 
@@ -30,27 +36,99 @@
  * CLI UART functions
 *************************/
 
-static char cli_uart_rx_char = NOCHAR;
+// CLI RX ring buffer - single producer (the rx ISR writes the head) and single
+// consumer (the CLI task reads the tail), so no locking is needed. Indexes are
+// free-running and wrapped with the buffer mask.
+#if (UART_RX_BUF_SIZE_CLI & (UART_RX_BUF_SIZE_CLI - 1)) != 0
+#error "UART_RX_BUF_SIZE_CLI must be a power of 2"
+#endif
+static char cli_uart_rx_buf[UART_RX_BUF_SIZE_CLI];
+static volatile uint32_t cli_uart_rx_head; // written only by on_cli_uart_rx()
+static volatile uint32_t cli_uart_rx_tail; // written only by cli_uart_getc()
+
+// CLI TX block currently being fed to the FIFO by the TX interrupt, see cli_uart_write()
+static const char *cli_uart_tx_data;
+static size_t cli_uart_tx_len;
+static volatile size_t cli_uart_tx_pos;
+static SemaphoreHandle_t cli_uart_tx_done; // signals that the TX interrupt has sent the whole block
+#define UART_IRQ_CLI (UART_ID_CLI == uart0 ? UART0_IRQ : UART1_IRQ)
 
 // global CLI UART mutex
 SemaphoreHandle_t cli_uart_mutex;
 
-// cli uart rx interrupt handler
-static void on_cli_uart_rx() {
-    if (uart_is_readable(UART_ID_CLI)) {
-        cli_uart_rx_char = uart_getc(UART_ID_CLI);
+// global CLI UART statistics
+cli_uart_stats_t cli_uart_stats;
+
+// feed the TX fifo from the current block, returns true once it has all been
+// written. runs in the ISR, or from a task with the cli uart IRQ disabled
+static bool cli_uart_tx_fill(void) {
+    while (cli_uart_tx_pos < cli_uart_tx_len && uart_is_writable(UART_ID_CLI)) {
+        uart_get_hw(UART_ID_CLI)->dr = cli_uart_tx_data[cli_uart_tx_pos++];
+    }
+    return cli_uart_tx_pos == cli_uart_tx_len;
+}
+
+// cli uart interrupt handler (rx and tx)
+static void on_cli_uart_irq() {
+    BaseType_t higher_priority_woken = pdFALSE;
+    uint32_t head = cli_uart_rx_head;
+    uint32_t dropped = 0;
+
+    // check for characters lost in hardware before we got here, then clear the error
+    if (uart_get_hw(UART_ID_CLI)->rsr & UART_UARTRSR_OE_BITS) {
+        cli_uart_stats.rx_hw_overruns++;
+        hw_clear_bits(&uart_get_hw(UART_ID_CLI)->rsr, UART_UARTRSR_OE_BITS);
+        LOG_WARN(CLI_UART, LOG_CLI_UART_HW_OVERRUN);
+    }
+
+    // drain the whole FIFO into the ring buffer
+    while (uart_is_readable(UART_ID_CLI)) {
+        char ch = (char)uart_get_hw(UART_ID_CLI)->dr;
+        if (head - cli_uart_rx_tail < UART_RX_BUF_SIZE_CLI) {
+            cli_uart_rx_buf[head & (UART_RX_BUF_SIZE_CLI - 1)] = ch;
+            head++;
+            cli_uart_stats.rx_chars++;
+        }
+        else {
+            dropped++; // ring buffer full, drop the char
+        }
+    }
+
+    __dmb(); // make sure the buffer contents are visible before the new head
+    cli_uart_rx_head = head;
+
+    if (dropped > 0) {
+        cli_uart_stats.rx_overruns += dropped;
+        LOG_WARN(CLI_UART, LOG_CLI_UART_RX_OVERRUN, dropped);
     }
+
+    // wake the CLI to read the input
+    if (head != cli_uart_rx_tail) {
+        service_events_signal_from_isr(&cli_events, SERVICE_EVENT_IO, &higher_priority_woken);
+    }
+
+    // keep the tx fifo fed, waking the writer once the block is done
+    if (uart_get_hw(UART_ID_CLI)->imsc & UART_UARTIMSC_TXIM_BITS) {
+        if (cli_uart_tx_fill()) {
+            hw_clear_bits(&uart_get_hw(UART_ID_CLI)->imsc, UART_UARTIMSC_TXIM_BITS);
+            xSemaphoreGiveFromISR(cli_uart_tx_done, &higher_priority_woken);
+        }
+    }
+
+    portYIELD_FROM_ISR(higher_priority_woken);
 }
 
 void cli_uart_init(void) {
-    // The CLI UART is intended to be accessed character by character at low-ish
-    // speed (human typing), with reads/writes regularly serviced by the CLI
-    // task. As such it is configured without FIFO, and a simple rx interrupt
-    // routine that puts the rx char into a global variable. It is assumed that
-    // microshell will pull the byte before a new incoming byte overwrites it.
-
-    // create CLI UART mutex
-    cli_uart_mutex = xSemaphoreCreateMutex();
+    // The CLI UART is accessed character by character by microshell, but input
+    // may arrive in bursts (pasted text, scripted provisioning). The FIFO is
+    // enabled and the rx interrupt (FIFO level or rx timeout) drains it into a
+    // ring buffer, which the CLI task empties through cli_uart_getc(). Output
+    // is written in blocks, and the TX interrupt feeds the FIFO while the
+    // writing task blocks (see cli_uart_write()).
+
+    // create CLI UART mutex and TX completion semaphore
+    cli_uart_mutex = MUTEX_CREATE(cli_uart_mutex);
+    cli_uart_tx_done = BINARY_SEMAPHORE_CREATE(cli_uart_tx_done);
     
     // initialize uart at defined speed
     uart_init(UART_ID_CLI, UART_BAUD_RATE_CLI);
@@ -65,16 +143,15 @@ void cli_uart_init(void) {
     // set data format
     uart_set_format(UART_ID_CLI, UART_DATA_BITS_CLI, UART_STOP_BITS_CLI, UART_PARITY_CLI);
 
-    // disable fifos - handle single characters only
-    uart_set_fifo_enabled(UART_ID_CLI, false);
+    // enable fifos - the rx ISR drains the whole fifo each time it runs
+    uart_set_fifo_enabled(UART_ID_CLI, true);
 
-    // set up RX interrupt
-    int UART_IRQ = UART_ID_CLI == uart0 ? UART0_IRQ : UART1_IRQ;
-    irq_set_exclusive_handler(UART_IRQ, on_cli_uart_rx);
-    irq_set_enabled(UART_IRQ, true);
+    // set up RX interrupt, TX interrupt is only enabled while a block is being sent
+    irq_set_exclusive_handler(UART_IRQ_CLI, on_cli_uart_irq);
+    irq_set_enabled(UART_IRQ_CLI, true);
     uart_set_irq_enables(UART_ID_CLI, true, false);
 
-    cli_uart_rx_char = NOCHAR; // clear out RX buffer as a junk char appears upon enable
+    cli_uart_rx_tail = cli_uart_rx_head; // clear out RX buffer as a junk char appears upon enable
 
     // print out a string to indicate that uart was successfully initialized
     uart_puts(UART_ID_CLI, "\r\n\n");
@@ -95,21 +172,60 @@ int cli_uart_putc(char tx_char) {
     return status;
 }
 
+int cli_uart_write(const char *tx_data, size_t tx_len) {
+    int status = 0;
+    if(xSemaphoreTake(cli_uart_mutex, 10) == pdTRUE) {
+        xSemaphoreTake(cli_uart_tx_done, 0); // clear out a completion from a timed out write
+        cli_uart_tx_data = tx_data;
+        cli_uart_tx_len = tx_len;
+        cli_uart_tx_pos = 0;
+
+        // fill the FIFO from here with the interrupt masked. anything that doesn't
+        // fit leaves the FIFO full, so the TX interrupt is guaranteed to fire as
+        // it drains down through the trigger level
+        irq_set_enabled(UART_IRQ_CLI, false);
+        bool tx_complete = cli_uart_tx_fill();
+        if (!tx_complete) {
+            hw_set_bits(&uart_get_hw(UART_ID_CLI)->imsc, UART_UARTIMSC_TXIM_BITS);
+        }
+        irq_set_enabled(UART_IRQ_CLI, true);
+
+        if (!tx_complete) {
+            // block until the ISR has sent the rest (allow 2x the time on the wire plus a tick)
+            TickType_t tx_timeout = pdMS_TO_TICKS((tx_len * 10 * 2 * 1000) / UART_BAUD_RATE_CLI) + 2;
+            uint64_t wait_start_us = get_time_us();
+            if (xSemaphoreTake(cli_uart_tx_done, tx_timeout) != pdTRUE) {
+                // give up on the rest of the block, the buffer belongs to the caller again
+                irq_set_enabled(UART_IRQ_CLI, false);
+                hw_clear_bits(&uart_get_hw(UART_ID_CLI)->imsc, UART_UARTIMSC_TXIM_BITS);
+                irq_set_enabled(UART_IRQ_CLI, true);
+                cli_uart_stats.tx_timeouts++;
+            }
+            cli_uart_stats.tx_wait_us += get_time_us() - wait_start_us;
+            cli_uart_stats.tx_waits++;
+        }
+        status = (int)cli_uart_tx_pos;
+        xSemaphoreGive(cli_uart_mutex);
+    }
+    return status;
+}
+
 char cli_uart_getc(void) {
     char ch;
-    if (cli_uart_rx_char != NOCHAR) {
-        // try to obtain the mutex to allow reading the buffered single char.
-        // note that the direct UART read is inherently thread safe because it is
-        // accessed thru a static ISR (on_cli_uart_rx).
-        // of course this does not prevent another incoming UART char from overwriting
-        // the buffered char if it is not pulled out in time.
-        if(xSemaphoreTake(cli_uart_mutex, 10) == pdTRUE) {
-            ch = cli_uart_rx_char;
-            cli_uart_rx_char = NOCHAR;
-            xSemaphoreGive(cli_uart_mutex);
-        }
-        return ch;
+    uint32_t tail = cli_uart_rx_tail;
+
+    if (tail == cli_uart_rx_head) {
+        return NOCHAR; // nothing received
     }
+    __dmb(); // read the head before the buffer contents it covers
+    ch = cli_uart_rx_buf[tail & (UART_RX_BUF_SIZE_CLI - 1)];
+    cli_uart_rx_tail = tail + 1;
+
+    return ch;
+}
+
+uint32_t cli_uart_rx_pending(void) {
+    return cli_uart_rx_head - cli_uart_rx_tail;
 }
 
 void cli_uart_puts(const char *print_string) {
@@ -127,16 +243,165 @@ void cli_uart_puts(const char *print_string) {
 // global Aux UART mutex
 SemaphoreHandle_t aux_uart_mutex;
 
+// global Aux UART statistics
+aux_uart_stats_t aux_uart_stats;
+
+// RX stream buffer filled by the aux uart ISR
+static StreamBufferHandle_t aux_uart_rx_stream;
+
+// asynchronous TX write descriptors, queued by aux_uart_write_async()
+typedef struct aux_uart_tx_desc_t {
+    const uint8_t *data;
+    size_t len;
+    aux_uart_tx_callback_t callback;
+    void *cb_arg;
+} aux_uart_tx_desc_t;
+static QueueHandle_t aux_uart_tx_queue;
+static aux_uart_tx_desc_t aux_uart_tx_cur;    // write currently being sent
+static size_t aux_uart_tx_pos;                // next byte of the current write
+static volatile bool aux_uart_tx_active;      // true while the TX interrupt owns the hardware
+static size_t aux_uart_tx_backlog;            // bytes queued or in progress, not yet written to the hardware
+#define UART_IRQ_AUX (UART_ID_AUX == uart0 ? UART0_IRQ : UART1_IRQ)
+
+// completion token for a blocking aux_uart_write(), passed as the callback argument
+typedef struct aux_uart_write_wait_t {
+    TaskHandle_t task;
+    volatile bool done;
+} aux_uart_write_wait_t;
+
+// feed the TX fifo from the queued writes, calling each write's completion
+// callback as it finishes. runs only in the ISR, inside a critical section
+static void aux_uart_tx_fill(BaseType_t *higher_priority_woken) {
+    while (uart_is_writable(UART_ID_AUX)) {
+        if (aux_uart_tx_pos == aux_uart_tx_cur.len) {
+            // current write is finished (or there was none), signal it and get the next one
+            if (aux_uart_tx_cur.data != NULL) {
+                aux_uart_stats.tx_writes++;
+                if (aux_uart_tx_cur.callback != NULL) {
+                    aux_uart_tx_cur.callback(aux_uart_tx_cur.data, aux_uart_tx_cur.len, aux_uart_tx_cur.cb_arg);
+                }
+                aux_uart_tx_cur.data = NULL;
+            }
+            if (xQueueReceiveFromISR(aux_uart_tx_queue, &aux_uart_tx_cur, higher_priority_woken) != pdTRUE) {
+                // nothing left to send, stop the TX interrupt
+                aux_uart_tx_cur.data = NULL;
+                aux_uart_tx_cur.len = 0;
+                aux_uart_tx_pos = 0;
+                aux_uart_tx_active = false;
+                uart_set_irq_enables(UART_ID_AUX, true, false);
+                return;
+            }
+            aux_uart_tx_pos = 0;
+            continue;
+        }
+        uart_get_hw(UART_ID_AUX)->dr = aux_uart_tx_cur.data[aux_uart_tx_pos++];
+        aux_uart_tx_backlog--;
+        aux_uart_stats.tx_bytes++;
+    }
+}
+
+// start up an idle transmitter from a task, inside a critical section. the first
+// queued write is fed into the FIFO as far as it fits, but is left for the ISR to
+// complete - the TX interrupt is raised as the primed FIFO drains, on whichever
+// core services it
+static void aux_uart_tx_prime(void) {
+    if (xQueueReceive(aux_uart_tx_queue, &aux_uart_tx_cur, 0) != pdTRUE) return;
+    aux_uart_tx_pos = 0;
+    while (aux_uart_tx_pos < aux_uart_tx_cur.len && uart_is_writable(UART_ID_AUX)) {
+        uart_get_hw(UART_ID_AUX)->dr = aux_uart_tx_cur.data[aux_uart_tx_pos++];
+        aux_uart_tx_backlog--;
+        aux_uart_stats.tx_bytes++;
+    }
+}
+
+// aux uart interrupt handler (rx and tx)
+static void on_aux_uart_irq() {
+    BaseType_t higher_priority_woken = pdFALSE;
+    uint8_t rx_buf[UART_RX_FIFO_SIZE_AUX];
+    size_t rx_count = 0;
+
+    // check for bytes lost in hardware before we got here, then clear the error
+    if (uart_get_hw(UART_ID_AUX)->rsr & UART_UARTRSR_OE_BITS) {
+        aux_uart_stats.rx_hw_overruns++;
+        hw_clear_bits(&uart_get_hw(UART_ID_AUX)->rsr, UART_UARTRSR_OE_BITS);
+    }
+
+    // drain the rx fifo into the stream buffer in one go
+    while (uart_is_readable(UART_ID_AUX) && rx_count < sizeof(rx_buf)) {
+        rx_buf[rx_count++] = (uint8_t)uart_get_hw(UART_ID_AUX)->dr;
+    }
+    if (rx_count > 0) {
+        size_t rx_sent = xStreamBufferSendFromISR(aux_uart_rx_stream, rx_buf, rx_count, &higher_priority_woken);
+        aux_uart_stats.rx_bytes += rx_sent;
+        aux_uart_stats.rx_overruns += rx_count - rx_sent;
+    }
+
+    // keep the tx fifo fed, the critical section keeps a task from cancelling a
+    // write (see aux_uart_tx_cancel()) in the middle of it
+    if (aux_uart_tx_active) {
+        UBaseType_t saved_irq = taskENTER_CRITICAL_FROM_ISR();
+        aux_uart_tx_fill(&higher_priority_woken);
+        taskEXIT_CRITICAL_FROM_ISR(saved_irq);
+    }
+
+    portYIELD_FROM_ISR(higher_priority_woken);
+}
+
+// completion callback for the blocking aux_uart_write(), cb_arg is the writer's token
+static void aux_uart_write_done(const uint8_t *tx_data, size_t tx_len, void *cb_arg) {
+    aux_uart_write_wait_t *wait = (aux_uart_write_wait_t *)cb_arg;
+    BaseType_t higher_priority_woken = pdFALSE;
+    wait->done = true;
+    vTaskNotifyGiveIndexedFromISR(wait->task, NOTIFY_INDEX_AUX_UART, &higher_priority_woken);
+    portYIELD_FROM_ISR(higher_priority_woken);
+}
+
+// take a blocking write that has not finished off the hardware or out of the
+// queue, so that neither its buffer nor its token are used again. returns false
+// if the write had already completed
+static bool aux_uart_tx_cancel(aux_uart_write_wait_t *wait) {
+    aux_uart_tx_desc_t tx_desc;
+    bool cancelled = false;
+
+    taskENTER_CRITICAL();
+    if (!wait->done) {
+        if (aux_uart_tx_cur.data != NULL && aux_uart_tx_cur.cb_arg == wait) {
+            // being sent now - drop the rest, the ISR moves on to the next write
+            aux_uart_tx_backlog -= aux_uart_tx_cur.len - aux_uart_tx_pos;
+            aux_uart_tx_cur.data = NULL;
+            aux_uart_tx_cur.len = aux_uart_tx_pos;
+        }
+        else {
+            // still queued - rotate the queue once, leaving the write out
+            for (UBaseType_t n = uxQueueMessagesWaiting(aux_uart_tx_queue); n > 0; n--) {
+                xQueueReceive(aux_uart_tx_queue, &tx_desc, 0);
+                if (tx_desc.cb_arg == wait) {
+                    aux_uart_tx_backlog -= tx_desc.len;
+                }
+                else {
+                    xQueueSend(aux_uart_tx_queue, &tx_desc, 0);
+                }
+            }
+        }
+        cancelled = true;
+    }
+    taskEXIT_CRITICAL();
+
+    return cancelled;
+}
+
 void aux_uart_init(void) {
     // The auxilliary uart is a multi-purpose serial interface intended to send
-    // and receive multiple bytes at a time, without any specific servicing
-    // routine implemented. The FIFO is enabled but there is no RX ISR; on
-    // the RP2040 platform this means we have 32 bytes of hw buffer before data
-    // starts getting overwritten by any more incoming bytes.
-    // Refer to cli_uart_init() if the need to implement an RX ISR arises.
+    // and receive multiple bytes at a time (i.e. bridging a GPS or modem). The
+    // FIFO is enabled and an interrupt drains received bytes into a stream
+    // buffer, so the reader does not have to keep up with the 32 byte hw FIFO.
+    // Writes are queued as descriptors and fed to the TX FIFO by the same
+    // interrupt, with an optional completion callback per write.
 
-    // create Aux UART mutex
-    aux_uart_mutex = xSemaphoreCreateMutex();
+    // create Aux UART mutex, buffers and queues
+    aux_uart_mutex = MUTEX_CREATE(aux_uart_mutex);
+    aux_uart_rx_stream = STREAM_BUFFER_CREATE(aux_uart_rx_stream, UART_RX_BUF_SIZE_AUX, 1);
+    aux_uart_tx_queue = QUEUE_CREATE(aux_uart_tx_queue, UART_TX_QUEUE_DEPTH_AUX, sizeof(aux_uart_tx_desc_t));
 
     // initialize uart at defined speed
     uart_init(UART_ID_AUX, UART_BAUD_RATE_AUX);
@@ -153,33 +418,62 @@ void aux_uart_init(void) {
 
     // enable fifos
     uart_set_fifo_enabled(UART_ID_AUX, true);
+
+    // set up RX interrupt, TX interrupt is only enabled while there is data to send
+    irq_set_exclusive_handler(UART_IRQ_AUX, on_aux_uart_irq);
+    irq_set_enabled(UART_IRQ_AUX, true);
+    uart_set_irq_enables(UART_ID_AUX, true, false);
+}
+
+int aux_uart_write_async(const uint8_t *tx_data, size_t tx_len, aux_uart_tx_callback_t callback, void *cb_arg) {
+    aux_uart_tx_desc_t tx_desc = {.data = tx_data, .len = tx_len, .callback = callback, .cb_arg = cb_arg};
+
+    if (tx_data == NULL || tx_len == 0) return 0;
+
+    taskENTER_CRITICAL();
+    if (xQueueSend(aux_uart_tx_queue, &tx_desc, 0) != pdTRUE) {
+        taskEXIT_CRITICAL();
+        aux_uart_stats.tx_queue_full++;
+        return 0;
+    }
+    aux_uart_tx_backlog += tx_len;
+
+    // if the transmitter is idle, prime the FIFO and unmask the TX interrupt in
+    // the UART. writes are only completed (and callbacks only called) by the ISR
+    if (!aux_uart_tx_active) {
+        aux_uart_tx_active = true;
+        aux_uart_tx_prime();
+        uart_set_irq_enables(UART_ID_AUX, true, true);
+    }
+    taskEXIT_CRITICAL();
+
+    return 1;
 }
 
 int aux_uart_write(uint8_t *tx_data, size_t tx_len) {
     int status = 0;
-    if (uart_is_writable(UART_ID_AUX)) {
-        if(xSemaphoreTake(aux_uart_mutex, 10) == pdTRUE) {
-            // if uart is writeable and semaphore is obtained, write the data
-            uart_write_blocking(UART_ID_AUX, tx_data, tx_len);
-            xSemaphoreGive(aux_uart_mutex);
-            status = 1;
+    if(xSemaphoreTake(aux_uart_mutex, 10) == pdTRUE) {
+        aux_uart_write_wait_t wait = {.task = xTaskGetCurrentTaskHandle(), .done = false};
+        ulTaskNotifyTakeIndexed(NOTIFY_INDEX_AUX_UART, pdTRUE, 0); // clear out a stale completion
+        if (aux_uart_write_async(tx_data, tx_len, aux_uart_write_done, &wait)) {
+            // block until the ISR has sent the data (allow 2x the time on the wire for
+            // this write and everything queued ahead of it, plus a tick)
+            TickType_t tx_timeout = pdMS_TO_TICKS(((uint64_t)aux_uart_tx_backlog * 10 * 2 * 1000) / UART_BAUD_RATE_AUX) + 2;
+            ulTaskNotifyTakeIndexed(NOTIFY_INDEX_AUX_UART, pdTRUE, tx_timeout);
+            if (aux_uart_tx_cancel(&wait)) {
+                // gave up, the buffer belongs to the caller again
+                aux_uart_stats.tx_timeouts++;
+            }
+            else {
+                status = 1;
+            }
         }
+        xSemaphoreGive(aux_uart_mutex);
     }
     return status;
 }
 
 int aux_uart_read(uint8_t *rx_data, size_t rx_len) {
-    int rx_pos = 0;
-
-    // read from uart if there is data in the fifo, up to rx_len times
-    while(uart_is_readable(UART_ID_AUX) && rx_pos < rx_len) {
-        // first try to obtain mutex
-        if(xSemaphoreTake(aux_uart_mutex, 10) == pdTRUE) {
-            rx_data[rx_pos] = (uint8_t) uart_getc(UART_ID_AUX);
-            xSemaphoreGive(aux_uart_mutex);
-            rx_pos++;
-        }
-    }
-
-    return rx_pos + 1;
-}
\ No newline at end of file
+    // take whatever the ISR has already received, without blocking
+    return (int)xStreamBufferReceive(aux_uart_rx_stream, rx_data, rx_len, 0);
+}
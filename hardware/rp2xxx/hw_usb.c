@@ -17,14 +17,25 @@
  ******************************************************************************/
 
 #include "hardware_config.h"
+#include "rtos_utils.h"
 #include "pico/stdlib.h"
 #include "hardware/flash.h"
 #include "tusb.h"
+#include "services.h"
+#include "service_events.h"
+#include "task.h"
 #include "semphr.h"
 
 // global USB mutex
 SemaphoreHandle_t usb_mutex;
 
+// global CLI over USB transmit statistics
+cli_usb_stats_t cli_usb_stats;
+
+// signals that TinyUSB has completed a transfer to the host on the CLI interface
+static SemaphoreHandle_t cli_usb_tx_ready;
+#define CLI_USB_TX_WAIT_MS 20 // longest a CLI writer waits for the host before retrying
+
 
 /************************
  * USB Descriptor Setup
@@ -145,8 +156,9 @@ void usb_serialno_init(void) {
 }
 
 void usb_device_init(void) {
-	// create USB mutex
-    usb_mutex = xSemaphoreCreateMutex();
+	// create USB mutex and CLI TX completion semaphore
+    usb_mutex = MUTEX_CREATE(usb_mutex);
+	cli_usb_tx_ready = BINARY_SEMAPHORE_CREATE(cli_usb_tx_ready);
 
 	// generate unique USB device serial no. from RPi Pico unique flash ID
 	usb_serialno_init();
@@ -208,6 +220,67 @@ int cli_usb_putc(char tx_char) {
 	return status;
 }
 
+// TinyUSB hook, called whenever an event is queued for tud_task() to process
+// (usually from the USB ISR) - wakes the USB service to run tud_task()
+void tud_event_hook_cb(uint8_t rhport, uint32_t eventid, bool in_isr) {
+	BaseType_t higher_priority_woken = pdFALSE;
+
+	if (in_isr) {
+		service_events_signal_from_isr(&usb_events, SERVICE_EVENT_IO, &higher_priority_woken);
+		portYIELD_FROM_ISR(higher_priority_woken);
+	}
+	else {
+		service_events_signal(&usb_events, SERVICE_EVENT_IO);
+	}
+}
+
+// TinyUSB callback, runs in the USB task when data is received from the host
+void tud_cdc_rx_cb(uint8_t itf) {
+	if (itf == CDC_ID_CLI) {
+		service_events_signal(&cli_events, SERVICE_EVENT_IO); // wake the CLI to read it
+	}
+}
+
+// TinyUSB callback, runs in the USB task when a transfer to the host completes
+void tud_cdc_tx_complete_cb(uint8_t itf) {
+	if (itf == CDC_ID_CLI) {
+		xSemaphoreGive(cli_usb_tx_ready);
+	}
+}
+
+int cli_usb_write(const char *tx_data, size_t tx_len) {
+	size_t tx_pos = 0;
+	int retries = 0;
+
+	while (tx_pos < tx_len && tud_cdc_n_connected(CDC_ID_CLI)) {
+		uint32_t count = 0;
+		// write as much as the CDC FIFO will take, then flush it as one packet
+		if(xSemaphoreTake(usb_mutex, 10) == pdTRUE) {
+			xSemaphoreTake(cli_usb_tx_ready, 0); // only wake for transfers completed after this write
+			count = tud_cdc_n_write(CDC_ID_CLI, tx_data + tx_pos, tx_len - tx_pos);
+			tud_cdc_n_write_flush(CDC_ID_CLI);
+			xSemaphoreGive(usb_mutex);
+		}
+		if (count > 0) {
+			tx_pos += count;
+			retries = 0;
+		}
+		else if (++retries > 10) {
+			cli_usb_stats.tx_timeouts++;
+			break; // host isn't reading, give up on the rest
+		}
+		else {
+			// FIFO is full, block until the host takes a packet
+			uint64_t wait_start_us = get_time_us();
+			xSemaphoreTake(cli_usb_tx_ready, pdMS_TO_TICKS(CLI_USB_TX_WAIT_MS));
+			cli_usb_stats.tx_wait_us += get_time_us() - wait_start_us;
+			cli_usb_stats.tx_waits++;
+		}
+	}
+
+	return (int)tx_pos;
+}
+
 char cli_usb_getc(void) {
 	char readchar = NOCHAR;
 
@@ -221,4 +294,8 @@ char cli_usb_getc(void) {
 	}
 
 	return readchar;
+}
+
+uint32_t cli_usb_rx_pending(void) {
+	return tud_cdc_n_connected(CDC_ID_CLI) ? tud_cdc_n_available(CDC_ID_CLI) : 0;
 }
\ No newline at end of file
@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <string.h>
 #include "hardware_config.h"
+#include "rtos_utils.h"
 #include "hardware/flash.h"
 #include "hardware/regs/addressmap.h"
 #include "hardware/sync.h"
@@ -30,16 +31,19 @@
 
 const char* FLASH0_FS_BASE = (char*)(PICO_FLASH_SIZE_BYTES - FLASH0_FS_SIZE); // 'flash0' filesystem start address is at the end of flash
 SemaphoreHandle_t onboard_flash_mutex; // global onboard flash mutex
+flash_io_stats_t onboard_flash_io_stats; // global onboard flash I/O counters
 
 void onboard_flash_init(void) {
     // create onboard flash mutex
-    onboard_flash_mutex = xSemaphoreCreateMutex();
+    onboard_flash_mutex = MUTEX_CREATE(onboard_flash_mutex);
 }
 
 int onboard_flash_read(const struct lfs_config *c, uint32_t block, uint32_t offset, void* buffer, uint32_t size) {
     if(xSemaphoreTake(onboard_flash_mutex, 10) == pdTRUE) { // try to acquire flash access
         // copy from address of memory-mapped flash location - read address includes RAM offset XIP_NOCACHE_NOALLOC_BASE
         memcpy(buffer, FLASH0_FS_BASE + XIP_NOCACHE_NOALLOC_BASE + (block * FLASH_SECTOR_SIZE) + offset, size); // note "block" and "sector" are synonomous here
+        onboard_flash_io_stats.reads++;
+        onboard_flash_io_stats.read_bytes += size;
         xSemaphoreGive(onboard_flash_mutex);
         return 0;
     }
@@ -52,6 +56,8 @@ int onboard_flash_write(const struct lfs_config *c, uint32_t block, uint32_t off
         uint32_t interrupts = save_and_disable_interrupts(); // disable interrupts since we are writing to program memory
         flash_range_program(addr, buffer, size);
         restore_interrupts(interrupts); // re-enable interrupts
+        onboard_flash_io_stats.progs++;
+        onboard_flash_io_stats.prog_bytes += size;
         xSemaphoreGive(onboard_flash_mutex);
         return 0;
     }
@@ -64,6 +70,7 @@ int onboard_flash_erase(const struct lfs_config *c, uint32_t block) {
         uint32_t interrupts = save_and_disable_interrupts(); // disable interrupts since we are erasing within program memory
         flash_range_erase(addr, FLASH_SECTOR_SIZE); // erase entire block/sector
         restore_interrupts(interrupts); // re-enable interrupts
+        onboard_flash_io_stats.erases++;
         xSemaphoreGive(onboard_flash_mutex);
         return 0;
     }
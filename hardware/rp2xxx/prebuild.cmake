@@ -12,6 +12,7 @@ set(hardware_libs   "pico_unique_id"
                     "pico_stdlib"
                     "hardware_i2c"
                     "hardware_spi"
+                    "hardware_dma"
                     "hardware_flash"
                     "hardware_adc"
                     "cmsis_core"
@@ -22,14 +22,25 @@
 // FreeRTOS total heap size settings - trial and error to find what linker will accept
 // RP2040 has 264KB RAM total, RP2350 has 520KB RAM total. RTOS heap will be something less than this.
 // Using the wireless stack appears to chew up about 30-40KB.
+// With ENABLE_STATIC_ALLOC the service stacks, queues and kernel task stacks are
+// linked in as static storage instead, so the heap gives up that much RAM.
+// RTOS_STATIC_ALLOC_SIZE is the static RAM report total for the default service
+// set (~34.9KB) plus a ~2KB margin. To regenerate it after changing services,
+// stack sizes or queue depths, build with ENABLE_STATIC_ALLOC and copy the
+// "suggested" value printed by the report (rtos/static_ram_report.cmake).
+#ifdef ENABLE_STATIC_ALLOC
+#define RTOS_STATIC_ALLOC_SIZE (36*1024)
+#else
+#define RTOS_STATIC_ALLOC_SIZE 0
+#endif
 #if defined(USING_RP2350) && !defined(HW_USE_WIFI)
-#define RTOS_HEAP_SIZE (489*1024) // RP2350 without wireless stack
+#define RTOS_HEAP_SIZE ((489*1024) - RTOS_STATIC_ALLOC_SIZE) // RP2350 without wireless stack
 #elif defined(USING_RP2350) && defined(HW_USE_WIFI)
-#define RTOS_HEAP_SIZE (439*1024) // RP2350 with wireless stack
+#define RTOS_HEAP_SIZE ((439*1024) - RTOS_STATIC_ALLOC_SIZE) // RP2350 with wireless stack
 #elif defined(USING_RP2040) && !defined(HW_USE_WIFI)
-#define RTOS_HEAP_SIZE (235*1024) // RP2040 without wireless stack
+#define RTOS_HEAP_SIZE ((235*1024) - RTOS_STATIC_ALLOC_SIZE) // RP2040 without wireless stack
 #elif defined(USING_RP2040) && defined(HW_USE_WIFI)
-#define RTOS_HEAP_SIZE (186*1024) // RP2040 with wireless stack
+#define RTOS_HEAP_SIZE ((186*1024) - RTOS_STATIC_ALLOC_SIZE) // RP2040 with wireless stack
 #endif
 
 // For FreeRTOS SMP (multicore) support only
@@ -39,6 +50,19 @@
 #define RTOS_USE_CORE_AFFINITY           1
 #define RTOS_USE_PASSIVE_IDLE_HOOK       0
 
+// Tickless idle - when every task is blocked, the idle task stops the tick
+// interrupt and sleeps the CPU until the next task is due or an IRQ arrives.
+// Set with the ENABLE_TICKLESS_IDLE option in project.cmake.
+#ifdef ENABLE_TICKLESS_IDLE
+#if RTOS_NUM_CORES > 1
+#error "Tickless idle is not supported by the FreeRTOS SMP port, disable ENABLE_TICKLESS_IDLE"
+#endif
+#define RTOS_USE_TICKLESS_IDLE           1
+#else
+#define RTOS_USE_TICKLESS_IDLE           0
+#endif
+#define RTOS_IDLE_TIME_BEFORE_SLEEP      2 // min OS ticks of idle time worth sleeping for
+
 // RP2040/RP2350-specific FreeRTOS settings
 #define configSUPPORT_PICO_SYNC_INTEROP  1
 #define configSUPPORT_PICO_TIME_INTEROP  1
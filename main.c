@@ -16,6 +16,8 @@
 #include "hardware_config.h"
 #include "device_drivers.h"
 #include "services/services.h"
+#include "mem_pool.h"
+#include "stack_monitor.h"
 #include "task.h"
 
 
@@ -25,6 +27,12 @@
 
 void main()
 {
+    // set up the scratch buffer pools before anything can use them
+    mem_pool_init();
+
+    // pick up the record of a stack overflow that caused the last reboot, if any
+    stack_mon_init();
+
     // initialize hardware
     hardware_init();
 
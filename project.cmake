@@ -19,4 +19,7 @@ set(HOSTNAME "bbos")
 # BUILD OPTIONS - individual features which can be enabled or disabled
 option(ENABLE_MOTD "Enable Message of the Day print at boot" true)
 option(ENABLE_WIFI "Enable WiFi support" true)
-option(ENABLE_HTTPD "Enable httpd web server" true)
\ No newline at end of file
+option(ENABLE_HTTPD "Enable httpd web server" true)
+option(ENABLE_TICKLESS_IDLE "Enable FreeRTOS tickless idle (CPU sleeps when no service is due to run)" false)
+option(ENABLE_STATIC_ALLOC "Create services, queues and mutexes in static storage instead of the RTOS heap" false)
+option(ENABLE_HEAP_TRACE "Track heap allocations per task for the 'heap' command" true)
\ No newline at end of file
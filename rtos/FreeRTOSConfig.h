@@ -58,7 +58,8 @@
 
 /* Scheduler Related */
 #define configUSE_PREEMPTION                    1
-#define configUSE_TICKLESS_IDLE                 0
+#define configUSE_TICKLESS_IDLE                 RTOS_USE_TICKLESS_IDLE // see rtos_config.h
+#define configEXPECTED_IDLE_TIME_BEFORE_SLEEP   RTOS_IDLE_TIME_BEFORE_SLEEP
 #define configUSE_IDLE_HOOK                     0
 #define configUSE_TICK_HOOK                     0
 #define configTICK_RATE_HZ                      ( ( TickType_t ) 1000 )
@@ -79,27 +80,48 @@
 #define configUSE_NEWLIB_REENTRANT              0
 #define configENABLE_BACKWARD_COMPATIBILITY     1 // needed for lwip FreeRTOS compatibility
 #define configNUM_THREAD_LOCAL_STORAGE_POINTERS 5
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES   7 // see NOTIFY_INDEX_* in rtos_utils.h
 
 /* System */
 #define configSTACK_DEPTH_TYPE                  uint32_t
 #define configMESSAGE_BUFFER_LENGTH_TYPE        size_t
 
 /* Memory allocation related definitions. */
+#ifdef ENABLE_STATIC_ALLOC
+#define configSUPPORT_STATIC_ALLOCATION         1 // services, queues and mutexes in static storage, see rtos_utils.h
+#else
 #define configSUPPORT_STATIC_ALLOCATION         0
+#endif
 #define configSUPPORT_DYNAMIC_ALLOCATION        1
 #define configTOTAL_HEAP_SIZE                   RTOS_HEAP_SIZE // defined in hardware-specific CMakeLists.txt
 #define configAPPLICATION_ALLOCATED_HEAP        0
 
 /* Hook function related definitions. */
-#define configCHECK_FOR_STACK_OVERFLOW          0
+#define configCHECK_FOR_STACK_OVERFLOW          2 /* canary check on each context switch, see stack_monitor.h */
 #define configUSE_MALLOC_FAILED_HOOK            0
 #define configUSE_DAEMON_TASK_STARTUP_HOOK      0
+#if configUSE_TICKLESS_IDLE
+/* sleep statistics for '/proc/power', defined in rtos_utils.c */
+extern void rtos_sleep_enter(uint32_t expected_idle_ticks);
+extern void rtos_sleep_exit(uint32_t expected_idle_ticks);
+#define configPRE_SLEEP_PROCESSING(x)           rtos_sleep_enter(x)
+#define configPOST_SLEEP_PROCESSING(x)          rtos_sleep_exit(x)
+#endif
 
 /* Run time and task stats gathering related definitions. */
 #define configGENERATE_RUN_TIME_STATS           1
 #define configUSE_TRACE_FACILITY                1
 #define configUSE_STATS_FORMATTING_FUNCTIONS    1
 #define configRECORD_STACK_HIGH_ADDRESS         1
+#ifdef ENABLE_HEAP_TRACE
+/* per-task heap allocation tracking for '/bin/heap', see heap_trace.h. the
+   hooks expand inside pvPortMalloc(), so the return address is the call site */
+#include <stddef.h>
+extern void heap_trace_malloc(void *addr, size_t size, void *call_site);
+extern void heap_trace_free(void *addr);
+#define traceMALLOC(addr, size)                 heap_trace_malloc((addr), (size), __builtin_return_address(0))
+#define traceFREE(addr, size)                   heap_trace_free(addr)
+#endif
 
 /* Co-routine related definitions. */
 #define configUSE_CO_ROUTINES                   0
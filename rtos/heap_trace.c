@@ -0,0 +1,105 @@
+/******************************************************************************
+ * @file heap_trace.c
+ *
+ * @brief Heap allocation tracker - per-task attribution of FreeRTOS heap use.
+ *        See heap_trace.h.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include "heap_trace.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define HEAP_TRACE_NO_OWNER 0xFF
+
+// tracking tables and statistics (extern declared in heap_trace.h).
+// entry 0 of the task table holds allocations made before the scheduler started
+heap_trace_alloc_t heap_trace_allocs[HEAP_TRACE_ALLOCS_MAX];
+heap_trace_task_t heap_trace_tasks[HEAP_TRACE_TASKS_MAX] = {
+    {.task = NULL, .name = "boot"}
+};
+heap_trace_stats_t heap_trace_stats;
+
+// find (or add) the task table entry for the calling task
+static uint8_t heap_trace_owner(void) {
+    TaskHandle_t task;
+    const char *name;
+
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) return 0;
+
+    task = xTaskGetCurrentTaskHandle();
+    name = pcTaskGetName(task);
+    for (int i = 1; i < HEAP_TRACE_TASKS_MAX; i++) {
+        // a deleted task's handle can be reused by a new task, so the name must match too
+        if (heap_trace_tasks[i].task == task &&
+            strncmp(heap_trace_tasks[i].name, name, configMAX_TASK_NAME_LEN) == 0) {
+            return i;
+        }
+        if (heap_trace_tasks[i].task == NULL) {
+            heap_trace_tasks[i].task = task;
+            strncpy(heap_trace_tasks[i].name, name, configMAX_TASK_NAME_LEN - 1);
+            return i;
+        }
+    }
+
+    return HEAP_TRACE_NO_OWNER;
+}
+
+void heap_trace_malloc(void *addr, size_t size, void *call_site) {
+    uint8_t owner = heap_trace_owner();
+    heap_trace_task_t *owner_stats;
+
+    if (owner == HEAP_TRACE_NO_OWNER) {
+        heap_trace_stats.dropped_tasks++;
+        return;
+    }
+    owner_stats = &heap_trace_tasks[owner];
+
+    if (addr == NULL) {
+        owner_stats->failures++;
+        return;
+    }
+
+    owner_stats->allocs++;
+    owner_stats->live_bytes += size;
+    if (owner_stats->live_bytes > owner_stats->peak_bytes) {
+        owner_stats->peak_bytes = owner_stats->live_bytes;
+    }
+
+    // record the allocation so that the free can be attributed to its owner
+    for (int i = 0; i < HEAP_TRACE_ALLOCS_MAX; i++) {
+        if (heap_trace_allocs[i].addr == NULL) {
+            heap_trace_allocs[i].addr = addr;
+            heap_trace_allocs[i].call_site = (uint32_t)call_site;
+            heap_trace_allocs[i].size = size;
+            heap_trace_allocs[i].owner = owner;
+            return;
+        }
+    }
+    // table full - the bytes stay counted against the owner, as the free can't be matched
+    heap_trace_stats.untracked_allocs++;
+}
+
+void heap_trace_free(void *addr) {
+    if (addr == NULL) return; // would match an unused entry
+    for (int i = 0; i < HEAP_TRACE_ALLOCS_MAX; i++) {
+        if (heap_trace_allocs[i].addr == addr) {
+            heap_trace_task_t *owner_stats = &heap_trace_tasks[heap_trace_allocs[i].owner];
+            owner_stats->live_bytes -= heap_trace_allocs[i].size;
+            owner_stats->frees++;
+            heap_trace_allocs[i].addr = NULL;
+            return;
+        }
+    }
+    heap_trace_stats.untracked_frees++;
+}
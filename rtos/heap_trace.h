@@ -0,0 +1,90 @@
+/******************************************************************************
+ * @file heap_trace.h
+ *
+ * @brief Heap allocation tracker. Hooks the FreeRTOS heap's traceMALLOC and
+ *        traceFREE macros to record every live allocation - owning task, size
+ *        and call site - in a fixed table, and keeps live bytes, peak bytes
+ *        and allocation counts for each task. Shown by '/bin/heap'.
+ *
+ *        Enabled with the ENABLE_HEAP_TRACE option in project.cmake. The hooks
+ *        run inside the heap's own scheduler lock and only do a table search,
+ *        so the overhead is small enough to leave in production builds.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#ifndef HEAP_TRACE_H
+#define HEAP_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+#define HEAP_TRACE_ALLOCS_MAX   128 // live allocations tracked, later ones are only counted
+#define HEAP_TRACE_TASKS_MAX    16  // tasks tracked, including the "boot" entry
+
+// a live allocation
+typedef struct heap_trace_alloc_t {
+    void *addr;             // address returned by pvPortMalloc(), NULL if the entry is free
+    uint32_t call_site;     // return address of the pvPortMalloc() call
+    uint32_t size;          // bytes taken from the heap, including the heap's block header
+    uint8_t owner;          // index of the owning task in heap_trace_tasks[]
+} heap_trace_alloc_t;
+
+// allocation statistics for a task
+typedef struct heap_trace_task_t {
+    TaskHandle_t task;                      // owning task, NULL for allocations before the scheduler started
+    char name[configMAX_TASK_NAME_LEN];     // task name, kept after the task is deleted
+    uint32_t live_bytes;                    // bytes currently allocated
+    uint32_t peak_bytes;                    // most bytes ever allocated at once
+    uint32_t allocs;                        // successful allocations
+    uint32_t frees;                         // frees of tracked allocations
+    uint32_t failures;                      // allocations the heap could not satisfy
+} heap_trace_task_t;
+
+// heap trace statistics
+typedef struct heap_trace_stats_t {
+    uint32_t untracked_allocs;  // allocations not recorded because the table was full
+    uint32_t untracked_frees;   // frees of allocations that were not recorded
+    uint32_t dropped_tasks;     // allocations by tasks beyond HEAP_TRACE_TASKS_MAX, not attributed
+} heap_trace_stats_t;
+
+// tracking tables and statistics
+extern heap_trace_alloc_t heap_trace_allocs[HEAP_TRACE_ALLOCS_MAX];
+extern heap_trace_task_t heap_trace_tasks[HEAP_TRACE_TASKS_MAX];
+extern heap_trace_stats_t heap_trace_stats;
+
+/**
+* @brief Record an allocation.
+*
+* Called by traceMALLOC() in pvPortMalloc(), with the scheduler suspended.
+*
+* @param addr      address returned by the heap, NULL if the allocation failed
+* @param size      bytes taken from the heap
+* @param call_site return address of the pvPortMalloc() call
+*
+* @return nothing
+*/
+void heap_trace_malloc(void *addr, size_t size, void *call_site);
+
+/**
+* @brief Record a free.
+*
+* Called by traceFREE() in vPortFree(), with the scheduler suspended.
+*
+* @param addr address being freed
+*
+* @return nothing
+*/
+void heap_trace_free(void *addr);
+
+#endif /* HEAP_TRACE_H */
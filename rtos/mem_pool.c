@@ -0,0 +1,115 @@
+/******************************************************************************
+ * @file mem_pool.c
+ *
+ * @brief Fixed-block memory pools for short-lived scratch buffers.
+ *        See mem_pool.h.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mem_pool.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define MEM_POOL_CLASS_BYTES(size, count) + ((size) * (count))
+#define MEM_POOL_TOTAL_BYTES (0 MEM_POOL_CLASSES(MEM_POOL_CLASS_BYTES))
+#define MEM_POOL_CLASS_INIT(size, count) {.block_size = (size), .blocks = (count)},
+
+// free blocks are linked through their first word
+typedef struct mem_pool_block_t {
+    struct mem_pool_block_t *next;
+} mem_pool_block_t;
+
+// pool storage - the classes are laid out one after another, smallest first,
+// so a block's class is found from its address alone
+static uint8_t *mem_pool_storage;
+static uint8_t *mem_pool_class_end[MEM_POOL_NUM_CLASSES];
+static mem_pool_block_t *mem_pool_free_list[MEM_POOL_NUM_CLASSES];
+
+// global pool statistics (extern declared in mem_pool.h)
+mem_pool_stats_t mem_pool_stats[MEM_POOL_NUM_CLASSES] = {
+    MEM_POOL_CLASSES(MEM_POOL_CLASS_INIT)
+};
+uint32_t mem_pool_heap_fallbacks;
+
+bool mem_pool_init(void) {
+    uint8_t *block;
+
+    // heap allocations are 8-byte aligned, and block sizes are multiples of 8
+    mem_pool_storage = pvPortMalloc(MEM_POOL_TOTAL_BYTES);
+    if (mem_pool_storage == NULL) return false; // everything will come from the heap instead
+
+    // carve each class into blocks and put them all on its free list
+    block = mem_pool_storage;
+    for (int class = 0; class < MEM_POOL_NUM_CLASSES; class++) {
+        mem_pool_free_list[class] = NULL;
+        for (int i = 0; i < mem_pool_stats[class].blocks; i++) {
+            ((mem_pool_block_t *)block)->next = mem_pool_free_list[class];
+            mem_pool_free_list[class] = (mem_pool_block_t *)block;
+            block += mem_pool_stats[class].block_size;
+        }
+        mem_pool_class_end[class] = block;
+    }
+
+    return true;
+}
+
+void *mem_pool_alloc(size_t size) {
+    mem_pool_block_t *block = NULL;
+
+    for (int class = 0; class < MEM_POOL_NUM_CLASSES && block == NULL; class++) {
+        if (size > mem_pool_stats[class].block_size) continue;
+
+        taskENTER_CRITICAL();
+        block = mem_pool_free_list[class];
+        if (block != NULL) {
+            mem_pool_free_list[class] = block->next;
+            mem_pool_stats[class].allocs++;
+            if (++mem_pool_stats[class].in_use > mem_pool_stats[class].high_water) {
+                mem_pool_stats[class].high_water = mem_pool_stats[class].in_use;
+            }
+        }
+        else {
+            mem_pool_stats[class].exhausted++;
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    if (block == NULL) {
+        mem_pool_heap_fallbacks++;
+        return pvPortMalloc(size);
+    }
+    return block;
+}
+
+void mem_pool_free(void *ptr) {
+    uint8_t *addr = ptr;
+
+    if (ptr == NULL) return;
+
+    // anything outside of the pool storage came from the heap
+    if (mem_pool_storage == NULL || addr < mem_pool_storage || addr >= mem_pool_class_end[MEM_POOL_NUM_CLASSES - 1]) {
+        vPortFree(ptr);
+        return;
+    }
+
+    for (int class = 0; class < MEM_POOL_NUM_CLASSES; class++) {
+        if (addr < mem_pool_class_end[class]) {
+            taskENTER_CRITICAL();
+            ((mem_pool_block_t *)addr)->next = mem_pool_free_list[class];
+            mem_pool_free_list[class] = (mem_pool_block_t *)addr;
+            mem_pool_stats[class].in_use--;
+            taskEXIT_CRITICAL();
+            break;
+        }
+    }
+}
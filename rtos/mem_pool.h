@@ -0,0 +1,93 @@
+/******************************************************************************
+ * @file mem_pool.h
+ *
+ * @brief Fixed-block memory pools for short-lived scratch buffers. Blocks come
+ *        in a few size classes, each kept on its own free list, so allocating
+ *        and freeing take constant time and never fragment the FreeRTOS heap.
+ *        Requests that no pool block can serve fall back to pvPortMalloc().
+ *        Pool usage is shown by '/bin/free'.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// pool size classes, smallest first - block size in bytes, number of blocks.
+// block sizes must be multiples of 8 to keep every block 8-byte aligned
+#define MEM_POOL_CLASSES(X) \
+    X(64,   16) \
+    X(256,  8) \
+    X(1024, 4)
+
+#define MEM_POOL_COUNT_CLASS(size, count) + 1
+#define MEM_POOL_NUM_CLASSES (0 MEM_POOL_CLASSES(MEM_POOL_COUNT_CLASS))
+
+// size class statistics
+typedef struct mem_pool_stats_t {
+    uint16_t block_size;    // bytes per block
+    uint16_t blocks;        // number of blocks in the class
+    uint16_t in_use;        // blocks currently allocated
+    uint16_t high_water;    // most blocks ever allocated at once
+    uint32_t allocs;        // allocations served from this class
+    uint32_t exhausted;     // requests that found this class empty and moved on
+} mem_pool_stats_t;
+
+// global pool statistics, one entry per size class
+extern mem_pool_stats_t mem_pool_stats[MEM_POOL_NUM_CLASSES];
+
+// number of requests served from the FreeRTOS heap instead, because they were
+// bigger than the largest block or every big enough block was in use
+extern uint32_t mem_pool_heap_fallbacks;
+
+/**
+* @brief Set up the memory pools.
+*
+* Takes the storage for all of the pools from the FreeRTOS heap in a single
+* allocation that is never freed. Call once at boot, before anything uses
+* mem_pool_alloc().
+*
+* @param none
+*
+* @return true if the pools were set up, false if the heap could not hold them
+*/
+bool mem_pool_init(void);
+
+/**
+* @brief Allocate a scratch buffer.
+*
+* Takes a block from the smallest size class that fits, or from the next
+* larger class if that one is empty. Falls back to pvPortMalloc() if no block
+* is available. Not safe to call from an ISR.
+*
+* @param size number of bytes needed
+*
+* @return pointer to the buffer, NULL if it could not be allocated
+*/
+void *mem_pool_alloc(size_t size);
+
+/**
+* @brief Free a buffer from mem_pool_alloc().
+*
+* Blocks go back on their class's free list, buffers that were served from the
+* heap are passed to vPortFree(). NULL is ignored.
+*
+* @param ptr pointer returned by mem_pool_alloc()
+*
+* @return nothing
+*/
+void mem_pool_free(void *ptr);
+
+#endif /* MEM_POOL_H */
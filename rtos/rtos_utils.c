@@ -14,6 +14,7 @@
  ******************************************************************************/
 
 #include <stdint.h>
+#include <string.h>
 #include "hardware_config.h"
 #include "rtos_utils.h"
 #include "FreeRTOSConfig.h"
@@ -35,7 +36,145 @@ void task_sched_update(uint32_t repeat, const TickType_t delay) {
     }
 }
 
+// registry of periodic tasks (extern declared in rtos_utils.h)
+task_period_t *task_periods[TASK_PERIODS_MAX];
+
+void task_period_init(task_period_t *tp, const char *name, const TickType_t period, uint32_t budget_us) {
+    memset(tp, 0, sizeof(task_period_t));
+    tp->name = name;
+    tp->period = period;
+    tp->budget_us = budget_us;
+    tp->last_wake = xTaskGetTickCount();
+    tp->wake_us = get_time_us();
+
+    // register the schedule, unless it already is (i.e. the service was restarted)
+    taskENTER_CRITICAL();
+    for (int i = 0; i < TASK_PERIODS_MAX; i++) {
+        if (task_periods[i] == tp) break;
+        if (task_periods[i] == NULL) {
+            task_periods[i] = tp;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
+void task_period_wait(task_period_t *tp) {
+    uint64_t now_us;
+    uint32_t exec_us;
+    uint32_t interval_us;
+    uint32_t period_us = (uint32_t)(((uint64_t)tp->period * 1000000) / configTICK_RATE_HZ);
+
+#ifdef SCHED_TEST_DELAY
+    // used for OS scheduler testing, see task_sched_update()
+    wait_here_us(1000);
+#endif
+
+    // execution time of the cycle that just finished (includes any preemption)
+    now_us = get_time_us();
+    exec_us = (uint32_t)(now_us - tp->wake_us);
+    tp->exec_total_us += exec_us;
+    if (exec_us > tp->exec_max_us) tp->exec_max_us = exec_us;
+    if (tp->budget_us != 0 && exec_us > tp->budget_us) tp->budget_overruns++;
+    tp->cycles++;
+
+    if (xTaskDelayUntil(&tp->last_wake, tp->period) == pdTRUE) {
+        // start jitter is how far the time between cycle starts was from the period
+        now_us = get_time_us();
+        interval_us = (uint32_t)(now_us - tp->wake_us);
+        interval_us = (interval_us > period_us) ? interval_us - period_us : period_us - interval_us;
+        tp->jitter_total_us += interval_us;
+        if (interval_us > tp->jitter_max_us) tp->jitter_max_us = interval_us;
+    }
+    else {
+        // the next period had already started, resync to now rather than
+        // running cycles back-to-back to catch up
+        tp->overruns++;
+        tp->last_wake = xTaskGetTickCount();
+        now_us = get_time_us();
+    }
+    tp->wake_us = now_us;
+}
+
 void task_delay_ms(uint32_t delay_ms) {
     TickType_t delay_ticks = (TickType_t)(delay_ms * configTICK_RATE_HZ / 1000); // convert millisecond delay to OS ticks
     vTaskDelay(delay_ticks);
-}
\ No newline at end of file
+}
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+BaseType_t task_create_static(TaskFunction_t func, const char *name, configSTACK_DEPTH_TYPE stack_depth, void *params,
+                              UBaseType_t priority, StackType_t *stack, StaticTask_t *tcb, TaskHandle_t *handle) {
+    TaskHandle_t task = xTaskCreateStatic(func, name, stack_depth, params, priority, stack, tcb);
+
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return (task != NULL) ? pdPASS : errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+}
+
+// the kernel's own tasks also need static storage once static allocation is enabled
+static StaticTask_t rtos_idle_static_tcb;
+static StackType_t rtos_idle_static_stack[configMINIMAL_STACK_SIZE];
+void vApplicationGetIdleTaskMemory(StaticTask_t **tcb, StackType_t **stack, configSTACK_DEPTH_TYPE *stack_depth) {
+    *tcb = &rtos_idle_static_tcb;
+    *stack = rtos_idle_static_stack;
+    *stack_depth = configMINIMAL_STACK_SIZE;
+}
+
+#if (configNUMBER_OF_CORES > 1)
+static StaticTask_t rtos_passive_idle_static_tcb[configNUMBER_OF_CORES - 1];
+static StackType_t rtos_passive_idle_static_stack[configNUMBER_OF_CORES - 1][configMINIMAL_STACK_SIZE];
+void vApplicationGetPassiveIdleTaskMemory(StaticTask_t **tcb, StackType_t **stack, configSTACK_DEPTH_TYPE *stack_depth,
+                                          BaseType_t passive_idle_index) {
+    *tcb = &rtos_passive_idle_static_tcb[passive_idle_index];
+    *stack = rtos_passive_idle_static_stack[passive_idle_index];
+    *stack_depth = configMINIMAL_STACK_SIZE;
+}
+#endif
+
+static StaticTask_t rtos_timer_static_tcb;
+static StackType_t rtos_timer_static_stack[configTIMER_TASK_STACK_DEPTH];
+void vApplicationGetTimerTaskMemory(StaticTask_t **tcb, StackType_t **stack, configSTACK_DEPTH_TYPE *stack_depth) {
+    *tcb = &rtos_timer_static_tcb;
+    *stack = rtos_timer_static_stack;
+    *stack_depth = configTIMER_TASK_STACK_DEPTH;
+}
+#endif
+
+bool task_set_core_affinity(TaskHandle_t task, UBaseType_t core_mask) {
+#if (configNUMBER_OF_CORES > 1) && (configUSE_CORE_AFFINITY == 1)
+    vTaskCoreAffinitySet(task, (core_mask == 0) ? tskNO_AFFINITY : core_mask);
+    return true;
+#else
+    return false;
+#endif
+}
+
+UBaseType_t task_get_core_affinity(TaskHandle_t task) {
+#if (configNUMBER_OF_CORES > 1) && (configUSE_CORE_AFFINITY == 1)
+    UBaseType_t core_mask = vTaskCoreAffinityGet(task);
+    // any mask covering every core is the same as no affinity
+    return ((core_mask & ((1 << configNUMBER_OF_CORES) - 1)) == ((1 << configNUMBER_OF_CORES) - 1)) ? 0 : core_mask;
+#else
+    return 0;
+#endif
+}
+
+// global low power statistics (extern declared in rtos_utils.h)
+rtos_power_stats_t rtos_power_stats;
+
+void rtos_sleep_enter(uint32_t expected_idle_ticks) {
+    rtos_power_stats.enter_us = get_time_us();
+}
+
+void rtos_sleep_exit(uint32_t expected_idle_ticks) {
+    // the microsecond timer keeps running while the CPU sleeps, so it measures
+    // the real sleep time whether the sleep ran its course or an IRQ cut it short
+    uint32_t sleep_us = (uint32_t)(get_time_us() - rtos_power_stats.enter_us);
+
+    rtos_power_stats.sleeps++;
+    rtos_power_stats.sleep_us += sleep_us;
+    rtos_power_stats.expected_ticks += expected_idle_ticks;
+    if (sleep_us > rtos_power_stats.sleep_max_us) {
+        rtos_power_stats.sleep_max_us = sleep_us;
+    }
+}
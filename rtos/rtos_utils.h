@@ -17,24 +17,214 @@
 #define RTOS_UTILS_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "FreeRTOS.h"
 #include "task.h"
 
 
+// task notification array indexes (up to configTASK_NOTIFICATION_ARRAY_ENTRIES).
+// index 0 is used by the non-indexed xTaskNotify()/ulTaskNotifyTake() APIs
+#define NOTIFY_INDEX_DEFAULT    0
+#define NOTIFY_INDEX_STORMAN    1 // storagemanager request completion, see storman_request_wait()
+#define NOTIFY_INDEX_EVENTS     2 // event-driven service events, see service_events.h
+#define NOTIFY_INDEX_SPI        3 // SPI transaction completion, see spi_dev_transfer()
+#define NOTIFY_INDEX_I2C        4 // I2C transaction completion, see i2c_transfer()
+#define NOTIFY_INDEX_ADC        5 // new ADC stream samples, see adc_stream_subscribe()
+#define NOTIFY_INDEX_AUX_UART   6 // aux UART write completion, see aux_uart_write()
+
+// RTOS object creation. Services, queues, mutexes and semaphores are created
+// with these instead of the FreeRTOS create functions so that a build with
+// ENABLE_STATIC_ALLOC (see project.cmake) places them in statically allocated
+// RAM at link time rather than taking them from the FreeRTOS heap at boot.
+// The label names the storage - services use their SERVICE_NAME, so that
+// TASK_CREATE(SERVICE_NAME_CLI, ...) gives cli_static_stack and cli_static_tcb,
+// and other objects use the name of their handle variable. The post-build RAM
+// budget report totals the storage by label. Each call site gets its own storage, so a call
+// site must only create one object at a time - re-running it (e.g. restarting
+// a deleted service) reuses the same storage.
+#define RTOS_CAT_(a, b) a##b
+#define RTOS_CAT(a, b)  RTOS_CAT_(a, b) // expands its arguments before pasting, so labels can be #defines
+#ifdef ENABLE_STATIC_ALLOC
+#define TASK_CREATE(label, func, name, stack_depth, params, priority, handle) \
+    ({ static StackType_t RTOS_CAT(label, _static_stack)[stack_depth]; \
+       static StaticTask_t RTOS_CAT(label, _static_tcb); \
+       task_create_static((func), (name), (stack_depth), (params), (priority), \
+                          RTOS_CAT(label, _static_stack), &RTOS_CAT(label, _static_tcb), (handle)); })
+#define QUEUE_CREATE(label, depth, item_size) \
+    ({ static uint8_t RTOS_CAT(label, _static_storage)[(depth) * (item_size)]; \
+       static StaticQueue_t RTOS_CAT(label, _static_queue); \
+       xQueueCreateStatic((depth), (item_size), RTOS_CAT(label, _static_storage), &RTOS_CAT(label, _static_queue)); })
+#define MUTEX_CREATE(label) \
+    ({ static StaticSemaphore_t RTOS_CAT(label, _static_sem); \
+       xSemaphoreCreateMutexStatic(&RTOS_CAT(label, _static_sem)); })
+#define BINARY_SEMAPHORE_CREATE(label) \
+    ({ static StaticSemaphore_t RTOS_CAT(label, _static_sem); \
+       xSemaphoreCreateBinaryStatic(&RTOS_CAT(label, _static_sem)); })
+#define STREAM_BUFFER_CREATE(label, size, trigger_level) \
+    ({ static uint8_t RTOS_CAT(label, _static_storage)[(size) + 1]; \
+       static StaticStreamBuffer_t RTOS_CAT(label, _static_stream); \
+       xStreamBufferCreateStatic((size), (trigger_level), RTOS_CAT(label, _static_storage), &RTOS_CAT(label, _static_stream)); })
+#else
+#define TASK_CREATE(label, func, name, stack_depth, params, priority, handle) \
+    xTaskCreate((func), (name), (stack_depth), (params), (priority), (handle))
+#define QUEUE_CREATE(label, depth, item_size)               xQueueCreate((depth), (item_size))
+#define MUTEX_CREATE(label)                                 xSemaphoreCreateMutex()
+#define BINARY_SEMAPHORE_CREATE(label)                      xSemaphoreCreateBinary()
+#define STREAM_BUFFER_CREATE(label, size, trigger_level)    xStreamBufferCreate((size), (trigger_level))
+#endif
+
+// periodic task schedule and statistics, see task_period_init()
+#define TASK_PERIODS_MAX        12 // max number of periodic tasks tracked for /proc/sched
+typedef struct task_period_t {
+    const char *name;           // name to show in stats, normally the service name
+    TickType_t period;          // OS ticks between the start of each cycle
+    uint32_t budget_us;         // CPU budget for each cycle, 0 for none
+    TickType_t last_wake;       // reference wake time for xTaskDelayUntil()
+    uint64_t wake_us;           // time the current cycle started
+    uint32_t cycles;            // number of cycles run
+    uint64_t exec_total_us;     // sum of cycle execution times, for the average
+    uint32_t exec_max_us;       // longest cycle execution time
+    uint64_t jitter_total_us;   // sum of cycle start jitter, for the average
+    uint32_t jitter_max_us;     // worst cycle start jitter (deviation from the period)
+    uint32_t overruns;          // cycles that ran past the start of the next period
+    uint32_t budget_overruns;   // cycles that ran longer than the CPU budget
+} task_period_t;
+
+// registry of periodic tasks, for reporting stats
+extern task_period_t *task_periods[TASK_PERIODS_MAX];
+
+// low power (tickless idle) sleep statistics, see rtos_sleep_enter()
+typedef struct rtos_power_stats_t {
+    uint32_t sleeps;            // number of times the idle task put the CPU to sleep
+    uint64_t sleep_us;          // total time spent asleep
+    uint32_t sleep_max_us;      // longest single sleep
+    uint64_t expected_ticks;    // sum of the idle time the kernel expected for each sleep
+    uint64_t enter_us;          // time the current sleep started
+} rtos_power_stats_t;
+
+// global low power statistics
+extern rtos_power_stats_t rtos_power_stats;
+
+
 /**
 * @brief Check and update task against scheduler parameters.
 *
-* Checks the current task's OS scheduler info and compares against pre-defined
-* schedule parameters (see services.h), blocking the task if necessary per the
-* given parameters.
+* Checks the current task's OS scheduler info and compares against the given
+* schedule parameters, blocking the task if necessary. Note that the delay is
+* relative to the end of the task's work, so the period drifts with execution
+* time - the built-in services use task_period_init()/task_period_wait() instead.
 *
-* @param repeat number of times to repeat a task, see services.h
-* @param delay  number of OS ticks to block a task, see services.h
+* @param repeat number of times to repeat a task before blocking
+* @param delay  number of OS ticks to block a task
 *
 * @return nothing
 */
 void task_sched_update(uint32_t repeat, const TickType_t delay);
 
+/**
+* @brief Set up a periodic task schedule.
+*
+* Call once at the start of a task, before its main loop, and then call
+* task_period_wait() at the end of every loop iteration. The task will then
+* start each cycle a fixed period after the start of the previous one,
+* regardless of how long the cycle took to execute (unlike a fixed delay at
+* the end of the loop, which lets the period drift with execution time). The
+* schedule is registered so its statistics can be shown in '/proc/sched'.
+*
+* @param tp        pointer to the task's schedule, must remain valid (static) while the task runs
+* @param name      name to show in stats
+* @param period    OS ticks between the start of each cycle
+* @param budget_us CPU budget for each cycle in microseconds, 0 for none
+*
+* @return nothing
+*/
+void task_period_init(task_period_t *tp, const char *name, const TickType_t period, uint32_t budget_us);
+
+/**
+* @brief Finish a periodic task cycle and block until the next one.
+*
+* Records execution time and budget overruns for the cycle that just finished,
+* blocks the task with xTaskDelayUntil() until its next period starts, and then
+* records the start jitter of the new cycle. If a cycle has overrun its period,
+* the schedule is resynchronized rather than running back-to-back cycles to
+* catch up.
+*
+* @param tp pointer to the task's schedule, set up with task_period_init()
+*
+* @return nothing
+*/
+void task_period_wait(task_period_t *tp);
+
+/**
+* @brief Create a task in static storage.
+*
+* Used by TASK_CREATE() in ENABLE_STATIC_ALLOC builds, so that a statically
+* allocated task is created with the same return value and handle output as
+* xTaskCreate().
+*
+* @param func        task function
+* @param name        task name
+* @param stack_depth task stack size in words, the size of the stack array
+* @param params      parameter passed to the task function
+* @param priority    task priority
+* @param stack       stack storage, stack_depth words
+* @param tcb         task control block storage
+* @param handle      pointer to return the created task's handle in, or NULL
+*
+* @return pdPASS if the task was created, otherwise errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY
+*/
+BaseType_t task_create_static(TaskFunction_t func, const char *name, configSTACK_DEPTH_TYPE stack_depth, void *params,
+                              UBaseType_t priority, StackType_t *stack, StaticTask_t *tcb, TaskHandle_t *handle);
+
+/**
+* @brief Set which cores a task may run on.
+*
+* Only has an effect on SMP builds with core affinity enabled (RTOS_NUM_CORES > 1
+* in rtos_config.h), on single core builds every task runs on core 0. The task
+* moves to an allowed core the next time it is scheduled.
+*
+* @param task      handle of the task, NULL for the calling task
+* @param core_mask bitmask of the cores the task may run on, 0 for any core
+*
+* @return true if the affinity was set, false if the build does not support it
+*/
+bool task_set_core_affinity(TaskHandle_t task, UBaseType_t core_mask);
+
+/**
+* @brief Get which cores a task may run on.
+*
+* @param task handle of the task, NULL for the calling task
+*
+* @return bitmask of the cores the task may run on, 0 for any core (always 0 on single core builds)
+*/
+UBaseType_t task_get_core_affinity(TaskHandle_t task);
+
+/**
+* @brief Record the start of a tickless idle sleep.
+*
+* Called by the FreeRTOS idle task through configPRE_SLEEP_PROCESSING() just
+* before the CPU is put to sleep, with interrupts masked. Only used when the
+* build is configured with ENABLE_TICKLESS_IDLE.
+*
+* @param expected_idle_ticks OS ticks until the kernel next needs to run a task
+*
+* @return nothing
+*/
+void rtos_sleep_enter(uint32_t expected_idle_ticks);
+
+/**
+* @brief Record the end of a tickless idle sleep.
+*
+* Called through configPOST_SLEEP_PROCESSING() once the CPU wakes up, either
+* because the expected idle time has passed or because of an interrupt. The
+* totals are shown in '/proc/power'.
+*
+* @param expected_idle_ticks OS ticks the kernel expected to sleep for
+*
+* @return nothing
+*/
+void rtos_sleep_exit(uint32_t expected_idle_ticks);
+
 #endif
 
 /**
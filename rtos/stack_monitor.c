@@ -0,0 +1,149 @@
+/******************************************************************************
+ * @file stack_monitor.c
+ *
+ * @brief Task stack monitoring and stack overflow records. See stack_monitor.h.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include "hardware_config.h"
+#include "stack_monitor.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+// stack statistics (extern declared in stack_monitor.h)
+stack_mon_task_t stack_mon_tasks[STACK_MON_TASKS_MAX];
+stack_mon_crash_t stack_mon_last_crash;
+
+// overflow record written by the overflow hook, not cleared at boot
+static stack_mon_crash_t PERSISTENT_RAM(stack_mon_crash_record);
+
+// task states from the last sample, static to keep them off the caller's stack
+static TaskStatus_t stack_mon_status[STACK_MON_TASKS_MAX];
+
+// size of a task's stack in words, 0 if FreeRTOS doesn't record it
+static uint32_t stack_mon_stack_words(const TaskStatus_t *status) {
+#if (configRECORD_STACK_HIGH_ADDRESS == 1)
+    return (uint32_t)(status->pxEndOfStack - status->pxStackBase) + 1;
+#else
+    return 0;
+#endif
+}
+
+bool stack_mon_init(void) {
+    if (stack_mon_crash_record.magic == STACK_MON_CRASH_MAGIC) {
+        stack_mon_last_crash = stack_mon_crash_record;
+        stack_mon_last_crash.name[configMAX_TASK_NAME_LEN - 1] = '\0'; // the record survived a crash, don't trust it
+        stack_mon_crash_record.magic = 0;
+        return true;
+    }
+
+    memset(&stack_mon_last_crash, 0, sizeof(stack_mon_crash_t));
+    return false;
+}
+
+bool stack_mon_sample(void (*on_warning)(const stack_mon_task_t *stats)) {
+    UBaseType_t num_tasks = uxTaskGetSystemState(stack_mon_status, STACK_MON_TASKS_MAX, NULL);
+    bool seen[STACK_MON_TASKS_MAX] = {false};
+
+    if (num_tasks == 0) return false; // the status array is too small for every task
+
+    for (UBaseType_t t = 0; t < num_tasks; t++) {
+        const TaskStatus_t *status = &stack_mon_status[t];
+        stack_mon_task_t *stats = NULL;
+        int entry;
+
+        // find the task's entry, or start a new one
+        for (entry = 0; entry < STACK_MON_TASKS_MAX; entry++) {
+            if (stack_mon_tasks[entry].task == status->xHandle &&
+                stack_mon_tasks[entry].task_number == status->xTaskNumber) {
+                stats = &stack_mon_tasks[entry];
+                break;
+            }
+        }
+        if (stats == NULL) {
+            for (entry = 0; entry < STACK_MON_TASKS_MAX; entry++) {
+                if (stack_mon_tasks[entry].task == NULL && !seen[entry]) {
+                    stats = &stack_mon_tasks[entry];
+                    memset(stats, 0, sizeof(stack_mon_task_t));
+                    stats->task_number = status->xTaskNumber;
+                    strncpy(stats->name, status->pcTaskName, configMAX_TASK_NAME_LEN - 1);
+                    stats->stack_words = stack_mon_stack_words(status);
+                    stats->min_free_words = status->usStackHighWaterMark;
+                    stats->window_free_words = status->usStackHighWaterMark;
+                    stats->task = status->xHandle; // last, the CLI skips entries without a task
+                    break;
+                }
+            }
+        }
+        if (stats == NULL) continue; // entries of deleted tasks are dropped below, picked up next sample
+        seen[entry] = true;
+
+        // the high water mark only ever goes down
+        stats->min_free_words = status->usStackHighWaterMark;
+        stats->samples++;
+        if (stats->samples % STACK_MON_TREND_SAMPLES == 0) {
+            stats->trend_words = stats->window_free_words - stats->min_free_words;
+            stats->window_free_words = stats->min_free_words;
+        }
+
+        // warn about stacks that are nearly full, or still growing towards full
+        if (stats->warned_free_words == 0 || stats->min_free_words < stats->warned_free_words) {
+            bool low = (stats->min_free_words * 100) < (stats->stack_words * STACK_MON_WARN_PERCENT);
+            bool growing = (stats->trend_words > 0) &&
+                           (stats->min_free_words < stats->trend_words * STACK_MON_WARN_HORIZON);
+            if (low || growing) {
+                stats->warned_free_words = stats->min_free_words ? stats->min_free_words : 1;
+                if (on_warning != NULL) on_warning(stats);
+            }
+        }
+    }
+
+    // drop the entries of deleted tasks
+    for (int entry = 0; entry < STACK_MON_TASKS_MAX; entry++) {
+        if (!seen[entry]) stack_mon_tasks[entry].task = NULL;
+    }
+
+    return true;
+}
+
+uint32_t stack_mon_recommended(const stack_mon_task_t *stats) {
+    uint32_t used_words = stats->stack_words - stats->min_free_words;
+    uint32_t recommended = used_words + ((used_words * STACK_MON_MARGIN_PERCENT) / 100);
+
+    if (stats->stack_words == 0) return 0; // stack size not known
+    recommended = ((recommended + STACK_MON_ROUND_WORDS - 1) / STACK_MON_ROUND_WORDS) * STACK_MON_ROUND_WORDS;
+    if (recommended < configMINIMAL_STACK_SIZE) recommended = configMINIMAL_STACK_SIZE;
+
+    return recommended;
+}
+
+// called by FreeRTOS when a task switched out has overrun its stack canary
+// (configCHECK_FOR_STACK_OVERFLOW 2). The stack has already been corrupted, so
+// record the task for the next boot and reboot rather than carrying on.
+void vApplicationStackOverflowHook(TaskHandle_t xTask, char *pcTaskName) {
+    taskDISABLE_INTERRUPTS();
+    strncpy(stack_mon_crash_record.name, pcTaskName, configMAX_TASK_NAME_LEN - 1);
+    stack_mon_crash_record.name[configMAX_TASK_NAME_LEN - 1] = '\0';
+    stack_mon_crash_record.stack_words = 0;
+    for (int entry = 0; entry < STACK_MON_TASKS_MAX; entry++) {
+        if (stack_mon_tasks[entry].task == xTask) {
+            stack_mon_crash_record.stack_words = stack_mon_tasks[entry].stack_words;
+            break;
+        }
+    }
+    stack_mon_crash_record.uptime_us = get_time_us();
+    stack_mon_crash_record.magic = STACK_MON_CRASH_MAGIC;
+
+    force_watchdog_reboot();
+}
@@ -0,0 +1,112 @@
+/******************************************************************************
+ * @file stack_monitor.h
+ *
+ * @brief Task stack monitoring. Samples the stack high water mark of every
+ *        task, tracks how much each one is still growing, warns when a stack
+ *        is close to overflowing, and recommends right-sized stacks so that
+ *        over-provisioned ones can be trimmed in services.h. Sampled by the
+ *        stackmonitor service and shown in '/proc/stack'.
+ *
+ *        Overflows that do happen are caught by the FreeRTOS stack canary
+ *        check (configCHECK_FOR_STACK_OVERFLOW 2), which records the offending
+ *        task in RAM that is not cleared at boot and reboots - the record is
+ *        picked up on the next boot and shown in '/proc/stack'.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#ifndef STACK_MONITOR_H
+#define STACK_MONITOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+#define STACK_MON_TASKS_MAX         16  // max tasks in the system, including the RTOS idle and timer tasks
+#define STACK_MON_TREND_SAMPLES     60  // samples in each trend window (1 minute at the default PERIOD_STACKMON)
+#define STACK_MON_WARN_PERCENT      10  // warn when less than this much of a stack has never been used
+#define STACK_MON_WARN_HORIZON      10  // warn when a stack would run out within this many trend windows at its current growth
+#define STACK_MON_MARGIN_PERCENT    25  // headroom added to the peak use for recommended stack sizes
+#define STACK_MON_ROUND_WORDS       32  // recommended stack sizes are rounded up to a multiple of this
+
+// stack statistics for a task, sizes are in words (StackType_t) like the STACK_ defines in services.h
+typedef struct stack_mon_task_t {
+    TaskHandle_t task;                  // task handle, NULL if the entry is unused
+    UBaseType_t task_number;            // FreeRTOS task number, as shown by 'ps' - tells a re-created task apart
+    char name[configMAX_TASK_NAME_LEN]; // task name
+    uint32_t stack_words;               // size of the stack
+    uint32_t min_free_words;            // least free stack seen (the high water mark)
+    uint32_t window_free_words;         // least free stack at the start of the current trend window
+    uint32_t trend_words;               // stack growth over the last full trend window
+    uint32_t warned_free_words;         // free stack at the last warning, 0 if not warned
+    uint32_t samples;                   // samples taken since the task was first seen
+} stack_mon_task_t;
+
+// stack overflow record, kept across the reboot that follows an overflow
+typedef struct stack_mon_crash_t {
+    uint32_t magic;                     // STACK_MON_CRASH_MAGIC if the record is valid
+    char name[configMAX_TASK_NAME_LEN]; // task that overflowed
+    uint32_t stack_words;               // size of its stack, 0 if unknown
+    uint64_t uptime_us;                 // time since boot of the overflow
+} stack_mon_crash_t;
+
+#define STACK_MON_CRASH_MAGIC 0x53544B31 // "STK1"
+
+// stack statistics for each task, entries are removed when their task is deleted
+extern stack_mon_task_t stack_mon_tasks[STACK_MON_TASKS_MAX];
+
+// stack overflow that caused the last reboot, magic is 0 if there was none
+extern stack_mon_crash_t stack_mon_last_crash;
+
+/**
+* @brief Pick up the overflow record from before the last reboot.
+*
+* Copies a valid overflow record into stack_mon_last_crash and clears it, so
+* that it is only reported for the boot that follows the overflow. Call once at
+* boot, before the scheduler starts.
+*
+* @param none
+*
+* @return true if the last reboot was caused by a stack overflow
+*/
+bool stack_mon_init(void);
+
+/**
+* @brief Sample the stack use of every task.
+*
+* Updates stack_mon_tasks[] from the current high water mark of each task.
+* Walks all of the task stacks, so it should be called from a low priority
+* service rather than anywhere time-critical.
+*
+* @param on_warning callback for each task whose stack is newly below
+*                   STACK_MON_WARN_PERCENT free, or is still growing fast enough
+*                   to run out within STACK_MON_WARN_HORIZON trend windows.
+*                   Called again only if the free stack drops further. May be NULL.
+*
+* @return true if the tasks were sampled, false if there are more than STACK_MON_TASKS_MAX
+*/
+bool stack_mon_sample(void (*on_warning)(const stack_mon_task_t *stats));
+
+/**
+* @brief Get the recommended stack size for a task.
+*
+* The peak stack use seen so far plus STACK_MON_MARGIN_PERCENT, rounded up to
+* STACK_MON_ROUND_WORDS and at least configMINIMAL_STACK_SIZE. Only as good as
+* the code paths the task has run through since boot.
+*
+* @param stats pointer to the task's stack statistics
+*
+* @return recommended stack size in words
+*/
+uint32_t stack_mon_recommended(const stack_mon_task_t *stats);
+
+#endif /* STACK_MONITOR_H */
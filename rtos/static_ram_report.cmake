@@ -0,0 +1,79 @@
+# Static allocation RAM budget report
+#
+# Run after linking in ENABLE_STATIC_ALLOC builds (see hardware_build_extra()).
+# Lists the RAM taken by the static storage of each service and RTOS object,
+# grouped by the label given to TASK_CREATE(), QUEUE_CREATE() etc. in
+# rtos_utils.h - storage symbols are named <label>_static_<kind>.
+#
+# usage: cmake -DNM=<path to nm> -DELF=<path to elf> [-DCONFIG=<rtos_config.h>] -P static_ram_report.cmake
+
+cmake_minimum_required(VERSION 3.18)
+
+# headroom added to the measured total when suggesting RTOS_STATIC_ALLOC_SIZE,
+# covers small changes between regenerating it
+set(STATIC_ALLOC_MARGIN 2048)
+
+execute_process(
+    COMMAND ${NM} --print-size --radix=d ${ELF}
+    OUTPUT_VARIABLE nm_output
+    RESULT_VARIABLE nm_result
+)
+if(NOT nm_result EQUAL 0)
+    message(WARNING "static RAM report: could not read symbols from ${ELF}")
+    return()
+endif()
+
+# total the storage sizes for each label
+string(REPLACE "\n" ";" nm_lines "${nm_output}")
+set(labels "")
+set(total 0)
+foreach(line IN LISTS nm_lines)
+    if(line MATCHES "^[0-9]+ ([0-9]+) [bBdD] ([A-Za-z0-9_]+)_static_[a-z]+(\\.[0-9]+)?$")
+        set(size ${CMAKE_MATCH_1})
+        set(label ${CMAKE_MATCH_2})
+        math(EXPR size "${size}") # strip leading zeros
+        if(NOT label IN_LIST labels)
+            list(APPEND labels ${label})
+            set(label_size_${label} 0)
+        endif()
+        math(EXPR label_size_${label} "${label_size_${label}} + ${size}")
+        math(EXPR total "${total} + ${size}")
+    endif()
+endforeach()
+
+# print the table
+list(SORT labels)
+message("Static allocation RAM budget")
+message("----------------------------------------")
+foreach(label IN LISTS labels)
+    string(LENGTH "${label}" label_len)
+    math(EXPR pad_len "32 - ${label_len}")
+    if(pad_len LESS 1)
+        set(pad_len 1)
+    endif()
+    string(REPEAT " " ${pad_len} pad)
+    message("${label}${pad}${label_size_${label}}")
+endforeach()
+message("----------------------------------------")
+message("total                           ${total}")
+
+# compare against the RAM the heap gives up for static storage
+if(DEFINED CONFIG AND EXISTS ${CONFIG})
+    file(STRINGS ${CONFIG} budget_line REGEX "^#define RTOS_STATIC_ALLOC_SIZE \\(")
+    if(budget_line MATCHES "\\(([0-9*+ ]+)\\)")
+        math(EXPR budget "${CMAKE_MATCH_1}")
+        message("budget (RTOS_STATIC_ALLOC_SIZE) ${budget}")
+        # total plus margin, rounded up to whole KB
+        math(EXPR suggested_kb "(${total} + ${STATIC_ALLOC_MARGIN} + 1023) / 1024")
+        math(EXPR suggested "${suggested_kb} * 1024")
+        message("suggested RTOS_STATIC_ALLOC_SIZE (${suggested_kb}*1024)")
+        if(total GREATER budget)
+            message(WARNING "static storage exceeds RTOS_STATIC_ALLOC_SIZE in rtos_config.h, "
+                            "increase it so the heap and static storage still fit in RAM")
+        elseif(budget GREATER suggested)
+            math(EXPR unused "${budget} - ${total}")
+            message(WARNING "RTOS_STATIC_ALLOC_SIZE in rtos_config.h leaves ${unused} bytes unused, "
+                            "set it to the suggested value to give them back to the heap")
+        endif()
+    endif()
+endif()
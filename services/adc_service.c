@@ -0,0 +1,94 @@
+/******************************************************************************
+ * @file adc_service.c
+ *
+ * @brief adcstream service implementation and FreeRTOS task creation.
+ *        Streams the ADC (see adc_stream_start() in hardware_config.h) and
+ *        processes each block of samples as soon as DMA has filled it, so
+ *        consumers get decimated samples at a steady rate by notification.
+ *        Stream stats are shown in '/dev/adc0'.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "hardware_config.h"
+#include "rtos_utils.h"
+#include "services.h"
+#include "service_queues.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define ADC_OVERRUN_LOG_INTERVAL_US 1000000 // log overruns at most once a second
+
+
+static void prvAdcStreamTask(void *pvParameters);
+static service_events_t adc_events; // events for this service, see /proc/events
+TaskHandle_t xAdcStreamTask;
+
+// main service function, creates FreeRTOS task from prvAdcStreamTask
+BaseType_t adc_service(void)
+{
+    BaseType_t xReturn;
+
+    // create the FreeRTOS task
+    xReturn = TASK_CREATE(
+        SERVICE_NAME_ADC,
+        prvAdcStreamTask,
+        xstr(SERVICE_NAME_ADC),
+        STACK_ADC,
+        NULL,
+        PRIORITY_ADC,
+        &xAdcStreamTask
+    );
+
+    if (xReturn == pdPASS) {
+        cli_print_raw("adcstream service started");
+    }
+    else {
+        cli_print_raw("Error starting the adcstream service");
+    }
+
+    return xReturn;
+}
+
+// called from the DMA interrupt when a block of samples is ready
+static void adc_block_ready(BaseType_t *higher_priority_woken)
+{
+    service_events_signal_from_isr(&adc_events, SERVICE_EVENT_IO, higher_priority_woken);
+}
+
+// FreeRTOS task created by adc_service
+static void prvAdcStreamTask(void *pvParameters)
+{
+    uint32_t overruns_logged = 0;
+    uint64_t overrun_log_us = 0;
+
+    // run the main loop only when a block of samples is ready
+    service_events_init(&adc_events, xstr(SERVICE_NAME_ADC));
+
+    // (re)start the stream, this also picks it up again if the service was restarted
+    if (!adc_stream_start(ADC_STREAM_RATE_HZ, adc_block_ready)) {
+        LOG_ERROR(ADC, LOG_ADC_START_FAIL, ADC_STREAM_RATE_HZ);
+    }
+
+    while(true) {
+        // block until there is a block of samples to handle
+        service_events_wait(&adc_events, TIMEOUT_ADC);
+
+        while (adc_stream_process()) {}
+
+        // report lost blocks, without flooding the log if they keep happening
+        if (adc_stream_stats.overruns != overruns_logged &&
+            get_time_us() - overrun_log_us >= ADC_OVERRUN_LOG_INTERVAL_US) {
+            overruns_logged = adc_stream_stats.overruns;
+            overrun_log_us = get_time_us();
+            LOG_WARN(ADC, LOG_ADC_OVERRUN, overruns_logged);
+        }
+    }
+}
@@ -19,6 +19,7 @@
 #include "version.h"
 #include "hardware_config.h"
 #include "rtos_utils.h"
+#include "mem_pool.h"
 #include "shell.h"
 #include "cli_utils.h"
 #include "services.h"
@@ -31,10 +32,13 @@
 #define PRINT_MOTD_AT_BOOT false
 #endif
 
+#define CLI_STARTUP_DELAY 100 // OS ticks to hold off the CLI header at boot
+
 
 static void prvCliTask(void *pvParameters); // microshell cli task
 TaskHandle_t xShellTask;
 char BBOS_VERSION_MOD; // global "modified version" variable - declared in version.h
+service_events_t cli_events; // events and stats for this service (extern declared in services.h)
 
 // main service function, creates FreeRTOS task from prvCliTask
 BaseType_t cli_service(void)
@@ -44,7 +48,8 @@ BaseType_t cli_service(void)
     shell_init(); // init microshell cli
 
     // spawn the cli task
-    xReturn = xTaskCreate(
+    xReturn = TASK_CREATE(
+        SERVICE_NAME_CLI,
         prvCliTask,
         xstr(SERVICE_NAME_CLI),
         STACK_CLI,
@@ -69,14 +74,14 @@ BaseType_t cli_service(void)
 // FreeRTOS task created by cli_service
 static void prvCliTask(void *pvParameters)
 {
-    char print_string[PRINT_QUEUE_ITEM_SIZE];
+    char print_string[BUF_OUT_SIZE];
     extern const char *bbos_header_ascii;
 
     // Set the global "modified version" indicator if on a branch other than main
     BBOS_VERSION_MOD = strcmp(git_Branch(), "main") ? '+' : ' ';
 
     // delay CLI startup to allow taskmanager to finish with its startup status prints
-    vTaskDelay(DELAY_TASKMAN * 5);
+    vTaskDelay(CLI_STARTUP_DELAY);
 
     // print MOTD for additional YouTube likes
     if (PRINT_MOTD_AT_BOOT) {
@@ -92,31 +97,57 @@ static void prvCliTask(void *pvParameters)
     }
 
     // copy the CLI ASCII header into RAM
-    char *cli_header = pvPortMalloc(strlen(bbos_header_ascii+2)); // two extra bytes for BBOS_VERSION_MOD and NULL
+    char *cli_header = mem_pool_alloc(strlen(bbos_header_ascii) + 2); // two extra bytes for BBOS_VERSION_MOD and NULL
     strcpy(cli_header, bbos_header_ascii);
     // add the "modified version" indicator to the header
     memcpy( (cli_header + strlen(cli_header) - 78) , &BBOS_VERSION_MOD, 1); // manually offset to the correct position
     // print the ASCII header before dropping into the CLI
     shell_print(cli_header);
     // free up the RAM
-    vPortFree(cli_header);
+    mem_pool_free(cli_header);
+
+    // the CLI is woken by input, print queue messages or log records, with TIMEOUT_CLI as a safety net
+    service_events_init(&cli_events, xstr(SERVICE_NAME_CLI));
 
     while(true) {
-        // peek into the print queue to see if an item is available
-        if (xQueuePeek(print_queue, (void *)&print_string, 0) == pdTRUE) {
-            // only pull an item from the queue if microshell is available to process it
-            // note that if any characters have been entered at the prompt, it will
-            // block prints from the queue so as not to interfere with user input
-            if (ush.state == USH_STATE_READ_CHAR && ush.in_pos == 0) {
-                if (xQueueReceive(print_queue, (void *)&print_string, 0) == pdTRUE) {
+        // only pull a message from the print queue (or a log record, which is
+        // only formatted into text here) if microshell is waiting for input.
+        // if any characters have been entered at the prompt, the message is
+        // printed above the input line and the line is redrawn, so background
+        // services never have to wait for the user to finish typing
+        if (ush.state == USH_STATE_READ_CHAR && (cli_print_pending() || log_pending())) {
+            size_t print_len = cli_print_take(print_string, sizeof(print_string));
+            if (print_len == 0) {
+                print_len = log_take(print_string, sizeof(print_string));
+            }
+            if (print_len > 0) {
+                if (ush.in_pos == 0) {
                     shell_print(print_string);
                 }
+                else {
+                    shell_print_above_input(print_string);
+                }
             }
         }
 
-        shell_service(); // the main cli service gets called forever in a loop
-
-        // update this task's schedule
-        task_sched_update(REPEAT_CLI, DELAY_CLI);
+        // the main cli service gets called forever in a loop. while there is
+        // buffered UART input keep servicing the shell, so pasted or scripted
+        // input is consumed at line speed rather than one char per tick
+        int service_count = 0;
+        do {
+            shell_service();
+        } while (!CLI_USE_USB && cli_uart_rx_pending() > 0 && ++service_count < BUF_IN_SIZE);
+
+        // block until there is input or something to print if microshell is
+        // idle at the prompt, so that the CPU can sleep between keystrokes.
+        // otherwise a command is running or output is waiting, keep going
+        if (ush.state == USH_STATE_READ_CHAR &&
+            (CLI_USE_USB ? cli_usb_rx_pending() : cli_uart_rx_pending()) == 0 &&
+            !cli_print_pending() && !log_pending()) {
+            service_events_wait(&cli_events, TIMEOUT_CLI);
+        }
+        else {
+            vTaskDelay(DELAY_CLI_BUSY);
+        }
     }
 }
\ No newline at end of file
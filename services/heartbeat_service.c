@@ -30,6 +30,7 @@
 // to "hearbeat" with the new service name.
 
 static void prvHeartbeatTask(void *pvParameters); // entry function for this service, implementation below
+static task_period_t heartbeat_period; // schedule and stats for this service, see /proc/sched
 TaskHandle_t xHeartbeatTask; // FreeRTOS task handle for this service
 
 // service creation function, creates FreeRTOS task xHeartbeatTask from entry function prvHeartbeatTask
@@ -38,7 +39,8 @@ BaseType_t heartbeat_service(void)
 {
     BaseType_t xReturn;
 
-    xReturn = xTaskCreate(
+    xReturn = TASK_CREATE(
+        SERVICE_NAME_HEARTBEAT,       // label for the task's storage in static allocation builds
         prvHeartbeatTask,             // main function of this service, defined below
         xstr(SERVICE_NAME_HEARTBEAT), // name defined in services.h
         STACK_HEARTBEAT,              // stack size defined in services.h
@@ -64,20 +66,22 @@ static void prvHeartbeatTask(void *pvParameters)
     // Service startup (run once) code can be placed here
     // (similar to Arduino setup(), if that's your thing)
     //
-    static char *heartbeat_string = "ba-bump";
+
+    // run the main loop once every PERIOD_HEARTBEAT ticks
+    task_period_init(&heartbeat_period, xstr(SERVICE_NAME_HEARTBEAT), PERIOD_HEARTBEAT, BUDGET_HEARTBEAT);
 
     while(true) {
         //
         // Main service (run continuous) code can be placed here
         // (similar to Arduino loop(), if that's your thing)
         //
-        cli_print_timestamped(heartbeat_string);
+        LOG_INFO(HEARTBEAT, LOG_HEARTBEAT);
         
-        // always include the below, with REPEAT & DELAY settings in services.h,
+        // always include the below, with PERIOD & BUDGET settings in services.h,
         // otherwise the service will starve out other RTOS tasks
 
         // update this task's schedule
-        task_sched_update(REPEAT_HEARTBEAT, DELAY_HEARTBEAT);
+        task_period_wait(&heartbeat_period);
     }
 
     // the task runs forever unless the RTOS kernel suspends or kills it.
@@ -27,6 +27,7 @@
 
 
 static void prvNetworkManagerTask(void *pvParameters); // network manager task
+service_events_t netman_events; // events for this service, see /proc/events
 TaskHandle_t xNetManTask;
 
 struct netman_info_t nmi_glob; // global network manager status info
@@ -38,7 +39,8 @@ BaseType_t netman_service(void)
 {
     BaseType_t xReturn;
 
-    xReturn = xTaskCreate(
+    xReturn = TASK_CREATE(
+        SERVICE_NAME_NETMAN,
         prvNetworkManagerTask,
         xstr(SERVICE_NAME_NETMAN),
         STACK_NETMAN,
@@ -68,22 +70,28 @@ static void prvNetworkManagerTask(void *pvParameters) {
     // to be initialized when the OS is already running.
     if (hw_wifi_init()) { // todo: wifi country should be configurable
         hw_wifi_enable_sta_mode();
-        cli_print_timestamped("WiFi hardware ready to connect");
+        LOG_INFO(NETMAN, LOG_NETMAN_WIFI_READY);
         shell_net_mount(); // create '/net' node in the shell
         netman_request(NETJOIN); // auto-connect (will fail if '/net/wifi setauth' never used)
     } else {
-        cli_print_timestamped("WiFi init failed");
+        LOG_ERROR(NETMAN, LOG_NETMAN_WIFI_FAIL);
     }
 
+    // run the main loop only when netman_request() posts an action
+    service_events_init(&netman_events, xstr(SERVICE_NAME_NETMAN));
+
     while(true) {
-        // Check the networkmanager action queue to see if an item is available
-        if (xQueueReceive(netman_action_queue, (void *)&nm_action, 0) == pdTRUE)
+        // block until there is an event to handle
+        service_events_wait(&netman_events, TIMEOUT_NETMAN);
+
+        // handle all of the actions in the networkmanager action queue
+        while (xQueueReceive(netman_action_queue, (void *)&nm_action, 0) == pdTRUE)
         {
             // determine what action to perform
             switch(nm_action)
             {
                 case NETJOIN: // join a network (connect)
-                    struct storman_item_t smi;
+                    storman_item_t *smi = NULL; // credentials request item, kept until connect is done
                     char *wifi_ssid;
                     char *wifi_pass;
                     bool continue_connect = false;
@@ -95,30 +103,39 @@ static void prvNetworkManagerTask(void *pvParameters) {
                     }
 
                     // get network credentials from the filesystem
-                    smi.action = CHKFILE;
-                    strcpy(smi.sm_item_name, "wifi_auth");
-                    storman_request(&smi);
-                    // wait for storagemanager to provide semaphore indicating file exists
-                    if (xSemaphoreTake(smi_glob_sem, DELAY_STORMAN * 2) == pdTRUE) {
+                    smi = storman_item_alloc(0);
+                    if (smi == NULL) {
+                        cli_print_raw("storagemanager busy, could not read wifi credentials");
+                        break;
+                    }
+                    smi->action = CHKFILE;
+                    strcpy(smi->sm_item_name, "wifi_auth");
+                    // wait for storagemanager to check if the file exists
+                    bool auth_exists = storman_request_wait(smi, STORMAN_REQUEST_TIMEOUT) && smi->sm_item_result == 0;
+                    storman_item_release(smi);
+                    if (auth_exists) {
                         // read credentials file
-                        smi.action = DUMPFILE;
-                        strcpy(smi.sm_item_name, "wifi_auth");
-                        storman_request(&smi);
-                        // wait for storagemanager to provide semaphore indicating data is ready
-                        if (xSemaphoreTake(smi_glob_sem, DELAY_STORMAN * 2) == pdTRUE) {
+                        smi = storman_item_alloc(FILE_SIZE_MAX);
+                        if (smi == NULL) {
+                            cli_print_raw("storagemanager busy, could not read wifi credentials");
+                            break;
+                        }
+                        smi->action = DUMPFILE;
+                        strcpy(smi->sm_item_name, "wifi_auth");
+                        // wait for storagemanager to read the file into the item's data buffer
+                        if (storman_request_wait(smi, STORMAN_REQUEST_TIMEOUT) && smi->sm_item_result >= 0) {
                             // Split the credentials into SSID and password
-                            wifi_ssid = strtok(smi_glob.sm_item_data, ",");
+                            wifi_ssid = strtok(smi->sm_item_data, ",");
                             wifi_pass = strtok(NULL, ",");
                             // check for valid credentials
                             if (wifi_ssid == NULL || wifi_pass == NULL) {
                                 cli_print_raw("invalid wifi credentials format");
-                                break;
                             } else {
                                 continue_connect = true;
                             }
                         }
                     } else {
-                        // this will print if the semaphore was never given by storagemanager
+                        // this will print if storagemanager could not find the file (or never responded)
                         cli_print_raw("no wifi credentials found");
                         break;
                     }
@@ -161,6 +178,8 @@ static void prvNetworkManagerTask(void *pvParameters) {
                             cli_print_raw("could not start wifi connection");
                         }
                     }
+                    // credentials are no longer needed, return the item to the pool
+                    storman_item_release(smi);
                     break;
 
                 case NETLEAVE: // leave a network (disconnect)
@@ -177,8 +196,5 @@ static void prvNetworkManagerTask(void *pvParameters) {
                     break;
             }
         }
-        
-        // update this task's schedule
-        task_sched_update(REPEAT_NETMAN, DELAY_NETMAN);
     }
 }
@@ -0,0 +1,140 @@
+/******************************************************************************
+ * @file service_events.c
+ *
+ * @brief Event-driven service skeleton - event delivery by task notification
+ *        and wakeup/latency statistics. See service_events.h.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include <stddef.h>
+#include <string.h>
+#include "hardware_config.h"
+#include "rtos_utils.h"
+#include "service_events.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+// registry of event-driven services (extern declared in service_events.h)
+service_events_t *service_events[SERVICE_EVENTS_MAX];
+
+// software timer callback, runs in the timer service task
+static void service_events_timer_callback(TimerHandle_t timer) {
+    service_events_signal((service_events_t *)pvTimerGetTimerID(timer), SERVICE_EVENT_TIMER);
+}
+
+void service_events_init(service_events_t *se, const char *name) {
+    // clear everything but the timer, which is kept if the service is being restarted
+    memset(se, 0, offsetof(service_events_t, timer));
+    se->name = name;
+    se->start_us = get_time_us();
+    se->task = xTaskGetCurrentTaskHandle();
+
+    // register the service, unless it already is (i.e. the service was restarted)
+    taskENTER_CRITICAL();
+    for (int i = 0; i < SERVICE_EVENTS_MAX; i++) {
+        if (service_events[i] == se) break;
+        if (service_events[i] == NULL) {
+            service_events[i] = se;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    // handle anything that was queued before the task was running
+    service_events_signal(se, SERVICE_EVENT_COMMAND);
+}
+
+bool service_events_timer_start(service_events_t *se, TickType_t period) {
+    if (se->timer == NULL) {
+#ifdef ENABLE_STATIC_ALLOC
+        se->timer = xTimerCreateStatic(se->name, period, pdTRUE, se, service_events_timer_callback, &se->timer_buf);
+#else
+        se->timer = xTimerCreate(se->name, period, pdTRUE, se, service_events_timer_callback);
+#endif
+        if (se->timer == NULL) return false;
+    }
+    else {
+        xTimerChangePeriod(se->timer, period, 10);
+    }
+    return (xTimerStart(se->timer, 10) == pdPASS);
+}
+
+uint32_t service_events_wait(service_events_t *se, TickType_t timeout) {
+    uint32_t events = 0;
+    uint64_t signal_us;
+    uint32_t latency_us;
+
+    xTaskNotifyWaitIndexed(NOTIFY_INDEX_EVENTS, 0, UINT32_MAX, &events, timeout);
+
+    // grab and clear the signal time together, a signaller may be setting it
+    taskENTER_CRITICAL();
+    signal_us = se->signal_us;
+    se->signal_us = 0;
+    taskEXIT_CRITICAL();
+
+    if (events == 0) {
+        se->idle_wakeups++;
+    }
+    else {
+        se->wakeups++;
+        for (uint32_t bits = events; bits != 0; bits &= bits - 1) {
+            se->events++;
+        }
+        if (signal_us != 0) {
+            latency_us = (uint32_t)(get_time_us() - signal_us);
+            se->latency_total_us += latency_us;
+            if (latency_us > se->latency_max_us) se->latency_max_us = latency_us;
+        }
+    }
+
+    return events;
+}
+
+void service_events_signal(service_events_t *se, uint32_t events) {
+    TaskHandle_t task;
+
+    // the handle is read and notified under the lock, so that it can't be
+    // cleared and the task deleted in between (see service_events_task_deleted())
+    taskENTER_CRITICAL();
+    task = se->task;
+    if (task != NULL) {
+        // only the oldest undelivered signal sets the time, for worst case latency
+        if (se->signal_us == 0) se->signal_us = get_time_us();
+        xTaskNotifyIndexed(task, NOTIFY_INDEX_EVENTS, events, eSetBits);
+    }
+    taskEXIT_CRITICAL();
+}
+
+void service_events_task_deleted(TaskHandle_t task) {
+    // once the handle is cleared under the lock no signaller can still be using
+    // it, so the task can be deleted as soon as this returns
+    taskENTER_CRITICAL();
+    for (int i = 0; i < SERVICE_EVENTS_MAX && service_events[i] != NULL; i++) {
+        if (service_events[i]->task == task) {
+            service_events[i]->task = NULL;
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
+void service_events_signal_from_isr(service_events_t *se, uint32_t events, BaseType_t *higher_priority_woken) {
+    UBaseType_t saved_irq;
+    TaskHandle_t task;
+
+    saved_irq = taskENTER_CRITICAL_FROM_ISR();
+    task = se->task;
+    if (task != NULL) {
+        if (se->signal_us == 0) se->signal_us = get_time_us();
+        xTaskNotifyIndexedFromISR(task, NOTIFY_INDEX_EVENTS, events, eSetBits, higher_priority_woken);
+    }
+    taskEXIT_CRITICAL_FROM_ISR(saved_irq);
+}
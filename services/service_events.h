@@ -0,0 +1,151 @@
+/******************************************************************************
+ * @file service_events.h
+ *
+ * @brief Event-driven service skeleton. A service blocks on a bitmask of
+ *        events delivered by task notification - commands posted to its
+ *        queue, an optional periodic timer, and I/O events signalled from
+ *        drivers or ISRs - instead of polling its queue on a fixed delay.
+ *        Wakeup counts and signal-to-wakeup latency are tracked for each
+ *        service and shown in '/proc/events'.
+ *
+ *        Typical service task:
+ *
+ *            service_events_init(&my_events, "myservice");
+ *            while(true) {
+ *                uint32_t events = service_events_wait(&my_events, TIMEOUT_MYSERVICE);
+ *                if (events & SERVICE_EVENT_COMMAND) {
+ *                    while (xQueueReceive(my_queue, &item, 0) == pdTRUE) { ... }
+ *                }
+ *                if (events & SERVICE_EVENT_TIMER) { ... }
+ *            }
+ *
+ *        and whatever posts to my_queue follows up with
+ *        service_events_signal(&my_events, SERVICE_EVENT_COMMAND).
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#ifndef SERVICE_EVENTS_H
+#define SERVICE_EVENTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+
+// event bits common to all services, service-specific events can use
+// SERVICE_EVENT_USER and up
+#define SERVICE_EVENT_COMMAND   (1UL << 0) // a command was posted to the service's queue
+#define SERVICE_EVENT_TIMER     (1UL << 1) // the service's periodic timer expired
+#define SERVICE_EVENT_IO        (1UL << 2) // a driver has I/O for the service to handle
+#define SERVICE_EVENT_USER      (1UL << 8) // first bit free for service-specific events
+
+#define SERVICE_EVENTS_MAX      8 // max number of event-driven services tracked for /proc/events
+
+// event-driven service state and statistics
+typedef struct service_events_t {
+    const char *name;               // name to show in stats, normally the service name
+    TaskHandle_t task;              // task that waits on the events
+    volatile uint64_t signal_us;    // time the oldest undelivered event was signalled, 0 if none
+    uint64_t start_us;              // time the stats were started, for rates
+    uint32_t wakeups;               // wakeups with events to handle
+    uint32_t idle_wakeups;          // wakeups with nothing to do (wait timed out)
+    uint32_t events;                // event bits received
+    uint64_t latency_total_us;      // sum of signal to wakeup latency, for the average
+    uint32_t latency_max_us;        // worst signal to wakeup latency
+    // timer state last, it is kept when the service is restarted
+    TimerHandle_t timer;            // optional timer delivering SERVICE_EVENT_TIMER
+#ifdef ENABLE_STATIC_ALLOC
+    StaticTimer_t timer_buf;        // storage for the timer in static allocation builds
+#endif
+} service_events_t;
+
+// registry of event-driven services, for reporting stats
+extern service_events_t *service_events[SERVICE_EVENTS_MAX];
+
+/**
+* @brief Set up event delivery for the calling service task.
+*
+* Call once at the start of the service task, before its main loop. The first
+* service_events_wait() will return SERVICE_EVENT_COMMAND straight away, so that
+* anything posted to the service's queue before the task was running gets handled.
+*
+* @param se   pointer to the service's event state, must remain valid (static) while the task runs
+* @param name name to show in stats
+*
+* @return nothing
+*/
+void service_events_init(service_events_t *se, const char *name);
+
+/**
+* @brief Start a periodic timer that delivers SERVICE_EVENT_TIMER to a service.
+*
+* Uses a FreeRTOS software timer, so the service does not need to wake up on
+* its own to do periodic work.
+*
+* @param se     pointer to the service's event state
+* @param period OS ticks between timer events
+*
+* @return true if the timer was started, otherwise false
+*/
+bool service_events_timer_start(service_events_t *se, TickType_t period);
+
+/**
+* @brief Block until events are delivered to the calling service.
+*
+* @param se      pointer to the service's event state
+* @param timeout max OS ticks to block, portMAX_DELAY to wait forever
+*
+* @return event bits delivered (all pending events are cleared), 0 upon timeout
+*/
+uint32_t service_events_wait(service_events_t *se, TickType_t timeout);
+
+/**
+* @brief Deliver events to a service, from a task.
+*
+* Does nothing if the service task is not running yet.
+*
+* @param se     pointer to the service's event state
+* @param events event bits to deliver
+*
+* @return nothing
+*/
+void service_events_signal(service_events_t *se, uint32_t events);
+
+/**
+* @brief Deliver events to a service, from an ISR.
+*
+* Does nothing if the service task is not running yet.
+*
+* @param se     pointer to the service's event state
+* @param events event bits to deliver
+* @param higher_priority_woken set to pdTRUE if a context switch should be requested on exit
+*
+* @return nothing
+*/
+void service_events_signal_from_isr(service_events_t *se, uint32_t events, BaseType_t *higher_priority_woken);
+
+/**
+* @brief Stop delivering events to a task that is about to be deleted.
+*
+* Called by taskmanager before deleting a service task, so that signals to an
+* event-driven service that has been stopped are dropped instead of notifying
+* a deleted task. The service's events start being delivered again when it is
+* restarted and calls service_events_init().
+*
+* @param task handle of the task being deleted
+*
+* @return nothing
+*/
+void service_events_task_deleted(TaskHandle_t task);
+
+#endif /* SERVICE_EVENTS_H */
@@ -0,0 +1,132 @@
+/******************************************************************************
+ * @file service_log.c
+ *
+ * @brief Binary logging facility - log record ring and deferred formatting.
+ *        See service_log.h.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/platform.h"
+#include "hardware_config.h"
+#include "services.h"
+#include "service_log.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if (LOG_RING_DEPTH & (LOG_RING_DEPTH - 1)) != 0
+#error "LOG_RING_DEPTH must be a power of 2"
+#endif
+
+// global format string table, expanded from LOG_FORMATS
+#define LOG_FORMAT_STRING(id, fmt) fmt,
+const char *log_formats[LOG_NUM_IDS] = {
+    LOG_FORMATS(LOG_FORMAT_STRING)
+};
+
+// level names used when formatting records
+static const char *log_level_names[] = {"none", "error", "warn", "info", "debug"};
+
+// log record ring. producers (tasks and ISRs) reserve a slot by advancing the
+// head inside a short critical section, then fill the record and mark it
+// committed without holding anything. The CLI task is the only consumer, and
+// stops at the first record that has not been committed yet.
+// Indexes are free-running and wrapped with the ring mask.
+static log_record_t log_ring[LOG_RING_DEPTH];
+static uint32_t log_ring_head;
+static volatile uint32_t log_ring_tail;
+
+// global log statistics
+log_stats_t log_stats;
+
+bool log_write(uint8_t level, uint16_t id, const uint32_t *args, size_t nargs) {
+    log_record_t *record = NULL;
+    uint32_t in_use;
+
+    // reserve a slot - the FROM_ISR critical section is safe from tasks and ISRs
+    UBaseType_t saved_irq = taskENTER_CRITICAL_FROM_ISR();
+    in_use = log_ring_head - log_ring_tail;
+    if (in_use < LOG_RING_DEPTH) {
+        record = &log_ring[log_ring_head & (LOG_RING_DEPTH - 1)];
+        log_ring_head++;
+        log_stats.records++;
+        if (in_use + 1 > log_stats.high_water) {
+            log_stats.high_water = in_use + 1;
+        }
+    }
+    else {
+        log_stats.drops++;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(saved_irq);
+
+    if (record == NULL) return false;
+
+    // fill the record outside of the critical section
+    record->time_us = get_time_us();
+    record->id = id;
+    record->level = level;
+    for (int arg = 0; arg < LOG_ARGS_MAX; arg++) {
+        record->args[arg] = (arg < nargs) ? args[arg] : 0;
+    }
+    __sync_synchronize(); // record contents must be visible before the commit flag
+    record->committed = 1;
+
+    // wake the CLI to print it
+    if (__get_current_exception() != 0) {
+        BaseType_t higher_priority_woken = pdFALSE;
+        service_events_signal_from_isr(&cli_events, SERVICE_EVENT_COMMAND, &higher_priority_woken);
+        portYIELD_FROM_ISR(higher_priority_woken);
+    }
+    else {
+        service_events_signal(&cli_events, SERVICE_EVENT_COMMAND);
+    }
+
+    return true;
+}
+
+size_t log_take(char *buf, size_t buf_len) {
+    log_record_t *record;
+    size_t out_len;
+
+    if (!log_pending()) return 0;
+    record = &log_ring[log_ring_tail & (LOG_RING_DEPTH - 1)];
+    if (!record->committed) return 0; // producer is still writing it
+    __sync_synchronize(); // read the commit flag before the record contents
+
+    // same timestamp format as timestamp() in shell.c, followed by the level
+    out_len = snprintf(buf, buf_len, "[%llu\t] %s: ", record->time_us,
+                       log_level_names[record->level <= LOG_LEVEL_DEBUG ? record->level : LOG_LEVEL_NONE]);
+    if (out_len < buf_len) {
+        if (record->id < LOG_NUM_IDS) {
+            // pass all arguments, unused ones are ignored by the format
+            out_len += snprintf(buf + out_len, buf_len - out_len, log_formats[record->id],
+                                record->args[0], record->args[1], record->args[2], record->args[3]);
+        }
+        else {
+            out_len += snprintf(buf + out_len, buf_len - out_len, "unknown log id %u", record->id);
+        }
+    }
+    if (out_len >= buf_len) {
+        out_len = buf_len - 1; // truncated
+    }
+
+    // release the slot back to the producers
+    record->committed = 0;
+    __sync_synchronize();
+    log_ring_tail++;
+
+    return out_len;
+}
+
+bool log_pending(void) {
+    return log_ring_head != log_ring_tail;
+}
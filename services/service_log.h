@@ -0,0 +1,149 @@
+/******************************************************************************
+ * @file service_log.h
+ *
+ * @brief Binary logging facility. Log calls capture a format string ID and up
+ *        to LOG_ARGS_MAX integer arguments into a ring of fixed-size records,
+ *        without any string formatting, so they are cheap enough to use in
+ *        time-critical code and safe to call from ISRs. Records are formatted
+ *        into text later by the CLI task.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#ifndef SERVICE_LOG_H
+#define SERVICE_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// log levels - each service/driver sets the highest level it logs in services.h
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_DEBUG     4
+
+// log format string table - X(id, format). Arguments are captured as uint32_t,
+// so formats may only use 32 bit integer conversions (%lu, %ld, %lx, %c), and
+// at most LOG_ARGS_MAX of them. IDs are the position in this table, so new
+// entries should be added at the end to keep IDs stable for anything decoding
+// raw records.
+#define LOG_FORMATS(X) \
+    X(LOG_HEARTBEAT,            "ba-bump") \
+    X(LOG_NETMAN_WIFI_READY,    "WiFi hardware ready to connect") \
+    X(LOG_NETMAN_WIFI_FAIL,     "WiFi init failed") \
+    X(LOG_GPIO_IRQ,             "gpio %lu irq, event mask 0x%lx") \
+    X(LOG_CLI_UART_RX_OVERRUN,  "CLI UART rx buffer full, %lu chars dropped") \
+    X(LOG_CLI_UART_HW_OVERRUN,  "CLI UART rx hardware FIFO overrun") \
+    X(LOG_STACKMON_LOW,         "task %lu stack low, %lu of %lu words free, grew %lu last window - see /proc/stack") \
+    X(LOG_STACKMON_TOO_MANY,    "more than %lu tasks, stack use not sampled") \
+    X(LOG_ADC_START_FAIL,       "ADC stream could not start at %lu Hz") \
+    X(LOG_ADC_OVERRUN,          "ADC stream overrun, %lu blocks lost - see /dev/adc0")
+
+#define LOG_ID_ENUM(id, fmt) id,
+typedef enum log_id_t {
+    LOG_FORMATS(LOG_ID_ENUM)
+    LOG_NUM_IDS
+} log_id_t;
+
+// log record ring settings
+#define LOG_ARGS_MAX        4
+#define LOG_RING_DEPTH      64 // number of records, must be a power of 2
+
+// log record - fixed size so a slot can be reserved without knowing the contents
+typedef struct log_record_t {
+    uint64_t time_us;               // time of the log call
+    uint16_t id;                    // format string ID, see LOG_FORMATS
+    uint8_t  level;                 // LOG_LEVEL_*
+    volatile uint8_t committed;     // set once the producer has finished writing the record
+    uint32_t args[LOG_ARGS_MAX];    // captured arguments
+} log_record_t;
+
+// log statistics
+typedef struct log_stats_t {
+    uint32_t records;       // records logged
+    uint32_t drops;         // records dropped because the ring was full
+    uint32_t high_water;    // most records ever waiting in the ring
+} log_stats_t;
+
+// global log statistics
+extern log_stats_t log_stats;
+
+// global format string table, indexed by log_id_t
+extern const char *log_formats[LOG_NUM_IDS];
+
+/**
+* @brief Log a message.
+*
+* Log a message from a service or driver, if the message level is within the
+* level set for that source in services.h - otherwise the call is compiled out.
+* Safe to call from an ISR. Arguments are converted to uint32_t.
+*
+* Example: LOG(LOG_LEVEL_INFO, GPIO, LOG_GPIO_IRQ, gpio, event_mask);
+*
+* @param level  LOG_LEVEL_* of the message
+* @param source service/driver name, as in its LOG_LEVEL_<source> define in services.h
+* @param id     format string ID from LOG_FORMATS
+* @param ...    up to LOG_ARGS_MAX integer arguments for the format string
+*/
+#define LOG(level, source, id, ...) \
+    do { \
+        if ((level) <= LOG_LEVEL_##source) { \
+            const uint32_t log_args_[] = {0, ##__VA_ARGS__}; \
+            log_write((level), (id), &log_args_[1], (sizeof(log_args_) / sizeof(log_args_[0])) - 1); \
+        } \
+    } while (0)
+#define LOG_ERROR(source, id, ...)  LOG(LOG_LEVEL_ERROR, source, id, ##__VA_ARGS__)
+#define LOG_WARN(source, id, ...)   LOG(LOG_LEVEL_WARN, source, id, ##__VA_ARGS__)
+#define LOG_INFO(source, id, ...)   LOG(LOG_LEVEL_INFO, source, id, ##__VA_ARGS__)
+#define LOG_DEBUG(source, id, ...)  LOG(LOG_LEVEL_DEBUG, source, id, ##__VA_ARGS__)
+
+/**
+* @brief Write a record into the log ring.
+*
+* Captures the current time, format ID and arguments into the next free record.
+* Use the LOG() macros rather than calling this directly, so that levels are
+* filtered at compile time. Safe to call from an ISR. The CLI is signalled to
+* wake up and print the record.
+*
+* @param level LOG_LEVEL_* of the message
+* @param id    format string ID from LOG_FORMATS
+* @param args  pointer to the arguments
+* @param nargs number of arguments (extras beyond LOG_ARGS_MAX are ignored)
+*
+* @return true if the record was logged, false if the ring was full
+*/
+bool log_write(uint8_t level, uint16_t id, const uint32_t *args, size_t nargs);
+
+/**
+* @brief Take the next log record and format it as text.
+*
+* Formats the oldest committed record in the ring into a timestamped string,
+* in the same style as cli_print_timestamped(). Called by the CLI task.
+*
+* @param buf     buffer to write the string into
+* @param buf_len size of the buffer
+*
+* @return length of the string written, 0 if there was no record to take
+*/
+size_t log_take(char *buf, size_t buf_len);
+
+/**
+* @brief Check if there are log records waiting to be taken.
+*
+* @param none
+*
+* @return true if at least one record is waiting
+*/
+bool log_pending(void);
+
+#endif /* SERVICE_LOG_H */
@@ -18,31 +18,49 @@
 #include "services.h"
 #include "service_queues.h"
 #include "shell.h"
+#include "rtos_utils.h"
+#include "mem_pool.h"
 #include "FreeRTOS.h"
 #include "queue.h"
+#include "task.h"
 
 // global declarations in services.h
-QueueHandle_t print_queue;
 QueueHandle_t taskman_queue;
 QueueHandle_t storman_queue;
 QueueHandle_t usb0_rx_queue;
 QueueHandle_t usb0_tx_queue;
 QueueHandle_t netman_action_queue;
 
+// CLI print ring - length-prefixed records, see cli_print_raw(). Indexes are
+// free-running and wrapped with the ring mask
+#if (PRINT_RING_SIZE & (PRINT_RING_SIZE - 1)) != 0
+#error "PRINT_RING_SIZE must be a power of 2"
+#endif
+static char print_ring[PRINT_RING_SIZE];
+static uint32_t print_ring_head;
+static uint32_t print_ring_tail;
+static SemaphoreHandle_t print_ring_mutex;
+print_ring_stats_t print_ring_stats;
+print_producer_stats_t print_producer_stats[PRINT_PRODUCERS_MAX];
+
+// storagemanager request item pool - see storman_item_alloc()
+static storman_item_t storman_item_pool[STORMAN_ITEM_POOL_SIZE];
+storman_queue_stats_t storman_queue_stats;
+
 // create task queues
 bool init_queues(void) {
     // initialize all queues
-    print_queue = xQueueCreate(PRINT_QUEUE_DEPTH, PRINT_QUEUE_ITEM_SIZE);
-    taskman_queue = xQueueCreate(TASKMAN_QUEUE_DEPTH, TASKMAN_QUEUE_ITEM_SIZE);
-    storman_queue = xQueueCreate(STORMAN_QUEUE_DEPTH, STORMAN_QUEUE_ITEM_SIZE);
-    usb0_rx_queue = xQueueCreate(USB0_RX_QUEUE_DEPTH, USB0_RX_QUEUE_ITEM_SIZE);
-    usb0_tx_queue = xQueueCreate(USB0_TX_QUEUE_DEPTH, USB0_TX_QUEUE_ITEM_SIZE);
+    print_ring_mutex = MUTEX_CREATE(print_ring_mutex);
+    taskman_queue = QUEUE_CREATE(taskman_queue, TASKMAN_QUEUE_DEPTH, TASKMAN_QUEUE_ITEM_SIZE);
+    storman_queue = QUEUE_CREATE(storman_queue, STORMAN_QUEUE_DEPTH, STORMAN_QUEUE_ITEM_SIZE);
+    usb0_rx_queue = QUEUE_CREATE(usb0_rx_queue, USB0_RX_QUEUE_DEPTH, USB0_RX_QUEUE_ITEM_SIZE);
+    usb0_tx_queue = QUEUE_CREATE(usb0_tx_queue, USB0_TX_QUEUE_DEPTH, USB0_TX_QUEUE_ITEM_SIZE);
 #ifdef HW_USE_WIFI
-    netman_action_queue = xQueueCreate(NETMAN_ACTION_QUEUE_DEPTH, NETMAN_ACTION_QUEUE_ITEM_SIZE);
+    netman_action_queue = QUEUE_CREATE(netman_action_queue, NETMAN_ACTION_QUEUE_DEPTH, NETMAN_ACTION_QUEUE_ITEM_SIZE);
 #endif
 
     // make sure they were all created successfully
-    if (print_queue         != NULL &&
+    if (print_ring_mutex    != NULL &&
         taskman_queue       != NULL &&
         storman_queue       != NULL &&
         usb0_rx_queue       != NULL &&
@@ -59,43 +77,250 @@ bool init_queues(void) {
  * helper functions to interact with queues
 ********************************************/
 
-bool cli_print_raw(char *string) {
-    if (xQueueSend(print_queue, string, 10) == pdTRUE) { // add string to print queue, waiting 10 os ticks max
-        return true;
+// copy into the print ring at the head, wrapping around the end of the buffer
+static void print_ring_write(const void *data, size_t len) {
+    uint32_t pos = print_ring_head & (PRINT_RING_SIZE - 1);
+    size_t first = (len < PRINT_RING_SIZE - pos) ? len : PRINT_RING_SIZE - pos;
+    memcpy(&print_ring[pos], data, first);
+    memcpy(print_ring, (const char *)data + first, len - first);
+    print_ring_head += len;
+}
+
+// copy out of the print ring from the tail, wrapping around the end of the buffer
+static void print_ring_read(void *data, size_t len) {
+    uint32_t pos = print_ring_tail & (PRINT_RING_SIZE - 1);
+    size_t first = (len < PRINT_RING_SIZE - pos) ? len : PRINT_RING_SIZE - pos;
+    memcpy(data, &print_ring[pos], first);
+    memcpy((char *)data + first, print_ring, len - first);
+    print_ring_tail += len;
+}
+
+// count a queued or dropped message against the calling task
+static void print_producer_count(bool queued) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+    taskENTER_CRITICAL();
+    // a drop can happen without the ring mutex (i.e. it was busy), so drops are
+    // counted here where every producer is serialized
+    if (!queued) {
+        print_ring_stats.drops++;
     }
-    else return false;
+    for (int entry = 0; entry < PRINT_PRODUCERS_MAX; entry++) {
+        if (print_producer_stats[entry].task == NULL) {
+            // first message from this task, claim an entry
+            print_producer_stats[entry].task = task;
+            strncpy(print_producer_stats[entry].name, pcTaskGetName(task), configMAX_TASK_NAME_LEN - 1);
+        }
+        if (print_producer_stats[entry].task == task) {
+            if (queued) {
+                print_producer_stats[entry].records++;
+            }
+            else {
+                print_producer_stats[entry].drops++;
+            }
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
 }
 
-bool cli_print_timestamped(char *string) {
-    bool queue_post_result;
-    char *timestamped_string = pvPortMalloc(TIMESTAMP_LEN + strlen(string));
-    sprintf(timestamped_string, timestamp());
-    sprintf(timestamped_string + strlen(timestamped_string), string);
-    if (xQueueSend(print_queue, timestamped_string, 10) == pdTRUE) { // add string to print queue, waiting 10 os ticks max
-        queue_post_result = true;
-    }
-    else queue_post_result = false;
-    vPortFree(timestamped_string);
+// add a message record to the print ring, only the message chars are copied
+static bool cli_print_record(const char *string, uint16_t flags) {
+    bool queue_post_result = false;
+    uint64_t time_us = get_time_us(); // stamp the time of the call, not of the ring access
+    print_record_hdr_t hdr = {.len = strnlen(string, PRINT_RECORD_MAX), .flags = flags};
+    size_t record_len = sizeof(hdr) + hdr.len + ((flags & PRINT_FLAG_TIMESTAMP) ? sizeof(time_us) : 0);
+
+    if (xSemaphoreTake(print_ring_mutex, 10) == pdTRUE) {
+        if (PRINT_RING_SIZE - (print_ring_head - print_ring_tail) >= record_len) {
+            print_ring_write(&hdr, sizeof(hdr));
+            if (flags & PRINT_FLAG_TIMESTAMP) {
+                print_ring_write(&time_us, sizeof(time_us));
+            }
+            print_ring_write(string, hdr.len);
+            print_ring_stats.records++;
+            if (print_ring_head - print_ring_tail > print_ring_stats.high_water) {
+                print_ring_stats.high_water = print_ring_head - print_ring_tail;
+            }
+            queue_post_result = true;
+        }
+        xSemaphoreGive(print_ring_mutex);
+    }
+    if (queue_post_result) {
+        service_events_signal(&cli_events, SERVICE_EVENT_COMMAND); // wake the CLI to print it
+    }
+    print_producer_count(queue_post_result);
     return queue_post_result;
 }
 
+bool cli_print_raw(char *string) {
+    return cli_print_record(string, 0);
+}
+
+bool cli_print_timestamped(char *string) {
+    return cli_print_record(string, PRINT_FLAG_TIMESTAMP);
+}
+
+size_t cli_print_take(char *buf, size_t buf_len) {
+    print_record_hdr_t hdr;
+    uint64_t time_us;
+    size_t out_len = 0;
+    size_t copy_len;
+
+    if (!cli_print_pending()) return 0;
+    if (xSemaphoreTake(print_ring_mutex, 10) == pdTRUE) {
+        if (print_ring_head != print_ring_tail) {
+            print_ring_read(&hdr, sizeof(hdr));
+            if (hdr.flags & PRINT_FLAG_TIMESTAMP) {
+                // same format as timestamp(), but with the time the message was queued
+                print_ring_read(&time_us, sizeof(time_us));
+                out_len = snprintf(buf, buf_len, "[%llu\t] ", time_us);
+            }
+            copy_len = (hdr.len < buf_len - 1 - out_len) ? hdr.len : buf_len - 1 - out_len;
+            print_ring_read(buf + out_len, copy_len);
+            print_ring_tail += hdr.len - copy_len; // skip whatever doesn't fit
+            out_len += copy_len;
+            buf[out_len] = '\0';
+        }
+        xSemaphoreGive(print_ring_mutex);
+    }
+    return out_len;
+}
+
+bool cli_print_pending(void) {
+    return print_ring_head != print_ring_tail;
+}
+
 bool taskman_request(struct taskman_item_t *tmi) {
     if (xQueueSend(taskman_queue, tmi, 10) == pdTRUE) { // add request item to taskmanager queue, waiting 10 os ticks max
+        service_events_signal(&taskman_events, SERVICE_EVENT_COMMAND);
         return true;
     }
     else return false;
 }
 
-bool storman_request(struct storman_item_t *smi) {
-    if (xQueueSend(storman_queue, smi, 10) == pdTRUE) { // add request item to storagemanager queue, waiting 10 os ticks max
+storman_item_t *storman_item_alloc(size_t data_len) {
+    storman_item_t *smi = NULL;
+
+    // claim a free item from the pool
+    taskENTER_CRITICAL();
+    for (int i = 0; i < STORMAN_ITEM_POOL_SIZE; i++) {
+        if (storman_item_pool[i].sm_item_refs == 0) {
+            smi = &storman_item_pool[i];
+            smi->sm_item_refs = 1; // reference held by the requester
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if (smi != NULL) {
+        smi->sm_item_name[0] = '\0';
+        smi->sm_item_offset = 0;
+        smi->sm_item_size = 0;
+        smi->sm_item_handle = -1;
+        smi->sm_item_flags = 0;
+        smi->sm_item_data = NULL;
+        smi->sm_item_data_len = data_len;
+        smi->sm_item_requester = NULL;
+        smi->sm_item_done = false;
+        smi->sm_item_result = 0;
+        if (data_len > 0) {
+            smi->sm_item_data = mem_pool_alloc(data_len); // falls back to the heap if the pool is out
+            if (smi->sm_item_data == NULL) { // give the item back if there is no memory for its data
+                smi->sm_item_refs = 0;
+                return NULL;
+            }
+            smi->sm_item_data[0] = '\0';
+            storman_queue_stats.data_bytes += data_len;
+        }
+    }
+
+    return smi;
+}
+
+void storman_item_release(storman_item_t *smi) {
+    char *free_data = NULL;
+
+    if (smi == NULL) return;
+
+    taskENTER_CRITICAL();
+    smi->sm_item_refs--;
+    if (smi->sm_item_refs == 0) {
+        // last reference dropped, detach the data buffer before the item goes
+        // back into the pool so it can't be freed out from under a new owner
+        free_data = smi->sm_item_data;
+        smi->sm_item_data = NULL;
+    }
+    taskEXIT_CRITICAL();
+
+    if (free_data != NULL) {
+        mem_pool_free(free_data);
+    }
+}
+
+bool storman_request(storman_item_t *smi) {
+    // take a reference on behalf of storagemanager, it will be released when the request is serviced
+    taskENTER_CRITICAL();
+    smi->sm_item_refs++;
+    taskEXIT_CRITICAL();
+
+    smi->sm_item_queued_us = get_time_us();
+    if (xQueueSend(storman_queue, &smi, 10) == pdTRUE) { // add request item pointer to storagemanager queue, waiting 10 os ticks max
+        taskENTER_CRITICAL();
+        storman_queue_stats.requests++;
+        storman_queue_stats.queue_bytes += 2 * STORMAN_QUEUE_ITEM_SIZE; // pointer in, pointer out
+        taskEXIT_CRITICAL();
         return true;
     }
-    else return false;
+    else {
+        storman_item_release(smi); // request never made it to storagemanager, drop its reference
+        return false;
+    }
+}
+
+bool storman_request_wait(storman_item_t *smi, TickType_t timeout) {
+    TimeOut_t wait_timeout;
+
+    // discard any completion left over from an earlier request that timed out
+    xTaskNotifyStateClearIndexed(NULL, NOTIFY_INDEX_STORMAN);
+    ulTaskNotifyValueClearIndexed(NULL, NOTIFY_INDEX_STORMAN, UINT32_MAX);
+
+    smi->sm_item_requester = xTaskGetCurrentTaskHandle();
+    smi->sm_item_done = false;
+    if (!storman_request(smi)) {
+        return false;
+    }
+
+    // wait for storagemanager to signal that this item is done
+    vTaskSetTimeOutState(&wait_timeout);
+    while (!smi->sm_item_done) {
+        if (xTaskCheckForTimeOut(&wait_timeout, &timeout) == pdTRUE) {
+            break;
+        }
+        ulTaskNotifyTakeIndexed(NOTIFY_INDEX_STORMAN, pdTRUE, timeout);
+    }
+
+    return smi->sm_item_done;
+}
+
+bool storman_log(const char *name, const char *record) {
+    storman_item_t *smi = storman_item_alloc(strlen(record) + 1);
+    bool queued;
+
+    if (smi == NULL) return false;
+    smi->action = LOGAPPEND;
+    strncpy(smi->sm_item_name, name, PATHNAME_MAX_LEN - 1);
+    strcpy(smi->sm_item_data, record);
+    queued = storman_request(smi);
+    storman_item_release(smi); // fire and forget, storagemanager holds its own reference
+
+    return queued;
 }
 
 #ifdef HW_USE_WIFI
 bool netman_request(netman_action_t nma) {
     if (xQueueSend(netman_action_queue, &nma, 10) == pdTRUE) { // add request item to networkmanager queue, waiting 10 os ticks max
+        service_events_signal(&netman_events, SERVICE_EVENT_COMMAND);
         return true;
     }
     else return false;
@@ -104,6 +329,7 @@ bool netman_request(netman_action_t nma) {
 
 bool usb_data_get(uint8_t *usb_rx_data) {
     if (xQueueReceive(usb0_rx_queue, usb_rx_data, 0) == pdTRUE) { // try to get any data in queue immediately so as not to block
+        service_events_signal(&usb_events, SERVICE_EVENT_COMMAND); // there is room for the USB service to hand off more data
         return true;
     }
     else return false;
@@ -111,6 +337,7 @@ bool usb_data_get(uint8_t *usb_rx_data) {
 
 bool usb_data_put(uint8_t *usb_tx_data) {
     if (xQueueSend(usb0_tx_queue, usb_tx_data, 10) == pdTRUE) { // add data item to usb tx queue, waiting 10 os ticks max
+        service_events_signal(&usb_events, SERVICE_EVENT_COMMAND);
         return true;
     }
     else return false;
@@ -34,12 +34,42 @@
  * CLI printing queue -
  * allows tasks other than CLI to print to the CLI UART/USB
 ***********************************************************/
-extern QueueHandle_t print_queue;
-// note: if any characters are entered after the prompt, the CLI will not pull
-// from the print queue... so the queue depth represents how many output strings
-// can be buffered in the queue until current user input is completed
-#define PRINT_QUEUE_DEPTH       32
-#define PRINT_QUEUE_ITEM_SIZE   BUF_OUT_SIZE
+// messages are copied into a byte ring as length-prefixed records, so a
+// message only takes up as much space as its own length (plus a small header).
+// the CLI drains the ring even while a command is being typed - messages are
+// printed above the input line and the line is redrawn (see cli_service.c), so
+// the ring only needs to cover bursts faster than the CLI can print them
+#define PRINT_RING_SIZE         2048 // must be a power of 2
+#define PRINT_RECORD_MAX        (BUF_OUT_SIZE - TIMESTAMP_LEN - 1) // longer messages are truncated
+#define PRINT_FLAG_TIMESTAMP    0x01 // record carries a timestamp to print ahead of the message
+
+// print ring record header, followed by the timestamp (if flagged) and message chars
+typedef struct print_record_hdr_t {
+    uint16_t len;   // length of the message, without null terminator
+    uint16_t flags; // PRINT_FLAG_* bits
+} print_record_hdr_t;
+
+// print ring statistics
+typedef struct print_ring_stats_t {
+    uint32_t records;    // messages queued
+    uint32_t drops;      // messages dropped because the ring was full or busy
+    uint32_t high_water; // most bytes ever in use in the ring
+} print_ring_stats_t;
+
+// global print ring statistics
+extern print_ring_stats_t print_ring_stats;
+
+// per-producer print statistics, one entry per task that has printed
+#define PRINT_PRODUCERS_MAX     8 // tasks beyond this are only counted in print_ring_stats
+typedef struct print_producer_stats_t {
+    TaskHandle_t task;                      // producer task, NULL for an unused entry
+    char name[configMAX_TASK_NAME_LEN];     // copy of the task name, in case the task is deleted
+    uint32_t records;                       // messages queued by this task
+    uint32_t drops;                         // messages from this task that were dropped
+} print_producer_stats_t;
+
+// global per-producer print statistics
+extern print_producer_stats_t print_producer_stats[PRINT_PRODUCERS_MAX];
 
 
 /*************************************************
@@ -47,8 +77,8 @@ extern QueueHandle_t print_queue;
  * used to pass commands for managing task control
 **************************************************/
 extern QueueHandle_t taskman_queue;
-typedef enum tm_action_t {DELETE, SUSPEND, RESUME} tm_action_t; // action to take on task
-typedef struct taskman_item_t {TaskHandle_t task; tm_action_t action;} taskman_item_t; // queue item - struct for taskID & action
+typedef enum tm_action_t {DELETE, SUSPEND, RESUME, PIN} tm_action_t; // action to take on task
+typedef struct taskman_item_t {TaskHandle_t task; tm_action_t action; UBaseType_t core_mask;} taskman_item_t; // queue item - struct for taskID & action, core_mask for PIN
 #define TASKMAN_QUEUE_DEPTH     1
 #define TASKMAN_QUEUE_ITEM_SIZE sizeof(taskman_item_t)
 
@@ -72,24 +102,89 @@ typedef enum {LSDIR,      // list directory contents
               CHKFILE,    // check if a file exists without error
               FSSTAT,     // get filesystem statistics
               FORMAT,     // format the filesystem
-              UNMOUNT     // unmount the filesystem and stop the service
+              UNMOUNT,    // unmount the filesystem and stop the service
+              FOPEN,      // open a file and return a handle to it
+              FREAD,      // read from an open file at its current position
+              FWRITE,     // write to an open file at its current position
+              FSEEK,      // set the position of an open file
+              FCLOSE,     // close an open file handle
+              LOGAPPEND,  // append a record to a buffered log file
+              LOGSYNC,    // flush buffered log records to flash
+              FSBENCH,    // benchmark littlefs geometries on a RAM disk
+              STORMAN_NUM_ACTIONS // number of actions (not an action)
              } storman_action_t;
-// the storagemanager queue item structure
+// the storagemanager request item structure.
+// items are never copied through the queue - only a pointer to the item is
+// queued, and the storagemanager works directly on the item and its data buffer.
+// items (and their data buffers) are taken from a small static pool using
+// storman_item_alloc(), and are returned to the pool when the last reference
+// is dropped with storman_item_release().
 typedef struct storman_item_t {storman_action_t action;
                                char sm_item_name[PATHNAME_MAX_LEN];   // file or directory name
                                lfs_soff_t sm_item_offset;             // offset in file to read/write
                                long sm_item_size;                     // size of data to read/write
-                               char sm_item_data[FILE_SIZE_MAX];      // file input/output data
+                               int sm_item_handle;                    // open file handle (FREAD/FWRITE/FSEEK/FCLOSE)
+                               int sm_item_flags;                     // lfs_open_flags for FOPEN, lfs_whence_flags for FSEEK
+                               char *sm_item_data;                    // file input/output data buffer (NULL if not needed)
+                               size_t sm_item_data_len;               // size of the sm_item_data buffer in bytes
                                struct lfs_info sm_item_info;          // littlefs info structure
+                               uint8_t sm_item_refs;                  // reference count, 0 when item is free in the pool
+                               TaskHandle_t sm_item_requester;        // task to notify on completion (NULL if none)
+                               volatile bool sm_item_done;            // set by storagemanager when the action is complete
+                               int sm_item_result;                    // littlefs result of the action (>= 0 on success)
+                               uint64_t sm_item_queued_us;            // time the request was queued, for latency stats
                               } storman_item_t;
 
-// global structure to hold storagemanager status data
-extern struct storman_item_t smi_glob;
-// global storagemanager status binary semaphore - for data ready synchronization
-extern SemaphoreHandle_t smi_glob_sem;
+#define STORMAN_QUEUE_DEPTH     8
+#define STORMAN_QUEUE_ITEM_SIZE sizeof(storman_item_t *)
+// number of request items that can be allocated (in flight) at once
+#define STORMAN_ITEM_POOL_SIZE  8
+// request path counters. each request copies one item pointer into the queue and
+// one out again, where the item used to be copied by value (with a FILE_SIZE_MAX
+// data array) both ways and then once more into a global result item
+typedef struct storman_queue_stats_t {uint32_t requests;    // requests queued
+                                      uint32_t queue_bytes; // bytes copied into and out of the queue
+                                      uint32_t data_bytes;  // bytes of request data buffers allocated
+                                     } storman_queue_stats_t;
+extern storman_queue_stats_t storman_queue_stats;
+// bytes a request would have copied on the old by-value path, for comparison
+#define STORMAN_BYVALUE_REQUEST_BYTES (3 * (sizeof(storman_item_t) - sizeof(char *) - sizeof(size_t) + FILE_SIZE_MAX))
+// FOPEN returns a handle (0 to FLASH0_OPEN_FILES_MAX-1) in sm_item_result, which is
+// then passed in sm_item_handle to FREAD/FWRITE/FSEEK/FCLOSE. The file stays open
+// in storagemanager between requests until it is closed (or the fs is formatted/unmounted).
+// max OS ticks for a requester to wait for an action to complete (format can take a while)
+#define STORMAN_REQUEST_TIMEOUT 2000
+
+// storagemanager per-action latency statistics, measured from the time a
+// request is queued until its action is complete. Latencies are binned into
+// power-of-2 microsecond buckets: bucket 0 holds 0us, bucket n holds latencies
+// of [2^(n-1), 2^n) us, and the last bucket holds everything longer.
+#define STORMAN_LAT_BUCKETS     20
+typedef struct storman_latency_t {uint32_t count;                       // number of requests serviced
+                                  uint64_t total_us;                    // sum of all latencies, for the average
+                                  uint32_t max_us;                      // worst case latency
+                                  uint32_t wait_max_us;                 // worst case time spent waiting in the queue
+                                  uint32_t hist[STORMAN_LAT_BUCKETS];   // latency histogram
+                                 } storman_latency_t;
+extern storman_latency_t storman_latency[STORMAN_NUM_ACTIONS];
+extern const char *storman_action_names[STORMAN_NUM_ACTIONS];
 
-#define STORMAN_QUEUE_DEPTH     1
-#define STORMAN_QUEUE_ITEM_SIZE sizeof(smi_glob)
+// storagemanager buffered log writer. LOGAPPEND records are collected in a RAM
+// buffer of FLASH0_PAGE_SIZE per log file and written to flash in one program +
+// commit when the buffer fills, when the oldest buffered record is older than
+// STORMAN_LOG_FLUSH_MS, or on LOGSYNC. At most one page (or STORMAN_LOG_FLUSH_MS
+// worth) of records per log can be lost on power failure.
+#define STORMAN_LOGS_MAX        2       // number of log files which can be open at once
+#define STORMAN_LOG_FLUSH_MS    2000    // max age of a buffered record before it is flushed
+typedef struct storman_log_stats_t {uint32_t records;       // records appended
+                                    uint32_t bytes;         // bytes appended
+                                    uint32_t flushes;       // buffer flushes (flash program + commit)
+                                    uint32_t size_flushes;  // flushes due to a full buffer
+                                    uint32_t time_flushes;  // flushes due to the flush deadline
+                                    uint32_t sync_flushes;  // flushes due to LOGSYNC, unmount, etc
+                                    uint32_t dropped;       // bytes discarded because a flush failed
+                                   } storman_log_stats_t;
+extern storman_log_stats_t storman_log_stats;
 
 
 #ifdef HW_USE_WIFI
@@ -134,8 +229,9 @@ extern QueueHandle_t usb0_tx_queue;
 /**
 * @brief Initialize all queues.
 *
-* This routine uses the FreeRTOS xQueueCreate API to create each queue used
-* in the system. All queues are created even if the tasks that use them have
+* This routine uses QUEUE_CREATE() (see rtos_utils.h) to create each queue used
+* in the system, from the FreeRTOS heap or from static storage in
+* ENABLE_STATIC_ALLOC builds. All queues are created even if the tasks that use them have
 * not yet been started.
 *
 * @param none
@@ -149,27 +245,50 @@ bool init_queues(void);
 /**
 * @brief Print a raw string out to the CLI.
 *
-* This function puts a string pointer into the CLI printing queue exactly as
-* passed.
+* This function copies a string into the CLI printing queue exactly as passed.
+* The string does not need to remain valid after the call returns.
 *
 * @param string pointer to the string to put in the queue for printing
 *
-* @return nothing
+* @return true if the string was queued, false if it was dropped (queue full)
 */
 bool cli_print_raw(char *string);
 
 /**
 * @brief Print a timestamped string out to the CLI.
 *
-* This function prepends a timestamp onto the given string and then drops the
-* new timestamped string pointer into the CLI printing queue.
+* This function copies a string into the CLI printing queue along with the
+* current time, which is printed ahead of the string when the CLI dequeues it.
 *
 * @param string pointer to the string to put in the queue for printing
 *
-* @return nothing
+* @return true if the string was queued, false if it was dropped (queue full)
 */
 bool cli_print_timestamped(char *string);
 
+/**
+* @brief Take the next message out of the CLI printing queue.
+*
+* Used by the CLI service to pull queued messages for printing. The message is
+* copied into the given buffer as a null-terminated string, with its timestamp
+* prepended if it was queued with cli_print_timestamped().
+*
+* @param buf     buffer to copy the message into
+* @param buf_len size of the buffer, BUF_OUT_SIZE will fit any message
+*
+* @return length of the string copied into buf, 0 if the queue was empty
+*/
+size_t cli_print_take(char *buf, size_t buf_len);
+
+/**
+* @brief Check if there are messages waiting in the CLI printing queue.
+*
+* @param none
+*
+* @return true if at least one message is waiting
+*/
+bool cli_print_pending(void);
+
 /**
 * @brief Send a request to taskmanager.
 *
@@ -184,18 +303,83 @@ bool cli_print_timestamped(char *string);
 */
 bool taskman_request(struct taskman_item_t *tmi);
 
+/**
+* @brief Allocate a storagemanager request item.
+*
+* Takes a free request item from the storagemanager item pool and allocates a
+* data buffer of the requested size for it from the memory pools (see
+* mem_pool.h), so requests don't churn the FreeRTOS heap. The data buffer is used for both
+* input (i.e. data to write) and output (i.e. file contents, directory listings)
+* so it should be sized for whichever is larger - actions which do not carry
+* any data (CHKFILE, MKDIR, etc) can use a length of 0.
+*
+* @param data_len size in bytes of the data buffer to allocate with the item
+*
+* @return pointer to the request item, or NULL if the pool is exhausted or the
+*         data buffer could not be allocated
+*/
+storman_item_t *storman_item_alloc(size_t data_len);
+
+/**
+* @brief Release a storagemanager request item.
+*
+* Drops a reference to a request item obtained with storman_item_alloc(). The
+* item and its data buffer are returned to the pool once both the requester
+* and the storagemanager service have released it, so it is safe to release
+* an item immediately after queueing it if no result is needed.
+*
+* @param smi pointer to the request item to release (NULL is ignored)
+*
+* @return nothing
+*/
+void storman_item_release(storman_item_t *smi);
+
 /**
 * @brief Send a request to storagemanager.
 *
-* This helper function puts a storagemanager request item structure into the
-* storagemanager service's queue for interaction with a filesystem.
+* This helper function puts a pointer to a storagemanager request item into the
+* storagemanager service's queue for interaction with a filesystem. The item
+* must have been obtained with storman_item_alloc(); a reference is taken on
+* behalf of the service, which releases it when the action is complete.
 *
 * @param smi pointer to the storagemanger request item to put into the queue for
 *            filesystem access
 *
 * @return true if item successfully queued, otherwise false (queue full)
 */
-bool storman_request(struct storman_item_t *smi);
+bool storman_request(storman_item_t *smi);
+
+/**
+* @brief Send a request to storagemanager and wait for it to complete.
+*
+* Same as storman_request(), but the calling task blocks until storagemanager
+* has serviced this specific request (or the timeout expires). Completion is
+* signalled with a task notification on NOTIFY_INDEX_STORMAN, so any number of
+* tasks can have requests in flight without seeing each other's results. On
+* success the action's littlefs result is in smi->sm_item_result and any output
+* data is in smi->sm_item_data.
+*
+* @param smi pointer to the storagemanger request item
+* @param timeout maximum number of OS ticks to wait for completion
+*
+* @return true if the request was completed within the timeout, otherwise false
+*/
+bool storman_request_wait(storman_item_t *smi, TickType_t timeout);
+
+/**
+* @brief Append a record to a flash0 log file.
+*
+* Queues a LOGAPPEND request for storagemanager without waiting for it. The
+* record is buffered in RAM with other records for the same log, and written
+* to flash in page sized batches (see STORMAN_LOG_FLUSH_MS). A newline is added
+* after each record.
+*
+* @param name name of the log file
+* @param record null terminated record to append
+*
+* @return true if the record was queued, otherwise false
+*/
+bool storman_log(const char *name, const char *record);
 
 #ifdef HW_USE_WIFI
 /**
@@ -20,6 +20,9 @@
  ******************************************************************************/
 
 #include "services.h"
+#include "rtos_utils.h"
+#include "FreeRTOS.h"
+#include "task.h"
 
 // see services.h for more information on creating services
 // note: use xstr() to convert the SERVICE_NAME_ #define from services.h to a usable string
@@ -28,35 +31,66 @@ const service_desc_t service_descriptors[] = {
     {
         .name = xstr(SERVICE_NAME_USB), 
         .service_func = usb_service,
-        .startup = true
+        .startup = true,
+        .core_affinity = AFFINITY_USB
     },
     {
         .name = xstr(SERVICE_NAME_CLI), 
         .service_func = cli_service,
-        .startup = true
+        .startup = true,
+        .core_affinity = AFFINITY_CLI
     },
     {
         .name = xstr(SERVICE_NAME_STORMAN), 
         .service_func = storman_service,
-        .startup = true
+        .startup = true,
+        .core_affinity = AFFINITY_STORMAN
     },
 #ifdef HW_USE_WIFI
     {
         .name = xstr(SERVICE_NAME_NETMAN), 
         .service_func = netman_service,
-        .startup = true
+        .startup = true,
+        .core_affinity = AFFINITY_NETMAN
     },
 #endif /* HW_USE_WIFI */
     {
         .name = xstr(SERVICE_NAME_WATCHDOG), 
         .service_func = watchdog_service,
-        .startup = true
+        .startup = true,
+        .core_affinity = AFFINITY_WATCHDOG
     },
+    {
+        .name = xstr(SERVICE_NAME_STACKMON), 
+        .service_func = stackmon_service,
+        .startup = true,
+        .core_affinity = AFFINITY_STACKMON
+    },
+#if HW_USE_ADC
+    {
+        .name = xstr(SERVICE_NAME_ADC), 
+        .service_func = adc_service,
+        .startup = true,
+        .core_affinity = AFFINITY_ADC
+    },
+#endif /* HW_USE_ADC */
     {
         .name = xstr(SERVICE_NAME_HEARTBEAT), 
         .service_func = heartbeat_service,
-        .startup = false
+        .startup = false,
+        .core_affinity = AFFINITY_HEARTBEAT
     }
 };
 
-const size_t service_descriptors_length = sizeof(service_descriptors)/sizeof(service_desc_t);
\ No newline at end of file
+const size_t service_descriptors_length = sizeof(service_descriptors)/sizeof(service_desc_t);
+
+BaseType_t service_start(const service_desc_t *service) {
+    BaseType_t xReturn = service->service_func();
+
+    // the task is created by the service function, find it by name to set its affinity
+    if (xReturn == pdPASS) {
+        task_set_core_affinity(xTaskGetHandle(service->name), service->core_affinity);
+    }
+
+    return xReturn;
+}
\ No newline at end of file
@@ -23,6 +23,8 @@
 #include <stdbool.h>
 #include "hardware_config.h"
 #include "shell.h"
+#include "service_log.h"
+#include "service_events.h"
 #include "FreeRTOS.h"
 #include "lfs.h"
 
@@ -38,22 +40,37 @@
  *            an example). The service's "descriptor" then needs to be added
  *            to the service_descriptors[] array in services.c, which associates
  *            the service's main function pointer with its name string, and
- *            defines whether the service should run at boot.
+ *            defines whether the service should run at boot and which cores
+ *            it may run on.
  * 
  *            The service schedule within FreeRTOS is determined by 3 parameters:
- *            Priority, Repeat, and Delay. Upon any given scheduler tick, the OS
- *            will run the task (service) with the highest priority. After a task
- *            runs, it will check if it should immediately run again based on the
- *            REPEAT parameter; if it has already repeated the specified number
- *            of times it will block itself for the specified number of ticks
- *            based on the DELAY parameter. This essentially means a task's run
- *            percentage (within a priority level) is given by REPEAT/DELAY.
+ *            Priority, Period, and Budget. Upon any given scheduler tick, the OS
+ *            will run the task (service) with the highest priority. Each pass
+ *            of a service's main loop starts PERIOD ticks after the start of
+ *            the previous one (see task_period_init() in rtos_utils.h), so the
+ *            service runs at a fixed rate no matter how long each pass takes.
+ *            BUDGET is the CPU time a pass is expected to take; passes that
+ *            exceed it, or that run into the next period, are counted and shown
+ *            along with start jitter in '/proc/sched'.
+ *
+ *            Services that only have work to do when something happens (a
+ *            command arrives in their queue, or a driver has I/O for them) are
+ *            event-driven instead - they block until an event is delivered,
+ *            see service_events.h and the taskmanager service for an example.
+ *            Their wakeups and event latency are shown in '/proc/events'.
+ *
+ *            When every service is blocked, the CPU has nothing to do until the
+ *            next PERIOD or event. Building with ENABLE_TICKLESS_IDLE (see
+ *            project.cmake) lets FreeRTOS stop the tick and sleep through these
+ *            gaps - the longer services block for, the longer the sleeps. Sleep
+ *            vs active time is shown in '/proc/power'.
  * 
  *            Pro tip: uncomment add_definitions(-DSCHED_TEST_DELAY) in the
  *            top-level CMakeLists.txt to burn extra cycles in each service, and
  *            then use the 'bin/top' CLI command to show FreeRTOS task runtime
- *            percentages to help tune the scheduler! Don't forget to comment
- *            this back out after testing!
+ *            percentages and '/proc/sched' to see budget overruns and jitter to
+ *            help tune the scheduler! Don't forget to comment this back out
+ *            after testing!
  * 
  *            Note that by default, 1 OS tick is 1 ms.
  *            This can be changed in FreeRTOSConfig.h, see 'configTICK_RATE_HZ'
@@ -72,6 +89,8 @@
 #define SERVICE_NAME_NETMAN     networkmanager
 #define SERVICE_NAME_WATCHDOG   watchdog
 #define SERVICE_NAME_HEARTBEAT  heartbeat
+#define SERVICE_NAME_STACKMON   stackmonitor
+#define SERVICE_NAME_ADC        adcstream
 
 // freertos task priorities for the services.
 // as long as configUSE_TIME_SLICING is set, equal priority tasks will share time.
@@ -82,37 +101,67 @@
 #define PRIORITY_NETMAN    3
 #define PRIORITY_WATCHDOG  1
 #define PRIORITY_HEARTBEAT 1
+#define PRIORITY_STACKMON  1
+#define PRIORITY_ADC       2
+
+// core affinity for the services on SMP builds (RTOS_NUM_CORES > 1 in rtos_config.h),
+// as a bitmask of the cores a service may run on. AFFINITY_ANY leaves the service
+// free to run on whichever core is available. Keeping the latency-sensitive CLI and
+// USB services on one core and the network and storage stacks on the other stops
+// long flash or WiFi operations from delaying character I/O. Ignored on single
+// core builds. Use 'service pin' to change a service's core at runtime.
+#define AFFINITY_ANY        0
+#define AFFINITY_CORE0      (1 << 0)
+#define AFFINITY_CORE1      (1 << 1)
+#define AFFINITY_TASKMAN    AFFINITY_ANY
+#define AFFINITY_CLI        AFFINITY_CORE0
+#define AFFINITY_USB        AFFINITY_CORE0
+#define AFFINITY_STORMAN    AFFINITY_CORE1
+#define AFFINITY_NETMAN     AFFINITY_CORE1
+#define AFFINITY_WATCHDOG   AFFINITY_ANY
+#define AFFINITY_HEARTBEAT  AFFINITY_ANY
+#define AFFINITY_STACKMON   AFFINITY_ANY
+#define AFFINITY_ADC        AFFINITY_ANY
+
+// OS ticks from the start of one execution of a service to the start of the next.
+// The service blocks for whatever is left of the period once it has finished
+// its current work, so higher priority services must finish well within their
+// period to allow lower priority tasks to execute. Note that if a service never
+// blocks and priority is > 0, the IDLE task will always be blocked and FreeRTOS
+// will not be able to perform task cleanup (i.e. freeing RAM).
+#define PERIOD_WATCHDOG     100
+#define PERIOD_HEARTBEAT    5000  // Example heartbeat service "beats" every 5 seconds when started
+#define PERIOD_STACKMON     1000  // stack use trend windows are STACK_MON_TREND_SAMPLES periods long
+// storagemanager has no PERIOD - it blocks on its request queue and runs
+// as soon as a request arrives, see STORMAN_REQUEST_TIMEOUT in service_queues.h
+
+// CPU time budget in microseconds for each execution of a service, 0 for none.
+// Executions over budget are counted in '/proc/sched', they are not preempted.
+#define BUDGET_WATCHDOG     100
+#define BUDGET_HEARTBEAT    500
+#define BUDGET_STACKMON     1000  // walks the unused part of every task's stack
 
-// number of sequential time slices to run each service before beginning the
-// delay interval set below. If a service should run most of the time, set REPEAT
-// to a higher number and DELAY to a lower number. 
-#define REPEAT_TASKMAN      1
-#define REPEAT_CLI          1
-#define REPEAT_USB          1
-#define REPEAT_STORMAN      1
-#define REPEAT_NETMAN       1
-#define REPEAT_WATCHDOG     1
-#define REPEAT_HEARTBEAT    1
-
-// OS ticks to block after each execution of a service (sets max execution interval).
-// higher priority services should include some delay time to allow lower priority
-// tasks to execute. Since the delay happens at the end of the service loop, the
-// service should finish its current work before blocking itself with the delay.
-// Note that if a service has delay of 0 and priority is > 0, the IDLE task will
-// always be blocked and FreeRTOS will not be able to perform task cleanup (i.e. freeing RAM).
-#define DELAY_TASKMAN      20
-#define DELAY_CLI          1     // CLI delay could be increased at the expense of character I/O responsiveness
-#define DELAY_USB          5
-#define DELAY_STORMAN      100
-#define DELAY_NETMAN       10    // This will impact network latency
-#define DELAY_WATCHDOG     100
-#define DELAY_HEARTBEAT    5000  // Example heartbeat service "beats" every 5 seconds when started
+// event-driven services - max OS ticks to block without an event before
+// running anyway, portMAX_DELAY to only run when there is an event
+#define TIMEOUT_TASKMAN     portMAX_DELAY
+#define TIMEOUT_USB         1000  // safety net only, USB and usb0 queue activity are all signalled
+#define TIMEOUT_NETMAN      portMAX_DELAY
+#define TIMEOUT_ADC         portMAX_DELAY
+#define TIMEOUT_CLI         100   // safety net, input, print queue messages and log records all wake the CLI
+#define DELAY_CLI_BUSY      1     // OS ticks between CLI passes while a command is running or output is waiting
 
 // FreeRTOS stack sizes for the services - "stack" in this sense is dedicated heap memory for a task.
 // local variables within a service/task use this stack space.
 // If pvPortMalloc is called within a task, it will allocate directly from shared FreeRTOS heap.
+// Short-lived scratch buffers should come from mem_pool_alloc() instead (see mem_pool.h),
+// which does not fragment the heap.
 // Use 'bin/ps' command to show a service's min stack (memory usage high water mark)
-// to determine if too much/too little has been allocated.
+// to determine if too much/too little has been allocated. The stackmonitor service
+// tracks this for every task over time, warns before a stack runs out, and lists
+// recommended sizes in '/proc/stack'. Stacks that do overflow are caught by the
+// FreeRTOS canary check, which reboots and reports the task on the next boot.
+// In ENABLE_STATIC_ALLOC builds the stacks are static storage instead, and their
+// sizes are listed in the RAM budget report printed after the build.
 #define STACK_TASKMAN   512
 #define STACK_CLI       1024
 #define STACK_USB       1024
@@ -120,6 +169,23 @@
 #define STACK_NETMAN    1024
 #define STACK_WATCHDOG  configMINIMAL_STACK_SIZE // 256 by default
 #define STACK_HEARTBEAT configMINIMAL_STACK_SIZE
+#define STACK_STACKMON  512
+#define STACK_ADC       512
+
+// log levels for each service, see service_log.h. LOG() calls above the level
+// set for their source are compiled out entirely.
+#define LOG_LEVEL_TASKMAN   LOG_LEVEL_INFO
+#define LOG_LEVEL_CLI       LOG_LEVEL_INFO
+#define LOG_LEVEL_USB       LOG_LEVEL_INFO
+#define LOG_LEVEL_STORMAN   LOG_LEVEL_INFO
+#define LOG_LEVEL_NETMAN    LOG_LEVEL_INFO
+#define LOG_LEVEL_WATCHDOG  LOG_LEVEL_INFO
+#define LOG_LEVEL_HEARTBEAT LOG_LEVEL_INFO
+#define LOG_LEVEL_STACKMON  LOG_LEVEL_INFO
+#define LOG_LEVEL_ADC       LOG_LEVEL_INFO
+// log levels for hardware drivers, which may log from their ISRs
+#define LOG_LEVEL_GPIO      LOG_LEVEL_INFO  // set to LOG_LEVEL_DEBUG to log every GPIO interrupt
+#define LOG_LEVEL_CLI_UART  LOG_LEVEL_WARN
 
 
 /************************
@@ -143,6 +209,9 @@
 */
 BaseType_t taskman_service(void);
 
+// taskmanager events, signalled by taskman_request()
+extern service_events_t taskman_events;
+
 /**
 * @brief Start the CLI service.
 *
@@ -158,6 +227,9 @@ BaseType_t taskman_service(void);
 */
 BaseType_t cli_service(void);
 
+// CLI events, signalled by CLI input drivers and the print queue
+extern service_events_t cli_events;
+
 /**
 * @brief Start the USB service.
 *
@@ -172,6 +244,9 @@ BaseType_t cli_service(void);
 */
 BaseType_t usb_service(void);
 
+// USB service events, signalled by the TinyUSB event hook
+extern service_events_t usb_events;
+
 /**
 * @brief Start the storagemanager service.
 *
@@ -201,6 +276,9 @@ BaseType_t storman_service(void);
 */
 BaseType_t netman_service(void);
 
+// networkmanager events, signalled by netman_request()
+extern service_events_t netman_events;
+
 /**
 * @brief Start the watchdog service.
 *
@@ -230,6 +308,34 @@ BaseType_t watchdog_service(void);
 */
 BaseType_t heartbeat_service(void);
 
+/**
+* @brief Start the stackmonitor service.
+*
+* The stackmonitor service samples the stack high water mark of every task once
+* per PERIOD_STACKMON, tracks how much each stack is still growing, and logs a
+* warning when a stack is close to overflowing. The stats and recommended stack
+* sizes are shown in '/proc/stack', see stack_monitor.h.
+*
+* @param none
+*
+* @return 32-bit integer corresponding to FreeRTOS return status defined in projdefs.h
+*/
+BaseType_t stackmon_service(void);
+
+/**
+* @brief Start the adcstream service.
+*
+* The adcstream service starts the ADC streaming at ADC_STREAM_RATE_HZ, and
+* processes each block of samples as soon as DMA has filled it - decimating
+* it into the stream ring and notifying the tasks subscribed to the stream (see
+* adc_stream_start() in hardware_config.h). Stream stats are shown in '/dev/adc0'.
+*
+* @param none
+*
+* @return 32-bit integer corresponding to FreeRTOS return status defined in projdefs.h
+*/
+BaseType_t adc_service(void);
+
 
 /************************
  * Service Descriptors
@@ -248,6 +354,9 @@ typedef struct service_desc_t {
 
     //Function pointer to the service that creates the respective FreeRTOS task - declared in services.h
     service_func_t service_func;
+
+    //Bitmask of the cores the service may run on in SMP builds, AFFINITY_ANY (0) if not given
+    const UBaseType_t core_affinity;
 } service_desc_t;
 
 // holds all the services that can be launched with taskmanager.
@@ -260,5 +369,18 @@ extern const service_desc_t service_descriptors[];
 // for startup and interaction
 extern const size_t service_descriptors_length;
 
+/**
+* @brief Start a service from its descriptor.
+*
+* Calls the service function to create the service's FreeRTOS task, then sets
+* the task's core affinity from the descriptor. Used by taskmanager at boot and
+* by 'service start'.
+*
+* @param service pointer to the service descriptor
+*
+* @return 32-bit integer corresponding to FreeRTOS return status defined in projdefs.h
+*/
+BaseType_t service_start(const service_desc_t *service);
+
 
 #endif /* SERVICES_H */
\ No newline at end of file
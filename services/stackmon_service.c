@@ -0,0 +1,91 @@
+/******************************************************************************
+ * @file stackmon_service.c
+ *
+ * @brief stackmonitor service implementation and FreeRTOS task creation.
+ *        Samples the stack use of every task (see stack_monitor.h), and logs
+ *        a warning when a stack is close to overflowing or still growing
+ *        towards it. Also reports a stack overflow that caused the last
+ *        reboot. Stack stats and recommended sizes are shown in '/proc/stack'.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include <stdio.h>
+#include "hardware_config.h"
+#include "rtos_utils.h"
+#include "stack_monitor.h"
+#include "services.h"
+#include "service_queues.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+static void prvStackMonitorTask(void *pvParameters);
+static task_period_t stackmon_period; // schedule and stats for this service, see /proc/sched
+TaskHandle_t xStackMonTask;
+
+// main service function, creates FreeRTOS task from prvStackMonitorTask
+BaseType_t stackmon_service(void)
+{
+    BaseType_t xReturn;
+
+    // create the FreeRTOS task
+    xReturn = TASK_CREATE(
+        SERVICE_NAME_STACKMON,
+        prvStackMonitorTask,
+        xstr(SERVICE_NAME_STACKMON),
+        STACK_STACKMON,
+        NULL,
+        PRIORITY_STACKMON,
+        &xStackMonTask
+    );
+
+    if (xReturn == pdPASS) {
+        cli_print_raw("stackmonitor service started");
+    }
+    else {
+        cli_print_raw("Error starting the stackmonitor service");
+    }
+
+    return xReturn;
+}
+
+// log a stack that is running low, called by stack_mon_sample()
+static void stackmon_warning(const stack_mon_task_t *stats)
+{
+    LOG_WARN(STACKMON, LOG_STACKMON_LOW, stats->task_number, stats->min_free_words, stats->stack_words, stats->trend_words);
+}
+
+// FreeRTOS task created by stackmon_service
+static void prvStackMonitorTask(void *pvParameters)
+{
+    bool too_many_logged = false;
+
+    // report an overflow that caused the last reboot (picked up by stack_mon_init() at boot)
+    if (stack_mon_last_crash.magic == STACK_MON_CRASH_MAGIC) {
+        char crash_msg[80];
+        snprintf(crash_msg, sizeof(crash_msg), "Last reboot was a stack overflow in %s (%lu words) at %llu ms",
+                 stack_mon_last_crash.name, stack_mon_last_crash.stack_words, stack_mon_last_crash.uptime_us / 1000);
+        cli_print_timestamped(crash_msg);
+    }
+
+    // run the main loop once every PERIOD_STACKMON ticks
+    task_period_init(&stackmon_period, xstr(SERVICE_NAME_STACKMON), PERIOD_STACKMON, BUDGET_STACKMON);
+
+    while(true) {
+        if (!stack_mon_sample(stackmon_warning) && !too_many_logged) {
+            LOG_WARN(STACKMON, LOG_STACKMON_TOO_MANY, STACK_MON_TASKS_MAX);
+            too_many_logged = true;
+        }
+
+        // update this task's schedule
+        task_period_wait(&stackmon_period);
+    }
+}
@@ -0,0 +1,229 @@
+/******************************************************************************
+ * @file storman_bench.c
+ *
+ * @brief littlefs geometry benchmark for the storagemanager service. Runs a
+ *        fixed file workload against a RAM-backed block device for a set of
+ *        cache/lookahead configurations and reports throughput and block
+ *        device traffic for each, so geometries can be compared on target
+ *        without wearing the onboard flash.
+ *
+ * @author Cavin McKinley (MCKNLY LLC)
+ *
+ * @date 02-14-2024
+ *
+ * @copyright Copyright (c) 2024 Cavin McKinley (MCKNLY LLC)
+ *            Released under the MIT License
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <lfs.h>
+#include "hardware_config.h"
+#include "hardware/flash.h"
+#include "FreeRTOS.h"
+
+
+// RAM disk geometry - same block/page size as flash0, but only a few blocks. the
+// disk is sized from what the FreeRTOS heap can spare when the benchmark starts,
+// leaving BENCH_HEAP_RESERVE free for the other services while it runs
+#define BENCH_BLOCK_COUNT_MAX   16
+#define BENCH_BLOCK_COUNT_MIN   6           // enough for the metadata pairs, the file and copy-on-write
+#define BENCH_HEAP_RESERVE      (32 * 1024) // heap left untouched for other services
+#define BENCH_FILE_SIZE         (8 * 1024)  // size of the benchmark file
+#define BENCH_IO_SIZE           64          // size of each read/write op (a typical log record)
+
+// geometries to compare, the first is always the current build configuration
+typedef struct bench_geometry_t {
+    lfs_size_t read_size;
+    lfs_size_t cache_size;
+    lfs_size_t lookahead_size;
+} bench_geometry_t;
+static const bench_geometry_t bench_geometries[] = {
+    {FLASH0_READ_SIZE, FLASH0_CACHE_SIZE,   FLASH0_LOOKAHEAD_SIZE},
+    {1,                FLASH0_PAGE_SIZE,    32},
+    {16,               FLASH0_PAGE_SIZE,    32},
+    {16,               FLASH0_PAGE_SIZE*4,  32},
+    {64,               FLASH0_PAGE_SIZE*4,  8},
+};
+
+// heap needed besides the RAM disk - lfs state, and the buffers of the largest geometry
+#define BENCH_CACHE_MAX     ((FLASH0_CACHE_SIZE > FLASH0_PAGE_SIZE * 4) ? FLASH0_CACHE_SIZE : FLASH0_PAGE_SIZE * 4)
+#define BENCH_BUFFERS_SIZE  (sizeof(lfs_t) + sizeof(lfs_file_t) + (3 * BENCH_CACHE_MAX) + FLASH0_LOOKAHEAD_SIZE + 32)
+
+// RAM disk and its traffic counters
+static uint8_t *bench_disk;
+static lfs_size_t bench_block_count;
+static flash_io_stats_t bench_io;
+
+static int bench_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t offset, void *buffer, lfs_size_t size)
+{
+    memcpy(buffer, bench_disk + (block * c->block_size) + offset, size);
+    bench_io.reads++;
+    bench_io.read_bytes += size;
+    return 0;
+}
+
+static int bench_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t offset, const void *buffer, lfs_size_t size)
+{
+    memcpy(bench_disk + (block * c->block_size) + offset, buffer, size);
+    bench_io.progs++;
+    bench_io.prog_bytes += size;
+    return 0;
+}
+
+static int bench_erase(const struct lfs_config *c, lfs_block_t block)
+{
+    memset(bench_disk + (block * c->block_size), 0xff, c->block_size);
+    bench_io.erases++;
+    return 0;
+}
+
+static int bench_sync(const struct lfs_config *c)
+{
+    return 0;
+}
+
+// run the workload for one geometry on a freshly formatted RAM disk and write
+// a result line to the output, returns the length of the line or a negative lfs error
+static int bench_workload(const struct lfs_config *cfg, const bench_geometry_t *geo,
+                          lfs_t *lfs, lfs_file_t *file, void *file_buffer, char *out, size_t out_len)
+{
+    struct lfs_file_config file_cfg = {.buffer = file_buffer};
+    uint8_t io_buf[BENCH_IO_SIZE];
+    const int ops = BENCH_FILE_SIZE / BENCH_IO_SIZE;
+    uint64_t mount_us, write_us, read_us, start_us;
+    flash_io_stats_t write_io;
+    int err;
+
+    memset(io_buf, 'x', sizeof(io_buf));
+
+    // format and time a clean mount
+    err = lfs_format(lfs, cfg);
+    if (err < 0) return err;
+    start_us = get_time_us();
+    err = lfs_mount(lfs, cfg);
+    mount_us = get_time_us() - start_us;
+    if (err < 0) return err;
+
+    // sequential writes, one open/close around all of them
+    memset(&bench_io, 0, sizeof(bench_io));
+    start_us = get_time_us();
+    err = lfs_file_opencfg(lfs, file, "bench", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &file_cfg);
+    for (int op = 0; op < ops && err >= 0; op++) {
+        err = lfs_file_write(lfs, file, io_buf, sizeof(io_buf));
+    }
+    if (err >= 0) err = lfs_file_close(lfs, file);
+    write_us = get_time_us() - start_us;
+    write_io = bench_io;
+    if (err < 0) return err;
+
+    // sequential reads of the same file
+    memset(&bench_io, 0, sizeof(bench_io));
+    start_us = get_time_us();
+    err = lfs_file_opencfg(lfs, file, "bench", LFS_O_RDONLY, &file_cfg);
+    for (int op = 0; op < ops && err >= 0; op++) {
+        err = lfs_file_read(lfs, file, io_buf, sizeof(io_buf));
+    }
+    if (err >= 0) err = lfs_file_close(lfs, file);
+    read_us = get_time_us() - start_us;
+    if (err < 0) return err;
+
+    lfs_unmount(lfs);
+
+    // rd/cache/la, mount time, write ops/s and bytes read/prog/erased per op, read ops/s and bytes read per op
+    return snprintf(out, out_len,
+                    "%-4lu%-6lu%-4lu %-7lu %-7lu %lu/%lu/%lu\t%-7lu %lu\r\n",
+                    geo->read_size, geo->cache_size, geo->lookahead_size,
+                    (uint32_t)mount_us,
+                    (uint32_t)(ops * 1000000ULL / (write_us ? write_us : 1)),
+                    write_io.read_bytes / ops, write_io.prog_bytes / ops, (write_io.erases * FLASH0_BLOCK_SIZE) / ops,
+                    (uint32_t)(ops * 1000000ULL / (read_us ? read_us : 1)),
+                    bench_io.read_bytes / ops);
+}
+
+// set up a littlefs configuration for one geometry and benchmark it
+static int bench_run(const bench_geometry_t *geo, lfs_t *lfs, lfs_file_t *file, char *out, size_t out_len)
+{
+    // littlefs buffers come from the FreeRTOS heap, not libc malloc
+    void *read_buffer = pvPortMalloc(geo->cache_size);
+    void *prog_buffer = pvPortMalloc(geo->cache_size);
+    void *file_buffer = pvPortMalloc(geo->cache_size);
+    void *lookahead_buffer = pvPortMalloc(geo->lookahead_size);
+    int err = LFS_ERR_NOMEM;
+
+    struct lfs_config cfg = {
+        .read = bench_read,
+        .prog = bench_prog,
+        .erase = bench_erase,
+        .sync = bench_sync,
+        .read_size = geo->read_size,
+        .prog_size = FLASH0_PAGE_SIZE,
+        .block_size = FLASH0_BLOCK_SIZE,
+        .block_count = bench_block_count,
+        .block_cycles = FLASH0_BLOCK_CYCLES,
+        .cache_size = geo->cache_size,
+        .lookahead_size = geo->lookahead_size,
+        .read_buffer = read_buffer,
+        .prog_buffer = prog_buffer,
+        .lookahead_buffer = lookahead_buffer,
+        .name_max = PATHNAME_MAX_LEN,
+        .file_max = FLASH0_FILE_MAX,
+    };
+
+    if (read_buffer != NULL && prog_buffer != NULL && file_buffer != NULL && lookahead_buffer != NULL) {
+        err = bench_workload(&cfg, geo, lfs, file, file_buffer, out, out_len);
+    }
+
+    vPortFree(lookahead_buffer);
+    vPortFree(file_buffer);
+    vPortFree(prog_buffer);
+    vPortFree(read_buffer);
+    return err;
+}
+
+// run the benchmark for every geometry, writing a results table to the output
+// buffer. called from the storagemanager task by the FSBENCH action
+int storman_bench(char *out, size_t out_len)
+{
+    size_t heap_spare = xPortGetFreeHeapSize();
+    lfs_t *lfs = NULL;
+    lfs_file_t *file = NULL;
+    size_t out_pos;
+    int err = 0;
+
+    // take as many blocks as the heap can spare, up to BENCH_BLOCK_COUNT_MAX
+    heap_spare = (heap_spare > BENCH_HEAP_RESERVE + BENCH_BUFFERS_SIZE) ? heap_spare - BENCH_HEAP_RESERVE - BENCH_BUFFERS_SIZE : 0;
+    bench_block_count = heap_spare / FLASH0_BLOCK_SIZE;
+    if (bench_block_count > BENCH_BLOCK_COUNT_MAX) bench_block_count = BENCH_BLOCK_COUNT_MAX;
+    if (bench_block_count < BENCH_BLOCK_COUNT_MIN) {
+        snprintf(out, out_len, "not enough free heap for the benchmark RAM disk");
+        return LFS_ERR_NOMEM;
+    }
+
+    lfs = pvPortMalloc(sizeof(lfs_t));
+    file = pvPortMalloc(sizeof(lfs_file_t));
+    bench_disk = pvPortMalloc(bench_block_count * FLASH0_BLOCK_SIZE);
+    if (lfs == NULL || file == NULL || bench_disk == NULL) {
+        err = LFS_ERR_NOMEM;
+    }
+    else {
+        out_pos = snprintf(out, out_len,
+                           "RAM disk: %lu blocks\r\n"
+                           "rd  cache la  mnt(us) wr op/s wr B/op r/p/e\trd op/s rd B/op\r\n",
+                           bench_block_count);
+        for (int geo = 0; geo < sizeof(bench_geometries) / sizeof(bench_geometries[0]) && out_pos < out_len; geo++) {
+            err = bench_run(&bench_geometries[geo], lfs, file, out + out_pos, out_len - out_pos);
+            if (err < 0) break;
+            out_pos += err;
+            err = 0;
+        }
+    }
+
+    vPortFree(bench_disk);
+    vPortFree(file);
+    vPortFree(lfs);
+    bench_disk = NULL;
+    return err;
+}
@@ -27,22 +27,75 @@
 
 
 static void prvStorageManagerTask(void *pvParameters);
+static bool storman_action_uses_data(storman_action_t action);
+static void storman_latency_record(storman_action_t action, uint64_t queued_us, uint64_t start_us);
+static lfs_file_t *storman_handle_get(int handle);
+static lfs_file_t *storman_handle_user(int handle);
+static int storman_handle_open(lfs_t *lfs, const char *path, int flags);
+static int storman_handle_close(lfs_t *lfs, int handle);
+static void storman_handle_close_all(lfs_t *lfs);
+static int storman_log_append(lfs_t *lfs, const char *name, const char *record);
+static int storman_log_flush(lfs_t *lfs, int log, uint32_t *reason_count);
+static int storman_log_sync(lfs_t *lfs, const char *name);
+static int storman_log_flush_due(lfs_t *lfs);
+static TickType_t storman_log_timeout(void);
+static void storman_log_discard(void);
 TaskHandle_t xStorManTask;
 
 extern void shell_mnt_mount(void);   // declared in this file so /mnt can be mounted on-the-fly
 extern void shell_mnt_unmount(void); // declared in this file so /mnt can be unmounted on-the-fly
+extern int storman_bench(char *out, size_t out_len); // littlefs geometry benchmark, see storman_bench.c
+
+// sanity check the littlefs geometry, which can be overridden at build time (see hardware_config.h)
+#if (FLASH0_CACHE_SIZE % FLASH0_PAGE_SIZE) != 0 || (FLASH0_CACHE_SIZE % FLASH0_READ_SIZE) != 0 || \
+    (FLASH0_BLOCK_SIZE % FLASH0_CACHE_SIZE) != 0
+#error "FLASH0_CACHE_SIZE must be a multiple of the read and page sizes, and a factor of the block size"
+#endif
+#if (FLASH0_LOOKAHEAD_SIZE % 8) != 0
+#error "FLASH0_LOOKAHEAD_SIZE must be a multiple of 8"
+#endif
 
-struct storman_item_t smi_glob; // write any resulting lfs data into global struct so it can be used by other tasks
-SemaphoreHandle_t smi_glob_sem; // binary semaphore used to provide a data ready signal to other tasks
 int err = 0; // used throughout the task to indicate that an error has occured
 
+// per-action request latency statistics, read by the CLI
+storman_latency_t storman_latency[STORMAN_NUM_ACTIONS];
+const char *storman_action_names[STORMAN_NUM_ACTIONS] = {
+    "lsdir", "mkdir", "rmdir", "mkfile", "rmfile", "dumpfile", "readfile",
+    "writefile", "appendfile", "filestat", "chkfile", "fsstat", "format", "unmount",
+    "fopen", "fread", "fwrite", "fseek", "fclose", "logappend", "logsync", "fsbench"
+};
+
+// open file handle table - files stay open between requests so sequential
+// reads/writes don't re-walk the metadata, each with its own cache buffer.
+// handles owned by a log file are reserved and can't be used by requesters
+typedef struct storman_handle_t {bool open;
+                                 bool reserved;
+                                 lfs_file_t file;
+                                 struct lfs_file_config config;
+                                 uint8_t cache[FLASH0_CACHE_SIZE];
+                                } storman_handle_t;
+static storman_handle_t storman_handles[FLASH0_OPEN_FILES_MAX];
+
+// buffered log files - each holds an open file handle and up to one page of
+// records waiting to be written, see storman_log_append()
+typedef struct storman_log_t {bool open;
+                              char name[PATHNAME_MAX_LEN];
+                              int handle;                       // storagemanager file handle
+                              uint8_t buffer[FLASH0_PAGE_SIZE]; // records waiting to be written
+                              size_t fill;                      // bytes in the buffer
+                              TickType_t deadline;              // tick count when the buffer must be flushed
+                             } storman_log_t;
+static storman_log_t storman_logs[STORMAN_LOGS_MAX];
+storman_log_stats_t storman_log_stats;
+
 // main service function, creates FreeRTOS task from prvStorageManagerTask
 BaseType_t storman_service(void)
 {
     BaseType_t xReturn;
 
     // create the FreeRTOS task
-    xReturn = xTaskCreate(
+    xReturn = TASK_CREATE(
+        SERVICE_NAME_STORMAN,
         prvStorageManagerTask,
         xstr(SERVICE_NAME_STORMAN),
         STACK_STORMAN,
@@ -72,9 +125,9 @@ static void prvStorageManagerTask(void *pvParameters)
     lfs_file_t flash0_file;
     lfs_dir_t flash0_dir;
 
-    // allocate memory for littlefs buffers
-    void *lfs_read_buffer = pvPortMalloc(FLASH0_PAGE_SIZE);
-    void *lfs_prog_buffer = pvPortMalloc(FLASH0_PAGE_SIZE);
+    // allocate memory for littlefs buffers (read/prog buffers are cache sized)
+    void *lfs_read_buffer = pvPortMalloc(FLASH0_CACHE_SIZE);
+    void *lfs_prog_buffer = pvPortMalloc(FLASH0_CACHE_SIZE);
     void *lfs_lookahead_buffer = pvPortMalloc(FLASH0_LOOKAHEAD_SIZE);
     
     // littlefs flash0 filesystem configuration
@@ -86,7 +139,7 @@ static void prvStorageManagerTask(void *pvParameters)
         .sync = onboard_flash_sync,
 
         // block device configuration
-        .read_size = 1,
+        .read_size = FLASH0_READ_SIZE,
         .prog_size = FLASH0_PAGE_SIZE,
         .block_size = FLASH0_BLOCK_SIZE,
         .block_count = FLASH0_FS_SIZE / FLASH0_BLOCK_SIZE,
@@ -101,7 +154,7 @@ static void prvStorageManagerTask(void *pvParameters)
 
         // other configurations
         .name_max = PATHNAME_MAX_LEN, // max length of path+filenames
-        .file_max = FILE_SIZE_MAX,    // max size of a file in bytes
+        .file_max = FLASH0_FILE_MAX,  // max size of a file in bytes
     };
 
     // print some NVM initialization text
@@ -130,144 +183,219 @@ static void prvStorageManagerTask(void *pvParameters)
         }
     }
 
-    // create the binary semaphore used to signal other tasks that data is ready
-    smi_glob_sem = xSemaphoreCreateBinary();
-    
     while(true) {
+        storman_item_t *smi = NULL;     // request item being serviced, owned by the requester
+        storman_action_t action = LSDIR;
+        uint64_t start_us;              // time the request was taken off the queue
         err = 0;
 
-        // Check the storagemanager queue to see if an item is available
-        if (xQueueReceive(storman_queue, (void *)&smi_glob, 0) == pdTRUE)
+        // block until a request is available in the storagemanager queue, or
+        // until the next buffered log record is due to be flushed
+        if (xQueueReceive(storman_queue, (void *)&smi, storman_log_timeout()) == pdTRUE)
         {
-            // clear any existing semaphore in case a previous one was not taken
-            xSemaphoreTake(smi_glob_sem, 0);
+            start_us = get_time_us();
+            action = smi->action;
 
-            // determine what action to perform in the filesystem.
-            // note that there may be further littlefs capabilities which are
-            // not implemented here. see "littlefs/lfs.h" for all APIs
-            switch(smi_glob.action)
-            {
-                case LSDIR:      // list directory contents
-                    err = lfs_dir_open(&lfs_flash0, &flash0_dir, smi_glob.sm_item_name);
-                    if (err == 0) {
-                        char *lsdir_output = (char*)pvPortMalloc(BUF_OUT_SIZE); // use FreeRTOS malloc and free, it is a large buffer
-                        strcpy(lsdir_output, USH_SHELL_FONT_STYLE_BOLD
-                                             USH_SHELL_FONT_COLOR_BLUE
-                                             "File List\r\n"
-                                             "---------\r\n"
-                                             USH_SHELL_FONT_STYLE_RESET);
-                        while(lfs_dir_read(&lfs_flash0, &flash0_dir, &smi_glob.sm_item_info) > 0) {
-                            strcpy(lsdir_output + strlen(lsdir_output), smi_glob.sm_item_info.name);
-                            if (smi_glob.sm_item_info.type == LFS_TYPE_DIR) { // check if this item is a directory
-                                strcpy(lsdir_output + strlen(lsdir_output), "/"); // append a forward slash to the name if dir
-                            }
-                            strcpy(lsdir_output + strlen(lsdir_output), "\r\n");
-                        };
-                        strcpy(smi_glob.sm_item_data, lsdir_output); // use the global data to store a copy of the combined list output
-                        smi_glob.sm_item_data[strlen(smi_glob.sm_item_data)] = 0; // put a null character at the end
-                        xSemaphoreGive(smi_glob_sem); // provide the binary semaphore to indicate data is available
-                        vPortFree(lsdir_output);
-                        err = lfs_dir_close(&lfs_flash0, &flash0_dir);
-                    }
-                    break;
-                case MKDIR:      // create a new directory
-                    err = lfs_mkdir(&lfs_flash0, smi_glob.sm_item_name);
-                    break;
-                case RMDIR:      // delete a directory (only if empty)
-                    // note: currently the same as RMFILE but kept separate for future enhancement (delete non-empty dirs, etc)
-                    err = lfs_remove(&lfs_flash0, smi_glob.sm_item_name);
-                    break;
-                case MKFILE:     // create a new empty file (if file already exists, will generate error)
-                    err = lfs_file_open(&lfs_flash0, &flash0_file, smi_glob.sm_item_name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL);
-                    if (err < 0) break;
-                    err = lfs_file_write(&lfs_flash0, &flash0_file, NULL, (lfs_size_t)1); // may not be needed?
-                    if (err < 0) break;
-                    err = lfs_file_close(&lfs_flash0, &flash0_file);
-                    break;
-                case RMFILE:     // delete a file
-                    err = lfs_remove(&lfs_flash0, smi_glob.sm_item_name);
-                    break;
-                case DUMPFILE:   // dump entire contents of file
-                    err = lfs_file_open(&lfs_flash0, &flash0_file, smi_glob.sm_item_name, LFS_O_RDONLY);
-                    if (err < 0) break;
-                    err = lfs_file_read(&lfs_flash0, &flash0_file, smi_glob.sm_item_data, sizeof(smi_glob.sm_item_data));
-                    if (err < 0) break;
-                    smi_glob.sm_item_data[lfs_file_size(&lfs_flash0, &flash0_file)] = 0; // put a null character at the end of the file contents data
-                    xSemaphoreGive(smi_glob_sem); // provide the binary semaphore to indicate data is available
-                    err = lfs_file_close(&lfs_flash0, &flash0_file);
-                    break;
-                case READFILE:   // read a portion of a file
-                    err = lfs_file_open(&lfs_flash0, &flash0_file, smi_glob.sm_item_name, LFS_O_RDONLY);
-                    if (err < 0) break;
-                    err = lfs_file_seek(&lfs_flash0, &flash0_file, smi_glob.sm_item_offset, LFS_SEEK_SET);
-                    if (err < 0) break;
-                    err = lfs_file_read(&lfs_flash0, &flash0_file, smi_glob.sm_item_data, smi_glob.sm_item_size);
-                    if (err < 0) break;
-                    smi_glob.sm_item_data[smi_glob.sm_item_size] = 0; // put a null character at the end of the read data
-                    xSemaphoreGive(smi_glob_sem); // provide the binary semaphore to indicate data is available
-                    err = lfs_file_close(&lfs_flash0, &flash0_file);
-                    break;
-                case WRITEFILE:  // write to a new file, or overwrite an existing file
-                    err = lfs_file_open(&lfs_flash0, &flash0_file, smi_glob.sm_item_name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
-                    if (err < 0) break;
-                    err = lfs_file_write(&lfs_flash0, &flash0_file, smi_glob.sm_item_data, (lfs_size_t)strlen(smi_glob.sm_item_data));
-                    if (err < 0) break;
-                    err = lfs_file_close(&lfs_flash0, &flash0_file);
-                    break;
-                case APPENDFILE: // append data to end of existing file
-                    err = lfs_file_open(&lfs_flash0, &flash0_file, smi_glob.sm_item_name, LFS_O_WRONLY | LFS_O_APPEND);
-                    if (err < 0) break;
-                    err = lfs_file_write(&lfs_flash0, &flash0_file, smi_glob.sm_item_data, (lfs_size_t)strlen(smi_glob.sm_item_data));
-                    if (err < 0) break;
-                    err = lfs_file_close(&lfs_flash0, &flash0_file);
-                    break;
-                case FILESTAT:   // get file statistics (size)
-                    err = lfs_stat(&lfs_flash0, smi_glob.sm_item_name, &smi_glob.sm_item_info);
-                    if (err < 0) break;
-                    strcpy(smi_glob.sm_item_data, smi_glob.sm_item_info.name);
-                    sprintf(smi_glob.sm_item_data + strlen(smi_glob.sm_item_data), ": %lu bytes", smi_glob.sm_item_info.size);
-                    xSemaphoreGive(smi_glob_sem); // provide the binary semaphore to indicate data is available
-                    break;
-                case CHKFILE:    // check if a file exists without error
-                    if (lfs_stat(&lfs_flash0, smi_glob.sm_item_name, &smi_glob.sm_item_info) == 0) {
-                        xSemaphoreGive(smi_glob_sem); // provide the binary semaphore to indicate file exists
-                    }
-                    break;
-                case FSSTAT:     // get filesystem statistics
-                    smi_glob.sm_item_size = lfs_fs_size(&lfs_flash0);
-                    if (smi_glob.sm_item_size < 0) {
-                        err = smi_glob.sm_item_size;
+            // actions which move data need a buffer to move it through
+            if (smi->sm_item_data == NULL && storman_action_uses_data(action)) {
+                err = LFS_ERR_INVAL;
+            }
+            else {
+                // determine what action to perform in the filesystem.
+                // note that there may be further littlefs capabilities which are
+                // not implemented here. see "littlefs/lfs.h" for all APIs
+                switch(action)
+                {
+                    case LSDIR:      // list directory contents
+                        err = lfs_dir_open(&lfs_flash0, &flash0_dir, smi->sm_item_name);
+                        if (err == 0) {
+                            // build the listing directly in the requester's data buffer
+                            size_t lsdir_len = snprintf(smi->sm_item_data, smi->sm_item_data_len,
+                                                        USH_SHELL_FONT_STYLE_BOLD
+                                                        USH_SHELL_FONT_COLOR_BLUE
+                                                        "File List\r\n"
+                                                        "---------\r\n"
+                                                        USH_SHELL_FONT_STYLE_RESET);
+                            while(lfs_dir_read(&lfs_flash0, &flash0_dir, &smi->sm_item_info) > 0 && lsdir_len < smi->sm_item_data_len) {
+                                lsdir_len += snprintf(smi->sm_item_data + lsdir_len, smi->sm_item_data_len - lsdir_len,
+                                                      "%s%s\r\n",
+                                                      smi->sm_item_info.name,
+                                                      smi->sm_item_info.type == LFS_TYPE_DIR ? "/" : ""); // append a forward slash to the name if dir
+                            };
+                            err = lfs_dir_close(&lfs_flash0, &flash0_dir);
+                        }
+                        break;
+                    case MKDIR:      // create a new directory
+                        err = lfs_mkdir(&lfs_flash0, smi->sm_item_name);
+                        break;
+                    case RMDIR:      // delete a directory (only if empty)
+                        // note: currently the same as RMFILE but kept separate for future enhancement (delete non-empty dirs, etc)
+                        err = lfs_remove(&lfs_flash0, smi->sm_item_name);
+                        break;
+                    case MKFILE:     // create a new empty file (if file already exists, will generate error)
+                        err = lfs_file_open(&lfs_flash0, &flash0_file, smi->sm_item_name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL);
+                        if (err < 0) break;
+                        err = lfs_file_write(&lfs_flash0, &flash0_file, NULL, (lfs_size_t)1); // may not be needed?
+                        if (err < 0) break;
+                        err = lfs_file_close(&lfs_flash0, &flash0_file);
+                        break;
+                    case RMFILE:     // delete a file
+                        err = lfs_remove(&lfs_flash0, smi->sm_item_name);
+                        break;
+                    case DUMPFILE:   // dump entire contents of file (up to the size of the data buffer)
+                        err = lfs_file_open(&lfs_flash0, &flash0_file, smi->sm_item_name, LFS_O_RDONLY);
+                        if (err < 0) break;
+                        err = lfs_file_read(&lfs_flash0, &flash0_file, smi->sm_item_data, smi->sm_item_data_len - 1);
+                        if (err < 0) break;
+                        smi->sm_item_data[err] = 0; // put a null character at the end of the file contents data
+                        err = lfs_file_close(&lfs_flash0, &flash0_file);
+                        break;
+                    case READFILE:   // read a portion of a file
+                        if (smi->sm_item_size < 0 || smi->sm_item_size >= smi->sm_item_data_len) {
+                            err = LFS_ERR_INVAL; // requested length will not fit in the data buffer
+                            break;
+                        }
+                        err = lfs_file_open(&lfs_flash0, &flash0_file, smi->sm_item_name, LFS_O_RDONLY);
+                        if (err < 0) break;
+                        err = lfs_file_seek(&lfs_flash0, &flash0_file, smi->sm_item_offset, LFS_SEEK_SET);
+                        if (err < 0) break;
+                        err = lfs_file_read(&lfs_flash0, &flash0_file, smi->sm_item_data, smi->sm_item_size);
+                        if (err < 0) break;
+                        smi->sm_item_data[err] = 0; // put a null character at the end of the read data
+                        err = lfs_file_close(&lfs_flash0, &flash0_file);
+                        break;
+                    case WRITEFILE:  // write to a new file, or overwrite an existing file
+                        err = lfs_file_open(&lfs_flash0, &flash0_file, smi->sm_item_name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+                        if (err < 0) break;
+                        err = lfs_file_write(&lfs_flash0, &flash0_file, smi->sm_item_data, (lfs_size_t)strlen(smi->sm_item_data));
+                        if (err < 0) break;
+                        err = lfs_file_close(&lfs_flash0, &flash0_file);
+                        break;
+                    case APPENDFILE: // append data to end of existing file
+                        err = lfs_file_open(&lfs_flash0, &flash0_file, smi->sm_item_name, LFS_O_WRONLY | LFS_O_APPEND);
+                        if (err < 0) break;
+                        err = lfs_file_write(&lfs_flash0, &flash0_file, smi->sm_item_data, (lfs_size_t)strlen(smi->sm_item_data));
+                        if (err < 0) break;
+                        err = lfs_file_close(&lfs_flash0, &flash0_file);
                         break;
-                    }
-                    // format output for printing elsewhere
-                    sprintf(smi_glob.sm_item_data, "Filesystem usage: %lu/%lu blocks (%lu/%lu bytes)",
-                                                   smi_glob.sm_item_size,
-                                                   FLASH0_FS_SIZE/FLASH0_BLOCK_SIZE,
-                                                   smi_glob.sm_item_size*FLASH0_BLOCK_SIZE,
-                                                   FLASH0_FS_SIZE);
-                    xSemaphoreGive(smi_glob_sem); // provide the binary semaphore to indicate data is available
-                    break;
-                case FORMAT:     // format the filesystem (erase all contents)
-                    if(lfs_format(&lfs_flash0, &fs_config_flash0) == 0 && lfs_mount(&lfs_flash0, &fs_config_flash0)  == 0) {
-                        strcpy(smi_glob.sm_item_data, "formatting complete");
-                    }
-                    else {
-                        strcpy(smi_glob.sm_item_data, "problem formatting");
-                    }
-                    xSemaphoreGive(smi_glob_sem); // provide the binary semaphore to indicate data is available
-                    break;
-                case UNMOUNT:    // unmount the filesystem and stop the service
-                    err = lfs_unmount(&lfs_flash0);
-                    // free up buffers
-                    vPortFree(lfs_read_buffer);
-                    vPortFree(lfs_prog_buffer);
-                    vPortFree(lfs_lookahead_buffer);
-                    // remove the "/mnt" node from the CLI
-                    shell_mnt_unmount();
-                    break;
-                default:
-                    break;
+                    case FILESTAT:   // get file statistics (size)
+                        err = lfs_stat(&lfs_flash0, smi->sm_item_name, &smi->sm_item_info);
+                        if (err < 0) break;
+                        snprintf(smi->sm_item_data, smi->sm_item_data_len, "%s: %lu bytes", smi->sm_item_info.name, smi->sm_item_info.size);
+                        break;
+                    case CHKFILE:    // check if a file exists without error
+                        // result is returned to the requester only, a missing file is not an error here
+                        smi->sm_item_result = lfs_stat(&lfs_flash0, smi->sm_item_name, &smi->sm_item_info);
+                        break;
+                    case FSSTAT:     // get filesystem statistics
+                        smi->sm_item_size = lfs_fs_size(&lfs_flash0);
+                        if (smi->sm_item_size < 0) {
+                            err = smi->sm_item_size;
+                            break;
+                        }
+                        // format output for printing elsewhere
+                        snprintf(smi->sm_item_data, smi->sm_item_data_len,
+                                 "Filesystem usage: %lu/%lu blocks (%lu/%lu bytes)",
+                                 smi->sm_item_size,
+                                 FLASH0_FS_SIZE/FLASH0_BLOCK_SIZE,
+                                 smi->sm_item_size*FLASH0_BLOCK_SIZE,
+                                 FLASH0_FS_SIZE);
+                        break;
+                    case FORMAT:     // format the filesystem (erase all contents)
+                        storman_log_discard();
+                        storman_handle_close_all(&lfs_flash0);
+                        if(lfs_format(&lfs_flash0, &fs_config_flash0) == 0 && lfs_mount(&lfs_flash0, &fs_config_flash0)  == 0) {
+                            snprintf(smi->sm_item_data, smi->sm_item_data_len, "formatting complete");
+                        }
+                        else {
+                            snprintf(smi->sm_item_data, smi->sm_item_data_len, "problem formatting");
+                        }
+                        break;
+                    case UNMOUNT:    // unmount the filesystem and stop the service
+                        storman_log_sync(&lfs_flash0, NULL);
+                        storman_log_discard();
+                        storman_handle_close_all(&lfs_flash0);
+                        err = lfs_unmount(&lfs_flash0);
+                        // free up buffers
+                        vPortFree(lfs_read_buffer);
+                        vPortFree(lfs_prog_buffer);
+                        vPortFree(lfs_lookahead_buffer);
+                        // remove the "/mnt" node from the CLI
+                        shell_mnt_unmount();
+                        break;
+                    case FOPEN:      // open a file, result is the handle
+                        err = storman_handle_open(&lfs_flash0, smi->sm_item_name, smi->sm_item_flags);
+                        break;
+                    case FREAD:      // read from an open file, result is the number of bytes read
+                        if (storman_handle_user(smi->sm_item_handle) == NULL) {
+                            err = LFS_ERR_BADF;
+                            break;
+                        }
+                        if (smi->sm_item_size < 0 || smi->sm_item_size >= smi->sm_item_data_len) {
+                            err = LFS_ERR_INVAL; // requested length will not fit in the data buffer
+                            break;
+                        }
+                        err = lfs_file_read(&lfs_flash0, storman_handle_user(smi->sm_item_handle), smi->sm_item_data, smi->sm_item_size);
+                        if (err < 0) break;
+                        smi->sm_item_data[err] = 0; // put a null character at the end of the read data
+                        break;
+                    case FWRITE:     // write to an open file, result is the number of bytes written
+                        if (storman_handle_user(smi->sm_item_handle) == NULL) {
+                            err = LFS_ERR_BADF;
+                            break;
+                        }
+                        if (smi->sm_item_size < 0 || smi->sm_item_size > smi->sm_item_data_len) {
+                            err = LFS_ERR_INVAL;
+                            break;
+                        }
+                        err = lfs_file_write(&lfs_flash0, storman_handle_user(smi->sm_item_handle), smi->sm_item_data, (lfs_size_t)smi->sm_item_size);
+                        break;
+                    case FSEEK:      // set the position of an open file, result is the new position
+                        if (storman_handle_user(smi->sm_item_handle) == NULL) {
+                            err = LFS_ERR_BADF;
+                            break;
+                        }
+                        err = lfs_file_seek(&lfs_flash0, storman_handle_user(smi->sm_item_handle), smi->sm_item_offset, smi->sm_item_flags);
+                        break;
+                    case FCLOSE:     // close an open file (flushes any cached writes)
+                        if (storman_handle_user(smi->sm_item_handle) == NULL) {
+                            err = LFS_ERR_BADF;
+                            break;
+                        }
+                        err = storman_handle_close(&lfs_flash0, smi->sm_item_handle);
+                        break;
+                    case LOGAPPEND:  // buffer a record for a log file
+                        err = storman_log_append(&lfs_flash0, smi->sm_item_name, smi->sm_item_data);
+                        break;
+                    case LOGSYNC:    // write buffered records to flash (all logs if no name given)
+                        err = storman_log_sync(&lfs_flash0, smi->sm_item_name[0] ? smi->sm_item_name : NULL);
+                        break;
+                    case FSBENCH:    // benchmark littlefs geometries against a RAM disk (flash0 is untouched)
+                        err = storman_bench(smi->sm_item_data, smi->sm_item_data_len);
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            storman_latency_record(action, smi->sm_item_queued_us, start_us);
+
+            // hand the result back and wake up the requester if it is waiting
+            if (action != CHKFILE) {
+                smi->sm_item_result = err;
             }
+            smi->sm_item_done = true;
+            if (smi->sm_item_requester != NULL) {
+                xTaskNotifyGiveIndexed(smi->sm_item_requester, NOTIFY_INDEX_STORMAN);
+            }
+
+            // done with the request, drop the reference taken by storman_request()
+            storman_item_release(smi);
+        }
+
+        // write out any buffered log records which have reached their deadline
+        if (err >= 0 && action != UNMOUNT) {
+            err = storman_log_flush_due(&lfs_flash0);
         }
 
         // check if there were any lfs errors and print to CLI
@@ -324,12 +452,261 @@ static void prvStorageManagerTask(void *pvParameters)
             cli_print_raw(err_msg);
         }
 
-        if(smi_glob.action == UNMOUNT) {
+        if(action == UNMOUNT) {
             // filesystem is already unmounted, delete this task
             vTaskDelete(NULL);
         }
+    }
+}
+
+// returns true if the given action reads or writes the request item data buffer
+static bool storman_action_uses_data(storman_action_t action)
+{
+    switch(action) {
+        case LSDIR:
+        case DUMPFILE:
+        case READFILE:
+        case WRITEFILE:
+        case APPENDFILE:
+        case FILESTAT:
+        case FSSTAT:
+        case FORMAT:
+        case FREAD:
+        case FWRITE:
+        case LOGAPPEND:
+        case FSBENCH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// add a serviced request to the latency statistics for its action
+static void storman_latency_record(storman_action_t action, uint64_t queued_us, uint64_t start_us)
+{
+    uint32_t latency_us = (uint32_t)(get_time_us() - queued_us);
+    uint32_t wait_us = (uint32_t)(start_us - queued_us);
+    storman_latency_t *lat;
+    int bucket;
+
+    if (action >= STORMAN_NUM_ACTIONS) return;
+    lat = &storman_latency[action];
 
-        // update this task's schedule
-        task_sched_update(REPEAT_STORMAN, DELAY_STORMAN);
+    // bucket is the bit length of the latency, i.e. ceil(log2(latency + 1))
+    bucket = (latency_us == 0) ? 0 : 32 - __builtin_clz(latency_us);
+    if (bucket >= STORMAN_LAT_BUCKETS) {
+        bucket = STORMAN_LAT_BUCKETS - 1;
     }
-}
\ No newline at end of file
+
+    lat->count++;
+    lat->total_us += latency_us;
+    lat->hist[bucket]++;
+    if (latency_us > lat->max_us) lat->max_us = latency_us;
+    if (wait_us > lat->wait_max_us) lat->wait_max_us = wait_us;
+}
+
+// get the littlefs file for an open handle, NULL if the handle is not open
+static lfs_file_t *storman_handle_get(int handle)
+{
+    if (handle < 0 || handle >= FLASH0_OPEN_FILES_MAX || !storman_handles[handle].open) {
+        return NULL;
+    }
+    return &storman_handles[handle].file;
+}
+
+// get the littlefs file for a handle given by a requester, NULL if the handle
+// is not open or is reserved by a log file
+static lfs_file_t *storman_handle_user(int handle)
+{
+    lfs_file_t *file = storman_handle_get(handle);
+
+    if (file == NULL || storman_handles[handle].reserved) {
+        return NULL;
+    }
+    return file;
+}
+
+// open a file into a free handle, returns the handle or a negative lfs error
+static int storman_handle_open(lfs_t *lfs, const char *path, int flags)
+{
+    int err;
+
+    for (int handle = 0; handle < FLASH0_OPEN_FILES_MAX; handle++) {
+        if (!storman_handles[handle].open) {
+            storman_handles[handle].config = (struct lfs_file_config){.buffer = storman_handles[handle].cache};
+            err = lfs_file_opencfg(lfs, &storman_handles[handle].file, path, flags, &storman_handles[handle].config);
+            if (err < 0) return err;
+            storman_handles[handle].open = true;
+            storman_handles[handle].reserved = false;
+            return handle;
+        }
+    }
+
+    return LFS_ERR_NOMEM; // no free handles
+}
+
+// close an open handle, returns 0 or a negative lfs error
+static int storman_handle_close(lfs_t *lfs, int handle)
+{
+    lfs_file_t *file = storman_handle_get(handle);
+
+    if (file == NULL) return LFS_ERR_BADF;
+    storman_handles[handle].open = false;
+    storman_handles[handle].reserved = false;
+    return lfs_file_close(lfs, file);
+}
+
+// close every open handle, used before the filesystem is formatted or unmounted
+static void storman_handle_close_all(lfs_t *lfs)
+{
+    for (int handle = 0; handle < FLASH0_OPEN_FILES_MAX; handle++) {
+        if (storman_handles[handle].open) {
+            storman_handle_close(lfs, handle);
+        }
+    }
+}
+
+// add a record to a log's RAM buffer, opening the log if needed and flushing
+// the buffer to flash when it fills up. returns 0 or a negative lfs error
+static int storman_log_append(lfs_t *lfs, const char *name, const char *record)
+{
+    storman_log_t *log_p = NULL;
+    size_t record_len = strlen(record) + 1; // record plus newline
+    int log;
+    int err;
+
+    // find the log, or open it into a free slot
+    for (log = 0; log < STORMAN_LOGS_MAX; log++) {
+        if (storman_logs[log].open && strcmp(storman_logs[log].name, name) == 0) {
+            log_p = &storman_logs[log];
+            break;
+        }
+    }
+    if (log_p == NULL) {
+        for (log = 0; log < STORMAN_LOGS_MAX; log++) {
+            if (!storman_logs[log].open) break;
+        }
+        if (log == STORMAN_LOGS_MAX) return LFS_ERR_NOMEM; // no free log slots
+        err = storman_handle_open(lfs, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
+        if (err < 0) return err;
+        storman_handles[err].reserved = true; // keep requesters off the log's file
+        log_p = &storman_logs[log];
+        log_p->open = true;
+        log_p->handle = err;
+        log_p->fill = 0;
+        strncpy(log_p->name, name, PATHNAME_MAX_LEN - 1);
+        log_p->name[PATHNAME_MAX_LEN - 1] = '\0';
+    }
+
+    // make room for the record, a record larger than a page is written in pieces
+    if (log_p->fill + record_len > FLASH0_PAGE_SIZE) {
+        err = storman_log_flush(lfs, log, &storman_log_stats.size_flushes);
+        if (err < 0) return err;
+    }
+    if (log_p->fill == 0) {
+        log_p->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(STORMAN_LOG_FLUSH_MS);
+    }
+    for (size_t i = 0; i < record_len; i++) {
+        log_p->buffer[log_p->fill++] = (i < record_len - 1) ? record[i] : '\n';
+        if (log_p->fill == FLASH0_PAGE_SIZE) {
+            err = storman_log_flush(lfs, log, &storman_log_stats.size_flushes);
+            if (err < 0) return err;
+            log_p->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(STORMAN_LOG_FLUSH_MS);
+        }
+    }
+
+    storman_log_stats.records++;
+    storman_log_stats.bytes += record_len;
+    return 0;
+}
+
+// write a log's buffer to flash and commit it. returns 0 or a negative lfs error
+static int storman_log_flush(lfs_t *lfs, int log, uint32_t *reason_count)
+{
+    storman_log_t *log_p = &storman_logs[log];
+    lfs_file_t *file = storman_handle_get(log_p->handle);
+    int err;
+
+    if (log_p->fill == 0) return 0;
+
+    // if the records can't be written they are dropped and counted, otherwise
+    // the deadline stays in the past and the service would retry forever
+    if (file == NULL) {
+        // the log's handle is gone, forget the log so the next record reopens it
+        storman_log_stats.dropped += log_p->fill;
+        log_p->fill = 0;
+        log_p->open = false;
+        return LFS_ERR_BADF;
+    }
+    err = lfs_file_write(lfs, file, log_p->buffer, log_p->fill);
+    if (err < 0) {
+        storman_log_stats.dropped += log_p->fill;
+        log_p->fill = 0;
+        return err;
+    }
+    err = lfs_file_sync(lfs, file); // commit so the records survive a power loss
+    log_p->fill = 0;
+
+    storman_log_stats.flushes++;
+    (*reason_count)++;
+    return err;
+}
+
+// flush a log by name, or every log if name is NULL. returns 0 or a negative lfs error
+static int storman_log_sync(lfs_t *lfs, const char *name)
+{
+    int err = 0;
+
+    for (int log = 0; log < STORMAN_LOGS_MAX; log++) {
+        if (storman_logs[log].open && (name == NULL || strcmp(storman_logs[log].name, name) == 0)) {
+            int log_err = storman_log_flush(lfs, log, &storman_log_stats.sync_flushes);
+            if (log_err < 0) err = log_err;
+        }
+    }
+
+    return err;
+}
+
+// flush every log whose oldest buffered record has reached its deadline
+static int storman_log_flush_due(lfs_t *lfs)
+{
+    TickType_t now = xTaskGetTickCount();
+    int err = 0;
+
+    for (int log = 0; log < STORMAN_LOGS_MAX; log++) {
+        if (storman_logs[log].open && storman_logs[log].fill > 0 &&
+            (int32_t)(now - storman_logs[log].deadline) >= 0) {
+            int log_err = storman_log_flush(lfs, log, &storman_log_stats.time_flushes);
+            if (log_err < 0) err = log_err;
+        }
+    }
+
+    return err;
+}
+
+// ticks until the next buffered log record is due, portMAX_DELAY if none are buffered
+static TickType_t storman_log_timeout(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t timeout = portMAX_DELAY;
+
+    for (int log = 0; log < STORMAN_LOGS_MAX; log++) {
+        if (storman_logs[log].open && storman_logs[log].fill > 0) {
+            int32_t remaining = (int32_t)(storman_logs[log].deadline - now);
+            if (remaining <= 0) return 0;
+            if ((TickType_t)remaining < timeout) timeout = (TickType_t)remaining;
+        }
+    }
+
+    return timeout;
+}
+
+// drop all buffered log records and forget the open logs (their handles are
+// closed separately), used when the filesystem is formatted
+static void storman_log_discard(void)
+{
+    for (int log = 0; log < STORMAN_LOGS_MAX; log++) {
+        storman_logs[log].open = false;
+        storman_logs[log].fill = 0;
+    }
+}
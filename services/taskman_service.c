@@ -25,6 +25,7 @@
 
 
 static void prvTaskManagerTask(void *pvParameters);
+service_events_t taskman_events; // events for this service, see /proc/events
 TaskHandle_t xTaskManTask;
 
 // main service function, creates FreeRTOS task from prvTaskManagerTask
@@ -33,7 +34,8 @@ BaseType_t taskman_service(void)
     BaseType_t xReturn;
 
     // create the FreeRTOS task
-    xReturn = xTaskCreate(
+    xReturn = TASK_CREATE(
+        SERVICE_NAME_TASKMAN,
         prvTaskManagerTask,
         xstr(SERVICE_NAME_TASKMAN),
         STACK_TASKMAN,
@@ -46,6 +48,7 @@ BaseType_t taskman_service(void)
     cli_uart_puts(timestamp());
 
     if (xReturn == pdPASS) {
+        task_set_core_affinity(xTaskManTask, AFFINITY_TASKMAN);
         // initialize all service queues
         if (init_queues() == 0) {
             cli_uart_puts("Task manager registered\r\n");
@@ -77,7 +80,7 @@ static void prvTaskManagerTask(void *pvParameters)
     int i;
     for (i = 0; i < service_descriptors_length; i++) {
         if(service_descriptors[i].startup) {
-            service_descriptors[i].service_func();
+            service_start(&service_descriptors[i]);
         }
     }
 
@@ -86,15 +89,23 @@ static void prvTaskManagerTask(void *pvParameters)
     cli_uart_puts(timestamp());
     cli_uart_puts("All startup services launched.\r\n");
     
+    // run the main loop only when taskman_request() posts an action
+    service_events_init(&taskman_events, xstr(SERVICE_NAME_TASKMAN));
+
     while(true) {
-        // check for any task actions in the queue
-        if (xQueueReceive(taskman_queue, (void *)&tmi, 0) == pdTRUE) {
+        // block until there is an event to handle
+        service_events_wait(&taskman_events, TIMEOUT_TASKMAN);
+
+        // handle all of the task actions in the queue
+        while (xQueueReceive(taskman_queue, (void *)&tmi, 0) == pdTRUE) {
             // perform the action. note that "START" is not implemented in task manager
             // because an unregistered task does not have a TaskHandle yet (used
             // in the taskman_item struct). This could be a future enhancement
             switch (tmi.action)
             {
                 case DELETE:
+                    // stop event delivery first, signallers can't touch the task after this
+                    service_events_task_deleted(tmi.task);
                     vTaskDelete(tmi.task);
                     break;
 
@@ -105,13 +116,14 @@ static void prvTaskManagerTask(void *pvParameters)
                 case RESUME:
                     vTaskResume(tmi.task);
                     break;
+
+                case PIN:
+                    task_set_core_affinity(tmi.task, tmi.core_mask);
+                    break;
                 
                 default:
                     break;
             }
         }
-
-        // update this task's schedule
-        task_sched_update(REPEAT_TASKMAN, DELAY_TASKMAN);
     }
 }
\ No newline at end of file
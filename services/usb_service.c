@@ -25,6 +25,7 @@
 
 
 static void prvUsbTask(void *pvParameters); // usb task
+service_events_t usb_events; // events for this service, see /proc/events
 TaskHandle_t xUsbTask;
 
 // main service function, creates FreeRTOS task from prvUsbTask
@@ -33,7 +34,8 @@ BaseType_t usb_service(void)
     BaseType_t xReturn;
 
     // spawn the usb task
-    xReturn = xTaskCreate(
+    xReturn = TASK_CREATE(
+        SERVICE_NAME_USB,
         prvUsbTask,
         xstr(SERVICE_NAME_USB),
         STACK_USB,
@@ -68,7 +70,14 @@ static void prvUsbTask(void *pvParameters)
         .tx_pos = 0
     };
 
+    // run the main loop whenever TinyUSB queues an event (see tud_event_hook_cb()
+    // in hw_usb.c), or data is put into/taken out of the usb0 queues
+    service_events_init(&usb_events, xstr(SERVICE_NAME_USB));
+
     while(true) {
+        // block until there is an event to handle
+        service_events_wait(&usb_events, TIMEOUT_USB);
+
         // TinyUSB service function
         tud_task();
 
@@ -98,11 +107,9 @@ static void prvUsbTask(void *pvParameters)
             if (usb_iface_0.tx_pos == 0) {
                 if (xQueueReceive(usb0_tx_queue, usb_iface_0.tx_buffer, 0) == pdTRUE) {
                     usb_iface_0.tx_pos = strlen(usb_iface_0.tx_buffer) + 1; // add 1 assuming null terminated byte array
+                    service_events_signal(&usb_events, SERVICE_EVENT_COMMAND); // run again to write it out
                 }
             }
         }
-
-        // update this task's schedule
-        task_sched_update(REPEAT_USB, DELAY_USB);
     }
 }
\ No newline at end of file
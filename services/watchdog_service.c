@@ -21,6 +21,7 @@
 
 
 static void prvWatchdogTask(void *pvParameters);
+static task_period_t watchdog_period; // schedule and stats for this service, see /proc/sched
 TaskHandle_t xWatchdogTask;
 
 // main service function, creates FreeRTOS task from prvWatchdogTask
@@ -29,7 +30,8 @@ BaseType_t watchdog_service(void)
     BaseType_t xReturn;
 
     // create the FreeRTOS task
-    xReturn = xTaskCreate(
+    xReturn = TASK_CREATE(
+        SERVICE_NAME_WATCHDOG,
         prvWatchdogTask,
         xstr(SERVICE_NAME_WATCHDOG),
         STACK_WATCHDOG,
@@ -57,11 +59,14 @@ static void prvWatchdogTask(void *pvParameters)
     // enable the watchdog timer
     watchdog_en(WATCHDOG_DELAY_MS);
 
+    // run the main loop once every PERIOD_WATCHDOG ticks
+    task_period_init(&watchdog_period, xstr(SERVICE_NAME_WATCHDOG), PERIOD_WATCHDOG, BUDGET_WATCHDOG);
+
     while(true) {
         // reset watchdog timer
         watchdog_kick();
         
         // update this task's schedule
-        task_sched_update(REPEAT_WATCHDOG, DELAY_WATCHDOG);
+        task_period_wait(&watchdog_period);
     }
 }
\ No newline at end of file